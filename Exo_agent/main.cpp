@@ -5,6 +5,9 @@
 #include "Character.h"
 #include "BVH.h"
 #include "Muscle.h"
+#include "MeshCache.h"
+#include "Headless.h"
+#include <chrono>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -26,23 +29,55 @@ int main(int argc,char** argv)
 {	
 	// signal (SIGINT,SIGINT_handler); //catches cntrl-C and graphs data -> depreciated
 
+	auto begin = std::chrono::steady_clock::now();
+
 	// Create a new simulation environment 
 	MASS::Environment* env = new MASS::Environment();
 
 	// check if command line args are correct
-	if(argc!=5)
+	// --profile FILE writes the time per phase of the viewer on exit (ESC)
+	std::string profile;
+	for(int i=1;i+1<argc;i++)
+	{
+		if(std::string(argv[i])!="--profile")
+			continue;
+		profile = argv[i+1];
+		for(int j=i;j+2<=argc;j++)
+			argv[j] = argv[j+2];
+		argc -= 2;
+		break;
+	}
+
+	MASS::HeadlessOptions headless;
+	if(!headless.Parse(argc,argv) || argc!=5)
 	{
 		std::cout<<"Provide metadata.txt, benjaSIM nets, exo agent"<<std::endl;
+		std::cout<<"Options : --headless DIR [--episodes N] [--jobs N] [--frames N] [--size WxH] [--video] [--obj]"<<std::endl;
+		std::cout<<"          --profile FILE"<<std::endl;
 		return 0;
 	}
-	// initialise environment for MASS and DART
-	env->Initialize(std::string(argv[1]),true);
+	// initialise environment for MASS and DART, OBJ meshes load in the background
+	// (headless jobs are forked after this, so they load everything up front)
+	if(!headless.enabled)
+		MASS::MeshCache::SetLoadAsync(true);
+	env->Initialize(std::string(argv[1]),!headless.enabled || headless.draw_obj);
+	if(headless.enabled)
+	{
+		headless.frame_rate = env->GetControlHz();
+		return MASS::RunHeadless(headless,[&]() -> MASS::Window* {
+			return new MASS::exo_Window(env, argv[2], argv[3], argv[4]);
+		});
+	}
 	glutInit(&argc, argv);
 
 	// Setup render of environment and torque actor agent
 	window = new MASS::exo_Window(env, argv[2], argv[3], argv[4]);
+	window->SetProfilePath(profile);
 	
 	// run simulation
 	window->initWindow(1920,1080,"gui");
+	window->StartSimulationThread();
+	window->WatchModelFiles();
+	std::cout<<"Window ready "<<std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count()*1e3<<" ms after start"<<std::endl;
 	glutMainLoop();
 }
@@ -1,12 +1,14 @@
 from tkinter.tix import Select
 import numpy as np
+import matplotlib
+matplotlib.use("Agg")   # plots are only saved, and are made from the renderer's simulation thread
 import matplotlib.pyplot as plt
 import os
 
 class Plotter():
     """ 
     A class used to plot benjaSIM exo torques, joint angles, and 
-    muscle group activations
+    muscle group activations, from the telemetry files the renderer writes
     """
     def __init__(self):
         """
@@ -39,142 +41,26 @@ class Plotter():
         self.r_k_flex = []; self.r_k_ext = []
 
         ### Gait Phase ###
-        self.num_wraparounds = 0
+        # completed gait cycles plus the phase of the current one, the
+        # renderer records the first 8 cycles (Window::mTelemetryCycles)
         self.gait_phase = []
 
         ### plotter state variables ###
-        self.plot_size = 8  # how long to record data for (seconds)
-        self.stop = False   # set to true after self.plot_size seconds
         self.plotted = False
 
-    def Update_Torques(self, exo_torques):
-        """
-        Appends the inputted list of torques to their corresponding
-        lists.
-        :param exo_torques: list of applied exo torques in the order:
-                [L hip T, L knee T, R hip T, R knee T]
-        """
-        self.t_l_hip.append(exo_torques[0])
-        self.t_l_knee.append(exo_torques[1])
-        self.t_r_hip.append(exo_torques[2])
-        self.t_r_knee.append(exo_torques[3])
-            
-    def Update_Angles(self, joint_angles_act, joint_angles_ref):  #TODO update actual angles
-        """
-        Appends the inputted list of joint angles to their corresponding
-        lists.
-        :param joint_angles_act: list of actual observed joint angles in the order:
-                [L hip, L knee, R hip, R knee]
-        :param joint_angles_ref: list of ref joint angles in the order:
-                [L hip, L knee, R hip, R knee]
-        """
-        # Actual angles
-        self.l_hip_angle.append(joint_angles_act[0]) 
-        self.l_knee_angle.append(joint_angles_act[1]) 
-        self.r_hip_angle.append(joint_angles_act[2]) 
-        self.r_knee_angle.append(joint_angles_act[3]) 
-        # reference angles
-        self.d_l_hip_angle.append(joint_angles_ref[0])
-        self.d_l_knee_angle.append(joint_angles_ref[1])
-        self.d_r_hip_angle.append(joint_angles_ref[2])
-        self.d_r_knee_angle.append(joint_angles_ref[3])
-    
-    def Update_Activations(self, activations):
-        """
-        Appends the inputted list of activations to their corresponding
-        muscle group lists.
-        :param activations: list of muscle group activations in the order:
-            {LHFlex,LHExt,LHAbd,LHAdd,LHExtRot,LHIntRot,LKFlex,LKExt,
-            RHFlex,RHExt,RHAbd,RHAdd,RHExtRot,RHIntRot,RKFlex,RKExt,} 
-        """
-        activation_grp_lst = [
-            self.l_h_flex, self.l_h_ext, self.l_h_abd, self.l_h_add, 
-            self.l_h_extrot, self.l_h_introt, self.l_k_flex, self.l_k_ext,
-            self.r_h_flex, self.r_h_ext, self.r_h_abd, self.r_h_add, 
-            self.r_h_extrot, self.r_h_introt, self.r_k_flex, self.r_k_ext
-        ]
-
-        i = 0
-        while (i < len(activation_grp_lst)):
-            activation_grp_lst[i].append(activations[i])
-            i += 1
-    
-    def Update_Gait_Phase(self, phase):
-        """
-        Appends the current phase of gait to the gait phase list.
-        Some computation is done to adjust the value, because the
-        given phase wraps back around to 0.
-        :param phase: the current phase of gait (mapped between
-                            [0-1])
-        :return: whether the plotter should stop recording (so all plots have the same length)
-        """
-        phase = phase[0]
-        # Check if a wraparound has occurred
-        if len(self.gait_phase) < 1:
-            prev_phase = 0
-        else:
-            prev_phase = self.gait_phase[-1]
-        if self.num_wraparounds > 0:
-            prev_phase = prev_phase%self.num_wraparounds
-        if prev_phase > phase:
-            self.num_wraparounds += 1   # add to wraparounds if yes
-        # Compute current phase as number of wraps + gait_phase
-        # print(f"Summed phase: {curr_phase}, phase: {phase}")
-        curr_phase = self.num_wraparounds + phase
-        self.stop = (curr_phase >= self.plot_size)
-        self.gait_phase.append(curr_phase)
-
-    def Update_All_Exo(self, exo_torques, joint_angles_act, 
-                        joint_angles_ref, activations, phase):
-        """
-        Appends all inputted lists to their corresponding lists
-        by calling individual update functions. Also updates the gait_phase
-        list, which is used as the x-axis for all the plots.
-        :param exo_torques: list of applied exo torques in the order:
-                [L hip T, L knee T, R hip T, R knee T]
-        :param joint_angles_act: list of actual joint angles in the order:
-                [L hip, L knee, R hip, R knee]
-        :param joint_angles_ref: list of ref joint angles in the order:
-                [L hip, L knee, R hip, R knee]
-        :param activations: list of muscle group activations in the order:
-            {LHFlex,LHExt,LHAbd,LHAdd,LHExtRot,LHIntRot,LKFlex,LKExt,
-            RHFlex,RHExt,RHAbd,RHAdd,RHExtRot,RHIntRot,RKFlex,RKExt} 
-        :param phase: current progression through the gait phase
-        """
-        # Plotter plots for the first self.plot_size seconds. after this time, stop
-        # is set to True
-        if not self.stop:
-            self.Update_Gait_Phase(phase)
-            self.Update_Torques(exo_torques)
-            self.Update_Angles(joint_angles_act, joint_angles_ref)
-            self.Update_Activations(activations)
-        else:
-            self.Save_All_To_CSV_Exo()
-            self.Plot_All_Exo()
-            self.plotted = True
-
-    def Update_All_SIM(self, joint_angles_act, joint_angles_ref, activations, phase):
-        """
-        Appends all inputted lists to their corresponding lists
-        by calling individual update functions. Also updates the gait_phase
-        list, which is used as the x-axis for all the plots.
-        :param joint_angles: list of joint angles in the order:
-                [L hip, L knee, R hip, R knee]
-        :param activations: list of muscle group activations in the order:
-            {LHFlex,LHExt,LHAbd,LHAdd,LHExtRot,LHIntRot,LKFlex,LKExt,
-            RHFlex,RHExt,RHAbd,RHAdd,RHExtRot,RHIntRot,RKFlex,RKExt,} 
-        :param phase: current progression through the gait phase
-        """
-        # Plotter plots for the first self.plot_size seconds. after this time, stop
-        # is set to True
-        if not self.stop:
-            self.Update_Gait_Phase(phase)
-            self.Update_Angles(joint_angles_act, joint_angles_ref)
-            self.Update_Activations(activations)
-        else:
-            self.Save_All_To_CSV_SIM()
-            self.Plot_All_SIM()
-            self.plotted = True
+    def Load_CSV(self, path):
+        """
+        Loads the telemetry file written by the renderer (Window::record_data,
+        one header line naming the columns, one row per control step) into
+        the lists of the same names.
+        :param path: the csv file, e.g. Data/All_Data_SIM.csv or Data/All_Data_EXO.csv
+        """
+        with open(path) as f:
+            columns = f.readline().strip().split(",")
+        data = np.loadtxt(path, delimiter=",", skiprows=1, ndmin=2)
+        for i, name in enumerate(columns):
+            setattr(self, name, data[:, i].tolist())
+        self.plotted = False
 
     def Plot_Info_Vertical(self, titles: list, y_plot_lists: list, x_plot_list: list,
     xlabel: str, ylabel: str, plot_name: str):
@@ -424,50 +310,15 @@ class Plotter():
             # print("============ hip3 plotted ===========")
             print("Data plotted")
 
-    def Update_Plot_All(self, exo_torques, #TODO update actual angles
-                        joint_angles, activations, phase):
-        """
-        Updates all the lists to plot, then plots them, by calling 
-        Update_All and Plot_All functions
-        :param exo_torques: list of applied exo torques in the order:
-                [L hip T, L knee T, R hip T, R knee T]
-        :param joint_angles: list of joint angles in the order:
-                [L hip, L knee, R hip, R knee]
-        :param activations: list of muscle group activations in the order:
-            {LHFlex,LHExt,LHAbd,LHAdd,LHExtRot,LHIntRot,LKFlex,LKExt,
-            RHFlex,RHExt,RHAbd,RHAdd,RHExtRot,RHIntRot,RKFlex,RKExt,} 
-        """
-        #TODO update actual angles
-        self.Update_All(exo_torques, joint_angles, activations, phase)
-        self.Plot_All()
-
-    def Save_All_To_CSV_Exo(self):
-        """
-        Saves all the data lists to CSV for exo env.
-        """
-        data_lists = np.array([
-            self.t_l_hip, self.t_l_knee, self.t_r_hip, 
-            self.t_r_knee, self.l_hip_angle, self.l_knee_angle,
-            self.r_hip_angle, self.r_knee_angle, self.l_h_flex,
-            self.l_h_ext, self.l_h_abd, self.l_h_add, self.l_h_extrot,
-            self.l_h_introt, self.l_k_flex, self.l_k_ext, self.r_h_flex,
-            self.r_h_ext, self.r_h_abd, self.r_h_add, self.r_h_extrot,
-            self.r_h_introt, self.r_k_flex, self.r_k_ext, self.gait_phase
-        ])
-        path = "{}/Data/All_Data_EXO.csv".format(os.path.dirname(__file__))
-        np.savetxt(path, data_lists.T, delimiter=",")
-
-    def Save_All_To_CSV_SIM(self):
-        """
-        Saves all the data lists to CSV for MASS env.
-        """
-        data_lists = np.array([
-            self.l_hip_angle, self.l_knee_angle,
-            self.r_hip_angle, self.r_knee_angle, self.l_h_flex,
-            self.l_h_ext, self.l_h_abd, self.l_h_add, self.l_h_extrot,
-            self.l_h_introt, self.l_k_flex, self.l_k_ext, self.r_h_flex,
-            self.r_h_ext, self.r_h_abd, self.r_h_add, self.r_h_extrot,
-            self.r_h_introt, self.r_k_flex, self.r_k_ext, self.gait_phase
-        ])
-        path = "{}/Data/All_Data_SIM.csv".format(os.path.dirname(__file__))
-        np.savetxt(path, data_lists.T, delimiter=",")
+if __name__ == "__main__":
+    # Plots a telemetry file written by render/exo_render (Exo_agent/Data/All_Data_*.csv)
+    import sys
+    if len(sys.argv) != 2:
+        print("Usage: python3 plotter.py Data/All_Data_SIM.csv|Data/All_Data_EXO.csv")
+        sys.exit(1)
+    plotter = Plotter()
+    plotter.Load_CSV(sys.argv[1])
+    if hasattr(plotter, "t_l_hip") and len(plotter.t_l_hip) > 0:
+        plotter.Plot_All_Exo()
+    else:
+        plotter.Plot_All_SIM()
@@ -16,7 +16,6 @@ public:
     void Step()override;
     Eigen::VectorXd GetExoTorquesFromNN();
     void record_data()override;
-    void define_muscle_groups()override;
     void Plot_And_Save()override;
 
     py::object exo_agent;   //pybind object for torque actor
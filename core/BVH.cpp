@@ -1,4 +1,5 @@
 #include "BVH.h"
+#include "ModelCache.h"
 #include <iostream>
 #include <Eigen/Geometry>
 #include "dart/dart.hpp"
@@ -44,12 +45,12 @@ BVHNode(const std::string& name,BVHNode* parent)
 }
 void
 BVHNode::
-SetChannel(int c_offset,std::vector<std::string>& c_name)
+SetChannel(int c_offset,const std::vector<int>& channels)
 {
 	mChannelOffset = c_offset;
-	mNumChannels = c_name.size();
-	for(const auto& cn : c_name)
-		mChannel.push_back(CHANNEL_NAME[cn]);
+	mNumChannels = channels.size();
+	for(int c : channels)
+		mChannel.push_back((CHANNEL)c);
 }
 void
 BVHNode::
@@ -111,21 +112,135 @@ GetNode(const std::string& name)
 
 BVH::
 BVH(const dart::dynamics::SkeletonPtr& skel,const std::map<std::string,std::string>& bvh_map)
-	:mSkeleton(skel),mBVHMap(bvh_map),mCyclic(true)
+	:mSkeleton(skel),mBVHMap(bvh_map),mCyclic(true),mFileHash(0),mNumRotations(0),mRootIdx(0),mRootRotation(-1)
 {
 
 }
 
+/**
+ * @brief Target skeleton positions at time t, interpolated between the two
+ * surrounding frames of the precomputed motion table: slerp for the free
+ * joint rotation and ball joints, lerp for everything else.
+ */
 Eigen::VectorXd
 BVH::
 GetMotion(double t)
 {
-	int k = ((int)std::floor(t/mTimeStep));
+	int k,k1;
+	double dt;
+	Locate(t,k,k1,dt);
+
+	Eigen::VectorXd p = (1.0-dt)*mPositions.col(k) + dt*mPositions.col(k1);
+	if(dt==0.0)
+		return p;
+
+	const Eigen::Quaterniond* q0 = &mRotations[k*mNumRotations];
+	const Eigen::Quaterniond* q1 = &mRotations[k1*mNumRotations];
+	for(const auto& joint : mJoints)
+	{
+		if(joint.type==REVOLUTE)
+		{
+			// lerp along the shorter way around
+			double a0 = mPositions(joint.idx,k);
+			double d = mPositions(joint.idx,k1) - a0;
+			if(d>M_PI)
+				d -= 2*M_PI;
+			else if(d<-M_PI)
+				d += 2*M_PI;
+			double val = a0 + dt*d;
+			if(val>M_PI)
+				val -= 2*M_PI;
+			else if(val<-M_PI)
+				val += 2*M_PI;
+			p[joint.idx] = val;
+			continue;
+		}
+		Eigen::AngleAxisd aa(q0[joint.rotation].slerp(dt,q1[joint.rotation]));
+		p.segment<3>(joint.idx) = aa.angle()*aa.axis();
+	}
+
+	return p;
+}
+/**
+ * @brief Frames k and k1 surrounding time t, and the blend weight dt of k1.
+ */
+void
+BVH::
+Locate(double t,int& k,int& k1,double& dt)
+{
+	k = ((int)std::floor(t/mTimeStep));
 	if(mCyclic)
 		k %= mNumTotalFrames;
 	k = std::max(0,std::min(k,mNumTotalFrames-1));
-	double dt = t/mTimeStep - std::floor(t/mTimeStep);
-	Eigen::VectorXd m_t = mMotions[k];
+	dt = t/mTimeStep - std::floor(t/mTimeStep);
+
+	// The root jumps back to the first frame at the end of a cycle (Character
+	// accounts for it with mTc), so the last frame is never blended.
+	k1 = k+1;
+	if(k1>=mNumTotalFrames)
+	{
+		k1 = k;
+		dt = 0.0;
+	}
+}
+
+/**
+ * @brief Target skeleton velocities at time t: the slope of GetMotion over the
+ * current frame interval, read from the precomputed velocity table.
+ */
+Eigen::VectorXd
+BVH::
+GetVelocity(double t)
+{
+	int k,k1;
+	double dt;
+	Locate(t,k,k1,dt);
+	return mVelocities.col(k);
+}
+
+/**
+ * @brief Only the root (free joint) part of GetMotion.
+ */
+Eigen::Vector6d
+BVH::
+GetRootMotion(double t)
+{
+	int k,k1;
+	double dt;
+	Locate(t,k,k1,dt);
+	Eigen::Vector6d p = (1.0-dt)*mPositions.block<6,1>(mRootIdx,k) + dt*mPositions.block<6,1>(mRootIdx,k1);
+	if(dt!=0.0 && mRootRotation>=0)
+	{
+		Eigen::AngleAxisd aa(mRotations[k*mNumRotations+mRootRotation].slerp(dt,mRotations[k1*mNumRotations+mRootRotation]));
+		p.head<3>() = aa.angle()*aa.axis();
+	}
+	return p;
+}
+/**
+ * @brief Inverse dynamics torques needed to follow the motion at time t,
+ * interpolated from the feedforward table. The root is left unactuated.
+ * The table is built by the first call, only feedforward PD asks for it.
+ */
+Eigen::VectorXd
+BVH::
+GetFeedforward(double t)
+{
+	// BVHs are shared by the envs of the process, which may get here together
+	std::call_once(mFeedforwardOnce,[this]{BuildFeedforwardTable();});
+	int k,k1;
+	double dt;
+	Locate(t,k,k1,dt);
+	return (1.0-dt)*mFeedforward.col(k) + dt*mFeedforward.col(k1);
+}
+Eigen::VectorXd
+BVH::
+ComputeFrame(int k)
+{
+	// BVHs restored from the model cache only load the raw frames when asked for them
+	if(mData==nullptr)
+		LoadHierarchy(mFile,mFileHash);
+	int n = mData->GetNumChannels();
+	Eigen::VectorXd m_t = Eigen::Map<const Eigen::VectorXf>(mData->GetFrame(k),n).cast<double>();
 	
 	for(auto& bn: mMap)
 		bn.second->Set(m_t);
@@ -174,137 +289,219 @@ GetMotion(double t)
 	return p;
 }
 
+/**
+ * @brief Resolves the bvh map against the skeleton once, and fills the
+ * frames x DOF position table plus the rotations of free and ball joints
+ * as quaternions for slerp.
+ */
+void
+BVH::
+BuildMotionTable()
+{
+	mJoints.clear();
+	mNumRotations = 0;
+	mRootIdx = 0;
+	mRootRotation = -1;
+	for(auto ss : mBVHMap)
+	{
+		BodyNode* bn = mSkeleton->getBodyNode(ss.first);
+		Joint* jn = bn->getParentJoint();
+		MappedJoint joint;
+		joint.bvh_node = mMap[ss.second];
+		joint.idx = jn->getIndexInSkeleton(0);
+		joint.rotation = -1;
+		if(jn->getType()=="FreeJoint")
+			joint.type = FREE;
+		else if(jn->getType()=="BallJoint")
+			joint.type = BALL;
+		else if(jn->getType()=="RevoluteJoint")
+			joint.type = REVOLUTE;
+		else
+			continue;
+		if(joint.type!=REVOLUTE)
+			joint.rotation = mNumRotations++;
+		if(joint.type==FREE)
+		{
+			mRootIdx = joint.idx;
+			mRootRotation = joint.rotation;
+		}
+		mJoints.push_back(joint);
+	}
+
+	mPositions.resize(mSkeleton->getNumDofs(),mNumTotalFrames);
+	mRotations.resize(mNumTotalFrames*mNumRotations);
+	for(int k=0;k<mNumTotalFrames;k++)
+	{
+		mPositions.col(k) = ComputeFrame(k);
+		for(const auto& joint : mJoints)
+			if(joint.rotation>=0)
+				mRotations[k*mNumRotations+joint.rotation] = Eigen::Quaterniond(joint.bvh_node->Get());
+		// keep consecutive quaternions in the same hemisphere so slerp takes the short way
+		if(k>0)
+			for(int r=0;r<mNumRotations;r++)
+				if(mRotations[k*mNumRotations+r].dot(mRotations[(k-1)*mNumRotations+r])<0.0)
+					mRotations[k*mNumRotations+r].coeffs() *= -1.0;
+	}
+
+	// Velocity of frame k is the slope towards frame k+1. Rotations use the
+	// difference of their rotation vectors, revolute joints the shorter way around.
+	mVelocities = Eigen::MatrixXd::Zero(mPositions.rows(),mNumTotalFrames);
+	for(int k=0;k+1<mNumTotalFrames;k++)
+	{
+		mVelocities.col(k) = (mPositions.col(k+1)-mPositions.col(k))/mTimeStep;
+		for(const auto& joint : mJoints)
+		{
+			if(joint.type!=REVOLUTE)
+				continue;
+			double d = mPositions(joint.idx,k+1)-mPositions(joint.idx,k);
+			if(d>M_PI)
+				d -= 2*M_PI;
+			else if(d<-M_PI)
+				d += 2*M_PI;
+			mVelocities(joint.idx,k) = d/mTimeStep;
+		}
+	}
+	if(mNumTotalFrames>1)
+		mVelocities.col(mNumTotalFrames-1) = mVelocities.col(mNumTotalFrames-2);
+}
+
+/**
+ * @brief Runs inverse dynamics along the motion table. Velocities and
+ * accelerations are taken in generalized coordinates with
+ * getPositionDifferences (as Character does), not from the velocity table
+ * whose rotation vector differences are not ball or free joint velocities.
+ * Ground contact is not modelled: the root wrench that would hold the
+ * character up is dropped, the joint torques are kept.
+ */
+void
+BVH::
+BuildFeedforwardTable()
+{
+	// mSkeleton belongs to an env which may be stepping by now, use the copy
+	// taken while the motion was loaded
+	SkeletonPtr skel = mFeedforwardSkeleton;
+	mFeedforwardSkeleton = nullptr;
+	skel->setGravity(Eigen::Vector3d(0,-9.8,0.0));	// same as Environment's world
+
+	int dof = mPositions.rows();
+	Eigen::MatrixXd dq = Eigen::MatrixXd::Zero(dof,mNumTotalFrames);
+	for(int k=0;k+1<mNumTotalFrames;k++)
+	{
+		dq.col(k) = skel->getPositionDifferences(mPositions.col(k+1),mPositions.col(k))/mTimeStep;
+		for(const auto& joint : mJoints)
+		{
+			if(joint.type!=REVOLUTE)
+				continue;
+			double d = mPositions(joint.idx,k+1)-mPositions(joint.idx,k);
+			if(d>M_PI)
+				d -= 2*M_PI;
+			else if(d<-M_PI)
+				d += 2*M_PI;
+			dq(joint.idx,k) = d/mTimeStep;
+		}
+	}
+	if(mNumTotalFrames>1)
+		dq.col(mNumTotalFrames-1) = dq.col(mNumTotalFrames-2);
+
+	mFeedforward = Eigen::MatrixXd::Zero(dof,mNumTotalFrames);
+	Eigen::VectorXd ddq = Eigen::VectorXd::Zero(dof);
+	for(int k=0;k<mNumTotalFrames;k++)
+	{
+		// the last frame keeps the previous acceleration, like the velocities
+		if(k+1<mNumTotalFrames)
+			ddq = (dq.col(k+1)-dq.col(k))/mTimeStep;
+		skel->setPositions(mPositions.col(k));
+		skel->setVelocities(dq.col(k));
+		skel->setAccelerations(ddq);
+		skel->computeInverseDynamics();
+		mFeedforward.col(k) = skel->getForces();
+	}
+	if(skel->getRootJoint()->getType()=="FreeJoint")
+		mFeedforward.topRows<6>().setZero();
+}
 Eigen::Matrix3d
 BVH::
 Get(const std::string& bvh_node)
 {
+	if(mData==nullptr)
+		LoadHierarchy(mFile,mFileHash);
 	return mMap[bvh_node]->Get();
 }
-void
+/**
+ * @brief Loads the motion data through the process-wide cache and builds
+ * the node tree from its hierarchy.
+ */
+bool
 BVH::
-Parse(const std::string& file,bool cyclic)
+LoadHierarchy(const std::string& file,uint64_t file_hash)
 {
-	mCyclic = cyclic;
-	std::ifstream is(file);
-
-	char buffer[256];
+	mFile = file;
+	mFileHash = file_hash;
+	mData = LoadMotionData(file,file_hash);
+	if(mData==nullptr)
+		return false;
 
-	if(!is)
+	const std::vector<MotionData::Joint>& joints = mData->GetJoints();
+	if(joints.empty())
 	{
-		std::cout<<"Can't Open File"<<std::endl;
-		return;
+		std::cout<<file<<" has no joint hierarchy"<<std::endl;
+		mData = nullptr;
+		return false;
 	}
-	while(is>>buffer)
+	std::vector<BVHNode*> nodes;
+	for(const auto& joint : joints)
 	{
-		if(!strcmp(buffer,"HIERARCHY"))
-		{
-			is>>buffer;//Root
-			is>>buffer;//Name
-			int c_offset = 0;
-			mRoot = ReadHierarchy(nullptr,buffer,c_offset,is);
-			mNumTotalChannels = c_offset;
-		}
-		else if(!strcmp(buffer,"MOTION"))
+		if(joint.parent>=(int)nodes.size() || joint.parent<(nodes.empty() ? -1 : 0))
 		{
-			is>>buffer; //Frames:
-			is>>buffer; //num_frames
-			mNumTotalFrames = atoi(buffer);
-			is>>buffer; //Frame
-			is>>buffer; //Time:
-			is>>buffer; //time step
-			mTimeStep = atof(buffer);
-			mMotions.resize(mNumTotalFrames);
-			for(auto& m_t : mMotions)
-				m_t = Eigen::VectorXd::Zero(mNumTotalChannels);
-			double val;
-			for(int i=0;i<mNumTotalFrames;i++)
-			{
-				for(int j=0;j<mNumTotalChannels;j++)
-				{
-					is>>val;
-					mMotions[i][j]=val;
-				}
-			}
+			std::cout<<file<<" : joint "<<joint.name<<" has no valid parent"<<std::endl;
+			mData = nullptr;
+			return false;
 		}
+		BVHNode* parent = joint.parent<0 ? nullptr : nodes[joint.parent];
+		BVHNode* new_node = new BVHNode(joint.name,parent);
+		new_node->SetChannel(joint.channel_offset,joint.channels);
+		mMap.insert(std::make_pair(joint.name,new_node));
+		if(parent!=nullptr)
+			parent->AddChild(new_node);
+		nodes.push_back(new_node);
 	}
-	is.close();
+	mRoot = nodes[0];
+	mNumTotalFrames = mData->GetNumFrames();
+	mTimeStep = mData->GetTimeStep();
+	return true;
+}
+/**
+ * @brief Loads a .bvh or .mbin motion through the process-wide motion cache,
+ * so the file is read once no matter how many envs use it, and builds the
+ * node tree from its hierarchy.
+ *
+ * @param file_hash - HashFile of the file, so edits are not served the old frames
+ */
+void
+BVH::
+Parse(const std::string& file,bool cyclic,uint64_t file_hash)
+{
+	mCyclic = cyclic;
+	if(!LoadHierarchy(file,file_hash))
+		return;
+	int n = mData->GetNumChannels();
 
 	BodyNode* root = mSkeleton->getRootBodyNode();
 	std::string root_bvh_name = mBVHMap[root->getName()];
-	Eigen::VectorXd m = mMotions[0];
+	Eigen::VectorXd m = Eigen::Map<const Eigen::VectorXf>(mData->GetFrame(0),n).cast<double>();
 
 	mMap[root_bvh_name]->Set(m);
 	T0.linear() = this->Get(root_bvh_name);
 	T0.translation() = 0.01*m.segment<3>(0);
 
-	m = mMotions[mNumTotalFrames-1];
+	m = Eigen::Map<const Eigen::VectorXf>(mData->GetFrame(mNumTotalFrames-1),n).cast<double>();
 
 	mMap[root_bvh_name]->Set(m);
 	T1.linear() = this->Get(root_bvh_name);
 	T1.translation() = 0.01*m.segment<3>(0);
 
-
-}
-BVHNode*
-BVH::
-ReadHierarchy(BVHNode* parent,const std::string& name,int& channel_offset,std::ifstream& is)
-{
-	char buffer[256];
-	double offset[3];
-	std::vector<std::string> c_name;
-
-	BVHNode* new_node = new BVHNode(name,parent);
-	mMap.insert(std::make_pair(name,new_node));
-
-	is>>buffer; //{
-
-	while(is>>buffer)
-	{
-		if(!strcmp(buffer,"}"))
-			break;
-		if(!strcmp(buffer,"OFFSET"))
-		{
-			//Ignore
-			double x,y,z;
-
-			is>>x;
-			is>>y;
-			is>>z;
-		}
-		else if(!strcmp(buffer,"CHANNELS"))
-		{
-
-			is>>buffer;
-			int n;
-			n= atoi(buffer);
-			
-			for(int i=0;i<n;i++)
-			{
-				is>>buffer;
-				c_name.push_back(std::string(buffer));
-			}
-			
-			new_node->SetChannel(channel_offset,c_name);
-
-			
-			
-			channel_offset+=n;
-		}
-		else if(!strcmp(buffer,"JOINT"))
-		{
-			is>>buffer;
-			BVHNode* child = ReadHierarchy(new_node,std::string(buffer),channel_offset,is);
-			new_node->AddChild(child);
-		}
-		else if(!strcmp(buffer,"End"))
-		{
-			is>>buffer;
-			BVHNode* child = ReadHierarchy(new_node,std::string("EndEffector"),channel_offset,is);
-			new_node->AddChild(child);
-		}
-	}
-	
-	return new_node;
+	BuildMotionTable();
+	mFeedforwardSkeleton = mSkeleton->clone();
 }
 std::map<std::string,MASS::BVHNode::CHANNEL> BVHNode::CHANNEL_NAME =
 {
@@ -321,4 +518,74 @@ std::map<std::string,MASS::BVHNode::CHANNEL> BVHNode::CHANNEL_NAME =
 	{"Zrotation",Zrot},
 	{"ZROTATION",Zrot}
 };
+
+/**
+ * @brief Writes the motion tables (not the raw frames) to a model cache.
+ * The feedforward table is left out, GetFeedforward builds it on demand.
+ */
+void
+BVH::
+WriteCache(CacheWriter& cache)
+{
+	cache.WriteString(mFile);
+	cache.Write(mFileHash);
+	cache.Write<uint8_t>(mCyclic);
+	cache.Write(mTimeStep);
+	cache.Write<int32_t>(mNumTotalFrames);
+	cache.Write(T0);
+	cache.Write(T1);
+	cache.Write<uint32_t>(mJoints.size());
+	for(const auto& joint : mJoints)
+	{
+		cache.Write<int32_t>(joint.type);
+		cache.Write<int32_t>(joint.idx);
+		cache.Write<int32_t>(joint.rotation);
+	}
+	cache.Write<int32_t>(mNumRotations);
+	cache.Write<int32_t>(mRootIdx);
+	cache.Write<int32_t>(mRootRotation);
+	cache.WriteMatrix(mPositions);
+	cache.WriteMatrix(mVelocities);
+	Eigen::MatrixXd rotations(4,mRotations.size());
+	for(int i=0;i<mRotations.size();i++)
+		rotations.col(i) = mRotations[i].coeffs();
+	cache.WriteMatrix(rotations);
+}
+/**
+ * @brief Restores what WriteCache wrote instead of calling Parse.
+ */
+bool
+BVH::
+ReadCache(CacheReader& cache)
+{
+	mFile = cache.ReadString();
+	mFileHash = cache.Read<uint64_t>();
+	mCyclic = cache.Read<uint8_t>()!=0;
+	mTimeStep = cache.Read<double>();
+	mNumTotalFrames = cache.Read<int32_t>();
+	T0 = cache.Read<Eigen::Isometry3d>();
+	T1 = cache.Read<Eigen::Isometry3d>();
+	uint32_t num_joints = cache.Read<uint32_t>();
+	mJoints.clear();
+	for(uint32_t i=0;i<num_joints && cache.IsOk();i++)
+	{
+		MappedJoint joint;
+		joint.bvh_node = nullptr;
+		joint.type = (JointType)cache.Read<int32_t>();
+		joint.idx = cache.Read<int32_t>();
+		joint.rotation = cache.Read<int32_t>();
+		mJoints.push_back(joint);
+	}
+	mNumRotations = cache.Read<int32_t>();
+	mRootIdx = cache.Read<int32_t>();
+	mRootRotation = cache.Read<int32_t>();
+	mPositions = cache.ReadMatrix();
+	mVelocities = cache.ReadMatrix();
+	Eigen::MatrixXd rotations = cache.ReadMatrix();
+	mRotations.resize(rotations.cols());
+	for(int i=0;i<rotations.cols();i++)
+		mRotations[i].coeffs() = rotations.col(i);
+	mFeedforwardSkeleton = mSkeleton->clone();
+	return cache.IsOk() && mPositions.cols()==mNumTotalFrames;
+}
 };
\ No newline at end of file
@@ -1,19 +1,23 @@
 #ifndef __MASS_BVH_H__
 #define __MASS_BVH_H__
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <string>
-#include <fstream>
 #include <vector>
 #include <map>
 #include <utility>
 #include <initializer_list>
+#include <mutex>
 #include "dart/dart.hpp"
+#include "MotionData.h"
  
 namespace MASS
 {
 Eigen::Matrix3d R_x(double x);
 Eigen::Matrix3d R_y(double y);
 Eigen::Matrix3d R_z(double z);
+class CacheWriter;
+class CacheReader;
 class BVHNode
 {
 public:
@@ -30,7 +34,7 @@ public:
 
 
 	BVHNode(const std::string& name,BVHNode* parent);
-	void SetChannel(int c_offset,std::vector<std::string>& c_name);
+	void SetChannel(int c_offset,const std::vector<int>& channels);
 	void Set(const Eigen::VectorXd& m_t);
 	void Set(const Eigen::Matrix3d& R_t);
 	Eigen::Matrix3d Get();
@@ -54,23 +58,62 @@ public:
 	BVH(const dart::dynamics::SkeletonPtr& skel,const std::map<std::string,std::string>& bvh_map);
 
 	Eigen::VectorXd GetMotion(double t);
+	Eigen::VectorXd GetVelocity(double t);
+	Eigen::Vector6d GetRootMotion(double t);
+	Eigen::VectorXd GetFeedforward(double t);
+	// Skeleton positions of frame k computed from the raw channels, which is
+	// what fills the motion table (and what GetMotion used to do every call)
+	Eigen::VectorXd ComputeFrame(int k);
 
 	Eigen::Matrix3d Get(const std::string& bvh_node);
 
 	double GetMaxTime(){return (mNumTotalFrames)*mTimeStep;}
 	double GetTimeStep(){return mTimeStep;}
-	void Parse(const std::string& file,bool cyclic=true);
+	void Parse(const std::string& file,bool cyclic,uint64_t file_hash);
+	void WriteCache(CacheWriter& cache);
+	bool ReadCache(CacheReader& cache);
+	int GetNumFrames(){return mNumTotalFrames;}
+	const std::string& GetFile(){return mFile;}
 	
 	const std::map<std::string,std::string>& GetBVHMap(){return mBVHMap;}
 	const Eigen::Isometry3d& GetT0(){return T0;}
 	const Eigen::Isometry3d& GetT1(){return T1;}
 	bool IsCyclic(){return mCyclic;}
 private:
+	enum JointType
+	{
+		FREE,
+		BALL,
+		REVOLUTE
+	};
+	struct MappedJoint
+	{
+		BVHNode* bvh_node;
+		JointType type;
+		int idx;
+		int rotation;	// column in mRotations, -1 for revolute joints
+	};
+	bool LoadHierarchy(const std::string& file,uint64_t file_hash);
+	void BuildMotionTable();
+	void BuildFeedforwardTable();
+	void Locate(double t,int& k,int& k1,double& dt);
+
 	bool mCyclic;
-	std::vector<Eigen::VectorXd> mMotions;
+	std::string mFile;
+	uint64_t mFileHash;							// HashFile of mFile, keys its MotionData
+	std::shared_ptr<const MotionData> mData;	// shared by every BVH loading the same file
+	std::vector<MappedJoint> mJoints;
+	Eigen::MatrixXd mPositions;					// dof x frames
+	Eigen::MatrixXd mVelocities;				// dof x frames
+	Eigen::MatrixXd mFeedforward;				// dof x frames, inverse dynamics torques, built by the first GetFeedforward
+	std::once_flag mFeedforwardOnce;
+	dart::dynamics::SkeletonPtr mFeedforwardSkeleton;	// copy of mSkeleton taken before any env steps, for the table
+	int mRootIdx;
+	int mRootRotation;
+	std::vector<Eigen::Quaterniond,Eigen::aligned_allocator<Eigen::Quaterniond>> mRotations;	// frames x (free and ball joints)
+	int mNumRotations;
 	std::map<std::string,BVHNode*> mMap;
 	double mTimeStep;
-	int mNumTotalChannels;
 	int mNumTotalFrames;
 
 	BVHNode* mRoot;
@@ -79,7 +122,6 @@ private:
 	std::map<std::string,std::string> mBVHMap;
 
 	Eigen::Isometry3d T0,T1;
-	BVHNode* ReadHierarchy(BVHNode* parent,const std::string& name,int& channel_offset,std::ifstream& is);
 };
 
 };
@@ -1,7 +1,10 @@
 #include "Character.h"
 #include "BVH.h"
+#include "MotionLibrary.h"
+#include "ModelCache.h"
 #include "DARTHelper.h"
 #include "Muscle.h"
+#include "MuscleGroups.h"
 #include <dart/utils/urdf/DartLoader.hpp>
 #include <tinyxml.h>
 using namespace dart;
@@ -13,10 +16,19 @@ using namespace MASS;
 
 Character::
 Character()
-	:mSkeleton(nullptr),mBVH(nullptr),mTc(Eigen::Isometry3d::Identity())
+	:mSkeleton(nullptr),mBVH(nullptr),mSkeletonHash(0),mClip(0),mTc(Eigen::Isometry3d::Identity())
 {
 
 }
+/**
+ * @brief Deletes the muscles, which belong to this character alone. The
+ * skeleton, motions and muscle models may be shared with clones.
+ */
+Character::
+~Character()
+{
+	ClearMuscles();
+}
 
 /**
  * @brief Builds the skeleton by loading data from the skeleton
@@ -30,7 +42,8 @@ Character::
 LoadSkeleton(const std::string& path,bool create_obj)
 {
 	mSkeleton = BuildFromFile(path,create_obj);
-	std::map<std::string,std::string> bvh_map;
+	mSkeletonHash = HashFile(path);
+	std::map<std::string,std::string>& bvh_map = mBVHMap;
 	TiXmlDocument doc;
 	doc.LoadFile(path);
 	TiXmlElement *skel_elem = doc.FirstChildElement("Skeleton");
@@ -51,8 +64,6 @@ LoadSkeleton(const std::string& path,bool create_obj)
 			bvh_map.insert(std::make_pair(node->Attribute("name"),joint_elem->Attribute("bvh")));
 		}
 	}
-	
-	mBVH = new BVH(mSkeleton,bvh_map);
 }
 
 /**
@@ -104,9 +115,56 @@ LoadMuscles(const std::string& path)
 }
 
 /**
- * @brief Loads the reference motion trajectory
+ * @brief Resolves the muscle group file against the loaded muscles, see
+ * MuscleGroups. Load the muscles first.
  * 
- * @param path - path to the reference motion BVH
+ * @param path - path to the muscle group file (example: muscle_groups.xml)
+ */
+void
+Character::
+LoadMuscleGroups(const std::string& path)
+{
+	mMuscleGroups = MuscleGroups::Load(path,mMuscles);
+}
+/**
+ * @brief Removes the muscles (and muscle groups), so others can be loaded.
+ */
+void
+Character::
+ClearMuscles()
+{
+	for(auto muscle : mMuscles)
+		delete muscle;
+	mMuscles.clear();
+	mMuscleGroups.reset();
+}
+Eigen::VectorXd
+Character::
+GetMuscleActivations()
+{
+	Eigen::VectorXd activations(mMuscles.size());
+	for(int i=0;i<mMuscles.size();i++)
+		activations[i] = mMuscles[i]->activation;
+	return activations;
+}
+/**
+ * @brief Active plus passive force of every muscle at its current length.
+ */
+Eigen::VectorXd
+Character::
+GetMuscleForces()
+{
+	Eigen::VectorXd forces(mMuscles.size());
+	for(int i=0;i<mMuscles.size();i++)
+		forces[i] = mMuscles[i]->GetForce();
+	return forces;
+}
+
+/**
+ * @brief Adds a reference motion clip to the character's motion library.
+ * The first clip is the one used until another one is picked.
+ * 
+ * @param path - path to the reference motion (.bvh or .mbin)
  * @param cyclic - True for cyclic reference motions
  * such as walking/balancing. False for one-time
  * motions such as backflipping/kicking
@@ -115,11 +173,220 @@ void
 Character::
 LoadBVH(const std::string& path,bool cyclic)
 {
-	if(mBVH ==nullptr){
-		std::cout<<"Initialize BVH class first"<<std::endl;
+	if(mSkeleton==nullptr){
+		std::cout<<"Initialize skeleton first"<<std::endl;
 		return;
 	}
-	mBVH->Parse(path,cyclic);
+	mClipFiles.push_back(std::make_pair(path,cyclic));
+	mMotions = MotionLibrary::Get(mSkeleton,mSkeletonHash,mBVHMap,mClipFiles);
+	if(mMotions->GetNumClips()>0)
+		SetClip(mClip);
+}
+/**
+ * @brief Switches the reference motion to a clip of the library. Call Reset afterwards.
+ */
+void
+Character::
+SetClip(int clip)
+{
+	mClip = clip;
+	mBVH = mMotions->GetBVH(clip);
+}
+/**
+ * @brief Switches to a random clip and returns a random start time in it.
+ */
+double
+Character::
+SampleClip()
+{
+	int clip;
+	double t;
+	mMotions->Sample(clip,t);
+	SetClip(clip);
+	return t;
+}
+/**
+ * @brief Copy of this character with its own skeleton (Skeleton::clone) and
+ * muscle states. The muscle models, muscle groups and the motion library are
+ * shared, not copied.
+ */
+Character*
+Character::
+Clone()
+{
+	Character* character = new Character();
+	character->mSkeleton = mSkeleton->clone();
+	for(auto bn : mEndEffectors)
+		character->mEndEffectors.push_back(character->mSkeleton->getBodyNode(bn->getIndexInSkeleton()));
+	for(auto muscle : mMuscles)
+		character->mMuscles.push_back(muscle->Clone(character->mSkeleton));
+	character->mBVHMap = mBVHMap;
+	character->mClipFiles = mClipFiles;
+	character->mSkeletonHash = mSkeletonHash;
+	character->mMotions = mMotions;
+	character->mMuscleGroups = mMuscleGroups;
+	character->mBVH = mBVH;
+	character->mClip = mClip;
+	character->mTc = mTc;
+	character->mKp = mKp;
+	character->mKv = mKv;
+	return character;
+}
+/**
+ * @brief Bytes of muscle state owned by this character alone.
+ */
+size_t
+Character::
+GetMuscleStateBytes()
+{
+	size_t bytes = mMuscles.capacity()*sizeof(Muscle*);
+	for(auto muscle : mMuscles)
+		bytes += muscle->GetStateBytes();
+	return bytes;
+}
+/**
+ * @brief Bytes of the muscle models, shared with every clone of this character.
+ */
+size_t
+Character::
+GetMuscleModelBytes()
+{
+	size_t bytes = 0;
+	for(auto muscle : mMuscles)
+		bytes += muscle->GetModel().GetBytes();
+	return bytes;
+}
+/**
+ * @brief Writes the fully resolved model to a model cache: skeleton, end
+ * effectors, bvh map, muscles with their LBS anchors and rest state, and the
+ * motion tables of every clip (which are built now if they weren't yet).
+ */
+void
+Character::
+WriteCache(CacheWriter& cache)
+{
+	WriteSkeleton(mSkeleton,cache);
+	cache.Write<uint64_t>(mSkeletonHash);
+	cache.Write<uint32_t>(mEndEffectors.size());
+	for(auto bn : mEndEffectors)
+		cache.Write<int32_t>(bn->getIndexInSkeleton());
+	cache.Write<uint32_t>(mBVHMap.size());
+	for(const auto& ss : mBVHMap)
+	{
+		cache.WriteString(ss.first);
+		cache.WriteString(ss.second);
+	}
+
+	cache.Write<uint32_t>(mMuscles.size());
+	for(auto muscle : mMuscles)
+	{
+		const MuscleModel& model = muscle->GetModel();
+		cache.WriteString(model.name);
+		cache.Write(model.f0);
+		cache.Write(model.l_m0);
+		cache.Write(model.l_t0);
+		cache.Write(model.l_mt_max);
+		cache.Write<uint32_t>(model.anchors.size());
+		for(const auto& anchor : model.anchors)
+		{
+			cache.Write<uint32_t>(anchor.num_related_bodies);
+			for(int i=0;i<anchor.num_related_bodies;i++)
+			{
+				cache.Write<int32_t>(anchor.bodynodes[i]);
+				cache.Write(anchor.local_positions[i]);
+				cache.Write(anchor.weights[i]);
+			}
+		}
+		cache.Write(model.l_mt0);
+		cache.Write<uint32_t>(model.related_dof_indices.size());
+		for(int idx : model.related_dof_indices)
+			cache.Write<int32_t>(idx);
+	}
+
+	cache.Write<uint32_t>(mClipFiles.size());
+	for(int i=0;i<mClipFiles.size();i++)
+	{
+		cache.WriteString(mClipFiles[i].first);
+		cache.Write<uint8_t>(mClipFiles[i].second);
+		mMotions->GetBVH(i)->WriteCache(cache);
+	}
+}
+/**
+ * @brief Restores a model written by WriteCache, in place of LoadSkeleton,
+ * LoadMuscles and LoadBVH.
+ */
+bool
+Character::
+ReadCache(CacheReader& cache)
+{
+	mSkeleton = ReadSkeleton(cache);
+	if(mSkeleton==nullptr)
+		return false;
+	mSkeletonHash = cache.Read<uint64_t>();
+	uint32_t num_end_effectors = cache.Read<uint32_t>();
+	for(uint32_t i=0;i<num_end_effectors && cache.IsOk();i++)
+		mEndEffectors.push_back(mSkeleton->getBodyNode(cache.Read<int32_t>()));
+	uint32_t num_mapped = cache.Read<uint32_t>();
+	for(uint32_t i=0;i<num_mapped && cache.IsOk();i++)
+	{
+		std::string body = cache.ReadString();
+		mBVHMap[body] = cache.ReadString();
+	}
+
+	uint32_t num_muscles = cache.Read<uint32_t>();
+	for(uint32_t m=0;m<num_muscles && cache.IsOk();m++)
+	{
+		std::string name = cache.ReadString();
+		double f0 = cache.Read<double>();
+		double lm = cache.Read<double>();
+		double lt = cache.Read<double>();
+		double lmax = cache.Read<double>();
+		auto model = std::make_shared<MuscleModel>(name,f0,lm,lt,lmax);
+
+		uint32_t num_anchors = cache.Read<uint32_t>();
+		for(uint32_t a=0;a<num_anchors && cache.IsOk();a++)
+		{
+			std::vector<int> bodynodes;
+			std::vector<Eigen::Vector3d> local_positions;
+			std::vector<double> weights;
+			uint32_t num_bodies = cache.Read<uint32_t>();
+			for(uint32_t i=0;i<num_bodies && cache.IsOk();i++)
+			{
+				int32_t bn = cache.Read<int32_t>();
+				if(bn<0 || bn>=(int)mSkeleton->getNumBodyNodes())
+					return false;
+				bodynodes.push_back(bn);
+				local_positions.push_back(cache.Read<Eigen::Vector3d>());
+				weights.push_back(cache.Read<double>());
+			}
+			model->anchors.push_back(Anchor(bodynodes,local_positions,weights));
+		}
+		model->l_mt0 = cache.Read<double>();
+		model->related_dof_indices.resize(cache.Read<uint32_t>());
+		for(auto& idx : model->related_dof_indices)
+			idx = cache.Read<int32_t>();
+		if(!cache.IsOk())
+			return false;
+		mMuscles.push_back(new Muscle(model,mSkeleton));
+	}
+
+	uint32_t num_clips = cache.Read<uint32_t>();
+	std::vector<std::shared_ptr<BVH>> bvhs;
+	for(uint32_t i=0;i<num_clips && cache.IsOk();i++)
+	{
+		std::string path = cache.ReadString();
+		bool cyclic = cache.Read<uint8_t>()!=0;
+		mClipFiles.push_back(std::make_pair(path,cyclic));
+		bvhs.push_back(std::make_shared<BVH>(mSkeleton,mBVHMap));
+		if(!bvhs.back()->ReadCache(cache))
+			return false;
+	}
+	if(!cache.IsOk())
+		return false;
+	mMotions = MotionLibrary::Get(mSkeleton,mSkeletonHash,mBVHMap,mClipFiles,bvhs);
+	if(mMotions->GetNumClips()>0)
+		SetClip(0);
+	return true;
 }
 void
 Character::
@@ -151,14 +418,16 @@ GetSPDForces(const Eigen::VectorXd& p_desired)
 	Eigen::VectorXd q = mSkeleton->getPositions();		// Retrieve the current joint positions
 	Eigen::VectorXd dq = mSkeleton->getVelocities();	// Retrieve the current joint velocities
 	double dt = mSkeleton->getTimeStep();				// Retrieve the size of the time step
-	// Eigen::MatrixXd M_inv = mSkeleton->getInvMassMatrix();
-	Eigen::MatrixXd M_inv = (mSkeleton->getMassMatrix() + Eigen::MatrixXd(dt*mKv.asDiagonal())).inverse();
+	// M + dt*Kv is symmetric positive definite, so solve with a Cholesky factorization
+	// instead of forming the dense inverse
+	Eigen::MatrixXd M = mSkeleton->getMassMatrix();
+	M.diagonal() += dt*mKv;
 
 	Eigen::VectorXd qdqdt = q + dq*dt;	// Compute the new position of the joints, assuming constant velocity during this time step.
 
 	Eigen::VectorXd p_diff = -mKp.cwiseProduct(mSkeleton->getPositionDifferences(qdqdt,p_desired));
 	Eigen::VectorXd v_diff = -mKv.cwiseProduct(dq);
-	Eigen::VectorXd ddq = M_inv*(-mSkeleton->getCoriolisAndGravityForces()+p_diff+v_diff+mSkeleton->getConstraintForces());	// a = F/M or ddtheta = T/I?
+	Eigen::VectorXd ddq = M.llt().solve(-mSkeleton->getCoriolisAndGravityForces()+p_diff+v_diff+mSkeleton->getConstraintForces());	// a = F/M or ddtheta = T/I?
 
 	Eigen::VectorXd tau = p_diff + v_diff - dt*mKv.cwiseProduct(ddq);
 
@@ -166,18 +435,54 @@ GetSPDForces(const Eigen::VectorXd& p_desired)
 
 	return tau;
 }
+/**
+ * @brief Cheaper alternative to GetSPDForces: the reference motion's
+ * precomputed inverse dynamics torques at time t plus an explicit PD
+ * correction. No mass matrix is formed or solved.
+ *
+ * @param p_desired: desired positions of joints
+ * @param v_desired: desired velocities of joints
+ * @param t: time in the reference motion
+ */
+Eigen::VectorXd
+Character::
+GetFeedforwardPDForces(const Eigen::VectorXd& p_desired,const Eigen::VectorXd& v_desired,double t)
+{
+	Eigen::VectorXd q = mSkeleton->getPositions();
+	Eigen::VectorXd dq = mSkeleton->getVelocities();
+
+	Eigen::VectorXd tau = mBVH->GetFeedforward(t)
+		- mKp.cwiseProduct(mSkeleton->getPositionDifferences(q,p_desired))
+		- mKv.cwiseProduct(dq-v_desired);
+
+	tau.head<6>().setZero();
+
+	return tau;
+}
 Eigen::VectorXd
 Character::
 GetTargetPositions(double t,double dt)
 {
 	// std::cout<<"GetTargetPositions"<<std::endl;
 	Eigen::VectorXd p = mBVH->GetMotion(t);	
-	Eigen::Isometry3d T_current = dart::dynamics::FreeJoint::convertToTransform(p.head<6>());
+	p.head<6>() = this->GetTargetRoot(p.head<6>(),t,mTc);
+	mTc = this->AdvanceTc(t,dt,mTc);
+
+	return p;
+}
+
+/**
+ * @brief Moves the motion's root into the character's current cycle frame Tc,
+ * blending out the height difference between the last and first frame.
+ */
+Eigen::Vector6d
+Character::
+GetTargetRoot(const Eigen::Vector6d& root,double t,const Eigen::Isometry3d& Tc)
+{
+	Eigen::Isometry3d T_current = dart::dynamics::FreeJoint::convertToTransform(root);
 	T_current = mBVH->GetT0().inverse()*T_current;
-	Eigen::Isometry3d T_head = mTc*T_current;
+	Eigen::Isometry3d T_head = Tc*T_current;
 	Eigen::Vector6d p_head = dart::dynamics::FreeJoint::convertToPositions(T_head);
-	p.head<6>() = p_head;
-	
 	
 	if(mBVH->IsCyclic())
 	{
@@ -191,36 +496,53 @@ GetTargetPositions(double t,double dt)
 			Eigen::Isometry3d T01 = mBVH->GetT1()*(mBVH->GetT0().inverse());
 			double delta = T01.translation()[1];
 			delta *= ratio;
-			p[5] += delta;
+			p_head[5] += delta;
 		}
+	}
+	return p_head;
+}
 
+/**
+ * @brief Cycle frame to use after [t,t+dt]: when a cyclic motion wraps around
+ * in that interval, Tc is moved to where the last cycle ended. No side effects.
+ */
+Eigen::Isometry3d
+Character::
+AdvanceTc(double t,double dt,const Eigen::Isometry3d& Tc)
+{
+	if(!mBVH->IsCyclic())
+		return Tc;
+	double tdt_mod = std::fmod(t+dt, mBVH->GetMaxTime());
+	if(tdt_mod-dt>=0.0)
+		return Tc;
 
+	Eigen::Isometry3d T01 = mBVH->GetT1()*(mBVH->GetT0().inverse());
+	Eigen::Vector3d p01 = dart::math::logMap(T01.linear());
+	p01[0] =0.0;
+	p01[2] =0.0;
+	T01.linear() = dart::math::expMapRot(p01);
 
-		double tdt_mod = std::fmod(t+dt, mBVH->GetMaxTime());
-		if(tdt_mod-dt<0.0){
-			Eigen::Isometry3d T01 = mBVH->GetT1()*(mBVH->GetT0().inverse());
-			Eigen::Vector3d p01 = dart::math::logMap(T01.linear());
-			p01[0] =0.0;
-			p01[2] =0.0;
-			T01.linear() = dart::math::expMapRot(p01);
-
-			mTc = T01*mTc;
-			mTc.translation()[1] = 0.0;
-		}
-	}
-	
-
-	return p;
+	Eigen::Isometry3d Tc_next = T01*Tc;
+	Tc_next.translation()[1] = 0.0;
+	return Tc_next;
 }
 
+/**
+ * @brief Target positions at t and velocities, from the BVH motion and
+ * velocity tables. Only the root, which depends on the cycle frame, is
+ * finite-differenced over dt.
+ */
 std::pair<Eigen::VectorXd,Eigen::VectorXd>
 Character::
 GetTargetPosAndVel(double t,double dt)
 {
-	Eigen::VectorXd p = this->GetTargetPositions(t,dt);
-	Eigen::Isometry3d Tc = mTc;
-	Eigen::VectorXd p1 = this->GetTargetPositions(t+dt,dt);
-	mTc = Tc;
+	Eigen::VectorXd p = mBVH->GetMotion(t);
+	Eigen::VectorXd v = mBVH->GetVelocity(t);
+	p.head<6>() = this->GetTargetRoot(p.head<6>(),t,mTc);
+	mTc = this->AdvanceTc(t,dt,mTc);
+
+	Eigen::Vector6d p1_root = this->GetTargetRoot(mBVH->GetRootMotion(t+dt),t+dt,mTc);
+	v.head<6>() = (p1_root-p.head<6>())/dt;
 
-	return std::make_pair(p,(p1-p)/dt);
+	return std::make_pair(p,v);
 }
\ No newline at end of file
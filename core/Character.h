@@ -1,40 +1,69 @@
 #ifndef __MASS_CHARACTER_H__
 #define __MASS_CHARACTER_H__
 #include "dart/dart.hpp"
+#include <memory>
 
 namespace MASS
 {
 class BVH;
 class Muscle;
+class MotionLibrary;
+class CacheWriter;
+class CacheReader;
+class MuscleGroups;
 class Character
 {
 public:
 	Character();
+	~Character();
 
 	void LoadSkeleton(const std::string& path,bool create_obj = false);
 	void LoadMuscles(const std::string& path);
+	void LoadMuscleGroups(const std::string& path);
+	void ClearMuscles();
 	dart::dynamics::SkeletonPtr LoadExo(const std::string& path);
 	void LoadBVH(const std::string& path,bool cyclic=true);
+	void SetClip(int clip);
+	Character* Clone();
+	void WriteCache(CacheWriter& cache);
+	bool ReadCache(CacheReader& cache);
+	size_t GetMuscleStateBytes();
+	size_t GetMuscleModelBytes();
+	double SampleClip();
 
 	void Reset();	
 	void SetPDParameters(double kp, double kv);
 	void AddEndEffector(const std::string& body_name){mEndEffectors.push_back(mSkeleton->getBodyNode(body_name));}
 	Eigen::VectorXd GetSPDForces(const Eigen::VectorXd& p_desired);
+	Eigen::VectorXd GetFeedforwardPDForces(const Eigen::VectorXd& p_desired,const Eigen::VectorXd& v_desired,double t);
 
 	Eigen::VectorXd GetTargetPositions(double t,double dt);
 	std::pair<Eigen::VectorXd,Eigen::VectorXd> GetTargetPosAndVel(double t,double dt);
+	Eigen::Vector6d GetTargetRoot(const Eigen::Vector6d& root,double t,const Eigen::Isometry3d& Tc);
+	Eigen::Isometry3d AdvanceTc(double t,double dt,const Eigen::Isometry3d& Tc);
 	
 	
 	const dart::dynamics::SkeletonPtr& GetSkeleton(){return mSkeleton;}
 	const std::vector<Muscle*>& GetMuscles() {return mMuscles;}
+	const std::shared_ptr<const MuscleGroups>& GetMuscleGroups(){return mMuscleGroups;}	// nullptr if none were loaded
+	Eigen::VectorXd GetMuscleActivations();
+	Eigen::VectorXd GetMuscleForces();
 	const std::vector<dart::dynamics::BodyNode*>& GetEndEffectors(){return mEndEffectors;}
 	BVH* GetBVH(){return mBVH;}
+	const std::shared_ptr<MotionLibrary>& GetMotionLibrary(){return mMotions;}
+	int GetClip(){return mClip;}
 public:
 	dart::dynamics::SkeletonPtr mSkeleton;
 	BVH* mBVH;
+	std::map<std::string,std::string> mBVHMap;
+	std::vector<std::pair<std::string,bool>> mClipFiles;
+	uint64_t mSkeletonHash;		// HashFile of the skeleton file, keys the motion library
+	std::shared_ptr<MotionLibrary> mMotions;
+	int mClip;
 	Eigen::Isometry3d mTc;
 
 	std::vector<Muscle*> mMuscles;
+	std::shared_ptr<const MuscleGroups> mMuscleGroups;
 	std::vector<dart::dynamics::BodyNode*> mEndEffectors;
 
 	Eigen::VectorXd mKp, mKv;
@@ -1,4 +1,6 @@
 #include "DARTHelper.h"
+#include "ModelCache.h"
+#include "MeshCache.h"
 #include <tinyxml.h>
 using namespace dart::dynamics;
 
@@ -375,19 +377,168 @@ BuildFromFile(const std::string& path,bool create_obj)
 		if(obj_file!="None" && create_obj)
 		{
 			std::string obj_path = std::string(MASS_ROOT_DIR)+"/data/OBJ/"+obj_file;
-			const aiScene* scene = MeshShape::loadMesh(std::string(obj_path));
-
-			MeshShapePtr visual_shape = std::shared_ptr<MeshShape>(new MeshShape(Eigen::Vector3d(0.01,0.01,0.01),scene));
-			visual_shape->setColorMode(MeshShape::ColorMode::SHAPE_COLOR);
-			auto vsn = bn->createShapeNodeWith<VisualAspect>(visual_shape);
 
 			Eigen::Isometry3d T_obj;
 			T_obj.setIdentity();			
 			T_obj = T_body.inverse();
-			vsn->setRelativeTransform(T_obj);
+			MeshCache::Attach(bn,obj_path,T_obj);
 		}
 	}
 
 	std::cout<<"(DOFs : "<<skel->getNumDofs()<<")"<< std::endl;
 	return skel;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Writes everything BuildFromFile resolved from the skeleton xml: joints
+ * with their transforms, limits, springs and damping, inertias and the
+ * primitive shapes. Mesh shapes are not written (the cache is not used with obj).
+ */
+void
+MASS::
+WriteSkeleton(const SkeletonPtr& skel,CacheWriter& cache)
+{
+	cache.WriteString(skel->getName());
+	cache.Write<uint32_t>(skel->getNumBodyNodes());
+	for(int i=0;i<skel->getNumBodyNodes();i++)
+	{
+		BodyNode* bn = skel->getBodyNode(i);
+		Joint* jn = bn->getParentJoint();
+		cache.WriteString(bn->getName());
+		cache.Write<int32_t>(bn->getParentBodyNode()==nullptr ? -1 : bn->getParentBodyNode()->getIndexInSkeleton());
+
+		std::string type = jn->getType();
+		cache.WriteString(type.substr(0,type.size()-5));	// "FreeJoint" -> "Free"
+		cache.Write(jn->getTransformFromParentBodyNode());
+		cache.Write(jn->getTransformFromChildBodyNode());
+		int n = jn->getNumDofs();
+		Eigen::MatrixXd dofs(n,4);
+		for(int d=0;d<n;d++)
+			dofs.row(d)<<jn->getPositionLowerLimit(d),jn->getPositionUpperLimit(d),jn->getSpringStiffness(d),jn->getDampingCoefficient(d);
+		cache.WriteMatrix(dofs);
+		Eigen::Vector3d axis = Eigen::Vector3d::Zero();
+		int plane = 0;
+		if(type=="RevoluteJoint")
+			axis = dynamic_cast<RevoluteJoint*>(jn)->getAxis();
+		else if(type=="PlanarJoint")
+			plane = (int)dynamic_cast<PlanarJoint*>(jn)->getPlaneType();
+		cache.Write(axis);
+		cache.Write<int32_t>(plane);
+
+		const dart::dynamics::Inertia& inertia = bn->getInertia();
+		cache.Write(inertia.getMass());
+		cache.Write(inertia.getLocalCOM());
+		cache.Write(inertia.getMoment());
+
+		std::vector<ShapeNode*> shape_nodes;
+		for(int j=0;j<bn->getNumShapeNodes();j++)
+			if(dynamic_cast<MeshShape*>(bn->getShapeNode(j)->getShape().get())==nullptr)
+				shape_nodes.push_back(bn->getShapeNode(j));
+		cache.Write<uint32_t>(shape_nodes.size());
+		for(auto sn : shape_nodes)
+		{
+			Shape* shape = sn->getShape().get();
+			int32_t shape_type = 0;
+			Eigen::Vector3d params = Eigen::Vector3d::Zero();
+			if(auto box = dynamic_cast<BoxShape*>(shape))
+				params = box->getSize();
+			else if(auto sphere = dynamic_cast<SphereShape*>(shape))
+			{
+				shape_type = 1;
+				params[0] = sphere->getRadius();
+			}
+			else if(auto capsule = dynamic_cast<CapsuleShape*>(shape))
+			{
+				shape_type = 2;
+				params[0] = capsule->getRadius();
+				params[1] = capsule->getHeight();
+			}
+			cache.Write(shape_type);
+			cache.Write(params);
+			cache.Write<uint8_t>(sn->getCollisionAspect()!=nullptr);
+			cache.Write(sn->getVisualAspect()->getRGBA());
+			cache.Write(sn->getRelativeTransform());
+		}
+	}
+}
+
+/**
+ * @brief Rebuilds a skeleton written by WriteSkeleton, through the same Make*
+ * functions BuildFromFile uses.
+ */
+SkeletonPtr
+MASS::
+ReadSkeleton(CacheReader& cache)
+{
+	SkeletonPtr skel = Skeleton::create(cache.ReadString());
+	uint32_t num_body_nodes = cache.Read<uint32_t>();
+	for(uint32_t i=0;i<num_body_nodes && cache.IsOk();i++)
+	{
+		std::string name = cache.ReadString();
+		int32_t parent_idx = cache.Read<int32_t>();
+		BodyNode* parent = parent_idx<0 ? nullptr : skel->getBodyNode(parent_idx);
+
+		std::string type = cache.ReadString();
+		Eigen::Isometry3d parent_to_joint = cache.Read<Eigen::Isometry3d>();
+		Eigen::Isometry3d child_to_joint = cache.Read<Eigen::Isometry3d>();
+		Eigen::MatrixXd dofs = cache.ReadMatrix();
+		Eigen::Vector3d axis = cache.Read<Eigen::Vector3d>();
+		int32_t plane = cache.Read<int32_t>();
+		double mass = cache.Read<double>();
+		Eigen::Vector3d com = cache.Read<Eigen::Vector3d>();
+		Eigen::Matrix3d moment = cache.Read<Eigen::Matrix3d>();
+		if(!cache.IsOk())
+			return nullptr;
+
+		Joint::Properties* props;
+		if(type == "Free")
+			props = MASS::MakeFreeJointProperties(name,parent_to_joint,child_to_joint,dofs.col(0),dofs.col(1),dofs.col(2));
+		else if(type == "Planar")
+		{
+			std::string planes[] = {"XY","YZ","ZX"};
+			props = MASS::MakePlanarJointProperties(name,parent_to_joint,child_to_joint,dofs.col(0),dofs.col(1),dofs.col(2),dofs.col(3),planes[std::min(std::max(plane,0),2)]);
+		}
+		else if(type == "Ball")
+			props = MASS::MakeBallJointProperties(name,parent_to_joint,child_to_joint,dofs.col(0),dofs.col(1));
+		else if(type == "Revolute")
+			props = MASS::MakeRevoluteJointProperties(name,axis,parent_to_joint,child_to_joint,dofs.col(0),dofs.col(1));
+		else if(type == "Weld")
+			props = MASS::MakeWeldJointProperties(name,parent_to_joint,child_to_joint);
+		else
+			return nullptr;
+
+		BodyNode* bn = MakeBodyNode(skel,parent,props,type,dart::dynamics::Inertia(mass,com,moment));
+		Joint* jn = bn->getParentJoint();
+		for(int d=0;d<jn->getNumDofs();d++)
+		{
+			jn->setSpringStiffness(d,dofs(d,2));
+			jn->setDampingCoefficient(d,dofs(d,3));
+		}
+
+		uint32_t num_shapes = cache.Read<uint32_t>();
+		for(uint32_t j=0;j<num_shapes && cache.IsOk();j++)
+		{
+			int32_t shape_type = cache.Read<int32_t>();
+			Eigen::Vector3d params = cache.Read<Eigen::Vector3d>();
+			bool contact = cache.Read<uint8_t>()!=0;
+			Eigen::Vector4d color = cache.Read<Eigen::Vector4d>();
+			Eigen::Isometry3d T = cache.Read<Eigen::Isometry3d>();
+
+			ShapePtr shape;
+			if(shape_type==0)
+				shape = MASS::MakeBoxShape(params);
+			else if(shape_type==1)
+				shape = MASS::MakeSphereShape(params[0]);
+			else
+				shape = MASS::MakeCapsuleShape(params[0],params[1]);
+			ShapeNode* sn;
+			if(contact)
+				sn = bn->createShapeNodeWith<VisualAspect,CollisionAspect,DynamicsAspect>(shape);
+			else
+				sn = bn->createShapeNodeWith<VisualAspect, DynamicsAspect>(shape);
+			sn->getVisualAspect()->setRGBA(color);
+			sn->setRelativeTransform(T);
+		}
+	}
+	return cache.IsOk() ? skel : nullptr;
+}
@@ -28,6 +28,11 @@ dart::dynamics::WeldJoint::Properties* MakeWeldJointProperties(const std::string
 
 dart::dynamics::BodyNode* MakeBodyNode(const dart::dynamics::SkeletonPtr& skeleton,dart::dynamics::BodyNode* parent,dart::dynamics::Joint::Properties* joint_properties,const std::string& joint_type,dart::dynamics::Inertia inertia);
 dart::dynamics::SkeletonPtr BuildFromFile(const std::string& path,bool create_obj=false);
+
+class CacheWriter;
+class CacheReader;
+void WriteSkeleton(const dart::dynamics::SkeletonPtr& skel,CacheWriter& cache);
+dart::dynamics::SkeletonPtr ReadSkeleton(CacheReader& cache);
 };
 
 #endif
\ No newline at end of file
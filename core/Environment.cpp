@@ -3,6 +3,10 @@
 #include "Character.h"
 #include "BVH.h"
 #include "Muscle.h"
+#include "MuscleGroups.h"
+#include "ModelCache.h"
+#include "TrajectoryLog.h"
+#include <chrono>
 #include "dart/collision/bullet/bullet.hpp"
 using namespace dart;
 using namespace dart::simulation;
@@ -14,10 +18,15 @@ using namespace MASS;
 
 Environment::
 Environment()
-	:mControlHz(30),mSimulationHz(900),mWorld(std::make_shared<World>()),mUseMuscle(true),w_q(0.65),w_v(0.1),w_ee(0.15),w_com(0.1)
+	:mControlHz(30),mSimulationHz(900),mWorld(std::make_shared<World>()),mUseMuscle(true),mUseFeedforwardPD(false),mModelCacheHit(false),mInitializeTime(0.0),mLoadObj(false),mSkeletonHash(0),mMuscleHash(0),w_q(0.65),w_v(0.1),w_ee(0.15),w_com(0.1),mRecorder(nullptr),mExoEnergy(0.0)
 {
 
 }
+Environment::
+~Environment()
+{
+	StopRecording();
+}
 
 /**
  * @brief: Loads the parameter file, and configures the environment accordingly
@@ -29,17 +38,41 @@ void
 Environment::
 Initialize(const std::string& meta_file,bool load_obj)
 {
-	std::ifstream ifs(meta_file);	// Input stream class is created so meta_file can be read/operated on
+	auto begin = std::chrono::steady_clock::now();
+	mMetaFile = meta_file;
+	mLoadObj = load_obj;
+	if(!ReadMetadata())
+		return;
+
+	this->SetCharacter(LoadCharacter(nullptr));
+	this->SetGround(MASS::BuildFromFile(std::string(MASS_ROOT_DIR)+std::string("/data/ground.xml")));
+
+	this->Initialize();
+	mInitializeTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+}
+
+/**
+ * @brief Reads the settings and model file names of mMetaFile.
+ */
+bool
+Environment::
+ReadMetadata()
+{
+	std::ifstream ifs(mMetaFile);	// Input stream class is created so meta_file can be read/operated on
 	
 	if(!(ifs.is_open()))			// Self-exlanatory - triggered if ifstream object cannot open file
 	{
-		std::cout<<"Can't read file "<<meta_file<<std::endl;
-		return;
+		std::cout<<"Can't read file "<<mMetaFile<<std::endl;
+		return false;
 	}
 	std::string str;		// String initialised to store each line of file.
 	std::string index;		// String initialised to store the first word of each line.
 	std::stringstream ss;	// stringstream object used as a buffer such that each word of the current line can be examined separately.
-	MASS::Character* character = new MASS::Character();	// create a new MASS character object pointer.
+	// The model files are only loaded after the whole file is read (LoadCharacter)
+	mSkelFile.clear();
+	mMuscleFile.clear();
+	mMuscleGroupFile = std::string(MASS_ROOT_DIR)+"/data/muscle_groups.xml";
+	mClipFiles.clear();
 	while(!ifs.eof())	// While not at the end of file:
 	{
 		// Clear all veriables from previous loop:
@@ -81,22 +114,31 @@ Initialize(const std::string& meta_file,bool load_obj)
 			std::string str2;
 			ss>>str2;
 
-			character->LoadSkeleton(std::string(MASS_ROOT_DIR)+str2,load_obj);
+			mSkelFile = std::string(MASS_ROOT_DIR)+str2;
 		}
 		else if(!index.compare("muscle_file")){
 			std::string str2;
 			ss>>str2;
-			if(this->GetUseMuscle())
-				character->LoadMuscles(std::string(MASS_ROOT_DIR)+str2);
+			mMuscleFile = std::string(MASS_ROOT_DIR)+str2;
+		}
+		else if(!index.compare("muscle_group_file")){	// none to load no groups
+			std::string str2;
+			ss>>str2;
+			mMuscleGroupFile = str2.compare("none") ? std::string(MASS_ROOT_DIR)+str2 : std::string();
 		}
-		else if(!index.compare("bvh_file")){	// This is the reference motion file.
+		else if(!index.compare("bvh_file")){	// This is the reference motion file, repeat the line to add more clips.
 			std::string str2,str3;
 
 			ss>>str2>>str3;
 			bool cyclic = false;
 			if(!str3.compare("true"))
 				cyclic = true;
-			character->LoadBVH(std::string(MASS_ROOT_DIR)+str2,cyclic);
+			mClipFiles.push_back(std::make_pair(std::string(MASS_ROOT_DIR)+str2,cyclic));
+		}
+		else if(!index.compare("pd_mode")){	// spd (default) or feedforward
+			std::string str2;
+			ss>>str2;
+			this->SetUseFeedforwardPD(!str2.compare("feedforward"));
 		}
 		else if(!index.compare("reward_param")){
 			double a,b,c,d;
@@ -108,14 +150,221 @@ Initialize(const std::string& meta_file,bool load_obj)
 
 	}
 	ifs.close();
-	
-	
+	return true;
+}
+
+/**
+ * @brief Hashes of the files the skeleton (with the motions) and the muscles
+ * (with the muscle groups) are built from.
+ */
+void
+Environment::
+HashModelFiles(uint64_t& skeleton,uint64_t& muscles)
+{
+	skeleton = HashFile(mSkelFile);
+	for(const auto& clip : mClipFiles)
+		skeleton = HashFile(clip.first,skeleton);
+	muscles = HashFile(mMuscleFile);
+	if(!mMuscleGroupFile.empty())
+		muscles = HashFile(mMuscleGroupFile,muscles);
+}
+
+/**
+ * @brief Builds the character from the model files read by ReadMetadata,
+ * from the model cache if possible.
+ *
+ * @param previous - a character with the same skeleton and motions: only
+ * the muscles are loaded, onto a clone of its skeleton
+ */
+Character*
+Environment::
+LoadCharacter(Character* previous)
+{
+	// Everything the resolved model depends on goes into the cache file name
+	uint64_t hash = HashFile(mMetaFile);
+	hash = HashFile(mSkelFile,hash);
+	if(mUseMuscle)
+		hash = HashFile(mMuscleFile,hash);
+	for(const auto& clip : mClipFiles)
+		hash = HashFile(clip.first,hash);
+	std::string cache_path = GetModelCachePath(hash);
+	HashModelFiles(mSkeletonHash,mMuscleHash);
+
+	// The cache holds no meshes, models with obj files are always built from the xml
+	MASS::Character* character = nullptr;
+	mModelCacheHit = false;
+	if(!mLoadObj)
+	{
+		CacheReader reader;
+		if(reader.Load(cache_path))
+		{
+			character = new MASS::Character();
+			mModelCacheHit = character->ReadCache(reader);
+			if(!mModelCacheHit)
+			{
+				std::cout<<"Ignoring invalid model cache "<<cache_path<<std::endl;
+				delete character;
+				character = nullptr;
+			}
+		}
+	}
+	if(character==nullptr)
+	{
+		if(previous!=nullptr)
+		{
+			// muscle anchors are placed on the skeleton in its initial (zero) pose
+			character = previous->Clone();
+			character->ClearMuscles();
+			const auto& skel = character->GetSkeleton();
+			skel->setPositions(Eigen::VectorXd::Zero(skel->getNumDofs()));
+			skel->setVelocities(Eigen::VectorXd::Zero(skel->getNumDofs()));
+			skel->computeForwardKinematics(true,false,false);
+			if(this->GetUseMuscle())
+				character->LoadMuscles(mMuscleFile);
+		}
+		else
+		{
+			character = new MASS::Character();	// create a new MASS character object pointer.
+			character->LoadSkeleton(mSkelFile,mLoadObj);
+			if(this->GetUseMuscle())
+				character->LoadMuscles(mMuscleFile);
+			for(const auto& clip : mClipFiles)
+				character->LoadBVH(clip.first,clip.second);
+		}
+		if(!mLoadObj)
+		{
+			CacheWriter writer;
+			character->WriteCache(writer);
+			writer.Save(cache_path);
+		}
+	}
+
+	// Small and cheap to resolve, so not part of the model cache
+	if(this->GetUseMuscle() && !mMuscleGroupFile.empty())
+		character->LoadMuscleGroups(mMuscleGroupFile);
+
 	double kp = 300.0;
 	character->SetPDParameters(kp,sqrt(2*kp));
+	return character;
+}
+
+/**
+ * @brief Re-reads the metadata file given to Initialize(meta_file) and
+ * rebuilds the parts of the character whose files changed: only the muscles
+ * (and muscle groups) if the skeleton and motion files are the same, the
+ * whole character otherwise. The new character replaces the old one and the
+ * episode restarts.
+ *
+ * @param keep_sizes - refuse a model with other state, action or muscle
+ * sizes, which networks loaded for the old one can't drive
+ */
+Environment::ReloadResult
+Environment::
+Reload(bool keep_sizes)
+{
+	if(mMetaFile.empty())
+		return RELOAD_FAILED;
+	Environment next;
+	next.mMetaFile = mMetaFile;
+	next.mLoadObj = mLoadObj;
+	if(!next.ReadMetadata())
+		return RELOAD_FAILED;
+	uint64_t skeleton_hash,muscle_hash;
+	next.HashModelFiles(skeleton_hash,muscle_hash);
+	bool skeleton_changed = next.mUseMuscle!=mUseMuscle || next.mSkelFile!=mSkelFile || next.mClipFiles!=mClipFiles || skeleton_hash!=mSkeletonHash;
+	bool muscles_changed = next.mMuscleFile!=mMuscleFile || next.mMuscleGroupFile!=mMuscleGroupFile || muscle_hash!=mMuscleHash;
+
+	ReloadResult result = skeleton_changed ? RELOAD_CHARACTER : muscles_changed ? RELOAD_MUSCLES : RELOAD_SETTINGS;
+	Character* character = nullptr;
+	if(result!=RELOAD_SETTINGS)
+	{
+		character = next.LoadCharacter(skeleton_changed ? nullptr : mCharacter);
+		const auto& skel = character->GetSkeleton();
+		const auto& old_skel = mCharacter->GetSkeleton();
+		int num_related_dofs = 0,old_num_related_dofs = 0;
+		for(auto muscle : character->GetMuscles())
+			num_related_dofs += muscle->GetNumRelatedDofs();
+		for(auto muscle : mCharacter->GetMuscles())
+			old_num_related_dofs += muscle->GetNumRelatedDofs();
+		bool same_sizes = skel->getNumDofs()==old_skel->getNumDofs() && skel->getNumBodyNodes()==old_skel->getNumBodyNodes() &&
+			character->GetMuscles().size()==mCharacter->GetMuscles().size() && num_related_dofs==old_num_related_dofs;
+		if(keep_sizes && !same_sizes)
+		{
+			std::cout<<"Not reloading "<<mMetaFile<<" : the new model has other state, action or muscle sizes than the loaded networks"<<std::endl;
+			delete character;
+			return RELOAD_FAILED;
+		}
+		if(!same_sizes && IsRecording())
+		{
+			std::cout<<"The model changed size, recording stopped"<<std::endl;
+			StopRecording();
+		}
+	}
+
+	mUseMuscle = next.mUseMuscle;
+	mUseFeedforwardPD = next.mUseFeedforwardPD;
+	mControlHz = next.mControlHz;
+	mSimulationHz = next.mSimulationHz;
+	this->SetRewardParameters(next.w_q,next.w_v,next.w_ee,next.w_com);
+	if(character==nullptr)
+	{
+		mWorld->setTimeStep(1.0/mSimulationHz);
+		Reset(false);
+		return result;
+	}
+	mSkelFile = next.mSkelFile;
+	mMuscleFile = next.mMuscleFile;
+	mMuscleGroupFile = next.mMuscleGroupFile;
+	mClipFiles = next.mClipFiles;
+	mSkeletonHash = next.mSkeletonHash;
+	mMuscleHash = next.mMuscleHash;
+	mModelCacheHit = next.mModelCacheHit;
+
+	// Initialize adds both skeletons to the world again
+	mWorld->removeSkeleton(mCharacter->GetSkeleton());
+	mWorld->removeSkeleton(mGround);
+	delete mCharacter;
 	this->SetCharacter(character);
-	this->SetGround(MASS::BuildFromFile(std::string(MASS_ROOT_DIR)+std::string("/data/ground.xml")));
+	this->Initialize();
+	return result;
+}
+
+/**
+ * @brief The files Reload reads: metadata, skeleton and, with muscles, the
+ * muscle and muscle group files.
+ */
+std::vector<std::string>
+Environment::
+GetModelFiles()
+{
+	std::vector<std::string> files = {mMetaFile,mSkelFile};
+	if(mUseMuscle)
+		files.push_back(mMuscleFile);
+	if(mUseMuscle && !mMuscleGroupFile.empty())
+		files.push_back(mMuscleGroupFile);
+	return files;
+}
+
+/**
+ * @brief Sets up the environment as a copy of an initialized prototype,
+ * without loading any file: same settings, cloned character and ground.
+ * Only reads the prototype, so several envs can be cloned from it at once.
+ */
+void
+Environment::
+Initialize(Environment* prototype)
+{
+	auto begin = std::chrono::steady_clock::now();
+	mUseMuscle = prototype->mUseMuscle;
+	mUseFeedforwardPD = prototype->mUseFeedforwardPD;
+	mControlHz = prototype->mControlHz;
+	mSimulationHz = prototype->mSimulationHz;
+	this->SetRewardParameters(prototype->w_q,prototype->w_v,prototype->w_ee,prototype->w_com);
+	this->SetCharacter(prototype->mCharacter->Clone());
+	this->SetGround(prototype->mGround->clone());
 
 	this->Initialize();
+	mInitializeTime = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
 }
 
 void
@@ -161,9 +410,9 @@ Initialize()
  * @brief Resets the DART simulation, as well as MASS
  * models and the exoAgent.
  * 
- * @param RSI - when true, this sets the start
- * time between 0 - 0.9*max time, where max time
- * is 10 seconds
+ * @param RSI - when true, this picks a random clip
+ * of the motion library and sets the start time
+ * between 0 - 0.9*the clip's max time
  */
 void
 Environment::
@@ -176,6 +425,7 @@ Reset(bool RSI)
 	SetRHipT(0);
 	SetLKneeT(0);
 	SetRKneeT(0);
+	mExoEnergy = 0.0;
 
 	// reset all forces and constraints
 	mCharacter->GetSkeleton()->clearConstraintImpulses();
@@ -184,8 +434,10 @@ Reset(bool RSI)
 	
 	double t = 0.0;	// Set time to 0
 
-	if(RSI)	// sets time randomly between 0 and 0.9*max time
-		t = dart::math::random(0.0,mCharacter->GetBVH()->GetMaxTime()*0.9);
+	if(RSI)	// picks a random clip, and a time between 0 and 0.9*its max time
+		t = mCharacter->SampleClip();
+	else
+		mCharacter->SetClip(0);
 	mWorld->setTime(t); 
 	mCharacter->Reset();
 
@@ -198,6 +450,13 @@ Reset(bool RSI)
 	mCharacter->GetSkeleton()->setPositions(mTargetPositions);
 	mCharacter->GetSkeleton()->setVelocities(mTargetVelocities);
 	mCharacter->GetSkeleton()->computeForwardKinematics(true,false,false);
+
+	if(mRecorder!=nullptr)
+	{
+		mRecorder->Flush();
+		mRecorder->BeginEpisode();
+		Record(0.0);
+	}
 }
 
 void
@@ -270,6 +529,16 @@ Step()
 	}
 
 	mWorld->step();	// step DARTsim
+	if(mUseMuscle)
+	{
+		// the exo torques are held over the step, with the same joint mapping as above
+		auto& skel = mCharacter->GetSkeleton();
+		double power = std::abs(GetLHipT()*skel->getBodyNode("FemurL")->getParentJoint()->getVelocity(0))
+			+ std::abs(GetRHipT()*skel->getBodyNode("FemurR")->getParentJoint()->getVelocity(0))
+			+ std::abs(GetRKneeT()*skel->getBodyNode("TibiaL")->getParentJoint()->getVelocity(0))
+			+ std::abs(GetLKneeT()*skel->getBodyNode("TibiaR")->getParentJoint()->getVelocity(0));
+		mExoEnergy += power*mWorld->getTimeStep();
+	}
 	// Eigen::VectorXd p_des = mTargetPositions;
 	// //p_des.tail(mAction.rows()) += mAction;
 	// mCharacter->GetSkeleton()->setPositions(p_des);
@@ -278,12 +547,47 @@ Step()
 	// mWorld->setTime(mWorld->getTime()+mWorld->getTimeStep());
 
 	mSimCount++;
+	// the last simulation step of a control step
+	if(mRecorder!=nullptr && mSimCount==GetNumSteps())
+		Record(GetReward());
+}
+
+/**
+ * @brief Starts logging every control step to path (overwritten). The log is
+ * written out at every reset and when recording stops.
+ */
+void
+Environment::
+StartRecording(const std::string& path)
+{
+	StopRecording();
+	mRecorder = new TrajectoryRecorder(path,mCharacter->GetSkeleton()->getNumDofs(),mCharacter->GetMuscles().size(),
+		GetExoTorques().rows(),mControlHz);
+	if(!mRecorder->IsOpen())
+	{
+		StopRecording();
+		return;
+	}
+}
+void
+Environment::
+StopRecording()
+{
+	delete mRecorder;
+	mRecorder = nullptr;
+}
+void
+Environment::
+Record(double reward)
+{
+	mRecorder->Record(mWorld->getTime(),reward,mCharacter->GetSkeleton()->getPositions(),mCharacter->GetMuscleActivations(),GetExoTorques());
 }
 
 /**
  * @brief Calls the PD controller to retrieve the
  * joint torques required to reach the position
- * targets.
+ * targets. With pd_mode feedforward this is the
+ * reference motion's inverse dynamics plus PD.
  * 
  * @return Eigen::VectorXd joint torques required to 
  * reach position targets
@@ -295,7 +599,10 @@ GetDesiredTorques()
 	Eigen::VectorXd p_des = mTargetPositions;						// Retrieve target positions of joints
 	p_des.tail(mTargetPositions.rows()-mRootJointDof) += mAction;	// updates desired position using the action (change in pos?)
 																	// mrootjointdof p_des is not modified as it represents the position of the whole skeleton (the pelvis)?? - XS
-	mDesiredTorque = mCharacter->GetSPDForces(p_des);				// retrieve desired torque for muscles to produce
+	if(mUseFeedforwardPD)
+		mDesiredTorque = mCharacter->GetFeedforwardPDForces(p_des,mTargetVelocities,mWorld->getTime());
+	else
+		mDesiredTorque = mCharacter->GetSPDForces(p_des);			// retrieve desired torque for muscles to produce
 
 	return mDesiredTorque.tail(mDesiredTorque.rows()-mRootJointDof);
 }
@@ -324,6 +631,32 @@ GetMuscleTorques()
 	return mCurrentMuscleTuple.JtA;
 
 
+}
+/**
+ * @brief Mean activation of every muscle group (see MuscleGroups), empty if
+ * the character has no groups.
+ */
+Eigen::VectorXd
+Environment::
+GetMuscleGroupActivations()
+{
+	const auto& groups = mCharacter->GetMuscleGroups();
+	if(groups==nullptr)
+		return Eigen::VectorXd();
+	return groups->Average(mCharacter->GetMuscleActivations());
+}
+/**
+ * @brief Total muscle force (N) of every muscle group, empty if the
+ * character has no groups.
+ */
+Eigen::VectorXd
+Environment::
+GetMuscleGroupForces()
+{
+	const auto& groups = mCharacter->GetMuscleGroups();
+	if(groups==nullptr)
+		return Eigen::VectorXd();
+	return groups->Sum(mCharacter->GetMuscleForces());
 }
 double exp_of_squared(const Eigen::VectorXd& vec,double w)
 {
@@ -388,10 +721,7 @@ GetState()
 	// Position of pelvis is not recorded in state, but velocity of it is added into vel vector here
 	v.tail<3>() = root->getCOMLinearVelocity();	
 
-	double t_phase = mCharacter->GetBVH()->GetMaxTime();
-	double phi = std::fmod(mWorld->getTime(),t_phase)/t_phase;	// fraction of how far through the gait cycle the sim is 
-																// modulus is used, so that when one full cycle is up, this progress value
-																// wraps around to 0
+	double phi = GetPhase();
 
 	// scaled to match BVH reference movement??
 	p *= 0.8;	
@@ -404,6 +734,18 @@ GetState()
 	return state;
 }
 
+/**
+ * @brief Fraction of how far through the gait cycle (the reference clip) the
+ * sim is, wrapping around to 0 when one full cycle is up. The last entry of the state.
+ */
+double
+Environment::
+GetPhase()
+{
+	double t_phase = mCharacter->GetBVH()->GetMaxTime();
+	return std::fmod(mWorld->getTime(),t_phase)/t_phase;
+}
+
 void 
 Environment::
 SetAction(const Eigen::VectorXd& a)
@@ -534,6 +876,19 @@ GetReward()
 	return r;
 }
 
+/**
+ * @brief Mean absolute difference between the joint positions and the
+ * reference motion over all dofs but the root joint's, in radians.
+ */
+double
+Environment::
+GetJointAngleError()
+{
+	auto& skel = mCharacter->GetSkeleton();
+	Eigen::VectorXd diff = skel->getPositionDifferences(mTargetPositions,skel->getPositions());
+	return diff.tail(diff.rows()-mRootJointDof).cwiseAbs().mean();
+}
+
 /**
  * @brief Function to calculate the current exo agent reward.
  * 
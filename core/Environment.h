@@ -6,6 +6,8 @@
 namespace MASS
 {
 
+class TrajectoryRecorder;
+
 struct MuscleTuple
 {
 	Eigen::VectorXd JtA;
@@ -17,8 +19,10 @@ class Environment
 {
 public:
 	Environment();
+	~Environment();
 
 	void SetUseMuscle(bool use_muscle){mUseMuscle = use_muscle;}
+	void SetUseFeedforwardPD(bool use_feedforward){mUseFeedforwardPD = use_feedforward;}
 	void SetControlHz(int con_hz) {mControlHz = con_hz;}
 	void SetSimulationHz(int sim_hz) {mSimulationHz = sim_hz;}
 
@@ -28,6 +32,12 @@ public:
 	void SetRewardParameters(double w_q,double w_v,double w_ee,double w_com){this->w_q = w_q;this->w_v = w_v;this->w_ee = w_ee;this->w_com = w_com;}
 	void Initialize();
 	void Initialize(const std::string& meta_file,bool load_obj = false);
+	void Initialize(Environment* prototype);
+
+	// Rebuilds the character from edited model files, see Reload in Environment.cpp
+	enum ReloadResult {RELOAD_FAILED,RELOAD_SETTINGS,RELOAD_MUSCLES,RELOAD_CHARACTER};
+	ReloadResult Reload(bool keep_sizes);
+	std::vector<std::string> GetModelFiles();
 
 	dart::dynamics::SkeletonPtr exo_model;
 public:
@@ -35,11 +45,14 @@ public:
 	void Reset(bool RSI = true);
 	bool IsEndOfEpisode();
 	Eigen::VectorXd GetState();
+	double GetPhase();
 	void SetAction(const Eigen::VectorXd& a);
 	double GetReward();
 
 	Eigen::VectorXd GetDesiredTorques();
 	Eigen::VectorXd GetMuscleTorques();
+	Eigen::VectorXd GetMuscleGroupActivations();
+	Eigen::VectorXd GetMuscleGroupForces();
 
 	const dart::simulation::WorldPtr& GetWorld(){return mWorld;}
 	Character* GetCharacter(){return mCharacter;}
@@ -56,10 +69,15 @@ public:
 	const Eigen::VectorXd& GetAverageActivationLevels(){return mAverageActivationLevels;}
 	void SetActivationLevels(const Eigen::VectorXd& a){mActivationLevels = a;}
 	bool GetUseMuscle(){return mUseMuscle;}
+	bool GetUseFeedforwardPD(){return mUseFeedforwardPD;}
+	bool GetModelCacheHit(){return mModelCacheHit;}
+	double GetInitializeTime(){return mInitializeTime;}	// seconds spent in Initialize(meta_file)
 
 	// Added by XS:
 	Eigen::VectorXd GetExoTorques();
 	double GetGaitReward();
+	double GetJointAngleError();
+	double GetExoEnergy(){return mExoEnergy;}	// J, since the last reset
 
 	// Setters and getters for the hip/knee joint torque vectors:
 	/**
@@ -110,10 +128,28 @@ public:
 
 	Eigen::VectorXd& GetTargetPositions(){return mTargetPositions;}
 
+	// Trajectory log of every control step (see TrajectoryLog.h), replayed by render --replay
+	void StartRecording(const std::string& path);
+	void StopRecording();
+	bool IsRecording(){return mRecorder!=nullptr;}
+
 private:
 	dart::simulation::WorldPtr mWorld;
 	int mControlHz,mSimulationHz;
 	bool mUseMuscle;
+	bool mUseFeedforwardPD;	// desired torques from the feedforward table plus PD instead of stable PD
+	bool mModelCacheHit;
+	double mInitializeTime;
+
+	// Files read by Initialize(meta_file), kept for Reload
+	std::string mMetaFile;
+	bool mLoadObj;
+	std::string mSkelFile,mMuscleFile,mMuscleGroupFile;	// mMuscleGroupFile is empty for none
+	std::vector<std::pair<std::string,bool>> mClipFiles;
+	uint64_t mSkeletonHash,mMuscleHash;	// see HashModelFiles
+	bool ReadMetadata();
+	void HashModelFiles(uint64_t& skeleton,uint64_t& muscles);
+	Character* LoadCharacter(Character* previous);
 	Character* mCharacter;
 	dart::dynamics::SkeletonPtr mGround;
 	Eigen::VectorXd mAction;
@@ -133,6 +169,9 @@ private:
 
 	double w_q,w_v,w_ee,w_com;
 
+	TrajectoryRecorder* mRecorder;
+	void Record(double reward);
+
 	// Added by XS:
 	// Variables added to represent exo torques to be applied to knee/hip joints
 	float T_Hip_L = 0;						// Left hip
@@ -140,6 +179,7 @@ private:
 	// Knee torque is 1D vector as it is revolute 
 	float T_Knee_L = 0;						// Left knee
 	float T_Knee_R = 0; 					// Right knee
+	double mExoEnergy;						// absolute work of the exo torques, integrated in Step
 	// Eigen::VectorXd::Zero(1);	
 
 };
@@ -0,0 +1,165 @@
+#include "MeshCache.h"
+#include <future>
+#include <mutex>
+#include <chrono>
+using namespace dart::dynamics;
+using namespace MASS;
+
+namespace
+{
+struct PendingMesh
+{
+	std::weak_ptr<Skeleton> skel;
+	size_t body;
+	Eigen::Isometry3d T;
+	std::shared_future<MeshShapePtr> mesh;
+};
+
+std::mutex gMutex;
+std::map<std::string,std::shared_future<MeshShapePtr>> gMeshes;
+std::vector<PendingMesh> gPending;
+bool gLoadAsync = false;
+std::chrono::steady_clock::time_point gFirstRequest;
+int gNumAttached = 0;
+
+MeshShapePtr
+LoadMesh(const std::string& path)
+{
+	const aiScene* scene = MeshShape::loadMesh(path);
+	if(scene==nullptr)
+	{
+		std::cout<<"Can't load mesh : "<<path<<std::endl;
+		return nullptr;
+	}
+	MeshShapePtr shape = std::shared_ptr<MeshShape>(new MeshShape(Eigen::Vector3d(0.01,0.01,0.01),scene));
+	shape->setColorMode(MeshShape::ColorMode::SHAPE_COLOR);
+	return shape;
+}
+
+/**
+ * @brief The (possibly still loading) mesh of path, started now if it was
+ * never requested. Deferred loads run on the first thread that waits for them.
+ */
+std::shared_future<MeshShapePtr>
+Request(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+	auto it = gMeshes.find(path);
+	if(it!=gMeshes.end())
+		return it->second;
+	if(gMeshes.empty())
+		gFirstRequest = std::chrono::steady_clock::now();
+	std::shared_future<MeshShapePtr> mesh = std::async(gLoadAsync ? std::launch::async : std::launch::deferred,LoadMesh,path).share();
+	gMeshes[path] = mesh;
+	return mesh;
+}
+
+void
+CreateShapeNode(BodyNode* bn,const MeshShapePtr& shape,const Eigen::Isometry3d& T)
+{
+	if(shape==nullptr)
+		return;
+	auto vsn = bn->createShapeNodeWith<VisualAspect>(shape);
+	vsn->setRelativeTransform(T);
+}
+}
+
+MeshShapePtr
+MeshCache::
+Get(const std::string& path)
+{
+	return Request(path).get();
+}
+
+/**
+ * @brief Adds the mesh of path to bn as a visual shape at T (relative to
+ * bn), now or, when loading asynchronously, in a later AttachLoaded.
+ */
+void
+MeshCache::
+Attach(BodyNode* bn,const std::string& path,const Eigen::Isometry3d& T)
+{
+	std::shared_future<MeshShapePtr> mesh = Request(path);
+	if(!GetLoadAsync())
+	{
+		CreateShapeNode(bn,mesh.get(),T);
+		return;
+	}
+	PendingMesh pending;
+	pending.skel = bn->getSkeleton();
+	pending.body = bn->getIndexInSkeleton();
+	pending.T = T;
+	pending.mesh = mesh;
+	std::lock_guard<std::mutex> lock(gMutex);
+	gPending.push_back(pending);
+}
+
+/**
+ * @brief Creates the shape nodes of the meshes that finished loading. Must be
+ * called from the thread that owns the skeletons (the render loop).
+ *
+ * @return the number of meshes still loading
+ */
+int
+MeshCache::
+AttachLoaded()
+{
+	std::vector<PendingMesh> ready;
+	int num_pending;
+	{
+		std::lock_guard<std::mutex> lock(gMutex);
+		if(gPending.empty())
+			return 0;
+		for(int i=0;i<gPending.size();)
+		{
+			if(gPending[i].mesh.wait_for(std::chrono::seconds(0))==std::future_status::timeout)
+				i++;
+			else
+			{
+				ready.push_back(gPending[i]);
+				gPending.erase(gPending.begin()+i);
+			}
+		}
+		num_pending = gPending.size();
+	}
+	for(const auto& pending : ready)
+	{
+		SkeletonPtr skel = pending.skel.lock();
+		if(skel!=nullptr)
+			CreateShapeNode(skel->getBodyNode(pending.body),pending.mesh.get(),pending.T);
+	}
+	gNumAttached += ready.size();
+	if(!ready.empty() && num_pending==0)
+		std::cout<<"Attached "<<gNumAttached<<" meshes "<<std::chrono::duration<double>(std::chrono::steady_clock::now()-gFirstRequest).count()*1e3
+			<<" ms after the first was requested"<<std::endl;
+	return num_pending;
+}
+
+/**
+ * @brief Hands the meshes still loading for from over to to (a clone of it),
+ * so they are attached to the skeleton that gets drawn instead.
+ */
+void
+MeshCache::
+TransferPending(const SkeletonPtr& from,const SkeletonPtr& to)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+	for(auto& pending : gPending)
+		if(pending.skel.lock()==from)
+			pending.skel = to;
+}
+
+void
+MeshCache::
+SetLoadAsync(bool async)
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+	gLoadAsync = async;
+}
+bool
+MeshCache::
+GetLoadAsync()
+{
+	std::lock_guard<std::mutex> lock(gMutex);
+	return gLoadAsync;
+}
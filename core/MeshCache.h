@@ -0,0 +1,29 @@
+#ifndef __MASS_MESH_CACHE_H__
+#define __MASS_MESH_CACHE_H__
+#include "dart/dart.hpp"
+
+namespace MASS
+{
+/**
+ * @brief Process-wide cache of the OBJ visual shapes, keyed by path.
+ *
+ * Every mesh is loaded once (one aiScene, one MeshShape) and the shape is
+ * shared by every skeleton built from the same file and by their clones.
+ * With SetLoadAsync(true), BuildFromFile only starts loading and the shape
+ * nodes are created later by AttachLoaded, so a window can open before the
+ * meshes arrive.
+ */
+class MeshCache
+{
+public:
+	static dart::dynamics::MeshShapePtr Get(const std::string& path);
+	static void Attach(dart::dynamics::BodyNode* bn,const std::string& path,const Eigen::Isometry3d& T);
+	static int AttachLoaded();
+	static void TransferPending(const dart::dynamics::SkeletonPtr& from,const dart::dynamics::SkeletonPtr& to);
+
+	static void SetLoadAsync(bool async);
+	static bool GetLoadAsync();
+};
+};
+
+#endif
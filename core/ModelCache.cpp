@@ -0,0 +1,197 @@
+#include "ModelCache.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <iomanip>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace MASS;
+
+#ifndef MASS_CACHE_DIR
+#define MASS_CACHE_DIR MASS_ROOT_DIR "/build/model_cache"
+#endif
+
+namespace
+{
+const uint32_t CACHE_VERSION = 4;
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+uint64_t
+Fnv1a(const char* data,size_t bytes,uint64_t hash)
+{
+	for(size_t i=0;i<bytes;i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+}
+
+void
+CacheWriter::
+Write(const void* data,size_t bytes)
+{
+	const char* p = static_cast<const char*>(data);
+	mBuffer.insert(mBuffer.end(),p,p+bytes);
+}
+void
+CacheWriter::
+WriteString(const std::string& str)
+{
+	Write<uint32_t>(str.size());
+	Write(str.data(),str.size());
+}
+void
+CacheWriter::
+WriteMatrix(const Eigen::MatrixXd& m)
+{
+	Write<uint32_t>(m.rows());
+	Write<uint32_t>(m.cols());
+	Write(m.data(),sizeof(double)*m.size());
+}
+
+/**
+ * @brief Writes header and buffer to a temporary file and renames it into
+ * place, so processes starting at the same time never see a partial cache.
+ */
+bool
+CacheWriter::
+Save(const std::string& path)
+{
+	std::string dir = path.substr(0,path.find_last_of('/'));
+	for(size_t p = dir.find('/',1);;p = dir.find('/',p+1))
+	{
+		mkdir(dir.substr(0,p).c_str(),0755);
+		if(p==std::string::npos)
+			break;
+	}
+
+	std::stringstream tmp;
+	tmp<<path<<".tmp"<<getpid();
+	FILE* fp = fopen(tmp.str().c_str(),"wb");
+	if(fp==nullptr)
+	{
+		std::cout<<"Can't write model cache : "<<path<<std::endl;
+		return false;
+	}
+	fwrite("MCAC",1,4,fp);
+	fwrite(&CACHE_VERSION,sizeof(CACHE_VERSION),1,fp);
+	bool ok = fwrite(mBuffer.data(),1,mBuffer.size(),fp)==mBuffer.size();
+	ok = fclose(fp)==0 && ok;
+	if(!ok || rename(tmp.str().c_str(),path.c_str())!=0)
+	{
+		unlink(tmp.str().c_str());
+		return false;
+	}
+	return true;
+}
+
+bool
+CacheReader::
+Load(const std::string& path)
+{
+	mOk = false;
+	FILE* fp = fopen(path.c_str(),"rb");
+	if(fp==nullptr)
+		return false;
+	char magic[4];
+	uint32_t version = 0;
+	if(fread(magic,1,4,fp)==4 && std::memcmp(magic,"MCAC",4)==0 &&
+		fread(&version,sizeof(version),1,fp)==1 && version==CACHE_VERSION)
+	{
+		fseek(fp,0,SEEK_END);
+		long bytes = ftell(fp)-8;
+		fseek(fp,8,SEEK_SET);
+		mBuffer.resize(bytes);
+		mOk = fread(mBuffer.data(),1,bytes,fp)==(size_t)bytes;
+	}
+	fclose(fp);
+	mPos = 0;
+	return mOk;
+}
+void
+CacheReader::
+Read(void* data,size_t bytes)
+{
+	if(!mOk || mPos+bytes>mBuffer.size())
+	{
+		mOk = false;
+		return;
+	}
+	std::memcpy(data,mBuffer.data()+mPos,bytes);
+	mPos += bytes;
+}
+std::string
+CacheReader::
+ReadString()
+{
+	uint32_t n = Read<uint32_t>();
+	if(!mOk || mPos+n>mBuffer.size())
+	{
+		mOk = false;
+		return std::string();
+	}
+	std::string str(mBuffer.data()+mPos,n);
+	mPos += n;
+	return str;
+}
+Eigen::MatrixXd
+CacheReader::
+ReadMatrix()
+{
+	uint32_t rows = Read<uint32_t>();
+	uint32_t cols = Read<uint32_t>();
+	if(!mOk || mPos+sizeof(double)*rows*cols>mBuffer.size())
+	{
+		mOk = false;
+		return Eigen::MatrixXd();
+	}
+	Eigen::MatrixXd m(rows,cols);
+	Read(m.data(),sizeof(double)*m.size());
+	return m;
+}
+
+/**
+ * @brief FNV-1a of the file contents (and the path), chained onto hash.
+ * Missing files hash as their path only.
+ */
+uint64_t
+MASS::
+HashFile(const std::string& path,uint64_t hash)
+{
+	hash = HashString(path,hash);
+	int fd = open(path.c_str(),O_RDONLY);
+	if(fd<0)
+		return hash;
+	struct stat st;
+	if(fstat(fd,&st)==0 && st.st_size>0)
+	{
+		void* data = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+		if(data!=MAP_FAILED)
+		{
+			hash = Fnv1a(static_cast<const char*>(data),st.st_size,hash);
+			munmap(data,st.st_size);
+		}
+	}
+	close(fd);
+	return hash;
+}
+uint64_t
+MASS::
+HashString(const std::string& str,uint64_t hash)
+{
+	return Fnv1a(str.data(),str.size()+1,hash);
+}
+std::string
+MASS::
+GetModelCachePath(uint64_t hash)
+{
+	const char* dir = getenv("MASS_MODEL_CACHE_DIR");
+	std::stringstream ss;
+	ss<<(dir!=nullptr ? dir : MASS_CACHE_DIR)<<"/"<<std::hex<<std::setw(16)<<std::setfill('0')<<hash<<".mcache";
+	return ss.str();
+}
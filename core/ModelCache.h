@@ -0,0 +1,60 @@
+#ifndef __MASS_MODEL_CACHE_H__
+#define __MASS_MODEL_CACHE_H__
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+namespace MASS
+{
+/**
+ * Model cache files hold a fully resolved model (skeleton, muscles with their
+ * LBS anchors, motion tables) so a warm Environment::Initialize parses nothing.
+ * They live in MASS_CACHE_DIR (the build directory, or $MASS_MODEL_CACHE_DIR)
+ * and are named after a hash of the contents of every file the model was
+ * built from, so editing any of them simply misses the cache.
+ *
+ * Layout: char[4] magic "MCAC", uint32 version, then the sections written by
+ * Character::WriteCache, all values in native byte order.
+ */
+class CacheWriter
+{
+public:
+	void Write(const void* data,size_t bytes);
+	template<typename T>
+	void Write(const T& value){Write(&value,sizeof(T));}
+	void WriteString(const std::string& str);
+	void WriteMatrix(const Eigen::MatrixXd& m);
+
+	bool Save(const std::string& path);
+private:
+	std::vector<char> mBuffer;
+};
+
+class CacheReader
+{
+public:
+	CacheReader():mPos(0),mOk(false){}
+
+	bool Load(const std::string& path);
+	void Read(void* data,size_t bytes);
+	template<typename T>
+	T Read(){T value; std::memset(static_cast<void*>(&value),0,sizeof(T)); Read(&value,sizeof(T)); return value;}
+	std::string ReadString();
+	Eigen::MatrixXd ReadMatrix();
+
+	bool IsOk(){return mOk;}
+private:
+	std::vector<char> mBuffer;
+	size_t mPos;
+	bool mOk;
+};
+
+// FNV-1a, chained by passing the previous hash
+uint64_t HashFile(const std::string& path,uint64_t hash = 14695981039346656037ULL);
+uint64_t HashString(const std::string& str,uint64_t hash = 14695981039346656037ULL);
+std::string GetModelCachePath(uint64_t hash);
+};
+
+#endif
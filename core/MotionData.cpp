@@ -0,0 +1,412 @@
+#include "MotionData.h"
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace MASS;
+
+namespace
+{
+/**
+ * @brief Read-only mapping of a whole file, unmapped on destruction unless released.
+ */
+struct MappedFile
+{
+	void* data;
+	size_t bytes;
+
+	MappedFile(const std::string& path)
+		:data(nullptr),bytes(0)
+	{
+		int fd = open(path.c_str(),O_RDONLY);
+		if(fd<0)
+			return;
+		struct stat st;
+		if(fstat(fd,&st)==0 && st.st_size>0)
+		{
+			bytes = st.st_size;
+			data = mmap(nullptr,bytes,PROT_READ,MAP_PRIVATE,fd,0);
+			if(data==MAP_FAILED)
+				data = nullptr;
+		}
+		close(fd);
+	}
+	~MappedFile()
+	{
+		if(data!=nullptr)
+			munmap(data,bytes);
+	}
+	void Release()
+	{
+		data = nullptr;
+	}
+};
+
+/**
+ * @brief Whitespace separated tokens and numbers over a mapped buffer.
+ */
+class Tokenizer
+{
+public:
+	Tokenizer(const char* begin,const char* end)
+		:mPtr(begin),mEnd(end){}
+
+	bool Next(const char*& token,size_t& length)
+	{
+		SkipSpace();
+		if(mPtr==mEnd)
+			return false;
+		token = mPtr;
+		while(mPtr<mEnd && !IsSpace(*mPtr))
+			mPtr++;
+		length = mPtr-token;
+		return true;
+	}
+	bool Is(const char* token,size_t length,const char* word)
+	{
+		return strlen(word)==length && strncmp(token,word,length)==0;
+	}
+	std::string NextString()
+	{
+		const char* token;
+		size_t length;
+		if(!Next(token,length))
+			return std::string();
+		return std::string(token,length);
+	}
+
+	/**
+	 * @brief Parses a decimal floating point number ("-12.345e-2") without
+	 * going through strtod, accurate to a few ulps for the digits BVH files use.
+	 */
+	double NextNumber()
+	{
+		static const double pow10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+			1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+		SkipSpace();
+		bool negative = false;
+		if(mPtr<mEnd && (*mPtr=='-' || *mPtr=='+'))
+			negative = *mPtr++=='-';
+
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		int digits = 0;
+		while(mPtr<mEnd && *mPtr>='0' && *mPtr<='9')
+		{
+			if(digits<19)
+			{
+				mantissa = mantissa*10+(*mPtr-'0');
+				digits += mantissa!=0;
+			}
+			else
+				exponent++;
+			mPtr++;
+		}
+		if(mPtr<mEnd && *mPtr=='.')
+		{
+			mPtr++;
+			while(mPtr<mEnd && *mPtr>='0' && *mPtr<='9')
+			{
+				if(digits<19)
+				{
+					mantissa = mantissa*10+(*mPtr-'0');
+					digits += mantissa!=0;
+					exponent--;
+				}
+				mPtr++;
+			}
+		}
+		if(mPtr<mEnd && (*mPtr=='e' || *mPtr=='E'))
+		{
+			mPtr++;
+			bool negative_exponent = false;
+			if(mPtr<mEnd && (*mPtr=='-' || *mPtr=='+'))
+				negative_exponent = *mPtr++=='-';
+			int e = 0;
+			while(mPtr<mEnd && *mPtr>='0' && *mPtr<='9')
+				e = e*10+(*mPtr++-'0');
+			exponent += negative_exponent ? -e : e;
+		}
+		// skip anything unexpected so a malformed value can't stall the parser
+		while(mPtr<mEnd && !IsSpace(*mPtr))
+			mPtr++;
+
+		double value = (double)mantissa;
+		if(exponent<0)
+			value = -exponent<=22 ? value/pow10[-exponent] : value*std::pow(10.0,exponent);
+		else if(exponent>0)
+			value = exponent<=22 ? value*pow10[exponent] : value*std::pow(10.0,exponent);
+		return negative ? -value : value;
+	}
+private:
+	static bool IsSpace(char c)
+	{
+		return c==' ' || c=='\n' || c=='\r' || c=='\t';
+	}
+	void SkipSpace()
+	{
+		while(mPtr<mEnd && IsSpace(*mPtr))
+			mPtr++;
+	}
+
+	const char* mPtr;
+	const char* mEnd;
+};
+
+int
+ChannelCode(const std::string& name)
+{
+	// Same codes as BVHNode::CHANNEL
+	static const char* names[] = {"Xposition","Yposition","Zposition","Xrotation","Yrotation","Zrotation"};
+	for(int i=0;i<6;i++)
+		if(strcasecmp(name.c_str(),names[i])==0)
+			return i;
+	return -1;
+}
+
+void
+ReadJoint(Tokenizer& tk,std::vector<MotionData::Joint>& joints,const std::string& name,int parent,int& channel_offset)
+{
+	int index = joints.size();
+	joints.push_back(MotionData::Joint());
+	joints[index].name = name;
+	joints[index].parent = parent;
+	joints[index].channel_offset = channel_offset;
+
+	const char* token;
+	size_t length;
+	tk.Next(token,length); //{
+	while(tk.Next(token,length))
+	{
+		if(tk.Is(token,length,"}"))
+			break;
+		if(tk.Is(token,length,"OFFSET"))
+		{
+			//Ignore
+			tk.NextNumber();
+			tk.NextNumber();
+			tk.NextNumber();
+		}
+		else if(tk.Is(token,length,"CHANNELS"))
+		{
+			int n = (int)tk.NextNumber();
+			for(int i=0;i<n;i++)
+				joints[index].channels.push_back(ChannelCode(tk.NextString()));
+			channel_offset += n;
+		}
+		else if(tk.Is(token,length,"JOINT"))
+			ReadJoint(tk,joints,tk.NextString(),index,channel_offset);
+		else if(tk.Is(token,length,"End"))
+		{
+			tk.NextString(); //Site
+			ReadJoint(tk,joints,"EndEffector",index,channel_offset);
+		}
+	}
+}
+}
+
+MotionData::
+MotionData()
+	:mNumChannels(0),mNumFrames(0),mTimeStep(0.0),mFrames(nullptr),mMapping(nullptr),mMappingBytes(0)
+{
+
+}
+MotionData::
+~MotionData()
+{
+	if(mMapping!=nullptr)
+		munmap(mMapping,mMappingBytes);
+}
+bool
+MotionData::
+Load(const std::string& path)
+{
+	if(path.size()>5 && path.compare(path.size()-5,5,".mbin")==0)
+		return LoadMBin(path);
+	return LoadBVH(path);
+}
+
+/**
+ * @brief Parses a BVH text file in one pass over its mapping.
+ */
+bool
+MotionData::
+LoadBVH(const std::string& path)
+{
+	MappedFile file(path);
+	if(file.data==nullptr)
+	{
+		std::cout<<"Can't Open File"<<std::endl;
+		return false;
+	}
+	const char* text = static_cast<const char*>(file.data);
+	Tokenizer tk(text,text+file.bytes);
+
+	const char* token;
+	size_t length;
+	while(tk.Next(token,length))
+	{
+		if(tk.Is(token,length,"HIERARCHY"))
+		{
+			tk.NextString();//Root
+			std::string name = tk.NextString();
+			mJoints.clear();
+			mNumChannels = 0;
+			ReadJoint(tk,mJoints,name,-1,mNumChannels);
+		}
+		else if(tk.Is(token,length,"MOTION"))
+		{
+			tk.NextString(); //Frames:
+			mNumFrames = (int)tk.NextNumber();
+			tk.NextString(); //Frame
+			tk.NextString(); //Time:
+			mTimeStep = tk.NextNumber();
+			mOwnedFrames.resize((size_t)mNumFrames*mNumChannels);
+			for(auto& v : mOwnedFrames)
+				v = (float)tk.NextNumber();
+			break;
+		}
+	}
+	mFrames = mOwnedFrames.data();
+	return mNumFrames>0;
+}
+
+/**
+ * @brief Maps a .mbin file. Only the small hierarchy is decoded, the frames
+ * are read directly from the (page cache shared) mapping. Every joint record
+ * is checked against the hierarchy block, so a truncated or corrupt file is
+ * refused instead of read past.
+ */
+bool
+MotionData::
+LoadMBin(const std::string& path)
+{
+	MappedFile file(path);
+	if(file.data==nullptr || file.bytes<sizeof(MotionFileHeader))
+	{
+		std::cout<<"Can't Open File"<<std::endl;
+		return false;
+	}
+	const char* base = static_cast<const char*>(file.data);
+	MotionFileHeader header;
+	std::memcpy(&header,base,sizeof(header));
+	if(std::memcmp(header.magic,"MBIN",4)!=0 || header.version!=1 || header.num_joints==0 ||
+		header.frames_offset<sizeof(header) || header.frames_offset>file.bytes || header.frames_offset%sizeof(float)!=0 ||
+		header.num_joints>(header.frames_offset-sizeof(header))/16 ||
+		(uint64_t)header.num_frames*header.num_channels*sizeof(float)>file.bytes-header.frames_offset)
+	{
+		std::cout<<path<<" is not a valid motion file"<<std::endl;
+		return false;
+	}
+
+	const char* p = base+sizeof(header);
+	const char* end = base+header.frames_offset;
+	mJoints.resize(header.num_joints);
+	int index = 0;
+	for(;index<mJoints.size();index++)
+	{
+		MotionData::Joint& joint = mJoints[index];
+		int32_t parent;
+		uint32_t channel_offset,num_channels,name_length;
+		if(end-p<16)
+			break;
+		std::memcpy(&parent,p,4);
+		std::memcpy(&channel_offset,p+4,4);
+		std::memcpy(&num_channels,p+8,4);
+		std::memcpy(&name_length,p+12,4);
+		p += 16;
+		// the root comes first and parents before their children, as ReadJoint writes them
+		if((uint64_t)name_length+num_channels>(uint64_t)(end-p) || parent<-1 || parent>=index || (index==0)!=(parent==-1) ||
+			(uint64_t)channel_offset+num_channels>header.num_channels)
+			break;
+		joint.name.assign(p,name_length);
+		p += name_length;
+		joint.parent = parent;
+		joint.channel_offset = channel_offset;
+		for(uint32_t c=0;c<num_channels;c++)
+			joint.channels.push_back(*p++);
+	}
+	if(index<mJoints.size())
+	{
+		std::cout<<path<<" has a corrupt joint hierarchy"<<std::endl;
+		mJoints.clear();
+		return false;
+	}
+	mNumChannels = header.num_channels;
+	mNumFrames = header.num_frames;
+	mTimeStep = header.time_step;
+	mFrames = reinterpret_cast<const float*>(base+header.frames_offset);
+
+	mMapping = file.data;
+	mMappingBytes = file.bytes;
+	file.Release();
+	return mNumFrames>0;
+}
+bool
+MotionData::
+SaveMBin(const std::string& path) const
+{
+	FILE* fp = fopen(path.c_str(),"wb");
+	if(fp==nullptr)
+	{
+		std::cout<<"Can't open file : "<<path<<std::endl;
+		return false;
+	}
+	std::vector<char> hierarchy;
+	for(const auto& joint : mJoints)
+	{
+		uint32_t fields[4] = {(uint32_t)joint.parent,(uint32_t)joint.channel_offset,(uint32_t)joint.channels.size(),(uint32_t)joint.name.size()};
+		hierarchy.insert(hierarchy.end(),(const char*)fields,(const char*)fields+sizeof(fields));
+		hierarchy.insert(hierarchy.end(),joint.name.begin(),joint.name.end());
+		for(int c : joint.channels)
+			hierarchy.push_back((char)c);
+	}
+
+	MotionFileHeader header;
+	std::memset(&header,0,sizeof(header));
+	std::memcpy(header.magic,"MBIN",4);
+	header.version = 1;
+	header.num_joints = mJoints.size();
+	header.num_channels = mNumChannels;
+	header.num_frames = mNumFrames;
+	header.time_step = mTimeStep;
+	header.frames_offset = (sizeof(header)+hierarchy.size()+15)/16*16;
+	hierarchy.resize(header.frames_offset-sizeof(header),0);
+
+	size_t num_values = (size_t)mNumFrames*mNumChannels;
+	bool ok = fwrite(&header,sizeof(header),1,fp)==1 &&
+		fwrite(hierarchy.data(),1,hierarchy.size(),fp)==hierarchy.size() &&
+		fwrite(mFrames,sizeof(float),num_values,fp)==num_values;
+	ok = fclose(fp)==0 && ok;
+	if(!ok)
+		std::cout<<"Can't write file : "<<path<<std::endl;
+	return ok;
+}
+
+std::shared_ptr<const MotionData>
+MASS::
+LoadMotionData(const std::string& path,uint64_t file_hash)
+{
+	static std::mutex mutex;
+	static std::map<std::pair<std::string,uint64_t>,std::weak_ptr<const MotionData>> cache;
+
+	// an edited file must not get the frames still held for its old contents
+	std::pair<std::string,uint64_t> key(path,file_hash);
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<const MotionData> data = cache[key].lock();
+	if(data==nullptr)
+	{
+		std::shared_ptr<MotionData> loaded = std::make_shared<MotionData>();
+		if(!loaded->Load(path))
+			return nullptr;
+		data = loaded;
+		cache[key] = data;
+	}
+	return data;
+}
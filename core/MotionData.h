@@ -0,0 +1,82 @@
+#ifndef __MASS_MOTION_DATA_H__
+#define __MASS_MOTION_DATA_H__
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace MASS
+{
+/**
+ * Binary motion layout (.mbin, all integers little endian):
+ *
+ * Header (40 bytes):
+ *   char[4] magic "MBIN", uint32 version, uint32 num_joints, uint32 num_channels,
+ *   uint32 num_frames, uint32 reserved, float64 frame time, uint64 frames offset
+ *
+ * Then per joint, in depth-first order:
+ *   int32 parent (-1 for the root), uint32 channel offset, uint32 num channels,
+ *   uint32 name length, name bytes, one uint8 per channel (BVHNode::CHANNEL)
+ *
+ * Then, at the 16 byte aligned frames offset, num_frames x num_channels
+ * float32 values, which are used in place from the mapped file.
+ */
+struct MotionFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t num_joints;
+	uint32_t num_channels;
+	uint32_t num_frames;
+	uint32_t reserved;
+	double time_step;
+	uint64_t frames_offset;
+};
+
+/**
+ * @brief Read-only BVH hierarchy and channel values. Parsed from .bvh text
+ * with a single pass over the mapped file, or mapped from .mbin with no parsing.
+ * Instances are shared by every BVH of the process through LoadMotionData.
+ */
+class MotionData
+{
+public:
+	struct Joint
+	{
+		std::string name;
+		int parent;
+		int channel_offset;
+		std::vector<int> channels;
+	};
+
+	MotionData();
+	~MotionData();
+
+	bool Load(const std::string& path);
+	bool LoadBVH(const std::string& path);
+	bool LoadMBin(const std::string& path);
+	bool SaveMBin(const std::string& path) const;
+
+	const std::vector<Joint>& GetJoints() const {return mJoints;}
+	int GetNumChannels() const {return mNumChannels;}
+	int GetNumFrames() const {return mNumFrames;}
+	double GetTimeStep() const {return mTimeStep;}
+	const float* GetFrame(int k) const {return mFrames+(size_t)k*mNumChannels;}
+private:
+	std::vector<Joint> mJoints;
+	int mNumChannels;
+	int mNumFrames;
+	double mTimeStep;
+
+	const float* mFrames;
+	std::vector<float> mOwnedFrames;
+	void* mMapping;
+	size_t mMappingBytes;
+};
+
+// Process-wide cache: every caller asking for the same file contents
+// (file_hash, see HashFile) gets the same data
+std::shared_ptr<const MotionData> LoadMotionData(const std::string& path,uint64_t file_hash);
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include "MotionLibrary.h"
+#include "MotionData.h"
+#include "BVH.h"
+#include "ModelCache.h"
+#include <sstream>
+using namespace dart::dynamics;
+using namespace MASS;
+
+namespace
+{
+std::mutex gCacheMutex;
+std::map<std::string,std::weak_ptr<BVH>> gBVHs;
+std::map<std::string,std::weak_ptr<MotionLibrary>> gLibraries;
+
+/**
+ * @param skeleton_hash - content of the skeleton file: masses, axes, ... change
+ * the motion tables without changing the name or the dofs
+ */
+std::string
+SkeletonKey(const SkeletonPtr& skel,uint64_t skeleton_hash,const std::map<std::string,std::string>& bvh_map)
+{
+	std::stringstream ss;
+	ss<<skel->getName()<<":"<<skel->getNumDofs()<<":"<<std::hex<<skeleton_hash<<std::dec;
+	for(const auto& ss_pair : bvh_map)
+		ss<<":"<<ss_pair.first<<"="<<ss_pair.second;
+	return ss.str();
+}
+
+std::string
+ClipKey(const std::string& path,uint64_t file_hash,bool cyclic)
+{
+	std::stringstream ss;
+	ss<<"|"<<path<<":"<<std::hex<<file_hash<<(cyclic ? "|cyclic" : "");
+	return ss.str();
+}
+
+/**
+ * @brief The parsed clip with its motion tables, shared by every skeleton
+ * with the same skeleton file and bvh map.
+ */
+std::shared_ptr<BVH>
+LoadSharedBVH(const SkeletonPtr& skel,uint64_t skeleton_hash,const std::map<std::string,std::string>& bvh_map,
+	const MotionLibrary::Clip& clip,const std::shared_ptr<BVH>& loaded = nullptr)
+{
+	std::string key = SkeletonKey(skel,skeleton_hash,bvh_map)+ClipKey(clip.path,clip.file_hash,clip.cyclic);
+	std::lock_guard<std::mutex> lock(gCacheMutex);
+	std::shared_ptr<BVH> bvh = gBVHs[key].lock();
+	if(bvh==nullptr)
+	{
+		bvh = loaded;
+		if(bvh==nullptr)
+		{
+			bvh = std::make_shared<BVH>(skel,bvh_map);
+			bvh->Parse(clip.path,clip.cyclic,clip.file_hash);
+		}
+		gBVHs[key] = bvh;
+	}
+	return bvh;
+}
+}
+
+MotionLibrary::
+MotionLibrary(const SkeletonPtr& skel,uint64_t skeleton_hash,const std::map<std::string,std::string>& bvh_map,
+	const std::vector<std::pair<std::string,bool>>& clips,const std::vector<uint64_t>& clip_hashes,
+	const std::vector<std::shared_ptr<BVH>>& bvhs)
+	:mSkeleton(skel),mSkeletonHash(skeleton_hash),mBVHMap(bvh_map)
+{
+	for(int i=0;i<clips.size();i++)
+	{
+		Clip clip;
+		clip.path = clips[i].first;
+		clip.file_hash = clip_hashes[i];
+		clip.cyclic = clips[i].second;
+		clip.first_phase = mPhaseClips.size();
+		if(i<bvhs.size() && bvhs[i]!=nullptr)
+		{
+			// restored from the model cache, already complete
+			clip.bvh = LoadSharedBVH(skel,skeleton_hash,bvh_map,clip,bvhs[i]);
+			clip.num_frames = clip.bvh->GetNumFrames();
+			clip.time_step = clip.bvh->GetTimeStep();
+		}
+		else
+		{
+			// Only the frame counts are needed here, the tables are built on first use
+			clip.data = LoadMotionData(clip.path,clip.file_hash);
+			if(clip.data==nullptr)
+				continue;
+			clip.num_frames = clip.data->GetNumFrames();
+			clip.time_step = clip.data->GetTimeStep();
+		}
+		int num_phases = std::max(1,(int)(clip.num_frames*0.9));
+		mPhaseClips.insert(mPhaseClips.end(),num_phases,(int)mClips.size());
+		mClips.push_back(clip);
+	}
+}
+
+/**
+ * @brief The library for this skeleton and clip list, created on first request.
+ *
+ * @param skeleton_hash - HashFile of the skeleton file
+ * @param clips - motion file and cyclic flag of every clip
+ * @param bvhs - clips restored from the model cache, if any
+ */
+std::shared_ptr<MotionLibrary>
+MotionLibrary::
+Get(const SkeletonPtr& skel,uint64_t skeleton_hash,const std::map<std::string,std::string>& bvh_map,
+	const std::vector<std::pair<std::string,bool>>& clips,const std::vector<std::shared_ptr<BVH>>& bvhs)
+{
+	// edited clips must not reuse the tables of the old ones still held by other characters
+	std::vector<uint64_t> clip_hashes;
+	std::string key = SkeletonKey(skel,skeleton_hash,bvh_map);
+	for(const auto& c : clips)
+	{
+		clip_hashes.push_back(HashFile(c.first));
+		key += ClipKey(c.first,clip_hashes.back(),c.second);
+	}
+
+	std::unique_lock<std::mutex> lock(gCacheMutex);
+	std::shared_ptr<MotionLibrary> library = gLibraries[key].lock();
+	if(library==nullptr)
+	{
+		// the constructor takes the lock itself for the clip cache
+		lock.unlock();
+		library = std::shared_ptr<MotionLibrary>(new MotionLibrary(skel,skeleton_hash,bvh_map,clips,clip_hashes,bvhs));
+		lock.lock();
+		std::shared_ptr<MotionLibrary> existing = gLibraries[key].lock();
+		if(existing!=nullptr)
+			return existing;
+		gLibraries[key] = library;
+	}
+	return library;
+}
+BVH*
+MotionLibrary::
+GetBVH(int clip)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	Clip& c = mClips[clip];
+	if(c.bvh==nullptr)
+		c.bvh = LoadSharedBVH(mSkeleton,mSkeletonHash,mBVHMap,c);
+	return c.bvh.get();
+}
+
+/**
+ * @brief Random clip and start time, uniform over the start frames of all
+ * clips, i.e. clips are picked in proportion to their length.
+ */
+void
+MotionLibrary::
+Sample(int& clip,double& t)
+{
+	int phase = std::min((int)dart::math::random(0.0,(double)mPhaseClips.size()),(int)mPhaseClips.size()-1);
+	Lookup(phase,clip,t);
+	t += dart::math::random(0.0,mClips[clip].time_step);
+}
+
+/**
+ * @brief Clip and start time of a phase index entry in O(1).
+ */
+void
+MotionLibrary::
+Lookup(int phase,int& clip,double& t)
+{
+	clip = mPhaseClips[phase];
+	t = (phase-mClips[clip].first_phase)*mClips[clip].time_step;
+}
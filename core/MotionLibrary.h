@@ -0,0 +1,63 @@
+#ifndef __MASS_MOTION_LIBRARY_H__
+#define __MASS_MOTION_LIBRARY_H__
+#include "dart/dart.hpp"
+#include <memory>
+#include <mutex>
+
+namespace MASS
+{
+class BVH;
+class MotionData;
+
+/**
+ * @brief The reference clips listed by the metadata (one bvh_file line each).
+ *
+ * A library is shared by every character with the same skeleton and clip list
+ * (compared by file content, so edited files get a library of their own),
+ * and every clip's BVH (motion tables included) is shared process-wide, so the
+ * memory used for motions does not grow with the number of envs. A clip's
+ * tables are only built the first time an env uses it.
+ */
+class MotionLibrary
+{
+public:
+	struct Clip
+	{
+		std::string path;
+		uint64_t file_hash;				// HashFile of path, part of the shared BVH key
+		bool cyclic;
+		std::shared_ptr<const MotionData> data;
+		std::shared_ptr<BVH> bvh;		// built on first use
+		int num_frames;
+		double time_step;
+		int first_phase;				// first entry in the phase index
+	};
+
+	static std::shared_ptr<MotionLibrary> Get(const dart::dynamics::SkeletonPtr& skel,uint64_t skeleton_hash,const std::map<std::string,std::string>& bvh_map,
+		const std::vector<std::pair<std::string,bool>>& clips,const std::vector<std::shared_ptr<BVH>>& bvhs = std::vector<std::shared_ptr<BVH>>());
+
+	int GetNumClips(){return mClips.size();}
+	const std::string& GetClipPath(int clip){return mClips[clip].path;}
+	BVH* GetBVH(int clip);
+
+	void Sample(int& clip,double& t);
+	void Lookup(int phase,int& clip,double& t);
+	int GetNumPhases(){return mPhaseClips.size();}
+private:
+	MotionLibrary(const dart::dynamics::SkeletonPtr& skel,uint64_t skeleton_hash,const std::map<std::string,std::string>& bvh_map,
+		const std::vector<std::pair<std::string,bool>>& clips,const std::vector<uint64_t>& clip_hashes,
+		const std::vector<std::shared_ptr<BVH>>& bvhs);
+
+	dart::dynamics::SkeletonPtr mSkeleton;
+	uint64_t mSkeletonHash;
+	std::map<std::string,std::string> mBVHMap;
+	std::vector<Clip> mClips;
+	std::mutex mMutex;
+
+	// One entry per start frame of every clip (the first 90% of each clip),
+	// giving the clip of a phase without any search.
+	std::vector<int> mPhaseClips;
+};
+};
+
+#endif
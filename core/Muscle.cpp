@@ -12,7 +12,7 @@ std::vector<int> sort_indices(const std::vector<double>& val)
 	return idx;
 }
 Anchor::
-Anchor(std::vector<BodyNode*> bns,std::vector<Eigen::Vector3d> lps,std::vector<double> ws)
+Anchor(std::vector<int> bns,std::vector<Eigen::Vector3d> lps,std::vector<double> ws)
 	:bodynodes(bns),local_positions(lps),weights(ws),num_related_bodies(bns.size())
 {
 
@@ -20,12 +20,12 @@ Anchor(std::vector<BodyNode*> bns,std::vector<Eigen::Vector3d> lps,std::vector<d
 
 Eigen::Vector3d
 Anchor::
-GetPoint()
+GetPoint(const Skeleton* skel) const
 {
 	Eigen::Vector3d p;
 	p.setZero();
 	for(int i = 0;i<num_related_bodies;i++)
-		p += weights[i]*(bodynodes[i]->getTransform()*local_positions[i]);
+		p += weights[i]*(skel->getBodyNode(bodynodes[i])->getTransform()*local_positions[i]);
 	return p;
 }
 
@@ -52,10 +52,37 @@ GetPoint()
  * l_mt_max: maximum musculo-tendon length? Z
  * 
  */
+MuscleModel::
+MuscleModel(const std::string& _name,double _f0,double lm0,double lt0,double lmax)
+	:name(_name),f0(_f0),l_m0(lm0),l_t0(lt0),l_mt0(0.0),l_mt_max(lmax),f_toe(0.33),k_toe(3.0),k_lin(51.878788),e_toe(0.02),e_t0(0.033),k_pe(4.0),e_mo(0.6),gamma(0.5)
+{
+}
+
+/**
+ * @brief Heap and inline bytes of the model, which all envs share.
+ */
+size_t
+MuscleModel::
+GetBytes() const
+{
+	size_t bytes = sizeof(MuscleModel)+name.capacity()+related_dof_indices.capacity()*sizeof(int);
+	for(const auto& anchor : anchors)
+		bytes += sizeof(Anchor)+anchor.bodynodes.capacity()*sizeof(int)+
+			anchor.local_positions.capacity()*sizeof(Eigen::Vector3d)+anchor.weights.capacity()*sizeof(double);
+	return bytes;
+}
+
 Muscle::
 Muscle(std::string _name,double _f0,double _lm0,double _lt0,double _pen_angle,double lmax)
-	:name(_name),f0(_f0),l_m0(_lm0),l_m(l_mt - l_t0),l_t0(_lt0),l_mt0(0.0),l_mt(1.0),activation(0.0),f_toe(0.33),k_toe(3.0),k_lin(51.878788),e_toe(0.02),e_t0(0.033),k_pe(4.0),e_mo(0.6),gamma(0.5),l_mt_max(lmax)
+	:mModel(std::make_shared<MuscleModel>(_name,_f0,_lm0,_lt0,lmax)),mSkeleton(nullptr),l_mt(1.0),l_m(1.0-_lt0),activation(0.0)
+{
+}
+Muscle::
+Muscle(const std::shared_ptr<MuscleModel>& model,const SkeletonPtr& skel)
+	:mModel(model),mSkeleton(skel.get()),l_mt(1.0),l_m(1.0-model->l_t0),activation(0.0)
 {
+	mCachedAnchorPositions.resize(mModel->anchors.size());
+	Update();
 }
 
 void
@@ -139,88 +166,104 @@ AddAnchor(const dart::dynamics::SkeletonPtr& skel,dart::dynamics::BodyNode* bn,c
 	// for(int i = 0;i<lbs_body_nodes.size();i++)
 		// std::cout<<lbs_body_nodes[i]->getName()<<" "<<lbs_weights[i]<<std::endl;
 	// std::cout<<std::endl<<std::endl<<std::endl<<std::endl;
-	mAnchors.push_back(new Anchor(lbs_body_nodes,lbs_local_positions,lbs_weights));
-
-	int n =mAnchors.size();
-	if(n>1)
-		l_mt0 += (mAnchors[n-1]->GetPoint()-mAnchors[n-2]->GetPoint()).norm();
-
-	mCachedAnchorPositions.resize(n);
-	Update();
-	Eigen::MatrixXd Jt = GetJacobianTranspose();
-	auto Ap = GetForceJacobianAndPassive();
-	Eigen::VectorXd JtA = Jt*Ap.first;
-	num_related_dofs = 0;
-	related_dof_indices.clear();
-	for(int i =0;i<JtA.rows();i++)
-		if(std::abs(JtA[i])>1E-3){
-			num_related_dofs++;
-			related_dof_indices.push_back(i);
-		}
+	std::vector<int> lbs_indices;
+	for(auto lbs_bn : lbs_body_nodes)
+		lbs_indices.push_back(lbs_bn->getIndexInSkeleton());
+	mSkeleton = skel.get();
+	AddAnchor(Anchor(lbs_indices,lbs_local_positions,lbs_weights));
 }
 void
 Muscle::
 AddAnchor(dart::dynamics::BodyNode* bn,const Eigen::Vector3d& glob_pos)
 {
-	std::vector<dart::dynamics::BodyNode*> lbs_body_nodes;
+	std::vector<int> lbs_body_nodes;
 	std::vector<Eigen::Vector3d> lbs_local_positions;
 	std::vector<double> lbs_weights;
 
-	lbs_body_nodes.push_back(bn);
+	lbs_body_nodes.push_back(bn->getIndexInSkeleton());
 	lbs_local_positions.push_back(bn->getTransform().inverse()*glob_pos);
 	lbs_weights.push_back(1.0);
 
-	mAnchors.push_back(new Anchor(lbs_body_nodes,lbs_local_positions,lbs_weights));
+	mSkeleton = bn->getSkeleton().get();
+	AddAnchor(Anchor(lbs_body_nodes,lbs_local_positions,lbs_weights));
+}
+/**
+ * @brief Appends an anchor to the model (only while it is being built, before
+ * it is shared) and updates the rest length and related dofs.
+ */
+void
+Muscle::
+AddAnchor(const Anchor& anchor)
+{
+	auto& anchors = mModel->anchors;
+	anchors.push_back(anchor);
 
-	int n =mAnchors.size();
+	int n =anchors.size();
 	if(n>1)
-		l_mt0 += (mAnchors[n-1]->GetPoint()-mAnchors[n-2]->GetPoint()).norm();
+		mModel->l_mt0 += (anchors[n-1].GetPoint(mSkeleton)-anchors[n-2].GetPoint(mSkeleton)).norm();
 
 	mCachedAnchorPositions.resize(n);
 	Update();
 	Eigen::MatrixXd Jt = GetJacobianTranspose();
 	auto Ap = GetForceJacobianAndPassive();
 	Eigen::VectorXd JtA = Jt*Ap.first;
-	num_related_dofs = 0;
-	related_dof_indices.clear();
+	mModel->related_dof_indices.clear();
 	for(int i =0;i<JtA.rows();i++)
-		if(std::abs(JtA[i])>1E-3){
-			num_related_dofs++;
-			related_dof_indices.push_back(i);
-		}
-	
+		if(std::abs(JtA[i])>1E-3)
+			mModel->related_dof_indices.push_back(i);
+}
+/**
+ * @brief Muscle of skel, a clone of the skeleton this muscle is attached to,
+ * sharing this muscle's model. Anchors refer to body nodes by index, so
+ * nothing but the state is copied.
+ */
+Muscle*
+Muscle::
+Clone(const dart::dynamics::SkeletonPtr& skel)
+{
+	return new Muscle(mModel,skel);
+}
+/**
+ * @brief Bytes owned by this env's copy of the muscle, the model excluded.
+ */
+size_t
+Muscle::
+GetStateBytes() const
+{
+	return sizeof(Muscle)+mCachedAnchorPositions.capacity()*sizeof(Eigen::Vector3d);
 }
 void
 Muscle::
 ApplyForceToBody()
 {
 	double f = GetForce();
+	const auto& anchors = mModel->anchors;
 
-	for(int i=0;i<mAnchors.size()-1;i++)
+	for(int i=0;i<anchors.size()-1;i++)
 	{
 		Eigen::Vector3d dir = mCachedAnchorPositions[i+1]-mCachedAnchorPositions[i];
 		dir.normalize();
 		dir = f*dir;
-		mAnchors[i]->bodynodes[0]->addExtForce(dir,mCachedAnchorPositions[i],false,false); 
+		mSkeleton->getBodyNode(anchors[i].bodynodes[0])->addExtForce(dir,mCachedAnchorPositions[i],false,false); 
 	}
 
-	for(int i=1;i<mAnchors.size();i++)
+	for(int i=1;i<anchors.size();i++)
 	{
 		Eigen::Vector3d dir = mCachedAnchorPositions[i-1]-mCachedAnchorPositions[i];
 		dir.normalize();
 		dir = f*dir;
-		mAnchors[i]->bodynodes[0]->addExtForce(dir,mCachedAnchorPositions[i],false,false);
+		mSkeleton->getBodyNode(anchors[i].bodynodes[0])->addExtForce(dir,mCachedAnchorPositions[i],false,false);
 	}
 }
 void
 Muscle::
 Update()
 {
-	for(int i =0;i<mAnchors.size();i++)
-		mCachedAnchorPositions[i] = mAnchors[i]->GetPoint();
+	for(int i =0;i<mModel->anchors.size();i++)
+		mCachedAnchorPositions[i] = mModel->anchors[i].GetPoint(mSkeleton);
 	l_mt = Getl_mt();
 
-	l_m = l_mt - l_t0;
+	l_m = l_mt - mModel->l_t0;
 }
 double
 Muscle::
@@ -232,23 +275,23 @@ double
 Muscle::
 Getf_A()
 {
-	return f0*g_al(l_m/l_m0);
+	return mModel->f0*g_al(l_m/mModel->l_m0);
 }
 double
 Muscle::
 Getf_p()
 {
-	return f0*g_pl(l_m/l_m0);
+	return mModel->f0*g_pl(l_m/mModel->l_m0);
 }
 double
 Muscle::
 Getl_mt()
 {
 	l_mt = 0.0;
-	for(int i=1;i<mAnchors.size();i++)
+	for(int i=1;i<mCachedAnchorPositions.size();i++)
 		l_mt += (mCachedAnchorPositions[i]-mCachedAnchorPositions[i-1]).norm();
 
-	return l_mt/l_mt0;
+	return l_mt/mModel->l_mt0;
 }
 Eigen::VectorXd
 Muscle::
@@ -260,8 +303,9 @@ GetRelatedJtA()
 
 	Eigen::VectorXd JtA = Jt*A;	// end effector twist?
 	
-	Eigen::VectorXd JtA_reduced = Eigen::VectorXd::Zero(num_related_dofs);
-	for(int i =0;i<num_related_dofs;i++){
+	const auto& related_dof_indices = mModel->related_dof_indices;
+	Eigen::VectorXd JtA_reduced = Eigen::VectorXd::Zero(related_dof_indices.size());
+	for(int i =0;i<related_dof_indices.size();i++){
 		JtA_reduced[i] = JtA[related_dof_indices[i]];
 	}
 
@@ -272,13 +316,16 @@ Eigen::MatrixXd
 Muscle::
 GetJacobianTranspose()
 {
-	const auto& skel = mAnchors[0]->bodynodes[0]->getSkeleton();
-	int dof = skel->getNumDofs();
-	Eigen::MatrixXd Jt(dof,3*mAnchors.size());
+	const auto& anchors = mModel->anchors;
+	int dof = mSkeleton->getNumDofs();
+	Eigen::MatrixXd Jt(dof,3*anchors.size());
 
 	Jt.setZero();
-	for(int i =0;i<mAnchors.size();i++)
-		Jt.block(0,i*3,dof,3) = skel->getLinearJacobian(mAnchors[i]->bodynodes[0],mAnchors[i]->bodynodes[0]->getTransform().inverse()*mCachedAnchorPositions[i]).transpose();
+	for(int i =0;i<anchors.size();i++)
+	{
+		BodyNode* bn = mSkeleton->getBodyNode(anchors[i].bodynodes[0]);
+		Jt.block(0,i*3,dof,3) = mSkeleton->getLinearJacobian(bn,bn->getTransform().inverse()*mCachedAnchorPositions[i]).transpose();
+	}
 	
 	return Jt;	
 }
@@ -291,11 +338,12 @@ GetForceJacobianAndPassive()
 	double f_p = Getf_p();
 	// if(f_p>100.0)
 	// 	std::cout<<name<<" "<<f_p<<std::endl;
+	int num_anchors = mCachedAnchorPositions.size();
 	std::vector<Eigen::Vector3d> force_dir;
-	for(int i =0;i<mAnchors.size();i++){
+	for(int i =0;i<num_anchors;i++){
 		force_dir.push_back(Eigen::Vector3d::Zero());
 	}
-	for(int i =0;i<mAnchors.size()-1;i++)
+	for(int i =0;i<num_anchors-1;i++)
 	{
 		Eigen::Vector3d dir = mCachedAnchorPositions[i+1]-mCachedAnchorPositions[i];
 		dir.normalize();
@@ -303,19 +351,19 @@ GetForceJacobianAndPassive()
 	}
 	
 	
-	for(int i =1;i<mAnchors.size();i++)
+	for(int i =1;i<num_anchors;i++)
 	{
 		Eigen::Vector3d dir = mCachedAnchorPositions[i-1]-mCachedAnchorPositions[i];
 		dir.normalize();
 		force_dir[i] += dir;
 	}
 
-	Eigen::VectorXd A(3*mAnchors.size());
-	Eigen::VectorXd p(3*mAnchors.size());
+	Eigen::VectorXd A(3*num_anchors);
+	Eigen::VectorXd p(3*num_anchors);
 	A.setZero();
 	p.setZero();
 
-	for(int i =0;i<mAnchors.size();i++)
+	for(int i =0;i<num_anchors;i++)
 	{
 		A.segment<3>(i*3) = force_dir[i]*f_a;
 		p.segment<3>(i*3) = force_dir[i]*f_p;
@@ -327,7 +375,7 @@ std::vector<dart::dynamics::Joint*>
 Muscle::
 GetRelatedJoints()
 {
-	auto skel = mAnchors[0]->bodynodes[0]->getSkeleton();
+	auto skel = mSkeleton;
 	std::map<dart::dynamics::Joint*,int> jns;
 	std::vector<dart::dynamics::Joint*> jns_related;
 	for(int i =0;i<skel->getNumJoints();i++)
@@ -356,36 +404,36 @@ GetRelatedBodyNodes()
 
 	return bns_related;
 }
-void
+std::vector<Eigen::MatrixXd>
 Muscle::
 ComputeJacobians()
 {
-	const auto& skel = mAnchors[0]->bodynodes[0]->getSkeleton();
-	int dof = skel->getNumDofs();
-	mCachedJs.resize(mAnchors.size());
-	for(int i =0;i<mAnchors.size();i++)
+	const auto& anchors = mModel->anchors;
+	int dof = mSkeleton->getNumDofs();
+	std::vector<Eigen::MatrixXd> Js(anchors.size());
+	for(int i =0;i<anchors.size();i++)
 	{
-		mCachedJs[i].resize(3,skel->getNumDofs());
-		mCachedJs[i].setZero();
+		Js[i].resize(3,dof);
+		Js[i].setZero();
 
-		for(int j=0;j<mAnchors[i]->num_related_bodies;j++){
-			mCachedJs[i] += mAnchors[i]->weights[j]*skel->getLinearJacobian(mAnchors[i]->bodynodes[j],mAnchors[i]->local_positions[j]);
+		for(int j=0;j<anchors[i].num_related_bodies;j++){
+			Js[i] += anchors[i].weights[j]*mSkeleton->getLinearJacobian(mSkeleton->getBodyNode(anchors[i].bodynodes[j]),anchors[i].local_positions[j]);
 		}
 	}
+	return Js;
 }
 Eigen::VectorXd
 Muscle::
 Getdl_dtheta()
 {
-	ComputeJacobians();
-	const auto& skel = mAnchors[0]->bodynodes[0]->getSkeleton();
-	Eigen::VectorXd dl_dtheta(skel->getNumDofs());
+	std::vector<Eigen::MatrixXd> Js = ComputeJacobians();
+	Eigen::VectorXd dl_dtheta(mSkeleton->getNumDofs());
 	dl_dtheta.setZero();
-	for(int i =0;i<mAnchors.size()-1;i++)
+	for(int i =0;i<Js.size()-1;i++)
 	{
 		Eigen::Vector3d pi = mCachedAnchorPositions[i+1] - mCachedAnchorPositions[i];
-		Eigen::MatrixXd dpi_dtheta = mCachedJs[i+1] - mCachedJs[i];
-		Eigen::VectorXd dli_d_theta = (dpi_dtheta.transpose()*pi)/(l_mt0*pi.norm());
+		Eigen::MatrixXd dpi_dtheta = Js[i+1] - Js[i];
+		Eigen::VectorXd dli_d_theta = (dpi_dtheta.transpose()*pi)/(mModel->l_mt0*pi.norm());
 		dl_dtheta += dli_d_theta;
 	}
 
@@ -399,8 +447,9 @@ double
 Muscle::
 g(double _l_m)
 {
-	double e_t = (l_mt -_l_m-l_t0)/l_t0;
-	_l_m = _l_m/l_m0;
+	const MuscleModel& m = *mModel;
+	double e_t = (l_mt -_l_m-m.l_t0)/m.l_t0;
+	_l_m = _l_m/m.l_m0;
 	double f = g_t(e_t) - (g_pl(_l_m)+activation*g_al(_l_m));
 	return f;
 }
@@ -408,11 +457,12 @@ double
 Muscle::
 g_t(double e_t)
 {
+	const MuscleModel& m = *mModel;
 	double f_t;
-	if(e_t<=e_t0)
-		f_t = f_toe/(exp(k_toe)-1)*(exp(k_toe*e_t/e_toe)-1);
+	if(e_t<=m.e_t0)
+		f_t = m.f_toe/(exp(m.k_toe)-1)*(exp(m.k_toe*e_t/m.e_toe)-1);
 	else
-		f_t = k_lin*(e_t-e_toe)+f_toe;
+		f_t = m.k_lin*(e_t-m.e_toe)+m.f_toe;
 
 	return f_t;
 }
@@ -420,7 +470,7 @@ double
 Muscle::
 g_pl(double _l_m)
 {
-	double f_pl = (exp(k_pe*(_l_m-1.0)/e_mo)-1.0)/(exp(k_pe)-1.0);
+	double f_pl = (exp(mModel->k_pe*(_l_m-1.0)/mModel->e_mo)-1.0)/(exp(mModel->k_pe)-1.0);
 	if(_l_m<1.0)
 		return 0.0;
 	else
@@ -430,5 +480,5 @@ double
 Muscle::
 g_al(double _l_m)
 {
-	return exp(-(_l_m-1.0)*(_l_m-1.0)/gamma);
+	return exp(-(_l_m-1.0)*(_l_m-1.0)/mModel->gamma);
 }
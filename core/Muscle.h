@@ -1,27 +1,72 @@
 #ifndef __MASS_MUSCLE_H__
 #define __MASS_MUSCLE_H__
 #include "dart/dart.hpp"
+#include <memory>
 
 namespace MASS
 {
+/**
+ * @brief LBS anchor: a weighted blend of points fixed in up to two bodies,
+ * which are referred to by their index in the skeleton so the anchor can be
+ * shared by every copy of the skeleton.
+ */
 struct Anchor
 {
 	int num_related_bodies;
 
-	std::vector<dart::dynamics::BodyNode*> bodynodes;
+	std::vector<int> bodynodes;
 	std::vector<Eigen::Vector3d> local_positions;
 	std::vector<double> weights;
 
-	Anchor(std::vector<dart::dynamics::BodyNode*> bns,std::vector<Eigen::Vector3d> lps,std::vector<double> ws);
-	Eigen::Vector3d GetPoint();
+	Anchor(std::vector<int> bns,std::vector<Eigen::Vector3d> lps,std::vector<double> ws);
+	Eigen::Vector3d GetPoint(const dart::dynamics::Skeleton* skel) const;
 };
+
+/**
+ * @brief The part of a muscle that does not change during simulation: curve
+ * parameters, anchors and the rest state derived from them. Built once by
+ * LoadMuscles (or read from the model cache) and shared by the muscles of
+ * every env, see Muscle::Clone.
+ */
+struct MuscleModel
+{
+	MuscleModel(const std::string& _name,double _f0,double lm0,double lt0,double lmax);
+	size_t GetBytes() const;
+
+	std::string name;
+	std::vector<Anchor> anchors;
+	std::vector<int> related_dof_indices;
+
+	double f0;
+	double l_mt0,l_m0,l_t0;
+	double l_mt_max;
+
+	double f_toe,e_toe,k_toe,k_lin,e_t0; //For g_t
+	double k_pe,e_mo; //For g_pl
+	double gamma; //For g_al
+};
+
+/**
+ * @brief Per-env muscle state (activation, lengths, anchor positions) on top
+ * of a shared MuscleModel.
+ */
 class Muscle
 {
 public:
 	Muscle(std::string _name,double f0,double lm0,double lt0,double pen_angle,double lmax);
+	Muscle(const std::shared_ptr<MuscleModel>& model,const dart::dynamics::SkeletonPtr& skel);
 	void AddAnchor(const dart::dynamics::SkeletonPtr& skel,dart::dynamics::BodyNode* bn,const Eigen::Vector3d& glob_pos,int num_related_bodies);
 	void AddAnchor(dart::dynamics::BodyNode* bn,const Eigen::Vector3d& glob_pos);
-	const std::vector<Anchor*>& GetAnchors(){return mAnchors;}
+	Muscle* Clone(const dart::dynamics::SkeletonPtr& skel);
+
+	const MuscleModel& GetModel(){return *mModel;}
+	const std::shared_ptr<MuscleModel>& GetSharedModel(){return mModel;}
+	const std::string& GetName(){return mModel->name;}
+	double GetF0(){return mModel->f0;}
+	int GetNumAnchors(){return mModel->anchors.size();}
+	Eigen::Vector3d GetAnchorPoint(int i){return mModel->anchors[i].GetPoint(mSkeleton);}
+	size_t GetStateBytes() const;
+
 	void Update();
 	void ApplyForceToBody();
 	double GetForce();
@@ -32,41 +77,30 @@ public:
 	Eigen::MatrixXd GetJacobianTranspose();
 	std::pair<Eigen::VectorXd,Eigen::VectorXd> GetForceJacobianAndPassive();
 
-	int GetNumRelatedDofs(){return num_related_dofs;};
+	int GetNumRelatedDofs(){return mModel->related_dof_indices.size();};
 	Eigen::VectorXd GetRelatedJtA();
 
 	std::vector<dart::dynamics::Joint*> GetRelatedJoints();
 	std::vector<dart::dynamics::BodyNode*> GetRelatedBodyNodes();
-	void ComputeJacobians();
+	std::vector<Eigen::MatrixXd> ComputeJacobians();
 	Eigen::VectorXd Getdl_dtheta();
-public:
-	std::string name;
-	std::vector<Anchor*> mAnchors;
-	int num_related_dofs;
-	std::vector<int> related_dof_indices;
+private:
+	void AddAnchor(const Anchor& anchor);
 
+	std::shared_ptr<MuscleModel> mModel;
+	dart::dynamics::Skeleton* mSkeleton;
 	std::vector<Eigen::Vector3d> mCachedAnchorPositions;
-	std::vector<Eigen::MatrixXd> mCachedJs;
 public:
 	//Dynamics
 	double g(double _l_m);
 	double g_t(double e_t);
 	double g_pl(double _l_m);
 	double g_al(double _l_m);
-	
 
-	double l_mt,l_mt_max;
+	double l_mt;
 	double l_m;
 	double activation;
-
-
-	double f0;
-	double l_mt0,l_m0,l_t0;
-
-	double f_toe,e_toe,k_toe,k_lin,e_t0; //For g_t
-	double k_pe,e_mo; //For g_pl
-	double gamma; //For g_al
 };
 
 }
-#endif
\ No newline at end of file
+#endif
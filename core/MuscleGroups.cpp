@@ -0,0 +1,95 @@
+#include "MuscleGroups.h"
+#include "Muscle.h"
+#include <tinyxml.h>
+#include <unordered_map>
+#include <iostream>
+using namespace MASS;
+
+/**
+ * @brief Reads the group file and resolves its muscle names. Names missing
+ * from the muscle file are reported and left out of their group, so a group
+ * file can be shared by models with fewer muscles.
+ *
+ * @param path - path to the group file (example: muscle_groups.xml)
+ * @param muscles - the character's muscles, in activation order
+ * @return nullptr if the file can't be read or a Group or Muscle has no name
+ */
+std::shared_ptr<const MuscleGroups>
+MuscleGroups::
+Load(const std::string& path,const std::vector<Muscle*>& muscles)
+{
+	TiXmlDocument doc;
+	if(!doc.LoadFile(path)){
+		std::cout << "Can't open file : " << path << std::endl;
+		return nullptr;
+	}
+	TiXmlElement* groups_elem = doc.FirstChildElement("MuscleGroups");
+	if(groups_elem==nullptr){
+		std::cout << "No MuscleGroups element in " << path << std::endl;
+		return nullptr;
+	}
+
+	std::unordered_map<std::string,int> muscle_index;
+	for(int i=0;i<muscles.size();i++)
+		muscle_index[muscles[i]->GetName()] = i;
+
+	std::shared_ptr<MuscleGroups> groups = std::make_shared<MuscleGroups>();
+	std::vector<Eigen::Triplet<double>> sum,average;
+	std::vector<std::string> unknown;
+	for(TiXmlElement* group = groups_elem->FirstChildElement("Group");group!=nullptr;group = group->NextSiblingElement("Group"))
+	{
+		const char* group_name = group->Attribute("name");
+		if(group_name==nullptr){
+			std::cout << "Group without a name at line " << group->Row() << " of " << path << std::endl;
+			return nullptr;
+		}
+		int g = groups->mNames.size();
+		groups->mNames.push_back(group_name);
+		groups->mMuscles.push_back(std::vector<int>());
+		std::vector<int>& members = groups->mMuscles.back();
+		for(TiXmlElement* muscle = group->FirstChildElement("Muscle");muscle!=nullptr;muscle = muscle->NextSiblingElement("Muscle"))
+		{
+			const char* muscle_name = muscle->Attribute("name");
+			if(muscle_name==nullptr){
+				std::cout << "Muscle without a name in group " << group_name << " at line " << muscle->Row() << " of " << path << std::endl;
+				return nullptr;
+			}
+			auto it = muscle_index.find(muscle_name);
+			if(it==muscle_index.end())
+				unknown.push_back(muscle_name);
+			else
+				members.push_back(it->second);
+		}
+		for(int m : members)
+		{
+			sum.push_back(Eigen::Triplet<double>(g,m,1.0));
+			average.push_back(Eigen::Triplet<double>(g,m,1.0/members.size()));
+		}
+	}
+	if(!unknown.empty())
+	{
+		std::cout<<unknown.size()<<" muscles of "<<path<<" are not in the muscle file:";
+		for(const auto& name : unknown)
+			std::cout<<" "<<name;
+		std::cout<<std::endl;
+	}
+
+	int num_groups = groups->mNames.size();
+	groups->mSum.resize(num_groups,muscles.size());
+	groups->mSum.setFromTriplets(sum.begin(),sum.end());
+	groups->mAverage.resize(num_groups,muscles.size());
+	groups->mAverage.setFromTriplets(average.begin(),average.end());
+	return groups;
+}
+/**
+ * @return index of the named group, -1 if there is none
+ */
+int
+MuscleGroups::
+GetIndex(const std::string& name) const
+{
+	for(int g=0;g<mNames.size();g++)
+		if(mNames[g]==name)
+			return g;
+	return -1;
+}
@@ -0,0 +1,44 @@
+#ifndef __MASS_MUSCLE_GROUPS_H__
+#define __MASS_MUSCLE_GROUPS_H__
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace MASS
+{
+class Muscle;
+/**
+ * @brief Named groups of muscles (data/muscle_groups.xml), resolved once
+ * against a character's muscles into a sparse groups x muscles matrix.
+ *
+ * Immutable after Load(), so one instance is shared by every clone of the
+ * character. Per muscle values (activations, forces) are reduced to per group
+ * values with one sparse product, for a single env (vector) or for all envs
+ * at once (one env per row).
+ */
+class MuscleGroups
+{
+public:
+	static std::shared_ptr<const MuscleGroups> Load(const std::string& path,const std::vector<Muscle*>& muscles);
+
+	int GetNumGroups() const {return mNames.size();}
+	int GetNumMuscles() const {return mSum.cols();}
+	const std::vector<std::string>& GetNames() const {return mNames;}
+	int GetIndex(const std::string& name) const;
+	const std::vector<int>& GetMuscles(int group) const {return mMuscles[group];}
+
+	// Mean over the group (activations) and sum over the group (forces)
+	Eigen::VectorXd Average(const Eigen::VectorXd& values) const {return mAverage*values;}
+	Eigen::VectorXd Sum(const Eigen::VectorXd& values) const {return mSum*values;}
+	Eigen::MatrixXd AverageRows(const Eigen::MatrixXd& values) const {return values*mAverage.transpose();}
+	Eigen::MatrixXd SumRows(const Eigen::MatrixXd& values) const {return values*mSum.transpose();}
+private:
+	std::vector<std::string> mNames;
+	std::vector<std::vector<int>> mMuscles;
+	Eigen::SparseMatrix<double,Eigen::RowMajor> mSum,mAverage;
+};
+};
+
+#endif
@@ -0,0 +1,325 @@
+#include "MuscleTupleWriter.h"
+#include "Environment.h"
+#include <zlib.h>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+using namespace MASS;
+
+/**
+ * @brief Converts an IEEE single precision float into half precision bits,
+ * rounding to nearest even. Values outside the half range saturate to inf.
+ */
+uint16_t
+MASS::
+FloatToHalf(float f)
+{
+	uint32_t x;
+	std::memcpy(&x,&f,sizeof(x));
+	uint32_t sign = (x>>16)&0x8000;
+	int32_t exponent = ((x>>23)&0xff) - 127 + 15;
+	uint32_t mantissa = x&0x7fffff;
+
+	if(((x>>23)&0xff)==0xff)		// inf or nan
+		return sign|0x7c00|(mantissa ? 0x200 : 0);
+	if(exponent>=0x1f)				// overflow
+		return sign|0x7c00;
+	if(exponent<=0)					// subnormal or zero
+	{
+		if(exponent<-10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half = mantissa>>shift;
+		uint32_t rest = mantissa&((1u<<shift)-1);
+		uint32_t halfway = 1u<<(shift-1);
+		if(rest>halfway || (rest==halfway && (half&1)))
+			half++;
+		return sign|half;
+	}
+	uint32_t half = sign|(exponent<<10)|(mantissa>>13);
+	uint32_t rest = mantissa&0x1fff;
+	if(rest>0x1000 || (rest==0x1000 && (half&1)))
+		half++;
+	return half;
+}
+
+/**
+ * @brief Opens the dataset file, writes the file header and starts the writer thread.
+ *
+ * @param path - output file, appended to if it already holds tuples of the same shape.
+ * A chunk cut short at its end (by a full disk or a crash) is truncated away first.
+ * @param half_precision - store values as float16 instead of float32
+ * @param compress - deflate each chunk with zlib
+ * @param chunk_size - number of tuples per chunk
+ */
+MuscleTupleWriter::
+MuscleTupleWriter(const std::string& path,int rows_JtA,int rows_tau_des,int rows_L,int rows_b,bool half_precision,bool compress,int chunk_size)
+	:mPath(path),mFile(nullptr),mRowsJtA(rows_JtA),mRowsTauDes(rows_tau_des),mRowsL(rows_L),mRowsb(rows_b),
+	mHalfPrecision(half_precision),mCompress(compress),mChunkSize(std::max(1,chunk_size)),mNumStaged(0),
+	mStop(false),mBusy(false),mFailed(false),mNumWritten(0)
+{
+	mTupleSize = mRowsJtA+mRowsTauDes+mRowsL+mRowsb;
+
+	MuscleTupleFileHeader header;
+	std::memset(&header,0,sizeof(header));
+	std::memcpy(header.magic,"MTUP",4);
+	header.version = 1;
+	header.dtype = mHalfPrecision ? 1 : 0;
+	header.rows_JtA = mRowsJtA;
+	header.rows_tau_des = mRowsTauDes;
+	header.rows_L = mRowsL;
+	header.rows_b = mRowsb;
+
+	mFile = fopen(mPath.c_str(),"r+b");
+	if(mFile!=nullptr)
+	{
+		MuscleTupleFileHeader existing;
+		if(fread(&existing,sizeof(existing),1,mFile)!=1 || std::memcmp(&existing,&header,sizeof(header))!=0)
+		{
+			std::cout<<"Muscle tuple file "<<mPath<<" has a different layout, overwriting"<<std::endl;
+			fclose(mFile);
+			mFile = nullptr;
+		}
+		else if(!SeekEndOfChunks())
+		{
+			fclose(mFile);
+			mFile = nullptr;
+			return;
+		}
+	}
+	if(mFile==nullptr)
+	{
+		mFile = fopen(mPath.c_str(),"wb");
+		if(mFile==nullptr)
+		{
+			std::cout<<"Can't open file : "<<mPath<<std::endl;
+			return;
+		}
+		if(fwrite(&header,sizeof(header),1,mFile)!=1 || fflush(mFile)!=0)
+		{
+			std::cout<<"Can't write file : "<<mPath<<std::endl;
+			fclose(mFile);
+			mFile = nullptr;
+			return;
+		}
+	}
+
+	mStaging.reserve((size_t)mChunkSize*mTupleSize);
+	mThread = std::thread(&MuscleTupleWriter::Run,this);
+}
+/**
+ * @brief Walks the chunks of an existing file and leaves it positioned after
+ * the last complete one, truncating anything after it.
+ *
+ * @return false if the file can't be truncated
+ */
+bool
+MuscleTupleWriter::
+SeekEndOfChunks()
+{
+	fseeko(mFile,0,SEEK_END);
+	off_t size = ftello(mFile);
+	off_t end = sizeof(MuscleTupleFileHeader);
+	MuscleTupleChunkHeader chunk;
+	while(fseeko(mFile,end,SEEK_SET)==0 && fread(&chunk,sizeof(chunk),1,mFile)==1 &&
+		std::memcmp(chunk.magic,"MCHK",4)==0 && chunk.payload_bytes<=(uint64_t)(size-end-sizeof(chunk)))
+		end += sizeof(chunk)+chunk.payload_bytes;
+	if(end<size)
+	{
+		std::cout<<"Muscle tuple file "<<mPath<<" ends in an incomplete chunk, truncating "<<size-end<<" bytes"<<std::endl;
+		if(fflush(mFile)!=0 || ftruncate(fileno(mFile),end)!=0)
+		{
+			std::cout<<"Can't truncate file : "<<mPath<<std::endl;
+			return false;
+		}
+	}
+	return fseeko(mFile,end,SEEK_SET)==0;
+}
+MuscleTupleWriter::
+~MuscleTupleWriter()
+{
+	Close();
+}
+
+/**
+ * @brief Copies the tuples into the staging chunk. Full chunks are handed over
+ * to the writer thread, so this never blocks on disk I/O.
+ */
+void
+MuscleTupleWriter::
+Push(const std::vector<MuscleTuple>& tuples)
+{
+	if(mFile==nullptr)
+		return;
+	for(const auto& tp : tuples)
+	{
+		size_t o = mStaging.size();
+		mStaging.resize(o+mTupleSize);
+		float* dst = mStaging.data()+o;
+		Eigen::Map<Eigen::VectorXf>(dst,mRowsJtA) = tp.JtA.cast<float>();
+		dst += mRowsJtA;
+		Eigen::Map<Eigen::VectorXf>(dst,mRowsTauDes) = tp.tau_des.cast<float>();
+		dst += mRowsTauDes;
+		Eigen::Map<Eigen::VectorXf>(dst,mRowsL) = tp.L.cast<float>();
+		dst += mRowsL;
+		Eigen::Map<Eigen::VectorXf>(dst,mRowsb) = tp.b.cast<float>();
+
+		if(++mNumStaged==mChunkSize)
+			SealStaging();
+	}
+}
+void
+MuscleTupleWriter::
+SealStaging()
+{
+	if(mNumStaged==0)
+		return;
+	std::vector<float> chunk;
+	chunk.reserve((size_t)mChunkSize*mTupleSize);
+	chunk.swap(mStaging);
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQueue.push_back(std::make_pair(std::move(chunk),mNumStaged));
+	}
+	mNumStaged = 0;
+	mCondition.notify_one();
+}
+
+/**
+ * @brief Writes out the partially filled chunk and blocks until every queued
+ * chunk is on disk.
+ */
+void
+MuscleTupleWriter::
+Flush()
+{
+	if(mFile==nullptr)
+		return;
+	SealStaging();
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDrained.wait(lock,[this]{return mQueue.empty() && !mBusy;});
+	fflush(mFile);
+}
+void
+MuscleTupleWriter::
+Close()
+{
+	if(mFile==nullptr)
+		return;
+	Flush();
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mCondition.notify_one();
+	mThread.join();
+	fclose(mFile);
+	mFile = nullptr;
+}
+long long
+MuscleTupleWriter::
+GetNumWritten()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mNumWritten;
+}
+void
+MuscleTupleWriter::
+Run()
+{
+	while(true)
+	{
+		std::pair<std::vector<float>,int> chunk;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock,[this]{return mStop || !mQueue.empty();});
+			if(mQueue.empty())
+				return;
+			chunk = std::move(mQueue.front());
+			mQueue.pop_front();
+			mBusy = true;
+		}
+		bool written = WriteChunk(chunk.first,chunk.second);
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if(written)
+				mNumWritten += chunk.second;
+			mBusy = false;
+		}
+		mDrained.notify_all();
+	}
+}
+
+/**
+ * @brief Reorders a tuple-major chunk into per-field blocks, converts the
+ * precision, optionally deflates it and appends it to the file. A chunk
+ * that can't be written completely is cut off again and every later chunk
+ * is dropped, so the file always ends in a complete chunk.
+ *
+ * @return false if the chunk was not written
+ */
+bool
+MuscleTupleWriter::
+WriteChunk(const std::vector<float>& staging,int num_tuples)
+{
+	if(mFailed)
+		return false;
+	const int rows[4] = {mRowsJtA,mRowsTauDes,mRowsL,mRowsb};
+	size_t num_values = (size_t)num_tuples*mTupleSize;
+
+	std::vector<float> blocks(num_values);
+	size_t block_offset = 0;
+	int field_offset = 0;
+	for(int f=0;f<4;f++)
+	{
+		for(int i=0;i<num_tuples;i++)
+			std::memcpy(&blocks[block_offset+(size_t)i*rows[f]],&staging[(size_t)i*mTupleSize+field_offset],rows[f]*sizeof(float));
+		block_offset += (size_t)num_tuples*rows[f];
+		field_offset += rows[f];
+	}
+
+	std::vector<uint16_t> halfs;
+	const unsigned char* raw = reinterpret_cast<const unsigned char*>(blocks.data());
+	uint64_t raw_bytes = num_values*sizeof(float);
+	if(mHalfPrecision)
+	{
+		halfs.resize(num_values);
+		for(size_t i=0;i<num_values;i++)
+			halfs[i] = FloatToHalf(blocks[i]);
+		raw = reinterpret_cast<const unsigned char*>(halfs.data());
+		raw_bytes = num_values*sizeof(uint16_t);
+	}
+
+	MuscleTupleChunkHeader header;
+	std::memset(&header,0,sizeof(header));
+	std::memcpy(header.magic,"MCHK",4);
+	header.num_tuples = num_tuples;
+	header.raw_bytes = raw_bytes;
+
+	std::vector<unsigned char> compressed;
+	const unsigned char* payload = raw;
+	header.codec = 0;
+	header.payload_bytes = raw_bytes;
+	if(mCompress)
+	{
+		uLongf dst_len = compressBound(raw_bytes);
+		compressed.resize(dst_len);
+		if(compress2(compressed.data(),&dst_len,raw,raw_bytes,1)==Z_OK && dst_len<raw_bytes)
+		{
+			payload = compressed.data();
+			header.codec = 1;
+			header.payload_bytes = dst_len;
+		}
+	}
+
+	off_t start = ftello(mFile);
+	if(fwrite(&header,sizeof(header),1,mFile)==1 && fwrite(payload,1,header.payload_bytes,mFile)==header.payload_bytes && fflush(mFile)==0)
+		return true;
+	mFailed = true;
+	std::cout<<"Can't write file : "<<mPath<<", dropping the tuples pushed from now on"<<std::endl;
+	clearerr(mFile);
+	if(start<0 || ftruncate(fileno(mFile),start)!=0 || fseeko(mFile,start,SEEK_SET)!=0)
+		std::cout<<"Can't truncate file : "<<mPath<<", its last chunk is incomplete"<<std::endl;
+	return false;
+}
@@ -0,0 +1,105 @@
+#ifndef __MASS_MUSCLE_TUPLE_WRITER_H__
+#define __MASS_MUSCLE_TUPLE_WRITER_H__
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+
+namespace MASS
+{
+struct MuscleTuple;
+
+/**
+ * On-disk muscle tuple dataset layout (all integers little endian):
+ *
+ * File header (32 bytes):
+ *   char[4] magic "MTUP", uint32 version, uint32 dtype (0 = float32, 1 = float16),
+ *   uint32 rows of JtA, tau_des, L, b, uint32 reserved
+ *
+ * Followed by any number of chunks, each with a 32 byte header:
+ *   char[4] magic "MCHK", uint32 num_tuples, uint32 codec (0 = raw, 1 = zlib),
+ *   uint32 reserved, uint64 payload bytes (on disk), uint64 raw bytes (decoded)
+ *
+ * A decoded chunk payload is stored column-wise, i.e. all JtA rows of the chunk,
+ * then all tau_des rows, then L, then b, so the reader can reshape each block
+ * directly into a (num_tuples x rows) array.
+ */
+struct MuscleTupleFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t dtype;
+	uint32_t rows_JtA;
+	uint32_t rows_tau_des;
+	uint32_t rows_L;
+	uint32_t rows_b;
+	uint32_t reserved;
+};
+struct MuscleTupleChunkHeader
+{
+	char magic[4];
+	uint32_t num_tuples;
+	uint32_t codec;
+	uint32_t reserved;
+	uint64_t payload_bytes;
+	uint64_t raw_bytes;
+};
+
+/**
+ * @brief Streams muscle tuples to a chunked binary file on a background thread,
+ * so MuscleNN can be trained offline without keeping the simulator running.
+ * Push() only copies the tuples into a staging buffer; precision conversion,
+ * compression and the actual file I/O happen on the writer thread.
+ */
+class MuscleTupleWriter
+{
+public:
+	MuscleTupleWriter(const std::string& path,int rows_JtA,int rows_tau_des,int rows_L,int rows_b,
+		bool half_precision = false,bool compress = true,int chunk_size = 2048);
+	~MuscleTupleWriter();
+
+	void Push(const std::vector<MuscleTuple>& tuples);
+	void Flush();
+	void Close();
+
+	bool IsOpen(){return mFile!=nullptr;}
+	long long GetNumWritten();
+	const std::string& GetPath(){return mPath;}
+private:
+	void Run();
+	bool SeekEndOfChunks();
+	bool WriteChunk(const std::vector<float>& staging,int num_tuples);
+	void SealStaging();
+
+	std::string mPath;
+	FILE* mFile;
+	int mRowsJtA,mRowsTauDes,mRowsL,mRowsb;
+	int mTupleSize;
+	bool mHalfPrecision;
+	bool mCompress;
+	int mChunkSize;
+
+	// Tuples of the chunk currently being filled, stored tuple-major.
+	std::vector<float> mStaging;
+	int mNumStaged;
+
+	std::deque<std::pair<std::vector<float>,int>> mQueue;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::condition_variable mDrained;
+	bool mStop;
+	bool mBusy;
+	bool mFailed;			// a chunk couldn't be written, only the writer thread touches it
+	long long mNumWritten;
+	std::thread mThread;
+};
+
+uint16_t FloatToHalf(float f);
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "TrajectoryLog.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+using namespace MASS;
+
+namespace
+{
+const uint32_t TRAJECTORY_VERSION = 1;
+const size_t FLUSH_BYTES = 1<<18;
+
+size_t
+RecordBytes(int num_dofs,int num_muscles,int num_exo_torques)
+{
+	return sizeof(double)+sizeof(uint32_t)+sizeof(float)+num_dofs*sizeof(double)+(num_muscles+num_exo_torques)*sizeof(float);
+}
+void
+Append(std::vector<char>& buffer,const void* data,size_t bytes)
+{
+	const char* p = static_cast<const char*>(data);
+	buffer.insert(buffer.end(),p,p+bytes);
+}
+void
+AppendFloats(std::vector<char>& buffer,const Eigen::VectorXd& v,int n)
+{
+	for(int i=0;i<n;i++)
+	{
+		float value = i<v.rows() ? (float)v[i] : 0.0f;
+		Append(buffer,&value,sizeof(float));
+	}
+}
+}
+
+/**
+ * @brief Creates the log (truncating any previous one) and writes its header.
+ */
+TrajectoryRecorder::
+TrajectoryRecorder(const std::string& path,int num_dofs,int num_muscles,int num_exo_torques,int control_hz)
+	:mPath(path),mFile(nullptr),mEpisode(0)
+{
+	std::memset(&mHeader,0,sizeof(mHeader));
+	std::memcpy(mHeader.magic,"MTRJ",4);
+	mHeader.version = TRAJECTORY_VERSION;
+	mHeader.num_dofs = num_dofs;
+	mHeader.num_muscles = num_muscles;
+	mHeader.num_exo_torques = num_exo_torques;
+	mHeader.control_hz = control_hz;
+	mHeader.record_bytes = RecordBytes(num_dofs,num_muscles,num_exo_torques);
+
+	mFile = fopen(mPath.c_str(),"wb");
+	if(mFile==nullptr)
+	{
+		std::cout<<"Can't open file : "<<mPath<<std::endl;
+		return;
+	}
+	fwrite(&mHeader,sizeof(mHeader),1,mFile);
+	mBuffer.reserve(FLUSH_BYTES+mHeader.record_bytes);
+}
+TrajectoryRecorder::
+~TrajectoryRecorder()
+{
+	if(mFile==nullptr)
+		return;
+	Flush();
+	fclose(mFile);
+}
+void
+TrajectoryRecorder::
+Record(double time,double reward,const Eigen::VectorXd& positions,const Eigen::VectorXd& activations,const Eigen::VectorXd& exo_torques)
+{
+	if(mFile==nullptr)
+		return;
+	Append(mBuffer,&time,sizeof(double));
+	Append(mBuffer,&mEpisode,sizeof(uint32_t));
+	float r = reward;
+	Append(mBuffer,&r,sizeof(float));
+	for(int i=0;i<(int)mHeader.num_dofs;i++)
+	{
+		double q = i<positions.rows() ? positions[i] : 0.0;
+		Append(mBuffer,&q,sizeof(double));
+	}
+	AppendFloats(mBuffer,activations,mHeader.num_muscles);
+	AppendFloats(mBuffer,exo_torques,mHeader.num_exo_torques);
+	if(mBuffer.size()>=FLUSH_BYTES)
+		Flush();
+}
+void
+TrajectoryRecorder::
+Flush()
+{
+	if(mFile==nullptr || mBuffer.empty())
+		return;
+	fwrite(mBuffer.data(),1,mBuffer.size(),mFile);
+	fflush(mFile);
+	mBuffer.clear();
+}
+
+TrajectoryLog::
+TrajectoryLog()
+	:mData(nullptr),mBytes(0),mNumFrames(0)
+{
+	std::memset(&mHeader,0,sizeof(mHeader));
+}
+TrajectoryLog::
+~TrajectoryLog()
+{
+	Unload();
+}
+void
+TrajectoryLog::
+Unload()
+{
+	if(mData!=nullptr)
+		munmap(const_cast<char*>(mData),mBytes);
+	mData = nullptr;
+	mBytes = 0;
+	mNumFrames = 0;
+}
+
+/**
+ * @brief Maps the log. A record cut short (the recording process was killed
+ * mid write) is ignored.
+ */
+bool
+TrajectoryLog::
+Load(const std::string& path)
+{
+	Unload();
+	int fd = open(path.c_str(),O_RDONLY);
+	if(fd<0)
+	{
+		std::cout<<"Can't open file : "<<path<<std::endl;
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd,&st)!=0 || st.st_size<(off_t)sizeof(TrajectoryFileHeader))
+	{
+		std::cout<<"Not a trajectory log : "<<path<<std::endl;
+		close(fd);
+		return false;
+	}
+	void* data = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(data==MAP_FAILED)
+	{
+		std::cout<<"Can't map file : "<<path<<std::endl;
+		return false;
+	}
+	mData = static_cast<const char*>(data);
+	mBytes = st.st_size;
+
+	std::memcpy(&mHeader,mData,sizeof(mHeader));
+	if(std::memcmp(mHeader.magic,"MTRJ",4)!=0 || mHeader.version!=TRAJECTORY_VERSION ||
+		mHeader.record_bytes!=RecordBytes(mHeader.num_dofs,mHeader.num_muscles,mHeader.num_exo_torques))
+	{
+		std::cout<<"Not a trajectory log (or a different version) : "<<path<<std::endl;
+		Unload();
+		return false;
+	}
+	mNumFrames = (mBytes-sizeof(mHeader))/mHeader.record_bytes;
+	return true;
+}
+int
+TrajectoryLog::
+GetEpisode(int frame)
+{
+	uint32_t episode;
+	std::memcpy(&episode,mData+sizeof(mHeader)+(size_t)frame*mHeader.record_bytes+sizeof(double),sizeof(uint32_t));
+	return episode;
+}
+void
+TrajectoryLog::
+GetFrame(int frame,Frame& out)
+{
+	const char* p = mData+sizeof(mHeader)+(size_t)frame*mHeader.record_bytes;
+	uint32_t episode;
+	float reward;
+	std::memcpy(&out.time,p,sizeof(double));
+	p += sizeof(double);
+	std::memcpy(&episode,p,sizeof(uint32_t));
+	p += sizeof(uint32_t);
+	std::memcpy(&reward,p,sizeof(float));
+	p += sizeof(float);
+	out.episode = episode;
+	out.reward = reward;
+
+	out.positions.resize(mHeader.num_dofs);
+	std::memcpy(out.positions.data(),p,mHeader.num_dofs*sizeof(double));
+	p += mHeader.num_dofs*sizeof(double);
+
+	std::vector<float> values(mHeader.num_muscles+mHeader.num_exo_torques);
+	std::memcpy(values.data(),p,values.size()*sizeof(float));
+	out.activations = Eigen::Map<Eigen::VectorXf>(values.data(),mHeader.num_muscles).cast<double>();
+	out.exo_torques = Eigen::Map<Eigen::VectorXf>(values.data()+mHeader.num_muscles,mHeader.num_exo_torques).cast<double>();
+}
@@ -0,0 +1,99 @@
+#ifndef __MASS_TRAJECTORY_LOG_H__
+#define __MASS_TRAJECTORY_LOG_H__
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+namespace MASS
+{
+/**
+ * Trajectory log layout (native byte order):
+ *
+ * File header (32 bytes):
+ *   char[4] magic "MTRJ", uint32 version, uint32 num_dofs, num_muscles,
+ *   num_exo_torques, control_hz, record_bytes, uint32 reserved
+ *
+ * Followed by fixed size records, one per control step (plus one for the
+ * initial state of every episode), so frame i is at 32 + i*record_bytes:
+ *   double time, uint32 episode, float reward, double positions[num_dofs],
+ *   float activations[num_muscles], float exo_torques[num_exo_torques]
+ *
+ * Positions are kept in double precision so a replay poses the skeleton
+ * exactly as it was simulated.
+ */
+struct TrajectoryFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t num_dofs;
+	uint32_t num_muscles;
+	uint32_t num_exo_torques;
+	uint32_t control_hz;
+	uint32_t record_bytes;
+	uint32_t reserved;
+};
+
+/**
+ * @brief Appends control steps of an Environment to a trajectory log.
+ * Records are buffered and written in blocks, so Record() is a copy.
+ */
+class TrajectoryRecorder
+{
+public:
+	TrajectoryRecorder(const std::string& path,int num_dofs,int num_muscles,int num_exo_torques,int control_hz);
+	~TrajectoryRecorder();
+
+	void BeginEpisode(){mEpisode++;}
+	void Record(double time,double reward,const Eigen::VectorXd& positions,const Eigen::VectorXd& activations,const Eigen::VectorXd& exo_torques);
+	void Flush();
+
+	bool IsOpen(){return mFile!=nullptr;}
+	const std::string& GetPath(){return mPath;}
+private:
+	std::string mPath;
+	FILE* mFile;
+	TrajectoryFileHeader mHeader;
+	std::vector<char> mBuffer;
+	uint32_t mEpisode;
+};
+
+/**
+ * @brief Read-only view of a trajectory log (memory mapped), with random
+ * access to any frame.
+ */
+class TrajectoryLog
+{
+public:
+	struct Frame
+	{
+		double time;
+		int episode;
+		double reward;
+		Eigen::VectorXd positions;
+		Eigen::VectorXd activations;
+		Eigen::VectorXd exo_torques;
+	};
+
+	TrajectoryLog();
+	~TrajectoryLog();
+
+	bool Load(const std::string& path);
+	int GetNumFrames(){return mNumFrames;}
+	int GetNumDofs(){return mHeader.num_dofs;}
+	int GetNumMuscles(){return mHeader.num_muscles;}
+	int GetControlHz(){return mHeader.control_hz;}
+	int GetEpisode(int frame);
+	void GetFrame(int frame,Frame& out);
+private:
+	void Unload();
+
+	TrajectoryFileHeader mHeader;
+	const char* mData;
+	size_t mBytes;
+	int mNumFrames;
+};
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include "EnvManager.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+
+/**
+ * Scores network checkpoints without a window: every checkpoint runs the same
+ * episodes (seed x episode) on the envs of one EnvManager, and every finished
+ * episode becomes one line of a CSV file. The networks are evaluated once per
+ * control step for all envs together, as in python/main.py.
+ */
+
+struct Options
+{
+	std::string meta_file;
+	std::vector<std::string> checkpoints;
+	std::string exo_checkpoint;
+	std::string output = "eval.csv";
+	int num_envs = 8;
+	int num_seeds = 1;
+	int num_episodes = 1;		// per seed
+	double max_time = 10.0;		// simulated seconds
+};
+
+// One evaluation episode, running on an env
+struct Episode
+{
+	int seed = -1;				// -1 while the env has nothing left to run
+	int episode = 0;
+	int steps = 0;				// control steps
+	double reward = 0.0;		// sums over the control steps
+	double gait_reward = 0.0;
+	double joint_error = 0.0;
+};
+
+/**
+ * @brief Networks of a checkpoint argument: "X.pt" is the simulation net and,
+ * with muscles, X_muscle.pt the muscle net (as python/main.py -m saves them);
+ * "A.pt,B.pt" names both.
+ */
+void
+SplitCheckpoint(const std::string& checkpoint,bool use_muscle,std::string& nn_path,std::string& muscle_nn_path)
+{
+	size_t comma = checkpoint.find(',');
+	if(comma!=std::string::npos)
+	{
+		nn_path = checkpoint.substr(0,comma);
+		muscle_nn_path = checkpoint.substr(comma+1);
+		return;
+	}
+	nn_path = checkpoint;
+	muscle_nn_path.clear();
+	if(!use_muscle)
+		return;
+	size_t dot = checkpoint.rfind(".pt");
+	muscle_nn_path = (dot!=std::string::npos && dot+3==checkpoint.size() ? checkpoint.substr(0,dot) : checkpoint)+"_muscle.pt";
+}
+
+/**
+ * @brief Resets env id to the start of the next episode of jobs. The start
+ * clip and time are drawn with rand() (dart::math::random), seeded from the
+ * seed and episode, so every checkpoint starts the same episodes alike.
+ */
+void
+StartEpisode(EnvManager& env,int id,std::deque<std::pair<int,int>>& jobs,Episode& episode)
+{
+	episode = Episode();
+	if(!jobs.empty())
+	{
+		episode.seed = jobs.front().first;
+		episode.episode = jobs.front().second;
+		jobs.pop_front();
+		srand(episode.seed*100003u+episode.episode);
+	}
+	env.Reset(true,id);
+}
+
+/**
+ * @brief Runs all episodes of one checkpoint and appends them to file.
+ *
+ * @return number of episodes written
+ */
+int
+Evaluate(EnvManager& env,const Options& options,const std::string& checkpoint,py::object& mns,py::object* exo_agent,FILE* file)
+{
+	bool use_muscle = env.UseMuscle();
+	std::string nn_path,muscle_nn_path;
+	SplitCheckpoint(checkpoint,use_muscle,nn_path,muscle_nn_path);
+	py::object nn = mns["SimulationNN"](env.GetNumState(),env.GetNumAction());
+	nn.attr("load")(nn_path);
+	py::object muscle_nn;
+	if(use_muscle)
+	{
+		muscle_nn = mns["MuscleNN"](env.GetNumTotalMuscleRelatedDofs(),env.GetNumAction(),env.GetNumMuscles());
+		muscle_nn.attr("load")(muscle_nn_path);
+	}
+
+	int num_envs = env.GetNumEnvs();
+	int num_steps = env.GetNumSteps();
+	int max_steps = std::max(1,(int)(options.max_time*env.GetControlHz()+0.5));
+	std::deque<std::pair<int,int>> jobs;
+	for(int seed=0;seed<options.num_seeds;seed++)
+		for(int e=0;e<options.num_episodes;e++)
+			jobs.push_back(std::make_pair(seed,e));
+	std::vector<Episode> episodes(num_envs);
+	for(int id=0;id<num_envs;id++)
+		StartEpisode(env,id,jobs,episodes[id]);
+
+	auto begin = std::chrono::steady_clock::now();
+	int num_written = 0;
+	long long num_control_steps = 0;
+	double total_time = 0.0,total_gait = 0.0,total_error = 0.0,total_energy = 0.0;
+	while(true)
+	{
+		int num_running = 0;
+		for(const auto& episode : episodes)
+			num_running += episode.seed>=0;
+		if(num_running==0)
+			break;
+
+		const Eigen::MatrixXd& states = env.GetStates();
+		if(exo_agent!=nullptr)
+		{
+			// the RLlib agent takes one state at a time
+			Eigen::MatrixXd torques(num_envs,4);
+			for(int id=0;id<num_envs;id++)
+				torques.row(id) = exo_agent->attr("get_action")(Eigen::VectorXd(states.row(id).transpose())).cast<Eigen::VectorXd>().transpose();
+			env.SetExoTorques(torques);
+		}
+		env.SetActions(nn.attr("get_actions")(states).cast<Eigen::MatrixXd>());
+		if(use_muscle)
+		{
+			Eigen::MatrixXd mt = env.GetMuscleTorques();
+			for(int i=0;i<num_steps/2;i++)
+			{
+				env.SetActivationLevels(muscle_nn.attr("get_activations")(mt,env.GetDesiredTorques()).cast<Eigen::MatrixXd>());
+				env.Steps(2);
+			}
+		}
+		else
+			env.StepsAtOnce();
+		num_control_steps += num_running;
+
+		// GetRewards and GetGaitRewards fill the same vector
+		Eigen::VectorXd rewards = env.GetRewards();
+		Eigen::VectorXd gait_rewards = env.GetGaitRewards();
+		const Eigen::VectorXd& errors = env.GetJointAngleErrors();
+		const Eigen::VectorXd& energies = env.GetExoEnergies();
+		const Eigen::VectorXd& eoe = env.IsEndOfEpisodes();
+		for(int id=0;id<num_envs;id++)
+		{
+			Episode& episode = episodes[id];
+			if(episode.seed<0)
+			{
+				// idle envs keep stepping with the others, they are only kept valid
+				if(eoe[id]!=0)
+					env.Reset(true,id);
+				continue;
+			}
+			episode.steps++;
+			episode.reward += rewards[id];
+			episode.gait_reward += gait_rewards[id];
+			episode.joint_error += errors[id];
+			bool terminated = eoe[id]!=0;
+			if(!terminated && episode.steps<max_steps)
+				continue;
+
+			double survival_time = (double)episode.steps/env.GetControlHz();
+			fprintf(file,"%s,%d,%d,%d,%.4f,%d,%.6f,%.6f,%.6f,%.6f\n",checkpoint.c_str(),episode.seed,episode.episode,id,
+				survival_time,(int)terminated,episode.reward/episode.steps,episode.gait_reward/episode.steps,
+				episode.joint_error/episode.steps,energies[id]);
+			num_written++;
+			total_time += survival_time;
+			total_gait += episode.gait_reward/episode.steps;
+			total_error += episode.joint_error/episode.steps;
+			total_energy += energies[id];
+			StartEpisode(env,id,jobs,episode);
+		}
+	}
+	fflush(file);
+
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+	std::cout<<checkpoint<<" : "<<num_written<<" episodes in "<<wall<<" s ("<<num_control_steps/wall<<" control steps/s)"
+		<<", survival "<<total_time/num_written<<" s, gait reward "<<total_gait/num_written
+		<<", joint angle MAE "<<total_error/num_written<<" rad, exo energy "<<total_energy/num_written<<" J"<<std::endl;
+	return num_written;
+}
+
+int main(int argc,char** argv)
+{
+	Options options;
+	std::vector<std::string> args(argv+1,argv+argc);
+	for(size_t i=0;i<args.size();i++)
+	{
+		bool has_value = i+1<args.size();
+		if(args[i]=="--envs" && has_value)
+			options.num_envs = atoi(args[++i].c_str());
+		else if(args[i]=="--seeds" && has_value)
+			options.num_seeds = atoi(args[++i].c_str());
+		else if(args[i]=="--episodes" && has_value)
+			options.num_episodes = atoi(args[++i].c_str());
+		else if(args[i]=="--max-time" && has_value)
+			options.max_time = atof(args[++i].c_str());
+		else if(args[i]=="--exo" && has_value)
+			options.exo_checkpoint = args[++i];
+		else if(args[i]=="--output" && has_value)
+			options.output = args[++i];
+		else if(options.meta_file.empty())
+			options.meta_file = args[i];
+		else
+			options.checkpoints.push_back(args[i]);
+	}
+	if(options.checkpoints.empty() || options.num_envs<1 || options.num_seeds<1 || options.num_episodes<1)
+	{
+		std::cout<<"Usage : mass_eval metadata.txt checkpoint.pt [checkpoint.pt ...]"<<std::endl;
+		std::cout<<"        [--envs N] [--seeds N] [--episodes N per seed] [--max-time S] [--exo RLLIB_CHECKPOINT] [--output FILE]"<<std::endl;
+		std::cout<<"A checkpoint X.pt uses X_muscle.pt as its muscle net, A.pt,B.pt names both"<<std::endl;
+		return 0;
+	}
+
+	py::scoped_interpreter guard;
+	py::object mns = py::module::import("__main__").attr("__dict__");
+	py::module sys_module = py::module::import("sys");
+	sys_module.attr("path").attr("insert")(1,std::string(MASS_ROOT_DIR)+"/python");
+	py::exec("from Model import *",mns);
+
+	EnvManager env(options.meta_file,options.num_envs);
+
+	py::object exo_agent;
+	if(!options.exo_checkpoint.empty())
+	{
+		sys_module.attr("path").attr("insert")(1,std::string(MASS_ROOT_DIR)+"/Exo_agent");
+		py::exec("from RLlib_MASS import Exo_Trainer",mns);
+		exo_agent = py::eval("Exo_Trainer()",mns);
+		exo_agent.attr("Restore_Agent")(options.exo_checkpoint);
+	}
+
+	FILE* file = fopen(options.output.c_str(),"w");
+	if(file==nullptr)
+	{
+		std::cout<<"Can't open file : "<<options.output<<std::endl;
+		return 1;
+	}
+	// the mean columns are per control step, survival_time and exo_energy are per episode
+	fprintf(file,"# %s, %d envs, %d seeds x %d episodes, max %.2f s, exo %s\n",options.meta_file.c_str(),options.num_envs,
+		options.num_seeds,options.num_episodes,options.max_time,options.exo_checkpoint.empty() ? "none" : options.exo_checkpoint.c_str());
+	fprintf(file,"checkpoint,seed,episode,env,survival_time,terminated,mean_reward,mean_gait_reward,joint_angle_mae,exo_energy\n");
+
+	int num_failed = 0;
+	for(const auto& checkpoint : options.checkpoints)
+	{
+		try
+		{
+			Evaluate(env,options,checkpoint,mns,exo_agent ? &exo_agent : nullptr,file);
+		}
+		catch(const std::exception& e)
+		{
+			std::cout<<"Skipping checkpoint "<<checkpoint<<" : "<<e.what()<<std::endl;
+			num_failed++;
+		}
+	}
+	fclose(file);
+	std::cout<<"Episodes written to "<<options.output<<std::endl;
+	return num_failed>0 ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+#include "DeadlineStepper.h"
+#include "NumaTopology.h"
+#include <chrono>
+#include <cmath>
+
+const int LatencyHistograms::NUM_BINS;
+
+LatencyHistograms::
+LatencyHistograms(int num_envs)
+	:mNumEnvs(num_envs),mCounts(new std::atomic<uint64_t>[num_envs*NUM_BINS])
+{
+	Clear();
+}
+void
+LatencyHistograms::
+Record(int id,double seconds)
+{
+	double us = seconds*1e6;
+	int bin = us<1.0 ? 0 : std::min(NUM_BINS-1,(int)std::log2(us));
+	mCounts[id*NUM_BINS+bin].fetch_add(1,std::memory_order_relaxed);
+}
+Eigen::MatrixXd
+LatencyHistograms::
+Get()
+{
+	Eigen::MatrixXd counts(mNumEnvs,NUM_BINS);
+	for(int i=0;i<mNumEnvs;i++)
+		for(int b=0;b<NUM_BINS;b++)
+			counts(i,b) = mCounts[i*NUM_BINS+b].load(std::memory_order_relaxed);
+	return counts;
+}
+void
+LatencyHistograms::
+Clear()
+{
+	for(int i=0;i<mNumEnvs*NUM_BINS;i++)
+		mCounts[i].store(0,std::memory_order_relaxed);
+}
+
+DeadlineStepper::
+DeadlineStepper(const std::vector<MASS::Environment*>& envs,const std::vector<int>& env_threads,
+	const std::vector<int>& thread_cpus,LatencyHistograms* histograms)
+	:mEnvs(envs),mThreadEnvs(thread_cpus.size()),mHistograms(histograms),
+	mBusy(new std::atomic<int>[envs.size()]),mPending(envs.size(),0),mBatches(envs.size(),0),mBatch(0),mNumSteps(0),mNumDone(0),mStop(false)
+{
+	for(int id=0;id<mEnvs.size();id++)
+	{
+		mBusy[id].store(0);
+		mThreadEnvs[env_threads[id]].push_back(id);
+	}
+	mLateMask = Eigen::VectorXd::Zero(mEnvs.size());
+	for(int t=0;t<mThreadEnvs.size();t++)
+	{
+		if(mThreadEnvs[t].empty())
+			continue;
+		int cpu = thread_cpus[t];
+		mThreads.push_back(std::thread([this,t,cpu]{
+			if(cpu>=0)
+				PinCurrentThread(cpu);
+			Run(t);
+		}));
+	}
+}
+DeadlineStepper::
+~DeadlineStepper()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWork.notify_all();
+	for(auto& thread : mThreads)
+		thread.join();
+}
+
+/**
+ * @brief Starts a control step on every idle env and waits for enough of them.
+ *
+ * @param num_steps - simulation steps per env
+ * @param fraction - return once this fraction of the dispatched envs is done
+ * @param budget_ms - or once this much time has passed, <= 0 for no limit
+ */
+void
+DeadlineStepper::
+Dispatch(int num_steps,double fraction,double budget_ms)
+{
+	auto begin = std::chrono::steady_clock::now();
+	int num_dispatched = 0;
+	std::unique_lock<std::mutex> lock(mMutex);
+	mNumSteps = num_steps;
+	mNumDone = 0;
+	mBatch++;
+	for(int id=0;id<mEnvs.size();id++)
+	{
+		if(IsBusy(id))
+			continue;
+		mBusy[id].store(1,std::memory_order_release);
+		mPending[id] = 1;
+		mBatches[id] = mBatch;
+		num_dispatched++;
+	}
+	mWork.notify_all();
+
+	int needed = std::min(num_dispatched,(int)std::ceil(fraction*num_dispatched));
+	auto enough = [this,needed]{return mNumDone>=needed;};
+	if(budget_ms>0.0)
+		mDone.wait_until(lock,begin+std::chrono::microseconds((long long)(budget_ms*1000.0)),enough);
+	else
+		mDone.wait(lock,enough);
+	lock.unlock();
+
+	// Envs skipped above are late too: if one finished during this batch, it
+	// finished the previous action, not the one set for this step
+	for(int id=0;id<mEnvs.size();id++)
+		mLateMask[id] = (IsBusy(id) || mBatches[id]!=mBatch) ? 1.0 : 0.0;
+}
+void
+DeadlineStepper::
+Wait(int id)
+{
+	if(!IsBusy(id))
+		return;
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDone.wait(lock,[this,id]{return !IsBusy(id);});
+}
+void
+DeadlineStepper::
+WaitAll()
+{
+	for(int id=0;id<mEnvs.size();id++)
+		Wait(id);
+}
+void
+DeadlineStepper::
+Run(int thread)
+{
+	const std::vector<int>& envs = mThreadEnvs[thread];
+	while(true)
+	{
+		int id = -1;
+		int num_steps;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWork.wait(lock,[&]{
+				if(mStop)
+					return true;
+				for(int e : envs)
+					if(mPending[e])
+					{
+						id = e;
+						return true;
+					}
+				return false;
+			});
+			if(id<0)
+				return;
+			mPending[id] = 0;
+			num_steps = mNumSteps;
+		}
+
+		auto begin = std::chrono::steady_clock::now();
+		for(int j=0;j<num_steps;j++)
+			mEnvs[id]->Step();
+		mHistograms->Record(id,std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count());
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBusy[id].store(0,std::memory_order_release);
+			// Late envs of earlier batches don't count towards this one
+			if(mBatches[id]==mBatch)
+				mNumDone++;
+		}
+		mDone.notify_all();
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef __DEADLINE_STEPPER_H__
+#define __DEADLINE_STEPPER_H__
+#include "Environment.h"
+#include <Eigen/Core>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Per-env histograms of control step latency on a log2 microsecond
+ * scale: bin b counts steps which took [2^b,2^(b+1)) us. Every env's row is
+ * written only by the thread stepping it.
+ */
+class LatencyHistograms
+{
+public:
+	static const int NUM_BINS = 32;
+
+	LatencyHistograms(int num_envs);
+
+	void Record(int id,double seconds);
+	Eigen::MatrixXd Get();
+	void Clear();
+private:
+	int mNumEnvs;
+	std::unique_ptr<std::atomic<uint64_t>[]> mCounts;
+};
+
+/**
+ * @brief Persistent stepping threads for EnvManager's deadline mode.
+ *
+ * Dispatch hands a control step to every idle env and returns once the given
+ * fraction of them is done or the time budget runs out. Envs still running at
+ * that point are late: they finish their step in the background and are
+ * skipped by the following Dispatch calls until they are idle again. The late
+ * mask flags every env whose step was not dispatched and finished in the last
+ * Dispatch, so a late env is flagged until it has run a step with a new action.
+ * Each env is stepped by the same thread, pinned to the same CPU as the
+ * OpenMP thread that owns it, so NUMA placement is kept.
+ */
+class DeadlineStepper
+{
+public:
+	DeadlineStepper(const std::vector<MASS::Environment*>& envs,const std::vector<int>& env_threads,
+		const std::vector<int>& thread_cpus,LatencyHistograms* histograms);
+	~DeadlineStepper();
+
+	void Dispatch(int num_steps,double fraction,double budget_ms);
+	bool IsBusy(int id){return mBusy[id].load(std::memory_order_acquire)!=0;}
+	void Wait(int id);
+	void WaitAll();
+	const Eigen::VectorXd& GetLateMask(){return mLateMask;}
+private:
+	void Run(int thread);
+
+	std::vector<MASS::Environment*> mEnvs;
+	std::vector<std::vector<int>> mThreadEnvs;
+	LatencyHistograms* mHistograms;
+
+	std::vector<std::thread> mThreads;
+	std::unique_ptr<std::atomic<int>[]> mBusy;
+	std::vector<int> mPending;		// guarded by mMutex
+	std::vector<int> mBatches;		// batch each env was last dispatched in
+	int mBatch;
+	int mNumSteps;
+	int mNumDone;
+	bool mStop;
+	std::mutex mMutex;
+	std::condition_variable mWork;
+	std::condition_variable mDone;
+
+	Eigen::VectorXd mLateMask;
+};
+
+#endif
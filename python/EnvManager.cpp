@@ -1,6 +1,12 @@
 #include "EnvManager.h"
+#include "ShardedEnvManager.h"
+#include "RemoteEnvManager.h"
 #include "DARTHelper.h"
+#include "MuscleGroups.h"
 #include <omp.h>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
 
 /**
  * This file contains all the C++ functions that have been ported to 
@@ -10,29 +16,148 @@
  * interact with the MASS environment from python
  */
 
+/**
+ * @brief Builds the environments. Every env is constructed by the thread that
+ * steps it afterwards (all loops below use the same static schedule), so its
+ * world and buffers are allocated first-touch on that thread's NUMA node. With
+ * pin_threads every OpenMP thread is pinned to one CPU; OpenMP thread 0 is the
+ * calling (Python) thread, which gets its affinity back once the envs exist.
+ *
+ * @param num_numa_nodes - number of NUMA nodes to spread the threads over, 0 for all
+ * @param use_prototype - build env 0 from the files and clone the others from
+ * it in parallel, instead of loading the files for every env
+ * @param pin_threads - pin the stepping threads, see NumaTopology
+ * @param cpu_offset - CPUs to skip within every node, to keep several pinned
+ * processes on one machine apart
+ */
 EnvManager::
-EnvManager(std::string meta_file,int num_envs)
-	:mNumEnvs(num_envs)
+EnvManager(std::string meta_file,int num_envs,int num_numa_nodes,bool use_prototype,bool pin_threads,int cpu_offset)
+	:mNumEnvs(num_envs),mMuscleTupleWriter(nullptr),mLatency(num_envs),mDeadlineStepper(nullptr),
+	mDeadlineFraction(1.0),mDeadlineBudget(0.0)
 {
 	// mMetafile = meta_file;
 	dart::math::seedRand();
 	omp_set_num_threads(mNumEnvs);
-	for(int i = 0;i<mNumEnvs;i++){
-		mEnvs.push_back(new MASS::Environment());
-		MASS::Environment* env = mEnvs.back();
+	auto begin = std::chrono::steady_clock::now();
+	std::vector<int> caller_cpus = GetCurrentAffinity();
+	mEnvs.resize(mNumEnvs,nullptr);
+	mEnvStates.resize(mNumEnvs);
+	mEnvThreads.resize(mNumEnvs);
+#pragma omp parallel
+	{
+		int thread = omp_get_thread_num();
+#pragma omp single
+		{
+			mThreadCpus = mTopology.AssignCpus(omp_get_num_threads(),num_numa_nodes,cpu_offset);
+			if(!pin_threads)
+				std::fill(mThreadCpus.begin(),mThreadCpus.end(),-1);
+		}
+		if(mThreadCpus[thread]>=0)
+			PinCurrentThread(mThreadCpus[thread]);
 
-		env->Initialize(meta_file,false);
+		// Env 0 is the prototype, built from the files by the thread that owns it
+		// (the static schedule gives env 0 to thread 0).
+#pragma omp master
+		{
+			mEnvs[0] = new MASS::Environment();
+			mEnvs[0]->Initialize(meta_file,false);
+		}
+#pragma omp barrier
+
+#pragma omp for schedule(static)
+		for(int i = 0;i<mNumEnvs;i++){
+			if(i>0)
+			{
+				mEnvs[i] = new MASS::Environment();
+				if(use_prototype)
+					mEnvs[i]->Initialize(mEnvs[0]);
+				else
+				{
+					// Loading the model files is not thread-safe, only the placement is parallel
+#pragma omp critical
+					mEnvs[i]->Initialize(meta_file,false);
+				}
+			}
+			mEnvThreads[i] = thread;
+		}
+		// The prototype is only read while cloning, its state can be used once all clones exist
+#pragma omp for schedule(static)
+		for(int i = 0;i<mNumEnvs;i++)
+			mEnvStates[i] = mEnvs[i]->GetState();
+	}
+	// this thread is the caller's, torch and everything else it runs would be stuck on one CPU
+	if(pin_threads)
+		SetCurrentAffinity(caller_cpus);
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+	double first = mEnvs[0]->GetInitializeTime(),rest = 0.0;
+	int num_hits = 0;
+	for(int i = 0;i<mNumEnvs;i++)
+	{
+		num_hits += mEnvs[i]->GetModelCacheHit();
+		if(i>0)
+			rest += mEnvs[i]->GetInitializeTime();
+	}
+	std::cout<<"Built "<<mNumEnvs<<" envs in "<<total*1e3<<" ms (first "<<first*1e3<<" ms";
+	if(mNumEnvs>1)
+		std::cout<<", others "<<rest/(mNumEnvs-1)*1e3<<" ms each";
+	std::cout<<"), model cache hits "<<num_hits<<"/"<<mNumEnvs<<std::endl;
+	if(mEnvs[0]->GetUseMuscle())
+	{
+		// Clones share the muscle models, envs loaded from the files own theirs
+		double state = mEnvs[0]->GetCharacter()->GetMuscleStateBytes()/1024.0;
+		double model = mEnvs[0]->GetCharacter()->GetMuscleModelBytes()/1024.0;
+		std::cout<<"Muscles: "<<(use_prototype ? state : state+model)<<" KB per env ("<<state<<" KB state, "
+			<<model<<" KB model "<<(use_prototype ? "shared" : "per env")<<", "<<state+model<<" KB per env unshared)"<<std::endl;
 	}
 	muscle_torque_cols = mEnvs[0]->GetMuscleTorques().rows();
 	tau_des_cols = mEnvs[0]->GetDesiredTorques().rows();
 	mEoe.resize(mNumEnvs);
 	mRewards.resize(mNumEnvs);
+	mJointAngleErrors.resize(mNumEnvs);
+	mExoEnergies.resize(mNumEnvs);
 	mStates.resize(mNumEnvs, GetNumState());
 	mMuscleTorques.resize(mNumEnvs, muscle_torque_cols);
 	mDesiredTorques.resize(mNumEnvs, tau_des_cols);
 	
 	// win = new MASS::Window(mEnvs[0]);
 }
+EnvManager::
+~EnvManager()
+{
+	WaitAllIdle();
+	delete mDeadlineStepper;
+	CloseMuscleTupleDataset();
+	StopRecordingTrajectories();
+}
+/**
+ * @brief Describes where every env runs and where its memory lives, as seen
+ * from inside the stepping threads.
+ */
+std::string
+EnvManager::
+GetPlacementReport()
+{
+	std::vector<int> cpus(mNumEnvs),threads(mNumEnvs),env_nodes(mNumEnvs),state_nodes(mNumEnvs);
+#pragma omp parallel for schedule(static)
+	for (int id = 0;id<mNumEnvs;++id)
+	{
+		cpus[id] = CurrentCpu();
+		threads[id] = omp_get_thread_num();
+		env_nodes[id] = NodeOfAddress(mEnvs[id]);
+		state_nodes[id] = NodeOfAddress(mEnvStates[id].data());
+	}
+
+	std::stringstream ss;
+	ss<<mTopology.GetNumNodes()<<(mTopology.IsFake() ? " fake" : "")<<" NUMA node(s), "<<mThreadCpus.size()<<" threads"<<std::endl;
+	for (int id = 0;id<mNumEnvs;++id)
+	{
+		int pinned = threads[id]==0 ? -1 : mThreadCpus[threads[id]];
+		ss<<"env "<<id<<" : thread "<<threads[id]<<(threads[id]!=mEnvThreads[id] ? " (moved)" : "")
+			<<", cpu "<<cpus[id]<<" ("<<(pinned>=0 ? "pinned "+std::to_string(pinned) : std::string("unpinned"))<<", node "<<mTopology.NodeOfCpu(cpus[id])<<")"
+			<<", env memory node "<<env_nodes[id]<<", state memory node "<<state_nodes[id]<<std::endl;
+	}
+	return ss.str();
+}
 int
 EnvManager::
 GetNumState()
@@ -73,18 +198,21 @@ void
 EnvManager::
 Step(int id)
 {
+	WaitIdle(id);
 	mEnvs[id]->Step();
 }
 void
 EnvManager::
 Reset(bool RSI,int id)
 {
+	WaitIdle(id);
 	mEnvs[id]->Reset(RSI);
 }
 bool
 EnvManager::
 IsEndOfEpisode(int id)
 {
+	WaitIdle(id);
 	return mEnvs[id]->IsEndOfEpisode();
 }
 
@@ -92,7 +220,7 @@ double
 EnvManager::
 GetReward(int id)
 {
-	
+	WaitIdle(id);
 	return mEnvs[id]->GetReward();
 }
 
@@ -100,7 +228,8 @@ void
 EnvManager::
 Steps(int num)
 {
-#pragma omp parallel for
+	WaitAllIdle();
+#pragma omp parallel for schedule(static)
 	for (int id = 0;id<mNumEnvs;++id)
 	{
 		for(int j=0;j<num;j++)
@@ -112,17 +241,94 @@ EnvManager::
 StepsAtOnce()
 {
 	int num = this->GetNumSteps();
-#pragma omp parallel for
+	if(mDeadlineStepper!=nullptr)
+	{
+		mDeadlineStepper->Dispatch(num,mDeadlineFraction,mDeadlineBudget);
+		return;
+	}
+#pragma omp parallel for schedule(static)
 	for (int id = 0;id<mNumEnvs;++id)
 	{
+		auto begin = std::chrono::steady_clock::now();
 		for(int j=0;j<num;j++)
 			mEnvs[id]->Step();
+		mLatency.Record(id,std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count());
+	}
+}
+
+/**
+ * @brief Enables deadline mode: StepsAtOnce returns as soon as fraction of the
+ * envs have finished their control step, or after budget_ms. The others are
+ * flagged in GetLateMask and keep stepping in the background; they are skipped
+ * by StepsAtOnce, SetActions and GetStates (which keeps their last row) until
+ * they are done. Per-env calls on a late env wait for it, and every other
+ * batched call waits for all of them. Deadline mode only covers the
+ * StepsAtOnce (torque control) path.
+ *
+ * @param fraction - fraction of envs to wait for, 1 to wait for all
+ * @param budget_ms - time budget of a control step, <= 0 for none
+ */
+void
+EnvManager::
+SetDeadline(double fraction,double budget_ms)
+{
+	// envs dispatched but not started yet would be dropped with the stepper
+	WaitAllIdle();
+	mDeadlineFraction = fraction;
+	mDeadlineBudget = budget_ms;
+	if(fraction>=1.0 && budget_ms<=0.0)
+	{
+		delete mDeadlineStepper;
+		mDeadlineStepper = nullptr;
 	}
+	else if(mDeadlineStepper==nullptr)
+		mDeadlineStepper = new DeadlineStepper(mEnvs,mEnvThreads,mThreadCpus,&mLatency);
+}
+Eigen::VectorXd
+EnvManager::
+GetLateMask()
+{
+	if(mDeadlineStepper==nullptr)
+		return Eigen::VectorXd::Zero(mNumEnvs);
+	return mDeadlineStepper->GetLateMask();
+}
+Eigen::MatrixXd
+EnvManager::
+GetLatencyHistograms()
+{
+	return mLatency.Get();
+}
+void
+EnvManager::
+ClearLatencyHistograms()
+{
+	mLatency.Clear();
+}
+bool
+EnvManager::
+IsBusy(int id)
+{
+	return mDeadlineStepper!=nullptr && mDeadlineStepper->IsBusy(id);
+}
+void
+EnvManager::
+WaitIdle(int id)
+{
+	if(mDeadlineStepper!=nullptr)
+		mDeadlineStepper->Wait(id);
+}
+void
+EnvManager::
+WaitAllIdle()
+{
+	if(mDeadlineStepper!=nullptr)
+		mDeadlineStepper->WaitAll();
 }
 void
 EnvManager::
 Resets(bool RSI)
 {
+	WaitAllIdle();
 	for (int id = 0;id<mNumEnvs;++id)
 	{
 		mEnvs[id]->Reset(RSI);
@@ -132,6 +338,7 @@ const Eigen::VectorXd&
 EnvManager::
 IsEndOfEpisodes()
 {
+	WaitAllIdle();
 	for (int id = 0;id<mNumEnvs;++id)
 	{
 		mEoe[id] = (double)mEnvs[id]->IsEndOfEpisode();
@@ -143,9 +350,17 @@ const Eigen::MatrixXd&
 EnvManager::
 GetStates()
 {
+	// States are computed into node-local buffers by each env's own thread,
+	// only the final gather touches the shared matrix
+#pragma omp parallel for schedule(static)
+	for (int id = 0;id<mNumEnvs;++id)
+	{
+		if(!IsBusy(id))
+			mEnvStates[id].noalias() = mEnvs[id]->GetState();
+	}
 	for (int id = 0;id<mNumEnvs;++id)
 	{
-		mStates.row(id) = mEnvs[id]->GetState().transpose();
+		mStates.row(id) = mEnvStates[id].transpose();
 	}
 
 	return mStates;
@@ -156,13 +371,15 @@ SetActions(const Eigen::MatrixXd& actions)
 {
 	for (int id = 0;id<mNumEnvs;++id)
 	{
-		mEnvs[id]->SetAction(actions.row(id).transpose());
+		if(!IsBusy(id))
+			mEnvs[id]->SetAction(actions.row(id).transpose());
 	}
 }
 const Eigen::VectorXd&
 EnvManager::
 GetRewards()
 {
+	WaitAllIdle();
 	for (int id = 0;id<mNumEnvs;++id)
 	{
 		mRewards[id] = mEnvs[id]->GetReward();
@@ -173,28 +390,117 @@ const Eigen::VectorXd&
 EnvManager::
 GetGaitRewards()
 {
+	WaitAllIdle();
 	for (int id = 0;id<mNumEnvs;++id)
 	{
 		mRewards[id] = mEnvs[id]->GetGaitReward();
 	}
 	return mRewards;
 }
+/**
+ * @brief Mean absolute joint angle error against the reference motion of
+ * every env, see Environment::GetJointAngleError.
+ */
+const Eigen::VectorXd&
+EnvManager::
+GetJointAngleErrors()
+{
+	WaitAllIdle();
+#pragma omp parallel for schedule(static)
+	for (int id = 0;id<mNumEnvs;++id)
+	{
+		mJointAngleErrors[id] = mEnvs[id]->GetJointAngleError();
+	}
+	return mJointAngleErrors;
+}
+/**
+ * @brief Work done by the exo torques of every env since its last reset.
+ */
+const Eigen::VectorXd&
+EnvManager::
+GetExoEnergies()
+{
+	WaitAllIdle();
+	for (int id = 0;id<mNumEnvs;++id)
+	{
+		mExoEnergies[id] = mEnvs[id]->GetExoEnergy();
+	}
+	return mExoEnergies;
+}
 const Eigen::MatrixXd&
 EnvManager::
 GetMuscleTorques()
 {
-#pragma omp parallel for
+	WaitAllIdle();
+#pragma omp parallel for schedule(static)
 	for (int id = 0; id < mNumEnvs; ++id)
 	{
 		mMuscleTorques.row(id) = mEnvs[id]->GetMuscleTorques();
 	}
 	return mMuscleTorques;
 }
+std::vector<std::string>
+EnvManager::
+GetMuscleGroupNames()
+{
+	const auto& groups = mEnvs[0]->GetCharacter()->GetMuscleGroups();
+	if(groups==nullptr)
+		return std::vector<std::string>();
+	return groups->GetNames();
+}
+/**
+ * @brief Mean activation of every muscle group in every env. The envs only
+ * copy their activations, the groups are reduced for all envs at once.
+ */
+const Eigen::MatrixXd&
+EnvManager::
+GetMuscleGroupActivations()
+{
+	WaitAllIdle();
+	const auto& groups = mEnvs[0]->GetCharacter()->GetMuscleGroups();
+	if(groups==nullptr)
+	{
+		mMuscleGroupActivations.resize(mNumEnvs,0);
+		return mMuscleGroupActivations;
+	}
+	mMuscleValues.resize(mNumEnvs,GetNumMuscles());
+#pragma omp parallel for schedule(static)
+	for (int id = 0; id < mNumEnvs; ++id)
+	{
+		mMuscleValues.row(id) = mEnvs[id]->GetCharacter()->GetMuscleActivations();
+	}
+	mMuscleGroupActivations = groups->AverageRows(mMuscleValues);
+	return mMuscleGroupActivations;
+}
+/**
+ * @brief Total muscle force of every muscle group in every env.
+ */
+const Eigen::MatrixXd&
+EnvManager::
+GetMuscleGroupForces()
+{
+	WaitAllIdle();
+	const auto& groups = mEnvs[0]->GetCharacter()->GetMuscleGroups();
+	if(groups==nullptr)
+	{
+		mMuscleGroupForces.resize(mNumEnvs,0);
+		return mMuscleGroupForces;
+	}
+	mMuscleValues.resize(mNumEnvs,GetNumMuscles());
+#pragma omp parallel for schedule(static)
+	for (int id = 0; id < mNumEnvs; ++id)
+	{
+		mMuscleValues.row(id) = mEnvs[id]->GetCharacter()->GetMuscleForces();
+	}
+	mMuscleGroupForces = groups->SumRows(mMuscleValues);
+	return mMuscleGroupForces;
+}
 const Eigen::MatrixXd&
 EnvManager::
 GetDesiredTorques()
 {
-#pragma omp parallel for
+	WaitAllIdle();
+#pragma omp parallel for schedule(static)
 	for (int id = 0; id < mNumEnvs; ++id)
 	{
 		mDesiredTorques.row(id) = mEnvs[id]->GetDesiredTorques();
@@ -206,6 +512,7 @@ void
 EnvManager::
 SetActivationLevels(const Eigen::MatrixXd& activations)
 {
+	WaitAllIdle();
 	for (int id = 0; id < mNumEnvs; ++id)
 		mEnvs[id]->SetActivationLevels(activations.row(id));	// why are there multiple envs
 }
@@ -214,11 +521,12 @@ void
 EnvManager::
 ComputeMuscleTuples()
 {
+	WaitAllIdle();
 	int n = 0;
-	int rows_JtA;
-	int rows_tau_des;
-	int rows_L;
-	int rows_b;
+	int rows_JtA = 0;
+	int rows_tau_des = 0;
+	int rows_L = 0;
+	int rows_b = 0;
 
 	for(int id=0;id<mNumEnvs;id++)
 	{
@@ -250,6 +558,8 @@ ComputeMuscleTuples()
 			mMuscleTuplesb.row(o) = tps[j].b;
 			o++;
 		}
+		if(mMuscleTupleWriter!=nullptr)
+			mMuscleTupleWriter->Push(tps);
 		tps.clear();
 	}
 }
@@ -278,6 +588,63 @@ GetMuscleTuplesb()
 	return mMuscleTuplesb;
 }
 
+/**
+ * @brief Starts streaming the tuples gathered by ComputeMuscleTuples to a
+ * chunked dataset file, which python/MuscleTupleDataset.py can memory-map
+ * for offline MuscleNN training.
+ *
+ * @param path - dataset file, appended to if it already exists with the same layout
+ * @param half_precision - store float16 instead of float32
+ * @param compress - deflate each chunk
+ */
+void
+EnvManager::
+SetMuscleTupleDataset(const std::string& path,bool half_precision,bool compress)
+{
+	CloseMuscleTupleDataset();
+	int num_action = GetNumAction();
+	mMuscleTupleWriter = new MASS::MuscleTupleWriter(path,GetNumTotalMuscleRelatedDofs(),num_action,
+		num_action*GetNumMuscles(),num_action,half_precision,compress);
+}
+void
+EnvManager::
+CloseMuscleTupleDataset()
+{
+	if(mMuscleTupleWriter==nullptr)
+		return;
+	delete mMuscleTupleWriter;
+	mMuscleTupleWriter = nullptr;
+}
+long long
+EnvManager::
+GetNumMuscleTuplesWritten()
+{
+	if(mMuscleTupleWriter==nullptr)
+		return 0;
+	return mMuscleTupleWriter->GetNumWritten();
+}
+
+/**
+ * @brief Every env logs its control steps to "<path>.<index>", replayable
+ * with render --replay.
+ *
+ * @param first_env - index of env 0 in the file names (for sharded runs)
+ */
+void
+EnvManager::
+RecordTrajectories(const std::string& path,int first_env)
+{
+	for(int id=0;id<mNumEnvs;id++)
+		mEnvs[id]->StartRecording(path+"."+std::to_string(first_env+id));
+}
+void
+EnvManager::
+StopRecordingTrajectories()
+{
+	for(int id=0;id<mNumEnvs;id++)
+		mEnvs[id]->StopRecording();
+}
+
 // Added by XS
 /**
  * @brief calls MASS::Environment function which sets a new value for the left hip torque vector
@@ -286,7 +653,8 @@ GetMuscleTuplesb()
 void 
 EnvManager::
 SetLHipTs(float T){
-#pragma omp parallel for				// Multithreading?
+	WaitAllIdle();
+#pragma omp parallel for schedule(static)				// Multithreading?
 	for (int id = 0;id<mNumEnvs;++id){
 		mEnvs[id]->SetLHipT(T);
 	}
@@ -299,7 +667,8 @@ SetLHipTs(float T){
 void 
 EnvManager::
 SetRHipTs(float T){
-#pragma omp parallel for				// Multithreading?
+	WaitAllIdle();
+#pragma omp parallel for schedule(static)				// Multithreading?
 	for (int id = 0;id<mNumEnvs;++id){
 		mEnvs[id]->SetRHipT(T);
 	}
@@ -312,7 +681,8 @@ SetRHipTs(float T){
 void 
 EnvManager::
 SetLKneeTs(float T){
-#pragma omp parallel for				// Multithreading?
+	WaitAllIdle();
+#pragma omp parallel for schedule(static)				// Multithreading?
 	for (int id = 0;id<mNumEnvs;++id){
 		mEnvs[id]->SetLKneeT(T);
 	}
@@ -325,13 +695,27 @@ SetLKneeTs(float T){
 void 
 EnvManager::
 SetRKneeTs(float T){
-#pragma omp parallel for				// Multithreading?
+	WaitAllIdle();
+#pragma omp parallel for schedule(static)				// Multithreading?
 	for (int id = 0;id<mNumEnvs;++id){
 		mEnvs[id]->SetRKneeT(T);
 	}
 
 }
 
+/**
+ * @brief Sets the exo torques of every env, as MASS::Environment::SetExoTorques.
+ * @param torques - one row per env
+ */
+void
+EnvManager::
+SetExoTorques(const Eigen::MatrixXd& torques)
+{
+	WaitAllIdle();
+	for (int id = 0;id<mNumEnvs;++id)
+		mEnvs[id]->SetExoTorques(torques.row(id).transpose());
+}
+
 // void 
 // EnvManager::
 // MakeWindow(std::string simNN_path, std::string muscleNN_path){
@@ -355,7 +739,14 @@ SetRKneeTs(float T){
 PYBIND11_MODULE(pymss, m)
 {
 	py::class_<EnvManager>(m, "pymss")
-		.def(py::init<std::string,int>())
+		.def(py::init<std::string,int,int,bool,bool,int>(),py::arg("meta_file"),py::arg("num_envs"),py::arg("num_numa_nodes")=0,py::arg("use_prototype")=true,
+			py::arg("pin_threads")=false,py::arg("cpu_offset")=0)
+		.def("GetNumEnvs",&EnvManager::GetNumEnvs)
+		.def("GetPlacementReport",&EnvManager::GetPlacementReport)
+		.def("SetDeadline",&EnvManager::SetDeadline,py::arg("fraction"),py::arg("budget_ms")=0.0)
+		.def("GetLateMask",&EnvManager::GetLateMask)
+		.def("GetLatencyHistograms",&EnvManager::GetLatencyHistograms)
+		.def("ClearLatencyHistograms",&EnvManager::ClearLatencyHistograms)
 		.def("GetNumState",&EnvManager::GetNumState)
 		.def("GetNumAction",&EnvManager::GetNumAction)
 		.def("GetSimulationHz",&EnvManager::GetSimulationHz)
@@ -374,21 +765,34 @@ PYBIND11_MODULE(pymss, m)
 		.def("SetActions",&EnvManager::SetActions)
 		.def("GetRewards",&EnvManager::GetRewards)
 		.def("GetGaitRewards",&EnvManager::GetGaitRewards)
+		.def("GetJointAngleErrors",&EnvManager::GetJointAngleErrors)
+		.def("GetExoEnergies",&EnvManager::GetExoEnergies)
 		//.def("GetLegJointAngles",&EnvManager::GetLegJointAngles)
 		.def("GetNumTotalMuscleRelatedDofs",&EnvManager::GetNumTotalMuscleRelatedDofs)
 		.def("GetNumMuscles",&EnvManager::GetNumMuscles)
 		.def("GetMuscleTorques",&EnvManager::GetMuscleTorques)
 		.def("GetDesiredTorques",&EnvManager::GetDesiredTorques)
 		.def("SetActivationLevels",&EnvManager::SetActivationLevels)
+		.def("GetMuscleGroupNames",&EnvManager::GetMuscleGroupNames)
+		.def("GetMuscleGroupActivations",&EnvManager::GetMuscleGroupActivations)
+		.def("GetMuscleGroupForces",&EnvManager::GetMuscleGroupForces)
 		.def("ComputeMuscleTuples",&EnvManager::ComputeMuscleTuples)
 		.def("GetMuscleTuplesJtA",&EnvManager::GetMuscleTuplesJtA)
 		.def("GetMuscleTuplesTauDes",&EnvManager::GetMuscleTuplesTauDes)
 		.def("GetMuscleTuplesL",&EnvManager::GetMuscleTuplesL)
 		.def("GetMuscleTuplesb",&EnvManager::GetMuscleTuplesb)
+		.def("SetMuscleTupleDataset",&EnvManager::SetMuscleTupleDataset,py::arg("path"),py::arg("half_precision")=false,py::arg("compress")=true)
+		.def("CloseMuscleTupleDataset",&EnvManager::CloseMuscleTupleDataset)
+		.def("GetNumMuscleTuplesWritten",&EnvManager::GetNumMuscleTuplesWritten)
+		.def("RecordTrajectories",&EnvManager::RecordTrajectories,py::arg("path"),py::arg("first_env")=0)
+		.def("StopRecordingTrajectories",&EnvManager::StopRecordingTrajectories)
 		.def("SetLHipTs", &EnvManager::SetLHipTs)
 		.def("SetRHipTs", &EnvManager::SetRHipTs)
 		.def("SetLKneeTs", &EnvManager::SetLKneeTs)
-		.def("SetRKneeTs", &EnvManager::SetRKneeTs);
+		.def("SetRKneeTs", &EnvManager::SetRKneeTs)
+		.def("SetExoTorques", &EnvManager::SetExoTorques);
+	BindShardedEnvManager(m);
+	BindRemoteEnvManager(m);
 		// .def("MakeWindow", &EnvManager::MakeWindow)
 		// .def("DrawWindow", &EnvManager::DrawWindow);
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include "dart/dart.hpp"
 #include "dart/gui/gui.hpp"
 #include "Environment.h"
+#include "MuscleTupleWriter.h"
+#include "NumaTopology.h"
+#include "DeadlineStepper.h"
 #include "Window.h"
 #include <pybind11/embed.h>
 #include <pybind11/pybind11.h>
@@ -16,8 +19,11 @@ namespace py = pybind11;
 class EnvManager
 {
 public:
-	EnvManager(std::string meta_file,int num_envs);
+	EnvManager(std::string meta_file,int num_envs,int num_numa_nodes = 0,bool use_prototype = true,bool pin_threads = false,int cpu_offset = 0);
+	~EnvManager();
 
+	int GetNumEnvs(){return mNumEnvs;}
+	std::string GetPlacementReport();
 	int GetNumState();
 	int GetNumAction();
 	int GetSimulationHz();
@@ -34,10 +40,17 @@ public:
 	bool IsEndOfEpisode(int id);
 	double GetReward(int id);
 	const Eigen::VectorXd& GetGaitRewards();
+	const Eigen::VectorXd& GetJointAngleErrors();
+	const Eigen::VectorXd& GetExoEnergies();
 	const Eigen::MatrixXd& GetLegJointAngles();
 
 	void Steps(int num);
 	void StepsAtOnce();
+	// Straggler-tolerant StepsAtOnce, see EnvManager.cpp
+	void SetDeadline(double fraction,double budget_ms);
+	Eigen::VectorXd GetLateMask();
+	Eigen::MatrixXd GetLatencyHistograms();
+	void ClearLatencyHistograms();
 	void Resets(bool RSI);
 	const Eigen::VectorXd& IsEndOfEpisodes();
 	const Eigen::MatrixXd& GetStates();
@@ -50,6 +63,11 @@ public:
 	const Eigen::MatrixXd& GetMuscleTorques();
 	const Eigen::MatrixXd& GetDesiredTorques();
 	void SetActivationLevels(const Eigen::MatrixXd& activations);
+
+	// Per env muscle group metrics, one row per env (see MuscleGroups.h)
+	std::vector<std::string> GetMuscleGroupNames();
+	const Eigen::MatrixXd& GetMuscleGroupActivations();
+	const Eigen::MatrixXd& GetMuscleGroupForces();
 	
 	void ComputeMuscleTuples();
 	const Eigen::MatrixXd& GetMuscleTuplesJtA();
@@ -57,13 +75,28 @@ public:
 	const Eigen::MatrixXd& GetMuscleTuplesL();
 	const Eigen::MatrixXd& GetMuscleTuplesb();
 
+	// Streams every computed muscle tuple to an on-disk dataset (see MuscleTupleWriter.h)
+	void SetMuscleTupleDataset(const std::string& path,bool half_precision,bool compress);
+	void CloseMuscleTupleDataset();
+	long long GetNumMuscleTuplesWritten();
+
+	// Logs the control steps of every env to "<path>.<env>" (see TrajectoryLog.h)
+	void RecordTrajectories(const std::string& path,int first_env = 0);
+	void StopRecordingTrajectories();
+
 	// sets the exo torques using MASS::Environment functions
 	void SetLHipTs(float T);
 	void SetRHipTs(float T);
 	void SetLKneeTs(float T);
 	void SetRKneeTs(float T);
+	// one row of [LHip,RHip,LKnee,RKnee] torques per env
+	void SetExoTorques(const Eigen::MatrixXd& torques);
 private:
 	std::vector<MASS::Environment*> mEnvs;
+	NumaTopology mTopology;
+	std::vector<int> mThreadCpus;		// -1 for unpinned threads
+	std::vector<int> mEnvThreads;
+	std::vector<Eigen::VectorXd> mEnvStates;
 	// MASS::Window* mWindow;
 
 	int mNumEnvs;
@@ -74,16 +107,31 @@ private:
 	Eigen::VectorXd mEoe;
 	Eigen::VectorXd mRewards;
 	Eigen::VectorXd mGaitRewards;
+	Eigen::VectorXd mJointAngleErrors;
+	Eigen::VectorXd mExoEnergies;
 	Eigen::MatrixXd mStates;
 	Eigen::MatrixXd mAngles;
 	Eigen::MatrixXd mMuscleTorques;
 	Eigen::MatrixXd mDesiredTorques;
+	Eigen::MatrixXd mMuscleValues;		// envs x muscles, reduced to groups by one sparse product
+	Eigen::MatrixXd mMuscleGroupActivations;
+	Eigen::MatrixXd mMuscleGroupForces;
 
 	Eigen::MatrixXd mMuscleTuplesJtA;
 	Eigen::MatrixXd mMuscleTuplesTauDes;
 	Eigen::MatrixXd mMuscleTuplesL;
 	Eigen::MatrixXd mMuscleTuplesb;
 
+	MASS::MuscleTupleWriter* mMuscleTupleWriter;
+
+	bool IsBusy(int id);
+	void WaitIdle(int id);
+	void WaitAllIdle();
+	LatencyHistograms mLatency;
+	DeadlineStepper* mDeadlineStepper;
+	double mDeadlineFraction;
+	double mDeadlineBudget;
+
 
 
 };
@@ -84,6 +84,12 @@ class MuscleNN(nn.Module):
 	def get_activation(self,muscle_tau,tau):
 		act = self.forward(Tensor(muscle_tau.reshape(1,-1).astype(np.float32)),Tensor(tau.reshape(1,-1).astype(np.float32)))
 		return act.cpu().detach().numpy().squeeze()
+
+	def get_activations(self,muscle_taus,taus):
+		# one row per env
+		with torch.no_grad():
+			act = self.forward(Tensor(muscle_taus.astype(np.float32)),Tensor(taus.astype(np.float32)))
+		return act.cpu().numpy()
 		
 class SimulationNN(nn.Module):
 	def __init__(self,num_states,num_actions):
@@ -144,6 +150,12 @@ class SimulationNN(nn.Module):
 		p,_ = self.forward(ts)
 		return p.loc.cpu().detach().numpy().squeeze()
 
+	def get_actions(self,states):
+		# one row per env
+		with torch.no_grad():
+			p,_ = self.forward(torch.tensor(states.astype(np.float32)))
+		return p.loc.cpu().numpy()
+
 	def get_random_action(self,s):
 		ts = torch.tensor(s.astype(np.float32))
 		p,_ = self.forward(ts)
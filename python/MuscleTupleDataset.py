@@ -0,0 +1,64 @@
+import zlib
+import numpy as np
+"""
+Memory-mapped reader for the muscle tuple datasets written by
+EnvManager.SetMuscleTupleDataset (core/MuscleTupleWriter.h has the layout).
+"""
+
+FILE_HEADER = np.dtype([('magic','S4'),('version','<u4'),('dtype','<u4'),
+	('rows_JtA','<u4'),('rows_tau_des','<u4'),('rows_L','<u4'),('rows_b','<u4'),('reserved','<u4')])
+CHUNK_HEADER = np.dtype([('magic','S4'),('num_tuples','<u4'),('codec','<u4'),('reserved','<u4'),
+	('payload_bytes','<u8'),('raw_bytes','<u8')])
+FIELDS = ('JtA','tau_des','L','b')
+
+class MuscleTupleDataset(object):
+	def __init__(self,path):
+		self.path = path
+		self.data = np.memmap(path,dtype=np.uint8,mode='r')
+		header = self.data[:FILE_HEADER.itemsize].view(FILE_HEADER)[0]
+		if header['magic'] != b'MTUP':
+			raise ValueError('{} is not a muscle tuple dataset'.format(path))
+		self.value_type = np.float16 if header['dtype'] == 1 else np.float32
+		self.rows = [int(header['rows_'+f]) for f in FIELDS]
+
+		# Index every chunk once, the payloads stay on disk until they are accessed
+		self.chunks = []
+		offset = FILE_HEADER.itemsize
+		while offset + CHUNK_HEADER.itemsize <= len(self.data):
+			chunk = self.data[offset:offset+CHUNK_HEADER.itemsize].view(CHUNK_HEADER)[0]
+			begin = offset + CHUNK_HEADER.itemsize
+			end = begin + int(chunk['payload_bytes'])
+			if chunk['magic'] != b'MCHK' or end > len(self.data):
+				break	# truncated tail of a run that is still being written
+			self.chunks.append((begin,end,int(chunk['num_tuples']),int(chunk['codec'])))
+			offset = end
+		self.offsets = np.cumsum([0]+[c[2] for c in self.chunks])
+
+	def __len__(self):
+		return int(self.offsets[-1])
+
+	def NumChunks(self):
+		return len(self.chunks)
+
+	def GetChunk(self,i):
+		"""Returns a dict of (num_tuples x rows) float arrays. Uncompressed chunks are zero-copy views."""
+		begin,end,n,codec = self.chunks[i]
+		payload = self.data[begin:end]
+		if codec == 1:
+			payload = np.frombuffer(zlib.decompress(payload.tobytes()),dtype=np.uint8)
+		values = payload.view(self.value_type)
+		out = {}
+		o = 0
+		for f,r in zip(FIELDS,self.rows):
+			out[f] = values[o:o+n*r].reshape(n,r)
+			o += n*r
+		return out
+
+	def Chunks(self,shuffle=False):
+		order = np.random.permutation(len(self.chunks)) if shuffle else range(len(self.chunks))
+		for i in order:
+			yield self.GetChunk(i)
+
+	def LoadAll(self):
+		chunks = [self.GetChunk(i) for i in range(len(self.chunks))]
+		return {f:np.concatenate([c[f] for c in chunks]).astype(np.float32) for f in FIELDS}
@@ -0,0 +1,162 @@
+#include "NumaTopology.h"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace
+{
+// From linux/mempolicy.h
+const unsigned long MPOL_F_NODE = 1<<0;
+const unsigned long MPOL_F_ADDR = 1<<1;
+
+/**
+ * @brief Parses a sysfs cpu list such as "0-7,16-23".
+ */
+std::vector<int>
+ParseCpuList(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::stringstream ss(list);
+	std::string range;
+	while(std::getline(ss,range,','))
+	{
+		if(range.empty() || range[0]=='\n')
+			continue;
+		size_t dash = range.find('-');
+		int begin = atoi(range.c_str());
+		int end = dash==std::string::npos ? begin : atoi(range.c_str()+dash+1);
+		for(int c=begin;c<=end;c++)
+			cpus.push_back(c);
+	}
+	return cpus;
+}
+}
+
+NumaTopology::
+NumaTopology()
+	:mFake(false)
+{
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	bool has_mask = sched_getaffinity(0,sizeof(allowed),&allowed)==0;
+
+	for(int node=0;;node++)
+	{
+		std::ifstream ifs("/sys/devices/system/node/node"+std::to_string(node)+"/cpulist");
+		if(!ifs.is_open())
+			break;
+		std::string list;
+		std::getline(ifs,list);
+		std::vector<int> cpus;
+		for(int c : ParseCpuList(list))
+			if(!has_mask || CPU_ISSET(c,&allowed))
+				cpus.push_back(c);
+		if(!cpus.empty())
+			mNodeCpus.push_back(cpus);
+	}
+	if(mNodeCpus.empty())
+	{
+		std::vector<int> cpus;
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		for(int c=0;c<n;c++)
+			if(!has_mask || CPU_ISSET(c,&allowed))
+				cpus.push_back(c);
+		mNodeCpus.push_back(cpus);
+	}
+
+	const char* fake = getenv("MASS_FAKE_NUMA_NODES");
+	int num_fake = fake==nullptr ? 0 : atoi(fake);
+	if(mNodeCpus.size()==1)
+		num_fake = std::min<int>(num_fake,mNodeCpus[0].size());
+	if(mNodeCpus.size()==1 && num_fake>1)
+	{
+		std::vector<int> cpus = mNodeCpus[0];
+		mNodeCpus.clear();
+		for(int i=0;i<num_fake;i++)
+			mNodeCpus.push_back(std::vector<int>(cpus.begin()+i*cpus.size()/num_fake,cpus.begin()+(i+1)*cpus.size()/num_fake));
+		mFake = true;
+	}
+}
+
+/**
+ * @brief Spreads threads over nodes in contiguous blocks (threads 0..k-1 on
+ * the first node, and so on), round-robin over the CPUs within a node.
+ *
+ * @param num_threads - number of threads to place
+ * @param num_nodes - number of nodes to use, 0 for all
+ * @param offset - CPUs to skip within every node, so that processes sharing
+ * the machine (shards, rollout servers) get different CPUs
+ */
+std::vector<int>
+NumaTopology::
+AssignCpus(int num_threads,int num_nodes,int offset)
+{
+	if(num_nodes<=0 || num_nodes>GetNumNodes())
+		num_nodes = GetNumNodes();
+	std::vector<int> cpus(num_threads);
+	for(int t=0;t<num_threads;t++)
+	{
+		int node = (int)((long long)t*num_nodes/num_threads);
+		int first = (int)(((long long)node*num_threads+num_nodes-1)/num_nodes);
+		const std::vector<int>& node_cpus = mNodeCpus[node];
+		cpus[t] = node_cpus[(t-first+std::max(offset,0))%node_cpus.size()];
+	}
+	return cpus;
+}
+int
+NumaTopology::
+NodeOfCpu(int cpu)
+{
+	for(int n=0;n<GetNumNodes();n++)
+		for(int c : mNodeCpus[n])
+			if(c==cpu)
+				return n;
+	return -1;
+}
+
+bool
+PinCurrentThread(int cpu)
+{
+	return SetCurrentAffinity(std::vector<int>(1,cpu));
+}
+std::vector<int>
+GetCurrentAffinity()
+{
+	std::vector<int> cpus;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0,sizeof(set),&set)!=0)
+		return cpus;
+	for(int c=0;c<CPU_SETSIZE;c++)
+		if(CPU_ISSET(c,&set))
+			cpus.push_back(c);
+	return cpus;
+}
+bool
+SetCurrentAffinity(const std::vector<int>& cpus)
+{
+	if(cpus.empty())
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int c : cpus)
+		CPU_SET(c,&set);
+	return sched_setaffinity(0,sizeof(set),&set)==0;
+}
+int
+CurrentCpu()
+{
+	return sched_getcpu();
+}
+int
+NodeOfAddress(const void* addr)
+{
+	int node = -1;
+	if(syscall(SYS_get_mempolicy,&node,nullptr,0,const_cast<void*>(addr),MPOL_F_NODE|MPOL_F_ADDR)!=0)
+		return -1;
+	return node;
+}
@@ -0,0 +1,38 @@
+#ifndef __NUMA_TOPOLOGY_H__
+#define __NUMA_TOPOLOGY_H__
+#include <string>
+#include <vector>
+
+/**
+ * @brief CPUs of each NUMA node, read from /sys/devices/system/node so that
+ * libnuma is not needed. Only CPUs in this process's affinity mask are listed.
+ *
+ * Where the machine has a single node (or sysfs is unavailable) the CPUs can
+ * be split into MASS_FAKE_NUMA_NODES pretend nodes, which exercises the same
+ * placement code on a workstation.
+ */
+class NumaTopology
+{
+public:
+	NumaTopology();
+
+	int GetNumNodes(){return mNodeCpus.size();}
+	const std::vector<int>& GetCpus(int node){return mNodeCpus[node];}
+	bool IsFake(){return mFake;}
+
+	// Node-major CPU assignment for num_threads threads over the first num_nodes nodes
+	std::vector<int> AssignCpus(int num_threads,int num_nodes,int offset = 0);
+	int NodeOfCpu(int cpu);
+private:
+	std::vector<std::vector<int>> mNodeCpus;
+	bool mFake;
+};
+
+bool PinCurrentThread(int cpu);
+std::vector<int> GetCurrentAffinity();
+bool SetCurrentAffinity(const std::vector<int>& cpus);
+int CurrentCpu();
+// Node holding the page at addr, or -1 if the kernel can't tell
+int NodeOfAddress(const void* addr);
+
+#endif
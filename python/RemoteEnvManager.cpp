@@ -0,0 +1,401 @@
+#include "RemoteEnvManager.h"
+#include <pybind11/eigen.h>
+#include <pybind11/stl.h>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <unistd.h>
+
+namespace
+{
+// Fire-and-forget requests whose acks have not been read yet, per server.
+// Bounded so neither side's socket buffer can fill up.
+const int MAX_PENDING = 64;
+
+typedef Eigen::Matrix<float,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> RowMatrixXf;
+}
+
+/**
+ * @brief Connects to every server and checks that they run the same model.
+ *
+ * @param addresses - "host:port" or "unix:/path" of each mass_rollout_server
+ */
+RemoteEnvManager::
+RemoteEnvManager(const std::vector<std::string>& addresses)
+	:mNumEnvs(0),mStatusValid(false)
+{
+	if(addresses.empty())
+		throw std::runtime_error("No rollout server given");
+	for(const auto& address : addresses)
+	{
+		Connection c;
+		c.address = address;
+		c.fd = RolloutConnect(address);
+		c.first_env = mNumEnvs;
+		c.num_envs = 0;
+		c.seq = 0;
+		c.pending = 0;
+		mConnections.push_back(c);
+
+		Send(mConnections.size()-1,ROLLOUT_HELLO,0,0,0.0f,nullptr,0);
+		Collect(mConnections.size()-1);
+		RolloutHello hello;
+		if(mPayload.size()*sizeof(float)!=sizeof(hello))
+			throw std::runtime_error("Unexpected hello from "+address);
+		std::memcpy(&hello,mPayload.data(),sizeof(hello));
+		if(mConnections.size()==1)
+			mHello = hello;
+		else if(hello.num_state!=mHello.num_state || hello.num_action!=mHello.num_action || hello.num_muscles!=mHello.num_muscles)
+			throw std::runtime_error("Rollout server "+address+" runs a different model");
+		mConnections.back().num_envs = hello.num_envs;
+		mNumEnvs += hello.num_envs;
+		std::cout<<"Rollout server "<<address<<" : "<<hello.num_envs<<" envs"<<std::endl;
+	}
+	mHello.num_envs = mNumEnvs;
+
+	mEoe.resize(mNumEnvs);
+	mRewards.resize(mNumEnvs);
+	mStates.resize(mNumEnvs,GetNumState());
+	mMuscleTorques.resize(mNumEnvs,GetNumTotalMuscleRelatedDofs());
+	mDesiredTorques.resize(mNumEnvs,GetNumAction());
+}
+RemoteEnvManager::
+~RemoteEnvManager()
+{
+	for(int c=0;c<mConnections.size();c++)
+	{
+		try
+		{
+			Send(c,ROLLOUT_CLOSE,0,0,0.0f,nullptr,0);
+			Collect(c);
+		}
+		catch(const std::exception&)
+		{
+		}
+		close(mConnections[c].fd);
+	}
+}
+void
+RemoteEnvManager::
+Send(int c,uint16_t type,int id,int num,float value,const float* payload,size_t num_values)
+{
+	Connection& conn = mConnections[c];
+	if(conn.pending>=MAX_PENDING)
+		Collect(c);
+	RolloutHeader header;
+	std::memset(&header,0,sizeof(header));
+	header.type = type;
+	header.seq = conn.seq++;
+	header.id = id;
+	header.num = num;
+	header.value = value;
+	RolloutSend(conn.fd,header,payload,num_values);
+	conn.pending++;
+	if(type!=ROLLOUT_GET_EPISODE_STATUS && type!=ROLLOUT_HELLO)
+		mStatusValid = false;
+}
+
+/**
+ * @brief Reads the replies to every request sent to the server so far. The
+ * payload of the last one is left in mPayload, and its num field is returned.
+ */
+int
+RemoteEnvManager::
+Collect(int c)
+{
+	Connection& conn = mConnections[c];
+	RolloutHeader header;
+	header.num = 0;
+	while(conn.pending>0)
+	{
+		if(!RolloutRecv(conn.fd,header,mPayload))
+			throw std::runtime_error("Rollout server "+conn.address+" closed the connection");
+		conn.pending--;
+		if(header.status!=0)
+			throw std::runtime_error("Rollout server "+conn.address+" failed request "+std::to_string(header.seq));
+	}
+	return header.num;
+}
+void
+RemoteEnvManager::
+SendAll(uint16_t type,int num)
+{
+	for(int c=0;c<mConnections.size();c++)
+		Send(c,type,0,num,0.0f,nullptr,0);
+}
+
+/**
+ * @brief Splits the rows of m over the servers and sends them as float32.
+ */
+void
+RemoteEnvManager::
+SendRows(uint16_t type,const Eigen::MatrixXd& m)
+{
+	if(m.rows()!=mNumEnvs)
+		throw std::runtime_error("Expected one row per environment");
+	for(int c=0;c<mConnections.size();c++)
+	{
+		const Connection& conn = mConnections[c];
+		mPacked.clear();
+		PackRows(Eigen::MatrixXd(m.middleRows(conn.first_env,conn.num_envs)),mPacked);
+		Send(c,type,0,0,0.0f,mPacked.data(),mPacked.size());
+	}
+}
+
+/**
+ * @brief Requests the same per-env quantity from every server, then
+ * concatenates the replies. All servers are asked before any reply is read.
+ */
+void
+RemoteEnvManager::
+GatherRows(uint16_t type,Eigen::MatrixXd& out)
+{
+	SendAll(type,0);
+	for(int c=0;c<mConnections.size();c++)
+	{
+		const Connection& conn = mConnections[c];
+		Collect(c);
+		if(mPayload.size()!=(size_t)conn.num_envs*out.cols())
+			throw std::runtime_error("Unexpected reply size from "+conn.address);
+		out.middleRows(conn.first_env,conn.num_envs) = Eigen::Map<RowMatrixXf>(mPayload.data(),conn.num_envs,out.cols()).cast<double>();
+	}
+}
+void
+RemoteEnvManager::
+GatherRows(uint16_t type,Eigen::VectorXd& out)
+{
+	SendAll(type,0);
+	for(int c=0;c<mConnections.size();c++)
+	{
+		const Connection& conn = mConnections[c];
+		Collect(c);
+		if(mPayload.size()!=(size_t)conn.num_envs)
+			throw std::runtime_error("Unexpected reply size from "+conn.address);
+		out.segment(conn.first_env,conn.num_envs) = Eigen::Map<Eigen::VectorXf>(mPayload.data(),conn.num_envs).cast<double>();
+	}
+}
+int
+RemoteEnvManager::
+ConnectionOf(int id)
+{
+	for(int c=0;c<mConnections.size();c++)
+		if(id<mConnections[c].first_env+mConnections[c].num_envs)
+			return c;
+	throw std::runtime_error("Environment id out of range");
+}
+
+/**
+ * @brief Fetches end-of-episode flags and rewards of every env in one round trip.
+ */
+void
+RemoteEnvManager::
+FetchEpisodeStatus()
+{
+	if(mStatusValid)
+		return;
+	mStatusEoe.resize(mNumEnvs);
+	mStatusRewards.resize(mNumEnvs);
+	SendAll(ROLLOUT_GET_EPISODE_STATUS,0);
+	for(int c=0;c<mConnections.size();c++)
+	{
+		const Connection& conn = mConnections[c];
+		Collect(c);
+		if(mPayload.size()!=2*(size_t)conn.num_envs)
+			throw std::runtime_error("Unexpected reply size from "+conn.address);
+		Eigen::Map<Eigen::VectorXf> values(mPayload.data(),2*conn.num_envs);
+		mStatusEoe.segment(conn.first_env,conn.num_envs) = values.head(conn.num_envs).cast<double>();
+		mStatusRewards.segment(conn.first_env,conn.num_envs) = values.tail(conn.num_envs).cast<double>();
+	}
+	mStatusValid = true;
+}
+void
+RemoteEnvManager::
+Step(int id)
+{
+	int c = ConnectionOf(id);
+	Send(c,ROLLOUT_STEPS,id-mConnections[c].first_env,1,0.0f,nullptr,0);
+}
+void
+RemoteEnvManager::
+Reset(bool RSI,int id)
+{
+	int c = ConnectionOf(id);
+	Send(c,ROLLOUT_RESET,id-mConnections[c].first_env,RSI,0.0f,nullptr,0);
+}
+bool
+RemoteEnvManager::
+IsEndOfEpisode(int id)
+{
+	FetchEpisodeStatus();
+	return mStatusEoe[id]!=0.0;
+}
+double
+RemoteEnvManager::
+GetReward(int id)
+{
+	FetchEpisodeStatus();
+	return mStatusRewards[id];
+}
+void
+RemoteEnvManager::
+Steps(int num)
+{
+	// id = -1 steps every env of the server
+	for(int c=0;c<mConnections.size();c++)
+		Send(c,ROLLOUT_STEPS,-1,num,0.0f,nullptr,0);
+}
+void
+RemoteEnvManager::
+StepsAtOnce()
+{
+	Steps(GetNumSteps());
+}
+void
+RemoteEnvManager::
+StepControl(const Eigen::MatrixXd& actions)
+{
+	SendRows(ROLLOUT_STEP_CONTROL,actions);
+}
+void
+RemoteEnvManager::
+Resets(bool RSI)
+{
+	SendAll(ROLLOUT_RESETS,RSI);
+}
+const Eigen::VectorXd&
+RemoteEnvManager::
+IsEndOfEpisodes()
+{
+	GatherRows(ROLLOUT_IS_END_OF_EPISODES,mEoe);
+	return mEoe;
+}
+const Eigen::MatrixXd&
+RemoteEnvManager::
+GetStates()
+{
+	GatherRows(ROLLOUT_GET_STATES,mStates);
+	return mStates;
+}
+void
+RemoteEnvManager::
+SetActions(const Eigen::MatrixXd& actions)
+{
+	SendRows(ROLLOUT_SET_ACTIONS,actions);
+}
+const Eigen::VectorXd&
+RemoteEnvManager::
+GetRewards()
+{
+	GatherRows(ROLLOUT_GET_REWARDS,mRewards);
+	return mRewards;
+}
+const Eigen::VectorXd&
+RemoteEnvManager::
+GetGaitRewards()
+{
+	GatherRows(ROLLOUT_GET_GAIT_REWARDS,mRewards);
+	return mRewards;
+}
+const Eigen::MatrixXd&
+RemoteEnvManager::
+GetMuscleTorques()
+{
+	GatherRows(ROLLOUT_GET_MUSCLE_TORQUES,mMuscleTorques);
+	return mMuscleTorques;
+}
+const Eigen::MatrixXd&
+RemoteEnvManager::
+GetDesiredTorques()
+{
+	GatherRows(ROLLOUT_GET_DESIRED_TORQUES,mDesiredTorques);
+	return mDesiredTorques;
+}
+void
+RemoteEnvManager::
+SetActivationLevels(const Eigen::MatrixXd& activations)
+{
+	SendRows(ROLLOUT_SET_ACTIVATION_LEVELS,activations);
+}
+void
+RemoteEnvManager::
+ComputeMuscleTuples()
+{
+	int rows[4] = {GetNumTotalMuscleRelatedDofs(),GetNumAction(),GetNumAction()*GetNumMuscles(),GetNumAction()};
+	Eigen::MatrixXd* dst[4] = {&mMuscleTuplesJtA,&mMuscleTuplesTauDes,&mMuscleTuplesL,&mMuscleTuplesb};
+	int tuple_size = rows[0]+rows[1]+rows[2]+rows[3];
+
+	SendAll(ROLLOUT_COMPUTE_MUSCLE_TUPLES,0);
+	std::vector<std::vector<float>> replies(mConnections.size());
+	std::vector<int> counts(mConnections.size());
+	int n = 0;
+	for(int c=0;c<mConnections.size();c++)
+	{
+		counts[c] = Collect(c);
+		if(mPayload.size()!=(size_t)counts[c]*tuple_size)
+			throw std::runtime_error("Unexpected reply size from "+mConnections[c].address);
+		replies[c].swap(mPayload);
+		n += counts[c];
+	}
+	for(int f=0;f<4;f++)
+		dst[f]->resize(n,rows[f]);
+
+	int o = 0;
+	for(int c=0;c<mConnections.size();c++)
+	{
+		const float* p = replies[c].data();
+		for(int f=0;f<4;f++)
+		{
+			dst[f]->middleRows(o,counts[c]) = Eigen::Map<const RowMatrixXf>(p,counts[c],rows[f]).cast<double>();
+			p += (size_t)counts[c]*rows[f];
+		}
+		o += counts[c];
+	}
+}
+void
+RemoteEnvManager::
+SetExoTorque(int which,float T)
+{
+	for(int c=0;c<mConnections.size();c++)
+		Send(c,ROLLOUT_SET_EXO_TORQUE,which,0,T,nullptr,0);
+}
+
+void
+BindRemoteEnvManager(py::module& m)
+{
+	py::class_<RemoteEnvManager>(m, "pymss_remote")
+		.def(py::init<std::vector<std::string>>())
+		.def("GetNumEnvs",&RemoteEnvManager::GetNumEnvs)
+		.def("GetNumState",&RemoteEnvManager::GetNumState)
+		.def("GetNumAction",&RemoteEnvManager::GetNumAction)
+		.def("GetSimulationHz",&RemoteEnvManager::GetSimulationHz)
+		.def("GetControlHz",&RemoteEnvManager::GetControlHz)
+		.def("GetNumSteps",&RemoteEnvManager::GetNumSteps)
+		.def("UseMuscle",&RemoteEnvManager::UseMuscle)
+		.def("Step",&RemoteEnvManager::Step)
+		.def("Reset",&RemoteEnvManager::Reset)
+		.def("IsEndOfEpisode",&RemoteEnvManager::IsEndOfEpisode)
+		.def("GetReward",&RemoteEnvManager::GetReward)
+		.def("Steps",&RemoteEnvManager::Steps)
+		.def("StepsAtOnce",&RemoteEnvManager::StepsAtOnce)
+		.def("StepControl",&RemoteEnvManager::StepControl)
+		.def("Resets",&RemoteEnvManager::Resets)
+		.def("IsEndOfEpisodes",&RemoteEnvManager::IsEndOfEpisodes)
+		.def("GetStates",&RemoteEnvManager::GetStates)
+		.def("SetActions",&RemoteEnvManager::SetActions)
+		.def("GetRewards",&RemoteEnvManager::GetRewards)
+		.def("GetGaitRewards",&RemoteEnvManager::GetGaitRewards)
+		.def("GetNumTotalMuscleRelatedDofs",&RemoteEnvManager::GetNumTotalMuscleRelatedDofs)
+		.def("GetNumMuscles",&RemoteEnvManager::GetNumMuscles)
+		.def("GetMuscleTorques",&RemoteEnvManager::GetMuscleTorques)
+		.def("GetDesiredTorques",&RemoteEnvManager::GetDesiredTorques)
+		.def("SetActivationLevels",&RemoteEnvManager::SetActivationLevels)
+		.def("ComputeMuscleTuples",&RemoteEnvManager::ComputeMuscleTuples)
+		.def("GetMuscleTuplesJtA",&RemoteEnvManager::GetMuscleTuplesJtA)
+		.def("GetMuscleTuplesTauDes",&RemoteEnvManager::GetMuscleTuplesTauDes)
+		.def("GetMuscleTuplesL",&RemoteEnvManager::GetMuscleTuplesL)
+		.def("GetMuscleTuplesb",&RemoteEnvManager::GetMuscleTuplesb)
+		.def("SetLHipTs",&RemoteEnvManager::SetLHipTs)
+		.def("SetRHipTs",&RemoteEnvManager::SetRHipTs)
+		.def("SetLKneeTs",&RemoteEnvManager::SetLKneeTs)
+		.def("SetRKneeTs",&RemoteEnvManager::SetRKneeTs);
+}
@@ -0,0 +1,110 @@
+#ifndef __REMOTE_ENV_MANAGER_H__
+#define __REMOTE_ENV_MANAGER_H__
+#include "RolloutProtocol.h"
+#include <pybind11/pybind11.h>
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+namespace py = pybind11;
+
+/**
+ * @brief Python-facing EnvManager replacement whose environments live in one
+ * or more mass_rollout_server processes, possibly on other machines. The
+ * servers' environments are concatenated in the order the addresses are given.
+ *
+ * Setters and steps are pipelined: they are sent without waiting for the
+ * reply, and every server works on a batched request in parallel. The
+ * per-env IsEndOfEpisode/GetReward calls main.py makes after each control
+ * step are served from one batched ROLLOUT_GET_EPISODE_STATUS per step.
+ */
+class RemoteEnvManager
+{
+public:
+	RemoteEnvManager(const std::vector<std::string>& addresses);
+	~RemoteEnvManager();
+
+	int GetNumEnvs(){return mNumEnvs;}
+	int GetNumState(){return mHello.num_state;}
+	int GetNumAction(){return mHello.num_action;}
+	int GetSimulationHz(){return mHello.sim_hz;}
+	int GetControlHz(){return mHello.con_hz;}
+	int GetNumSteps(){return mHello.num_steps;}
+	bool UseMuscle(){return mHello.use_muscle!=0;}
+
+	void Step(int id);
+	void Reset(bool RSI,int id);
+	bool IsEndOfEpisode(int id);
+	double GetReward(int id);
+
+	void Steps(int num);
+	void StepsAtOnce();
+	void StepControl(const Eigen::MatrixXd& actions);
+	void Resets(bool RSI);
+	const Eigen::VectorXd& IsEndOfEpisodes();
+	const Eigen::MatrixXd& GetStates();
+	void SetActions(const Eigen::MatrixXd& actions);
+	const Eigen::VectorXd& GetRewards();
+	const Eigen::VectorXd& GetGaitRewards();
+
+	int GetNumTotalMuscleRelatedDofs(){return mHello.num_related_dofs;}
+	int GetNumMuscles(){return mHello.num_muscles;}
+	const Eigen::MatrixXd& GetMuscleTorques();
+	const Eigen::MatrixXd& GetDesiredTorques();
+	void SetActivationLevels(const Eigen::MatrixXd& activations);
+
+	void ComputeMuscleTuples();
+	const Eigen::MatrixXd& GetMuscleTuplesJtA(){return mMuscleTuplesJtA;}
+	const Eigen::MatrixXd& GetMuscleTuplesTauDes(){return mMuscleTuplesTauDes;}
+	const Eigen::MatrixXd& GetMuscleTuplesL(){return mMuscleTuplesL;}
+	const Eigen::MatrixXd& GetMuscleTuplesb(){return mMuscleTuplesb;}
+
+	void SetLHipTs(float T){SetExoTorque(0,T);}
+	void SetRHipTs(float T){SetExoTorque(1,T);}
+	void SetLKneeTs(float T){SetExoTorque(2,T);}
+	void SetRKneeTs(float T){SetExoTorque(3,T);}
+private:
+	struct Connection
+	{
+		std::string address;
+		int fd;
+		int first_env;
+		int num_envs;
+		uint32_t seq;
+		int pending;
+	};
+
+	void Send(int c,uint16_t type,int id,int num,float value,const float* payload,size_t num_values);
+	void SendRows(uint16_t type,const Eigen::MatrixXd& m);
+	void SendAll(uint16_t type,int num);
+	int Collect(int c);
+	void GatherRows(uint16_t type,Eigen::MatrixXd& out);
+	void GatherRows(uint16_t type,Eigen::VectorXd& out);
+	void FetchEpisodeStatus();
+	void SetExoTorque(int which,float T);
+	int ConnectionOf(int id);
+
+	std::vector<Connection> mConnections;
+	RolloutHello mHello;
+	int mNumEnvs;
+	std::vector<float> mPayload;
+	std::vector<float> mPacked;
+
+	bool mStatusValid;
+	Eigen::VectorXd mStatusEoe;
+	Eigen::VectorXd mStatusRewards;
+
+	Eigen::VectorXd mEoe;
+	Eigen::VectorXd mRewards;
+	Eigen::MatrixXd mStates;
+	Eigen::MatrixXd mMuscleTorques;
+	Eigen::MatrixXd mDesiredTorques;
+
+	Eigen::MatrixXd mMuscleTuplesJtA;
+	Eigen::MatrixXd mMuscleTuplesTauDes;
+	Eigen::MatrixXd mMuscleTuplesL;
+	Eigen::MatrixXd mMuscleTuplesb;
+};
+
+void BindRemoteEnvManager(py::module& m);
+
+#endif
@@ -0,0 +1,195 @@
+#include "RolloutProtocol.h"
+#include <stdexcept>
+#include <cstring>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace
+{
+const size_t MAX_PAYLOAD_BYTES = (size_t)1<<31;
+
+bool
+IsUnix(const std::string& address)
+{
+	return address.compare(0,5,"unix:")==0;
+}
+sockaddr_un
+UnixAddress(const std::string& address)
+{
+	sockaddr_un addr;
+	std::memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::string path = address.substr(5);
+	if(path.size()>=sizeof(addr.sun_path))
+		throw std::runtime_error("Socket path too long : "+path);
+	std::strncpy(addr.sun_path,path.c_str(),sizeof(addr.sun_path)-1);
+	return addr;
+}
+addrinfo*
+Resolve(const std::string& address,bool passive)
+{
+	size_t colon = address.find_last_of(':');
+	std::string host = colon==std::string::npos ? "" : address.substr(0,colon);
+	std::string port = colon==std::string::npos ? address : address.substr(colon+1);
+	addrinfo hints;
+	std::memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(passive)
+		hints.ai_flags = AI_PASSIVE;
+	addrinfo* result = nullptr;
+	if(getaddrinfo(host.empty() ? nullptr : host.c_str(),port.c_str(),&hints,&result)!=0)
+		throw std::runtime_error("Can't resolve address "+address);
+	return result;
+}
+void
+SetNoDelay(int fd)
+{
+	int one = 1;
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+}
+bool
+RecvAll(int fd,void* data,size_t bytes)
+{
+	char* p = static_cast<char*>(data);
+	while(bytes>0)
+	{
+		ssize_t n = recv(fd,p,bytes,0);
+		if(n<=0)
+			return false;
+		p += n;
+		bytes -= n;
+	}
+	return true;
+}
+void
+SendAll(int fd,const void* data,size_t bytes)
+{
+	const char* p = static_cast<const char*>(data);
+	while(bytes>0)
+	{
+		ssize_t n = send(fd,p,bytes,MSG_NOSIGNAL);
+		if(n<=0)
+			throw std::runtime_error("Rollout connection lost");
+		p += n;
+		bytes -= n;
+	}
+}
+}
+
+/**
+ * @brief Opens a listening socket on "host:port", ":port" or "unix:/path".
+ */
+int
+RolloutListen(const std::string& address)
+{
+	if(IsUnix(address))
+	{
+		sockaddr_un addr = UnixAddress(address);
+		unlink(addr.sun_path);
+		int fd = socket(AF_UNIX,SOCK_STREAM,0);
+		if(fd<0 || bind(fd,(sockaddr*)&addr,sizeof(addr))!=0 || listen(fd,4)!=0)
+			throw std::runtime_error("Can't listen on "+address);
+		return fd;
+	}
+	addrinfo* result = Resolve(address,true);
+	int fd = -1;
+	for(addrinfo* ai = result;ai!=nullptr;ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol);
+		if(fd<0)
+			continue;
+		int one = 1;
+		setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+		if(bind(fd,ai->ai_addr,ai->ai_addrlen)==0 && listen(fd,4)==0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+	if(fd<0)
+		throw std::runtime_error("Can't listen on "+address);
+	return fd;
+}
+int
+RolloutConnect(const std::string& address)
+{
+	if(IsUnix(address))
+	{
+		sockaddr_un addr = UnixAddress(address);
+		int fd = socket(AF_UNIX,SOCK_STREAM,0);
+		if(fd<0 || connect(fd,(sockaddr*)&addr,sizeof(addr))!=0)
+		{
+			if(fd>=0)
+				close(fd);
+			throw std::runtime_error("Can't connect to "+address);
+		}
+		return fd;
+	}
+	addrinfo* result = Resolve(address,false);
+	int fd = -1;
+	for(addrinfo* ai = result;ai!=nullptr;ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol);
+		if(fd<0)
+			continue;
+		if(connect(fd,ai->ai_addr,ai->ai_addrlen)==0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+	if(fd<0)
+		throw std::runtime_error("Can't connect to "+address);
+	SetNoDelay(fd);
+	return fd;
+}
+
+/**
+ * @brief Sends one message. The header's magic and payload_bytes are filled in here.
+ */
+void
+RolloutSend(int fd,RolloutHeader header,const float* payload,size_t num_values)
+{
+	std::memcpy(header.magic,"MRPC",4);
+	header.payload_bytes = num_values*sizeof(float);
+	SendAll(fd,&header,sizeof(header));
+	if(num_values>0)
+		SendAll(fd,payload,header.payload_bytes);
+}
+
+/**
+ * @brief Receives one message. Returns false if the peer closed the connection.
+ */
+bool
+RolloutRecv(int fd,RolloutHeader& header,std::vector<float>& payload)
+{
+	if(!RecvAll(fd,&header,sizeof(header)))
+		return false;
+	if(std::memcmp(header.magic,"MRPC",4)!=0 || header.payload_bytes>MAX_PAYLOAD_BYTES || header.payload_bytes%sizeof(float)!=0)
+		throw std::runtime_error("Malformed rollout message");
+	payload.resize(header.payload_bytes/sizeof(float));
+	return RecvAll(fd,payload.data(),header.payload_bytes);
+}
+
+/**
+ * @brief Appends the matrix to out as row-major float32.
+ */
+void
+PackRows(const Eigen::MatrixXd& m,std::vector<float>& out)
+{
+	size_t o = out.size();
+	out.resize(o+m.size());
+	Eigen::Map<Eigen::Matrix<float,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor>>(out.data()+o,m.rows(),m.cols()) = m.cast<float>();
+}
+void
+PackRows(const Eigen::VectorXd& v,std::vector<float>& out)
+{
+	size_t o = out.size();
+	out.resize(o+v.size());
+	Eigen::Map<Eigen::VectorXf>(out.data()+o,v.size()) = v.cast<float>();
+}
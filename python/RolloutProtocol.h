@@ -0,0 +1,73 @@
+#ifndef __ROLLOUT_PROTOCOL_H__
+#define __ROLLOUT_PROTOCOL_H__
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Wire protocol between RemoteEnvManager (the client inside pymss) and
+ * mass_rollout_server (rollout/main.cpp), which wraps an EnvManager.
+ *
+ * Every message is a 32 byte RolloutHeader followed by payload_bytes of
+ * little-endian float32 values (matrices are sent row-major, one row per
+ * environment). Each request is answered by exactly one response carrying the
+ * same seq, in request order, so a client can send several requests before
+ * reading any response. A non-zero status in a response means the request failed.
+ *
+ * Addresses are either "host:port" (TCP) or "unix:/path/to/socket".
+ */
+enum RolloutRequestType
+{
+	ROLLOUT_HELLO = 1,				// -> RolloutHello
+	ROLLOUT_CLOSE,
+	ROLLOUT_RESET,					// id, num = RSI
+	ROLLOUT_RESETS,					// num = RSI
+	ROLLOUT_STEPS,					// num = number of simulation steps
+	ROLLOUT_STEP_CONTROL,			// actions -> SetActions + StepsAtOnce
+	ROLLOUT_SET_ACTIONS,			// actions
+	ROLLOUT_GET_STATES,				// -> states
+	ROLLOUT_GET_REWARDS,			// -> rewards
+	ROLLOUT_GET_GAIT_REWARDS,		// -> gait rewards
+	ROLLOUT_IS_END_OF_EPISODES,		// -> end of episode flags
+	ROLLOUT_GET_EPISODE_STATUS,		// -> end of episode flags, then rewards
+	ROLLOUT_GET_MUSCLE_TORQUES,		// -> muscle torques
+	ROLLOUT_GET_DESIRED_TORQUES,	// -> desired torques
+	ROLLOUT_SET_ACTIVATION_LEVELS,	// activations
+	ROLLOUT_COMPUTE_MUSCLE_TUPLES,	// -> num = number of tuples, JtA, tau_des, L, b blocks
+	ROLLOUT_SET_EXO_TORQUE			// id = 0 left hip, 1 right hip, 2 left knee, 3 right knee, value = torque
+};
+struct RolloutHeader
+{
+	char magic[4];		// "MRPC"
+	uint16_t type;
+	uint16_t status;
+	uint32_t seq;
+	int32_t id;
+	int32_t num;
+	float value;
+	uint64_t payload_bytes;
+};
+struct RolloutHello
+{
+	int32_t num_envs;
+	int32_t num_state;
+	int32_t num_action;
+	int32_t num_muscles;
+	int32_t num_related_dofs;
+	int32_t sim_hz;
+	int32_t con_hz;
+	int32_t num_steps;
+	int32_t use_muscle;
+	int32_t reserved[7];
+};
+
+int RolloutListen(const std::string& address);
+int RolloutConnect(const std::string& address);
+void RolloutSend(int fd,RolloutHeader header,const float* payload,size_t num_values);
+bool RolloutRecv(int fd,RolloutHeader& header,std::vector<float>& payload);
+
+void PackRows(const Eigen::MatrixXd& m,std::vector<float>& out);
+void PackRows(const Eigen::VectorXd& v,std::vector<float>& out);
+
+#endif
@@ -0,0 +1,785 @@
+#include "ShardedEnvManager.h"
+#include "EnvManager.h"
+#include <pybind11/eigen.h>
+#include <pybind11/stl.h>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <climits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+extern char** environ;
+
+/**
+ * This file implements the multi-process version of EnvManager. The parent
+ * (the python process running main.py) owns no environments itself; it only
+ * forwards commands to the shard workers, which are separate python processes
+ * running RunShardWorker below on their slice of the environments.
+ */
+
+namespace
+{
+const int SPIN_COUNT = 4000;
+
+void
+FutexWait(std::atomic<uint32_t>* addr,uint32_t expected,long timeout_ms)
+{
+	timespec ts;
+	ts.tv_sec = timeout_ms/1000;
+	ts.tv_nsec = (timeout_ms%1000)*1000000L;
+	syscall(SYS_futex,reinterpret_cast<uint32_t*>(addr),FUTEX_WAIT,expected,&ts,nullptr,0);
+}
+void
+FutexWake(std::atomic<uint32_t>* addr)
+{
+	syscall(SYS_futex,reinterpret_cast<uint32_t*>(addr),FUTEX_WAKE,INT_MAX,nullptr,nullptr,0);
+}
+inline void
+CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+void*
+MapSegment(const std::string& name,size_t bytes,bool create)
+{
+	int fd = shm_open(name.c_str(),create ? (O_CREAT|O_EXCL|O_RDWR) : O_RDWR,0600);
+	if(fd<0)
+		throw std::runtime_error("Can't open shared memory "+name);
+	if(create && ftruncate(fd,bytes)!=0)
+	{
+		close(fd);
+		throw std::runtime_error("Can't resize shared memory "+name);
+	}
+	void* ptr = mmap(nullptr,bytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	close(fd);
+	if(ptr==MAP_FAILED)
+		throw std::runtime_error("Can't map shared memory "+name);
+	return ptr;
+}
+
+/**
+ * Offsets (in doubles) of the per-env arrays in the data segment. All arrays
+ * are row-major with one row per environment.
+ */
+struct ShardDataLayout
+{
+	size_t states,actions,rewards,eoe,muscle_torques,desired_torques,activations,total;
+
+	ShardDataLayout(const ShardedControl* c)
+	{
+		size_t n = c->num_envs;
+		states = 0;
+		actions = states + n*c->num_state;
+		rewards = actions + n*c->num_action;
+		eoe = rewards + n;
+		muscle_torques = eoe + n;
+		desired_torques = muscle_torques + n*c->num_related_dofs;
+		activations = desired_torques + n*c->num_action;
+		total = activations + n*c->num_muscles;
+	}
+};
+
+typedef Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> RowMatrixXd;
+
+std::string
+TupleSegmentName(const std::string& name,int shard)
+{
+	return name+"_t"+std::to_string(shard);
+}
+}
+
+/**
+ * @brief Creates the shared control segment and launches one worker process
+ * per shard. Returns once every worker has built its environments.
+ *
+ * @param meta_file - metadata file, as for EnvManager
+ * @param num_envs - total number of environments
+ * @param num_shards - number of worker processes the environments are split over
+ * @param pin_threads - pin the threads of every worker, each shard starting
+ * at its first env's CPU so that the workers don't share CPUs
+ */
+ShardedEnvManager::
+ShardedEnvManager(std::string meta_file,int num_envs,int num_shards,bool pin_threads)
+	:mNumEnvs(num_envs),mNumShards(std::max(1,std::min(std::min(num_shards,num_envs),SHARD_MAX_SHARDS))),
+	mControl(nullptr),mData(nullptr),mDataBytes(0)
+{
+	static int count = 0;
+	mName = "/mass_"+std::to_string(getpid())+"_"+std::to_string(count++);
+
+	mControl = static_cast<ShardedControl*>(MapSegment(mName,sizeof(ShardedControl),true));
+	// a failed worker or fork must not leave processes and segments behind
+	try
+	{
+		std::memset(static_cast<void*>(mControl),0,sizeof(ShardedControl));
+		mControl->num_envs = mNumEnvs;
+		mControl->num_shards = mNumShards;
+		mControl->pin_threads = pin_threads;
+		std::strncpy(mControl->meta_file,meta_file.c_str(),sizeof(mControl->meta_file)-1);
+		for(int s=0;s<mNumShards;s++)
+		{
+			ShardChannel& ch = mControl->channels[s];
+			ch.first_env = (int)((long long)s*mNumEnvs/mNumShards);
+			ch.num_envs = (int)((long long)(s+1)*mNumEnvs/mNumShards) - ch.first_env;
+		}
+		mIssued.resize(mNumShards,0);
+
+		// Workers are fresh python processes importing this very module, so they
+		// do not inherit the OpenMP/torch thread state of this process.
+		Dl_info info;
+		dladdr(reinterpret_cast<void*>(&RunShardWorker),&info);
+		std::string module_dir(info.dli_fname);
+		module_dir = module_dir.substr(0,module_dir.find_last_of('/'));
+		std::string python = py::module::import("sys").attr("executable").cast<std::string>();
+
+		std::vector<std::string> env;
+		std::string python_path = "PYTHONPATH="+module_dir;
+		for(char** e = environ;*e!=nullptr;e++)
+		{
+			if(std::strncmp(*e,"PYTHONPATH=",11)==0)
+				python_path += ":"+std::string(*e+11);
+			else
+				env.push_back(*e);
+		}
+		env.push_back(python_path);
+		std::vector<char*> envp;
+		for(auto& e : env)
+			envp.push_back(const_cast<char*>(e.c_str()));
+		envp.push_back(nullptr);
+
+		pid_t parent = getpid();
+		for(int s=0;s<mNumShards;s++)
+		{
+			std::string code = "import pymss; pymss.RunShardWorker('"+mName+"',"+std::to_string(s)+")";
+			pid_t pid = fork();
+			if(pid==0)
+			{
+				prctl(PR_SET_PDEATHSIG,SIGTERM);
+				if(getppid()!=parent)
+					_exit(1);
+				execle(python.c_str(),python.c_str(),"-c",code.c_str(),(char*)nullptr,envp.data());
+				_exit(1);
+			}
+			if(pid<0)
+				throw std::runtime_error("Can't fork shard worker");
+			mPids.push_back(pid);
+		}
+
+		for(int s=0;s<mNumShards;s++)
+		{
+			ShardChannel& ch = mControl->channels[s];
+			while(ch.ready.load(std::memory_order_acquire)==0)
+			{
+				FutexWait(&ch.ready,0,100);
+				CheckWorkers();
+			}
+		}
+		std::cout<<"Sharded EnvManager : "<<mNumEnvs<<" envs over "<<mNumShards<<" processes"<<std::endl;
+
+		MapData();
+	}
+	catch(...)
+	{
+		Shutdown(false);
+		throw;
+	}
+}
+ShardedEnvManager::
+~ShardedEnvManager()
+{
+	Shutdown(true);
+}
+
+/**
+ * @brief Stops the workers, with SHARD_QUIT (they close their datasets and
+ * logs) if asked to and all of them are alive, with SIGTERM otherwise, and
+ * removes the shared segments.
+ */
+void
+ShardedEnvManager::
+Shutdown(bool graceful)
+{
+	bool alive = graceful;
+	for(pid_t pid : mPids)
+		if(pid<0 || waitpid(pid,nullptr,WNOHANG)!=0)
+			alive = false;
+	if(alive)
+	{
+		ShardCommand cmd = {SHARD_QUIT,0,0,0,0.0};
+		try
+		{
+			Broadcast(cmd);
+		}
+		catch(const std::exception&)
+		{
+			alive = false;
+		}
+	}
+	for(pid_t pid : mPids)
+	{
+		if(pid<0)
+			continue;
+		if(!alive)
+			kill(pid,SIGTERM);
+		waitpid(pid,nullptr,0);
+	}
+	mPids.clear();
+
+	if(mData!=nullptr)
+		munmap(mData,mDataBytes);
+	mData = nullptr;
+	if(mControl!=nullptr)
+		munmap(mControl,sizeof(ShardedControl));
+	mControl = nullptr;
+	shm_unlink(mName.c_str());
+	shm_unlink((mName+"_data").c_str());
+	for(int s=0;s<mNumShards;s++)
+		shm_unlink(TupleSegmentName(mName,s).c_str());
+}
+
+/**
+ * @brief Creates the data segment once the workers have reported the
+ * state/action dimensions, and asks them to map it.
+ */
+void
+ShardedEnvManager::
+MapData()
+{
+	ShardDataLayout layout(mControl);
+	mDataBytes = std::max<size_t>(1,layout.total)*sizeof(double);
+	mData = static_cast<double*>(MapSegment(mName+"_data",mDataBytes,true));
+	mSharedStates = mData+layout.states;
+	mSharedActions = mData+layout.actions;
+	mSharedRewards = mData+layout.rewards;
+	mSharedEoe = mData+layout.eoe;
+	mSharedMuscleTorques = mData+layout.muscle_torques;
+	mSharedDesiredTorques = mData+layout.desired_torques;
+	mSharedActivations = mData+layout.activations;
+
+	mEoe.resize(mNumEnvs);
+	mRewards.resize(mNumEnvs);
+	mStates.resize(mNumEnvs,GetNumState());
+	mMuscleTorques.resize(mNumEnvs,GetNumTotalMuscleRelatedDofs());
+	mDesiredTorques.resize(mNumEnvs,GetNumAction());
+
+	ShardCommand cmd = {SHARD_MAP_DATA,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+}
+void
+ShardedEnvManager::
+CheckWorkers()
+{
+	for(int s=0;s<mNumShards;s++)
+	{
+		int status;
+		if(waitpid(mPids[s],&status,WNOHANG)==mPids[s])
+		{
+			mPids[s] = -1;
+			throw std::runtime_error("Shard worker "+std::to_string(s)+" exited unexpectedly");
+		}
+	}
+}
+int
+ShardedEnvManager::
+ShardOf(int id)
+{
+	int s = (int)((long long)id*mNumShards/mNumEnvs);
+	while(id<mControl->channels[s].first_env)
+		s--;
+	while(id>=mControl->channels[s].first_env+mControl->channels[s].num_envs)
+		s++;
+	return s;
+}
+
+/**
+ * @brief Appends a command to a shard's ring without waiting for it to run.
+ * Blocks only if the ring is full.
+ */
+void
+ShardedEnvManager::
+Push(int shard,const ShardCommand& cmd)
+{
+	ShardChannel& ch = mControl->channels[shard];
+	while(mIssued[shard]-ch.tail.load(std::memory_order_acquire)>=(uint32_t)SHARD_RING_SIZE)
+	{
+		FutexWait(&ch.tail,ch.tail.load(std::memory_order_acquire),100);
+		CheckWorkers();
+	}
+	ch.ring[mIssued[shard]%SHARD_RING_SIZE] = cmd;
+	mIssued[shard]++;
+	ch.head.store(mIssued[shard],std::memory_order_release);
+	FutexWake(&ch.head);
+}
+void
+ShardedEnvManager::
+Broadcast(const ShardCommand& cmd)
+{
+	for(int s=0;s<mNumShards;s++)
+		Push(s,cmd);
+}
+
+/**
+ * @brief Blocks until the shard has executed every command issued so far.
+ */
+void
+ShardedEnvManager::
+Wait(int shard)
+{
+	ShardChannel& ch = mControl->channels[shard];
+	int spins = 0;
+	uint32_t tail;
+	while((tail = ch.tail.load(std::memory_order_acquire))!=mIssued[shard])
+	{
+		if(++spins<SPIN_COUNT)
+		{
+			CpuRelax();
+			continue;
+		}
+		FutexWait(&ch.tail,tail,100);
+		CheckWorkers();
+	}
+}
+void
+ShardedEnvManager::
+WaitAll()
+{
+	for(int s=0;s<mNumShards;s++)
+		Wait(s);
+}
+void
+ShardedEnvManager::
+CopyRows(double* shared,Eigen::MatrixXd& m)
+{
+	m = Eigen::Map<RowMatrixXd>(shared,m.rows(),m.cols());
+}
+void
+ShardedEnvManager::
+Step(int id)
+{
+	int s = ShardOf(id);
+	ShardCommand cmd = {SHARD_STEP,id-mControl->channels[s].first_env,0,0,0.0};
+	Push(s,cmd);
+}
+void
+ShardedEnvManager::
+Reset(bool RSI,int id)
+{
+	int s = ShardOf(id);
+	ShardCommand cmd = {SHARD_RESET,id-mControl->channels[s].first_env,0,RSI,0.0};
+	Push(s,cmd);
+}
+bool
+ShardedEnvManager::
+IsEndOfEpisode(int id)
+{
+	int s = ShardOf(id);
+	ShardCommand cmd = {SHARD_IS_END_OF_EPISODE,id-mControl->channels[s].first_env,0,0,0.0};
+	Push(s,cmd);
+	Wait(s);
+	return mControl->channels[s].result!=0.0;
+}
+double
+ShardedEnvManager::
+GetReward(int id)
+{
+	int s = ShardOf(id);
+	ShardCommand cmd = {SHARD_GET_REWARD,id-mControl->channels[s].first_env,0,0,0.0};
+	Push(s,cmd);
+	Wait(s);
+	return mControl->channels[s].result;
+}
+void
+ShardedEnvManager::
+Steps(int num)
+{
+	ShardCommand cmd = {SHARD_STEPS,0,num,0,0.0};
+	Broadcast(cmd);
+}
+void
+ShardedEnvManager::
+StepsAtOnce()
+{
+	ShardCommand cmd = {SHARD_STEPS_AT_ONCE,0,0,0,0.0};
+	Broadcast(cmd);
+}
+void
+ShardedEnvManager::
+Resets(bool RSI)
+{
+	ShardCommand cmd = {SHARD_RESETS,0,0,RSI,0.0};
+	Broadcast(cmd);
+}
+const Eigen::VectorXd&
+ShardedEnvManager::
+IsEndOfEpisodes()
+{
+	ShardCommand cmd = {SHARD_IS_END_OF_EPISODES,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+	mEoe = Eigen::Map<Eigen::VectorXd>(mSharedEoe,mNumEnvs);
+	return mEoe;
+}
+const Eigen::MatrixXd&
+ShardedEnvManager::
+GetStates()
+{
+	ShardCommand cmd = {SHARD_GET_STATES,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+	CopyRows(mSharedStates,mStates);
+	return mStates;
+}
+
+/**
+ * @brief Inputs are written to the shared rows only once the workers are done
+ * with the previous ones; the command itself is not waited on, so a following
+ * StepsAtOnce is queued right behind it.
+ */
+void
+ShardedEnvManager::
+SetActions(const Eigen::MatrixXd& actions)
+{
+	WaitAll();
+	Eigen::Map<RowMatrixXd>(mSharedActions,mNumEnvs,GetNumAction()) = actions;
+	ShardCommand cmd = {SHARD_SET_ACTIONS,0,0,0,0.0};
+	Broadcast(cmd);
+}
+const Eigen::VectorXd&
+ShardedEnvManager::
+GetRewards()
+{
+	ShardCommand cmd = {SHARD_GET_REWARDS,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+	mRewards = Eigen::Map<Eigen::VectorXd>(mSharedRewards,mNumEnvs);
+	return mRewards;
+}
+const Eigen::VectorXd&
+ShardedEnvManager::
+GetGaitRewards()
+{
+	ShardCommand cmd = {SHARD_GET_GAIT_REWARDS,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+	mRewards = Eigen::Map<Eigen::VectorXd>(mSharedRewards,mNumEnvs);
+	return mRewards;
+}
+const Eigen::MatrixXd&
+ShardedEnvManager::
+GetMuscleTorques()
+{
+	ShardCommand cmd = {SHARD_GET_MUSCLE_TORQUES,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+	CopyRows(mSharedMuscleTorques,mMuscleTorques);
+	return mMuscleTorques;
+}
+const Eigen::MatrixXd&
+ShardedEnvManager::
+GetDesiredTorques()
+{
+	ShardCommand cmd = {SHARD_GET_DESIRED_TORQUES,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+	CopyRows(mSharedDesiredTorques,mDesiredTorques);
+	return mDesiredTorques;
+}
+void
+ShardedEnvManager::
+SetActivationLevels(const Eigen::MatrixXd& activations)
+{
+	WaitAll();
+	Eigen::Map<RowMatrixXd>(mSharedActivations,mNumEnvs,GetNumMuscles()) = activations;
+	ShardCommand cmd = {SHARD_SET_ACTIVATION_LEVELS,0,0,0,0.0};
+	Broadcast(cmd);
+}
+
+/**
+ * @brief Each worker dumps its tuples into its own shared segment, which is
+ * then concatenated in shard order (the same order EnvManager would use).
+ */
+void
+ShardedEnvManager::
+ComputeMuscleTuples()
+{
+	ShardCommand cmd = {SHARD_COMPUTE_MUSCLE_TUPLES,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+
+	int rows[4] = {GetNumTotalMuscleRelatedDofs(),GetNumAction(),GetNumAction()*GetNumMuscles(),GetNumAction()};
+	Eigen::MatrixXd* dst[4] = {&mMuscleTuplesJtA,&mMuscleTuplesTauDes,&mMuscleTuplesL,&mMuscleTuplesb};
+	int64_t n = 0;
+	for(int s=0;s<mNumShards;s++)
+		n += mControl->channels[s].num_tuples;
+	for(int f=0;f<4;f++)
+		dst[f]->resize(n,rows[f]);
+
+	int64_t o = 0;
+	for(int s=0;s<mNumShards;s++)
+	{
+		int64_t m = mControl->channels[s].num_tuples;
+		if(m==0)
+			continue;
+		size_t bytes = m*(rows[0]+rows[1]+rows[2]+rows[3])*sizeof(double);
+		double* seg = static_cast<double*>(MapSegment(TupleSegmentName(mName,s),bytes,false));
+		double* p = seg;
+		for(int f=0;f<4;f++)
+		{
+			dst[f]->block(o,0,m,rows[f]) = Eigen::Map<RowMatrixXd>(p,m,rows[f]);
+			p += m*rows[f];
+		}
+		munmap(seg,bytes);
+		o += m;
+	}
+}
+
+/**
+ * @brief Every worker streams its own tuples to "<path>.<shard>"; train_muscle.py
+ * accepts all of them at once.
+ */
+void
+ShardedEnvManager::
+SetMuscleTupleDataset(const std::string& path,bool half_precision,bool compress)
+{
+	WaitAll();
+	std::strncpy(mControl->dataset_path,path.c_str(),sizeof(mControl->dataset_path)-1);
+	ShardCommand cmd = {SHARD_SET_MUSCLE_TUPLE_DATASET,0,(half_precision ? 1 : 0)|(compress ? 2 : 0),0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+}
+void
+ShardedEnvManager::
+CloseMuscleTupleDataset()
+{
+	ShardCommand cmd = {SHARD_CLOSE_MUSCLE_TUPLE_DATASET,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+}
+
+/**
+ * @brief Env i logs to "<path>.<i>", the same names EnvManager uses.
+ */
+void
+ShardedEnvManager::
+RecordTrajectories(const std::string& path)
+{
+	WaitAll();
+	std::strncpy(mControl->trajectory_path,path.c_str(),sizeof(mControl->trajectory_path)-1);
+	ShardCommand cmd = {SHARD_RECORD_TRAJECTORIES,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+}
+void
+ShardedEnvManager::
+StopRecordingTrajectories()
+{
+	ShardCommand cmd = {SHARD_STOP_RECORDING_TRAJECTORIES,0,0,0,0.0};
+	Broadcast(cmd);
+	WaitAll();
+}
+void
+ShardedEnvManager::
+SetExoTorque(int which,float T)
+{
+	ShardCommand cmd = {SHARD_SET_EXO_TORQUE,which,0,0,T};
+	Broadcast(cmd);
+}
+
+/**
+ * @brief Worker side: builds an EnvManager for this shard's slice and serves
+ * commands from the shard's ring until SHARD_QUIT.
+ *
+ * @param name - name of the shared control segment
+ * @param shard - index of this worker's channel
+ */
+void
+RunShardWorker(const std::string& name,int shard)
+{
+	ShardedControl* control = static_cast<ShardedControl*>(MapSegment(name,sizeof(ShardedControl),false));
+	ShardChannel& ch = control->channels[shard];
+	int first = ch.first_env;
+	int count = ch.num_envs;
+
+	EnvManager* env = new EnvManager(std::string(control->meta_file),count,0,true,control->pin_threads!=0,first);
+	if(shard==0)
+	{
+		control->num_state = env->GetNumState();
+		control->num_action = env->GetNumAction();
+		control->num_muscles = env->UseMuscle() ? env->GetNumMuscles() : 0;
+		control->num_related_dofs = env->UseMuscle() ? env->GetNumTotalMuscleRelatedDofs() : 0;
+		control->sim_hz = env->GetSimulationHz();
+		control->con_hz = env->GetControlHz();
+		control->num_steps = env->GetNumSteps();
+		control->use_muscle = env->UseMuscle();
+	}
+	ch.ready.store(1,std::memory_order_release);
+	FutexWake(&ch.ready);
+
+	py::gil_scoped_release release;
+	double* data = nullptr;
+	size_t data_bytes = 0;
+	ShardDataLayout* layout = nullptr;
+	int num_state = 0,num_action = 0,num_muscles = 0,num_related_dofs = 0;
+
+	uint32_t tail = ch.tail.load(std::memory_order_acquire);
+	bool quit = false;
+	while(!quit)
+	{
+		int spins = 0;
+		while(ch.head.load(std::memory_order_acquire)==tail)
+		{
+			if(++spins<SPIN_COUNT)
+				CpuRelax();
+			else
+				FutexWait(&ch.head,tail,100);
+		}
+		ShardCommand cmd = ch.ring[tail%SHARD_RING_SIZE];
+		switch(cmd.type)
+		{
+		case SHARD_QUIT: quit = true;break;
+		case SHARD_MAP_DATA:
+			num_state = control->num_state;
+			num_action = control->num_action;
+			num_muscles = control->num_muscles;
+			num_related_dofs = control->num_related_dofs;
+			layout = new ShardDataLayout(control);
+			data_bytes = std::max<size_t>(1,layout->total)*sizeof(double);
+			data = static_cast<double*>(MapSegment(name+"_data",data_bytes,false));
+			break;
+		case SHARD_STEP: env->Step(cmd.id);break;
+		case SHARD_RESET: env->Reset(cmd.flag!=0,cmd.id);break;
+		case SHARD_IS_END_OF_EPISODE: ch.result = env->IsEndOfEpisode(cmd.id);break;
+		case SHARD_GET_REWARD: ch.result = env->GetReward(cmd.id);break;
+		case SHARD_STEPS: env->Steps(cmd.num);break;
+		case SHARD_STEPS_AT_ONCE: env->StepsAtOnce();break;
+		case SHARD_RESETS: env->Resets(cmd.flag!=0);break;
+		case SHARD_IS_END_OF_EPISODES:
+			Eigen::Map<Eigen::VectorXd>(data+layout->eoe+first,count) = env->IsEndOfEpisodes();
+			break;
+		case SHARD_GET_STATES:
+			Eigen::Map<RowMatrixXd>(data+layout->states+(size_t)first*num_state,count,num_state) = env->GetStates();
+			break;
+		case SHARD_SET_ACTIONS:
+			env->SetActions(Eigen::Map<RowMatrixXd>(data+layout->actions+(size_t)first*num_action,count,num_action));
+			break;
+		case SHARD_GET_REWARDS:
+			Eigen::Map<Eigen::VectorXd>(data+layout->rewards+first,count) = env->GetRewards();
+			break;
+		case SHARD_GET_GAIT_REWARDS:
+			Eigen::Map<Eigen::VectorXd>(data+layout->rewards+first,count) = env->GetGaitRewards();
+			break;
+		case SHARD_GET_MUSCLE_TORQUES:
+			Eigen::Map<RowMatrixXd>(data+layout->muscle_torques+(size_t)first*num_related_dofs,count,num_related_dofs) = env->GetMuscleTorques();
+			break;
+		case SHARD_GET_DESIRED_TORQUES:
+			Eigen::Map<RowMatrixXd>(data+layout->desired_torques+(size_t)first*num_action,count,num_action) = env->GetDesiredTorques();
+			break;
+		case SHARD_SET_ACTIVATION_LEVELS:
+			env->SetActivationLevels(Eigen::Map<RowMatrixXd>(data+layout->activations+(size_t)first*num_muscles,count,num_muscles));
+			break;
+		case SHARD_COMPUTE_MUSCLE_TUPLES:
+		{
+			env->ComputeMuscleTuples();
+			const Eigen::MatrixXd* src[4] = {&env->GetMuscleTuplesJtA(),&env->GetMuscleTuplesTauDes(),&env->GetMuscleTuplesL(),&env->GetMuscleTuplesb()};
+			int64_t n = src[0]->rows();
+			ch.num_tuples = n;
+			if(n==0)
+				break;
+			size_t values = 0;
+			for(int f=0;f<4;f++)
+				values += src[f]->size();
+			std::string seg_name = TupleSegmentName(name,shard);
+			shm_unlink(seg_name.c_str());
+			double* seg = static_cast<double*>(MapSegment(seg_name,values*sizeof(double),true));
+			double* p = seg;
+			for(int f=0;f<4;f++)
+			{
+				Eigen::Map<RowMatrixXd>(p,src[f]->rows(),src[f]->cols()) = *src[f];
+				p += src[f]->size();
+			}
+			munmap(seg,values*sizeof(double));
+			break;
+		}
+		case SHARD_SET_EXO_TORQUE:
+			if(cmd.id==0) env->SetLHipTs(cmd.value);
+			else if(cmd.id==1) env->SetRHipTs(cmd.value);
+			else if(cmd.id==2) env->SetLKneeTs(cmd.value);
+			else env->SetRKneeTs(cmd.value);
+			break;
+		case SHARD_SET_MUSCLE_TUPLE_DATASET:
+			env->SetMuscleTupleDataset(std::string(control->dataset_path)+"."+std::to_string(shard),(cmd.num&1)!=0,(cmd.num&2)!=0);
+			break;
+		case SHARD_CLOSE_MUSCLE_TUPLE_DATASET: env->CloseMuscleTupleDataset();break;
+		case SHARD_RECORD_TRAJECTORIES: env->RecordTrajectories(std::string(control->trajectory_path),first);break;
+		case SHARD_STOP_RECORDING_TRAJECTORIES: env->StopRecordingTrajectories();break;
+		default: break;
+		}
+		tail++;
+		ch.tail.store(tail,std::memory_order_release);
+		FutexWake(&ch.tail);
+	}
+
+	// flushes the tuple dataset and the trajectory logs, _exit would drop them
+	delete env;
+	if(data!=nullptr)
+		munmap(data,data_bytes);
+	delete layout;
+	munmap(control,sizeof(ShardedControl));
+	_exit(0);
+}
+
+void
+BindShardedEnvManager(py::module& m)
+{
+	py::class_<ShardedEnvManager>(m, "pymss_sharded")
+		.def(py::init<std::string,int,int,bool>(),py::arg("meta_file"),py::arg("num_envs"),py::arg("num_shards"),py::arg("pin_threads")=false)
+		.def("GetNumShards",&ShardedEnvManager::GetNumShards)
+		.def("GetNumState",&ShardedEnvManager::GetNumState)
+		.def("GetNumAction",&ShardedEnvManager::GetNumAction)
+		.def("GetSimulationHz",&ShardedEnvManager::GetSimulationHz)
+		.def("GetControlHz",&ShardedEnvManager::GetControlHz)
+		.def("GetNumSteps",&ShardedEnvManager::GetNumSteps)
+		.def("UseMuscle",&ShardedEnvManager::UseMuscle)
+		.def("Step",&ShardedEnvManager::Step)
+		.def("Reset",&ShardedEnvManager::Reset)
+		.def("IsEndOfEpisode",&ShardedEnvManager::IsEndOfEpisode)
+		.def("GetReward",&ShardedEnvManager::GetReward)
+		.def("Steps",&ShardedEnvManager::Steps)
+		.def("StepsAtOnce",&ShardedEnvManager::StepsAtOnce)
+		.def("Resets",&ShardedEnvManager::Resets)
+		.def("IsEndOfEpisodes",&ShardedEnvManager::IsEndOfEpisodes)
+		.def("GetStates",&ShardedEnvManager::GetStates)
+		.def("SetActions",&ShardedEnvManager::SetActions)
+		.def("GetRewards",&ShardedEnvManager::GetRewards)
+		.def("GetGaitRewards",&ShardedEnvManager::GetGaitRewards)
+		.def("GetNumTotalMuscleRelatedDofs",&ShardedEnvManager::GetNumTotalMuscleRelatedDofs)
+		.def("GetNumMuscles",&ShardedEnvManager::GetNumMuscles)
+		.def("GetMuscleTorques",&ShardedEnvManager::GetMuscleTorques)
+		.def("GetDesiredTorques",&ShardedEnvManager::GetDesiredTorques)
+		.def("SetActivationLevels",&ShardedEnvManager::SetActivationLevels)
+		.def("ComputeMuscleTuples",&ShardedEnvManager::ComputeMuscleTuples)
+		.def("GetMuscleTuplesJtA",&ShardedEnvManager::GetMuscleTuplesJtA)
+		.def("GetMuscleTuplesTauDes",&ShardedEnvManager::GetMuscleTuplesTauDes)
+		.def("GetMuscleTuplesL",&ShardedEnvManager::GetMuscleTuplesL)
+		.def("GetMuscleTuplesb",&ShardedEnvManager::GetMuscleTuplesb)
+		.def("SetMuscleTupleDataset",&ShardedEnvManager::SetMuscleTupleDataset,py::arg("path"),py::arg("half_precision")=false,py::arg("compress")=true)
+		.def("CloseMuscleTupleDataset",&ShardedEnvManager::CloseMuscleTupleDataset)
+		.def("RecordTrajectories",&ShardedEnvManager::RecordTrajectories)
+		.def("StopRecordingTrajectories",&ShardedEnvManager::StopRecordingTrajectories)
+		.def("SetLHipTs",&ShardedEnvManager::SetLHipTs)
+		.def("SetRHipTs",&ShardedEnvManager::SetRHipTs)
+		.def("SetLKneeTs",&ShardedEnvManager::SetLKneeTs)
+		.def("SetRKneeTs",&ShardedEnvManager::SetRKneeTs);
+	m.def("RunShardWorker",&RunShardWorker);
+}
@@ -0,0 +1,183 @@
+#ifndef __SHARDED_ENV_MANAGER_H__
+#define __SHARDED_ENV_MANAGER_H__
+#include <pybind11/pybind11.h>
+#include <Eigen/Core>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/types.h>
+namespace py = pybind11;
+
+/**
+ * Shared memory protocol between a ShardedEnvManager and its worker processes.
+ *
+ * The control segment holds one ShardChannel per worker. Each channel is a
+ * single-producer/single-consumer ring of commands: the parent advances head,
+ * the worker advances tail once a command is executed, and both sides sleep on
+ * those counters with futexes. Bulk data (states, actions, torques...) lives in
+ * a second segment where each worker reads and writes only its own rows.
+ */
+enum ShardCommandType
+{
+	SHARD_QUIT = 0,
+	SHARD_MAP_DATA,
+	SHARD_STEP,
+	SHARD_RESET,
+	SHARD_IS_END_OF_EPISODE,
+	SHARD_GET_REWARD,
+	SHARD_STEPS,
+	SHARD_STEPS_AT_ONCE,
+	SHARD_RESETS,
+	SHARD_IS_END_OF_EPISODES,
+	SHARD_GET_STATES,
+	SHARD_SET_ACTIONS,
+	SHARD_GET_REWARDS,
+	SHARD_GET_GAIT_REWARDS,
+	SHARD_GET_MUSCLE_TORQUES,
+	SHARD_GET_DESIRED_TORQUES,
+	SHARD_SET_ACTIVATION_LEVELS,
+	SHARD_COMPUTE_MUSCLE_TUPLES,
+	SHARD_SET_EXO_TORQUE,
+	SHARD_SET_MUSCLE_TUPLE_DATASET,
+	SHARD_CLOSE_MUSCLE_TUPLE_DATASET,
+	SHARD_RECORD_TRAJECTORIES,
+	SHARD_STOP_RECORDING_TRAJECTORIES
+};
+struct ShardCommand
+{
+	uint32_t type;
+	int32_t id;
+	int32_t num;
+	int32_t flag;
+	double value;
+};
+
+static const int SHARD_RING_SIZE = 64;
+static const int SHARD_MAX_SHARDS = 64;
+
+struct alignas(64) ShardChannel
+{
+	alignas(64) std::atomic<uint32_t> head;
+	alignas(64) std::atomic<uint32_t> tail;
+	alignas(64) std::atomic<uint32_t> ready;
+	int32_t first_env;
+	int32_t num_envs;
+	int64_t num_tuples;
+	double result;
+	ShardCommand ring[SHARD_RING_SIZE];
+};
+struct ShardedControl
+{
+	int32_t num_envs;
+	int32_t num_shards;
+	int32_t num_state;
+	int32_t num_action;
+	int32_t num_muscles;
+	int32_t num_related_dofs;
+	int32_t sim_hz;
+	int32_t con_hz;
+	int32_t num_steps;
+	int32_t use_muscle;
+	int32_t pin_threads;
+	char meta_file[1024];
+	char dataset_path[1024];
+	char trajectory_path[1024];
+	ShardChannel channels[SHARD_MAX_SHARDS];
+};
+
+/**
+ * @brief Python-facing EnvManager replacement which splits the environments
+ * over several worker processes, each running its own EnvManager (and thus its
+ * own OpenMP team and Python interpreter), so stepping is not bound to one
+ * process. The interface mirrors EnvManager, so it can be used in place of pymss.pymss.
+ */
+class ShardedEnvManager
+{
+public:
+	ShardedEnvManager(std::string meta_file,int num_envs,int num_shards,bool pin_threads = false);
+	~ShardedEnvManager();
+
+	int GetNumState(){return mControl->num_state;}
+	int GetNumAction(){return mControl->num_action;}
+	int GetSimulationHz(){return mControl->sim_hz;}
+	int GetControlHz(){return mControl->con_hz;}
+	int GetNumSteps(){return mControl->num_steps;}
+	bool UseMuscle(){return mControl->use_muscle!=0;}
+	int GetNumShards(){return mNumShards;}
+
+	void Step(int id);
+	void Reset(bool RSI,int id);
+	bool IsEndOfEpisode(int id);
+	double GetReward(int id);
+
+	void Steps(int num);
+	void StepsAtOnce();
+	void Resets(bool RSI);
+	const Eigen::VectorXd& IsEndOfEpisodes();
+	const Eigen::MatrixXd& GetStates();
+	void SetActions(const Eigen::MatrixXd& actions);
+	const Eigen::VectorXd& GetRewards();
+	const Eigen::VectorXd& GetGaitRewards();
+
+	int GetNumTotalMuscleRelatedDofs(){return mControl->num_related_dofs;}
+	int GetNumMuscles(){return mControl->num_muscles;}
+	const Eigen::MatrixXd& GetMuscleTorques();
+	const Eigen::MatrixXd& GetDesiredTorques();
+	void SetActivationLevels(const Eigen::MatrixXd& activations);
+
+	void ComputeMuscleTuples();
+	const Eigen::MatrixXd& GetMuscleTuplesJtA(){return mMuscleTuplesJtA;}
+	const Eigen::MatrixXd& GetMuscleTuplesTauDes(){return mMuscleTuplesTauDes;}
+	const Eigen::MatrixXd& GetMuscleTuplesL(){return mMuscleTuplesL;}
+	const Eigen::MatrixXd& GetMuscleTuplesb(){return mMuscleTuplesb;}
+
+	void SetMuscleTupleDataset(const std::string& path,bool half_precision,bool compress);
+	void CloseMuscleTupleDataset();
+	void RecordTrajectories(const std::string& path);
+	void StopRecordingTrajectories();
+
+	void SetLHipTs(float T){SetExoTorque(0,T);}
+	void SetRHipTs(float T){SetExoTorque(1,T);}
+	void SetLKneeTs(float T){SetExoTorque(2,T);}
+	void SetRKneeTs(float T){SetExoTorque(3,T);}
+private:
+	void SetExoTorque(int which,float T);
+	int ShardOf(int id);
+	void Push(int shard,const ShardCommand& cmd);
+	void Broadcast(const ShardCommand& cmd);
+	void Wait(int shard);
+	void WaitAll();
+	void CheckWorkers();
+	void MapData();
+	void Shutdown(bool graceful);
+	void CopyRows(double* shared,Eigen::MatrixXd& m);
+
+	std::string mName;
+	int mNumEnvs;
+	int mNumShards;
+	ShardedControl* mControl;
+	std::vector<pid_t> mPids;
+	std::vector<uint32_t> mIssued;
+
+	double* mData;
+	size_t mDataBytes;
+	double *mSharedStates,*mSharedActions,*mSharedRewards,*mSharedEoe;
+	double *mSharedMuscleTorques,*mSharedDesiredTorques,*mSharedActivations;
+
+	Eigen::VectorXd mEoe;
+	Eigen::VectorXd mRewards;
+	Eigen::MatrixXd mStates;
+	Eigen::MatrixXd mMuscleTorques;
+	Eigen::MatrixXd mDesiredTorques;
+
+	Eigen::MatrixXd mMuscleTuplesJtA;
+	Eigen::MatrixXd mMuscleTuplesTauDes;
+	Eigen::MatrixXd mMuscleTuplesL;
+	Eigen::MatrixXd mMuscleTuplesb;
+};
+
+void RunShardWorker(const std::string& name,int shard);
+void BindShardedEnvManager(py::module& m);
+
+#endif
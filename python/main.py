@@ -67,11 +67,20 @@ class ReplayBuffer(object):
 		self.buffer.clear()
 
 class PPO(object):
-	def __init__(self,meta_file):
+	def __init__(self,meta_file,num_shards=1,remote=None,pin_threads=False):
 		np.random.seed(seed = int(time.time()))
 		self.num_slaves = 16								# Number of threads to run (1 environment instance per thread?) - XS
-		self.env = pymss.pymss(meta_file,self.num_slaves)	# C++ functionality accessed via self.env, wh
+		if remote is not None:
+			# Envs live in mass_rollout_server processes, possibly on other machines
+			self.env = pymss.pymss_remote(remote)
+			self.num_slaves = self.env.GetNumEnvs()
+		elif num_shards > 1:
+			# Same interface, but the envs are split over num_shards worker processes
+			self.env = pymss.pymss_sharded(meta_file,self.num_slaves,num_shards,pin_threads)
+		else:
+			self.env = pymss.pymss(meta_file,self.num_slaves,pin_threads=pin_threads)	# C++ functionality accessed via self.env, wh
 		self.use_muscle = self.env.UseMuscle()
+		self.use_deadline = False
 		self.num_state = self.env.GetNumState()
 		self.num_action = self.env.GetNumAction()
 		self.num_muscles = self.env.GetNumMuscles()
@@ -210,8 +219,12 @@ class PPO(object):
 					self.env.Steps(2)
 			else:
 				self.env.StepsAtOnce()
+			# Envs which missed the deadline of this step are still running, skip them
+			late = self.env.GetLateMask() if self.use_deadline else np.zeros(self.num_slaves)
 			
 			for j in range(self.num_slaves):
+				if late[j] != 0:
+					continue
 				nan_occur = False
 				terminated_state = True
 
@@ -409,15 +422,39 @@ if __name__=="__main__":
 	parser = argparse.ArgumentParser()
 	parser.add_argument('-m','--model',help='model path')
 	parser.add_argument('-d','--meta',help='meta file')
+	parser.add_argument('-t','--tuples',help='record muscle tuples to this dataset file (see train_muscle.py)')
+	parser.add_argument('--half',action='store_true',help='record muscle tuples as float16')
+	parser.add_argument('-s','--shards',type=int,default=1,help='number of worker processes to split the envs over')
+	parser.add_argument('--deadline',type=float,help='finish a control step once this fraction of envs is done')
+	parser.add_argument('--budget',type=float,default=0.0,help='time budget of a control step in ms, with --deadline')
+	parser.add_argument('-r','--remote',help='comma separated mass_rollout_server addresses (host:port or unix:/path)')
+	parser.add_argument('--pin',action='store_true',help='pin the env stepping threads to CPUs (see NUMA placement in the README)')
+	parser.add_argument('--record',help='log the trajectories of env i to RECORD.i (replay with render --replay)')
 
 	# Check that a meta filepath ahs been supplied
 	args = parser.parse_args()
 	if args.meta is None:
 		print('Provide meta file')
 		exit()
-
-
-	ppo = PPO(args.meta)
+	# only the in-process pymss steps envs against a deadline
+	if args.deadline is not None and (args.shards > 1 or args.remote is not None):
+		parser.error('--deadline is not supported with -s/--shards or -r/--remote')
+	# remote envs hand the tuples over the socket but write no dataset
+	if args.tuples is not None and args.remote is not None:
+		parser.error('-t/--tuples is not supported with -r/--remote')
+
+
+	ppo = PPO(args.meta,args.shards,args.remote.split(',') if args.remote is not None else None,args.pin)
+	if args.tuples is not None:
+		ppo.env.SetMuscleTupleDataset(args.tuples,args.half)
+	if args.record is not None:
+		if hasattr(ppo.env,'RecordTrajectories'):
+			ppo.env.RecordTrajectories(args.record)
+		else:
+			print('--record is not supported with remote envs')
+	if args.deadline is not None:
+		ppo.env.SetDeadline(args.deadline,args.budget)
+		ppo.use_deadline = True
 	nn_dir = '../nn'
 	if not os.path.exists(nn_dir):
 		os.makedirs(nn_dir)
@@ -0,0 +1,47 @@
+import argparse
+import subprocess
+import sys
+import time
+import numpy as np
+"""
+Compares StepsAtOnce throughput with the envs placed on 1 NUMA node against
+all of them spread over 2 nodes. Each configuration runs in its own process
+since thread pinning and first-touch placement happen once, at construction.
+On a single-socket machine, MASS_FAKE_NUMA_NODES=2 exercises the placement
+without the memory effect.
+"""
+
+def Run(meta_file,num_envs,num_nodes,num_steps):
+	import pymss
+	env = pymss.pymss(meta_file,num_envs,num_nodes,pin_threads=True)
+	print(env.GetPlacementReport())
+	env.Resets(True)
+	actions = np.zeros((num_envs,env.GetNumAction()))
+	for i in range(3):
+		env.SetActions(actions)
+		env.StepsAtOnce()
+
+	begin = time.time()
+	for i in range(num_steps):
+		env.SetActions(actions)
+		env.StepsAtOnce()
+		env.GetStates()
+		for j in range(num_envs):
+			if env.IsEndOfEpisode(j):
+				env.Reset(True,j)
+	elapsed = time.time() - begin
+	print('{} node(s) : {:.1f} control steps/s'.format(num_nodes,num_steps*num_envs/elapsed))
+
+if __name__=="__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument('-d','--meta',default='../data/metadata.txt',help='meta file')
+	parser.add_argument('-n','--envs',type=int,default=16)
+	parser.add_argument('--steps',type=int,default=50)
+	parser.add_argument('--nodes',type=int,help='run only this configuration (used internally)')
+	args = parser.parse_args()
+
+	if args.nodes is not None:
+		Run(args.meta,args.envs,args.nodes,args.steps)
+	else:
+		for nodes in [1,2]:
+			subprocess.check_call([sys.executable,__file__,'-d',args.meta,'-n',str(args.envs),'--steps',str(args.steps),'--nodes',str(nodes)])
@@ -0,0 +1,60 @@
+import argparse
+import os
+import subprocess
+import time
+import numpy as np
+import pymss
+"""
+Starts mass_rollout_server processes on this machine, drives them through
+pymss.pymss_remote the same way main.py does and reports the control rate.
+"""
+
+def Check(meta_file,server,num_servers,num_envs,num_steps):
+	addresses = ['unix:/tmp/mass_rollout_{}_{}.sock'.format(os.getpid(),i) for i in range(num_servers)]
+	servers = [subprocess.Popen([server,meta_file,str(num_envs),a]) for a in addresses]
+	try:
+		for a in addresses:
+			while not os.path.exists(a[5:]):
+				if any(s.poll() is not None for s in servers):
+					raise RuntimeError('mass_rollout_server exited')
+				time.sleep(0.1)
+
+		env = pymss.pymss_remote(addresses)
+		n = env.GetNumEnvs()
+		assert n == num_servers*num_envs
+		env.Resets(True)
+		states = env.GetStates()
+		assert states.shape == (n,env.GetNumState())
+
+		begin = time.time()
+		for i in range(num_steps):
+			actions = np.random.normal(0.0,0.1,size=(n,env.GetNumAction()))
+			env.SetActions(actions)
+			env.StepsAtOnce()
+			for j in range(n):
+				if env.IsEndOfEpisode(j):
+					env.Reset(True,j)
+				else:
+					env.GetReward(j)
+			states = env.GetStates()
+			assert not np.any(np.isnan(states))
+		elapsed = time.time() - begin
+		print('{} envs on {} servers : {:.1f} control steps/s'.format(n,num_servers,num_steps*n/elapsed))
+		del env
+	finally:
+		for s in servers:
+			s.kill()
+		for a in addresses:
+			if os.path.exists(a[5:]):
+				os.remove(a[5:])
+
+if __name__=="__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument('-d','--meta',default='../data/metadata.txt',help='meta file')
+	parser.add_argument('--server',default='../build/rollout/mass_rollout_server',help='mass_rollout_server executable')
+	parser.add_argument('-n','--servers',type=int,default=2)
+	parser.add_argument('-e','--envs',type=int,default=4,help='envs per server')
+	parser.add_argument('--steps',type=int,default=100)
+	args = parser.parse_args()
+
+	Check(args.meta,args.server,args.servers,args.envs,args.steps)
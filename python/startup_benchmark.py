@@ -0,0 +1,42 @@
+import argparse
+import subprocess
+import sys
+import time
+"""
+Compares EnvManager construction with every env loaded from the model files
+against one prototype env cloned into the others, for 16 and 64 envs: wall
+time and resident memory added by the envs. Each configuration runs in its
+own process so memory readings don't mix. Run it twice to see the model
+cache warm.
+"""
+
+def ResidentKB():
+	with open('/proc/self/status') as f:
+		for line in f:
+			if line.startswith('VmRSS:'):
+				return int(line.split()[1])
+	return 0
+
+def Run(meta_file,num_envs,use_prototype):
+	import pymss
+	rss = ResidentKB()
+	begin = time.time()
+	env = pymss.pymss(meta_file,num_envs,0,use_prototype)
+	elapsed = time.time() - begin
+	added = ResidentKB() - rss
+	print('{:>3} envs, {:<9} : {:7.2f} s, {:8.1f} MB resident ({:.2f} MB/env)'.format(
+		num_envs,'prototype' if use_prototype else 'files',elapsed,added/1024.0,added/1024.0/num_envs))
+
+if __name__=="__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument('-d','--meta',default='../data/metadata.txt',help='meta file')
+	parser.add_argument('-n','--envs',type=int,nargs='+',default=[16,64])
+	parser.add_argument('--prototype',type=int,help='run only this configuration (used internally)')
+	args = parser.parse_args()
+
+	if args.prototype is not None:
+		Run(args.meta,args.envs[0],args.prototype!=0)
+	else:
+		for num_envs in args.envs:
+			for prototype in [0,1]:
+				subprocess.check_call([sys.executable,__file__,'-d',args.meta,'-n',str(num_envs),'--prototype',str(prototype)])
@@ -0,0 +1,63 @@
+import argparse
+import numpy as np
+import torch
+import torch.optim as optim
+from Model import *
+from MuscleTupleDataset import MuscleTupleDataset
+"""
+Trains the muscle net offline from tuple datasets recorded with main.py -t,
+using the same loss as PPO.OptimizeMuscleNN in main.py.
+"""
+
+def Train(paths,model_path,num_epochs,batch_size,learning_rate,out_path):
+	datasets = [MuscleTupleDataset(p) for p in paths]
+	num_related_dofs,num_dofs,rows_L,_ = datasets[0].rows
+	num_muscles = rows_L//num_dofs
+	print('{} tuples in {} files'.format(sum(len(d) for d in datasets),len(datasets)))
+
+	muscle_model = MuscleNN(num_related_dofs,num_dofs,num_muscles)
+	if model_path is not None:
+		muscle_model.load(model_path)
+	optimizer = optim.Adam(muscle_model.parameters(),lr=learning_rate)
+
+	for epoch in range(num_epochs):
+		for d in datasets:
+			# Chunks are visited in random order and shuffled internally, so only
+			# one decoded chunk has to be resident at a time
+			for chunk in d.Chunks(shuffle=True):
+				n = chunk['JtA'].shape[0]
+				p = np.random.permutation(n)
+				for i in range(0,n-batch_size+1,batch_size):
+					idx = p[i:i+batch_size]
+					stack_JtA = Tensor(chunk['JtA'][idx].astype(np.float32))
+					stack_tau_des = Tensor(chunk['tau_des'][idx].astype(np.float32))
+					stack_L = Tensor(chunk['L'][idx].astype(np.float32).reshape(batch_size,num_dofs,num_muscles))
+					stack_b = Tensor(chunk['b'][idx].astype(np.float32))
+
+					activation = muscle_model(stack_JtA,stack_tau_des)
+					tau = torch.einsum('ijk,ik->ij',(stack_L,activation)) + stack_b
+
+					loss_reg = (activation).pow(2).mean()
+					loss_target = (((tau-stack_tau_des)/100.0).pow(2)).mean()
+					loss = 0.01*loss_reg + loss_target
+
+					optimizer.zero_grad()
+					loss.backward()
+					for param in muscle_model.parameters():
+						if param.grad is not None:
+							param.grad.data.clamp_(-0.5,0.5)
+					optimizer.step()
+		print('Epoch {}/{} : muscle loss {:.6f}'.format(epoch+1,num_epochs,loss.cpu().detach().numpy().tolist()))
+		muscle_model.save(out_path)
+
+if __name__=="__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument('datasets',nargs='+',help='muscle tuple dataset files')
+	parser.add_argument('-m','--model',help='muscle nn to continue from')
+	parser.add_argument('-o','--out',default='../nn/offline_muscle.pt',help='output muscle nn')
+	parser.add_argument('-e','--epochs',type=int,default=10)
+	parser.add_argument('-b','--batch_size',type=int,default=128)
+	parser.add_argument('-l','--learning_rate',type=float,default=1E-4)
+	args = parser.parse_args()
+
+	Train(args.datasets,args.model,args.epochs,args.batch_size,args.learning_rate,args.out)
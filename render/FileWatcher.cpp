@@ -0,0 +1,93 @@
+#include "FileWatcher.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+using namespace MASS;
+
+FileWatcher::
+FileWatcher()
+	:mFd(inotify_init1(IN_NONBLOCK|IN_CLOEXEC))
+{
+	if(mFd<0)
+		std::cout<<"Can't watch files, inotify is not available"<<std::endl;
+}
+FileWatcher::
+~FileWatcher()
+{
+	if(mFd>=0)
+		close(mFd);
+}
+
+/**
+ * @brief Watches exactly paths from now on (the previous set is replaced).
+ */
+bool
+FileWatcher::
+Watch(const std::vector<std::string>& paths)
+{
+	if(mFd<0)
+		return false;
+	for(const auto& dir : mDirs)
+		inotify_rm_watch(mFd,dir.first);
+	mDirs.clear();
+	mFiles.clear();
+
+	// events name files relative to the directory, so paths are compared resolved
+	std::set<std::string> dirs;
+	for(const auto& file : paths)
+	{
+		if(file.empty())
+			continue;
+		char* resolved = realpath(file.c_str(),nullptr);
+		std::string path = resolved!=nullptr ? resolved : file;
+		free(resolved);
+		mFiles.insert(path);
+		size_t slash = path.find_last_of('/');
+		dirs.insert(slash==std::string::npos ? std::string(".") : path.substr(0,std::max<size_t>(slash,1)));
+	}
+	for(const auto& dir : dirs)
+	{
+		int wd = inotify_add_watch(mFd,dir.c_str(),IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE);
+		if(wd<0)
+		{
+			std::cout<<"Can't watch "<<dir<<std::endl;
+			continue;
+		}
+		mDirs[wd] = dir;
+	}
+	return !mDirs.empty();
+}
+
+/**
+ * @return the watched files edited since the last call, each once
+ */
+std::vector<std::string>
+FileWatcher::
+Poll()
+{
+	std::set<std::string> changed;
+	if(mFd<0)
+		return std::vector<std::string>();
+	alignas(struct inotify_event) char buffer[16*(sizeof(struct inotify_event)+NAME_MAX+1)];
+	while(true)
+	{
+		ssize_t n = read(mFd,buffer,sizeof(buffer));
+		if(n<=0)
+			break;
+		for(char* p = buffer;p<buffer+n;)
+		{
+			const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+			p += sizeof(struct inotify_event)+event->len;
+			auto dir = mDirs.find(event->wd);
+			if(dir==mDirs.end() || event->len==0)
+				continue;
+			std::string path = dir->second+"/"+event->name;
+			if(mFiles.count(path))
+				changed.insert(path);
+		}
+	}
+	return std::vector<std::string>(changed.begin(),changed.end());
+}
@@ -0,0 +1,33 @@
+#ifndef __MASS_FILE_WATCHER_H__
+#define __MASS_FILE_WATCHER_H__
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace MASS
+{
+/**
+ * @brief Reports edits of a set of files through inotify, without blocking.
+ *
+ * The directories of the files are watched rather than the files, so edits
+ * saved by writing a new file and renaming it over the old one (as most
+ * editors do) are seen too.
+ */
+class FileWatcher
+{
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	bool Watch(const std::vector<std::string>& paths);
+	std::vector<std::string> Poll();
+	bool IsOpen(){return mFd>=0;}
+private:
+	int mFd;
+	std::map<int,std::string> mDirs;		// watch descriptor -> directory
+	std::set<std::string> mFiles;			// full paths
+};
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "FrameProfiler.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <iostream>
+using namespace MASS;
+
+const int FrameProfiler::BINS_PER_OCTAVE;
+const int FrameProfiler::NUM_BINS;
+
+const char*
+FrameProfiler::
+GetPhaseName(int phase)
+{
+	static const char* names[NUM_PHASES] = {"policy","exo_policy","muscle_nn","muscles","dart","record_data","draw"};
+	return names[phase];
+}
+FrameProfiler::
+FrameProfiler()
+	:mIntervalBegin(std::chrono::steady_clock::now()),mBegin(mIntervalBegin),mFrames(0),mSteps(0),mSimulated(0.0)
+{
+	std::memset(&mInterval,0,sizeof(mInterval));
+	std::memset(&mSummary,0,sizeof(mSummary));
+	for(int p=0;p<NUM_PHASES;p++)
+	{
+		mHistograms[p].assign(NUM_BINS,0);
+		mCalls[p] = 0;
+		mTotal[p] = 0.0;
+		mMax[p] = 0.0;
+	}
+}
+/**
+ * @brief Adds a duration to the current interval and to the histogram of
+ * the run: bin b counts durations in [2^(b/BINS_PER_OCTAVE),2^((b+1)/BINS_PER_OCTAVE)) us.
+ */
+void
+FrameProfiler::
+Record(Phase phase,double seconds)
+{
+	double us = seconds*1e6;
+	int bin = us<1.0 ? 0 : std::min(NUM_BINS-1,(int)(std::log2(us)*BINS_PER_OCTAVE));
+	std::lock_guard<std::mutex> lock(mMutex);
+	mInterval.seconds[phase] += seconds;
+	mInterval.calls[phase]++;
+	mHistograms[phase][bin]++;
+	mCalls[phase]++;
+	mTotal[phase] += seconds*1e3;
+	mMax[phase] = std::max(mMax[phase],seconds*1e3);
+}
+void
+FrameProfiler::
+AddFrame()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mInterval.frames++;
+	mFrames++;
+}
+void
+FrameProfiler::
+AddStep(double simulated_seconds)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	mInterval.steps++;
+	mInterval.simulated += simulated_seconds;
+	mSteps++;
+	mSimulated += simulated_seconds;
+}
+
+/**
+ * @brief Closes the current interval once it is at least interval seconds
+ * long and returns the summary of the last closed one.
+ */
+const FrameProfiler::Summary&
+FrameProfiler::
+Update(double interval)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(now-mIntervalBegin).count();
+	if(seconds<interval)
+		return mSummary;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mSummary.fps = mInterval.frames/seconds;
+	mSummary.real_time_factor = mInterval.simulated/seconds;
+	for(int p=0;p<NUM_PHASES;p++)
+	{
+		int per = p==DRAW ? mInterval.frames : mInterval.steps;
+		mSummary.ms[p] = mInterval.calls[p]>0 ? mInterval.seconds[p]*1e3/mInterval.calls[p] : 0.0;
+		mSummary.ms_per_step[p] = per>0 ? mInterval.seconds[p]*1e3/per : 0.0;
+	}
+	std::memset(&mInterval,0,sizeof(mInterval));
+	mIntervalBegin = now;
+	return mSummary;
+}
+
+/**
+ * @brief Writes one CSV line per phase over the whole run: calls, mean,
+ * percentiles and max in ms, and ms per control step (per frame for draw).
+ * The percentiles are the geometric middle of the histogram bin they fall in.
+ */
+bool
+FrameProfiler::
+Save(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(),"w");
+	if(file==nullptr)
+	{
+		std::cout<<"Can't open file : "<<path<<std::endl;
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(mMutex);
+	double wall = std::chrono::duration<double>(std::chrono::steady_clock::now()-mBegin).count();
+	fprintf(file,"# %lld frames, %lld control steps, %.3f s wall, %.3f s simulated (%.1f fps, real time x%.3f)\n",
+		mFrames,mSteps,wall,mSimulated,mFrames/wall,mSimulated/wall);
+	fprintf(file,"phase,calls,mean_ms,p50_ms,p90_ms,p99_ms,max_ms,ms_per_step\n");
+	for(int p=0;p<NUM_PHASES;p++)
+	{
+		const std::vector<long long>& histogram = mHistograms[p];
+		long long calls = mCalls[p];
+		if(calls==0)
+			continue;
+		auto percentile = [&](double q){
+			long long rank = std::min(calls-1,(long long)(q*calls)),count = 0;
+			int b = 0;
+			while(b+1<NUM_BINS && (count += histogram[b])<=rank)
+				b++;
+			return std::min(mMax[p],std::exp2((b+0.5)/BINS_PER_OCTAVE)*1e-3);
+		};
+		long long per = p==DRAW ? mFrames : mSteps;
+		fprintf(file,"%s,%lld,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",GetPhaseName(p),calls,mTotal[p]/calls,
+			percentile(0.5),percentile(0.9),percentile(0.99),mMax[p],per>0 ? mTotal[p]/per : 0.0);
+	}
+	fclose(file);
+	std::cout<<"Frame timings written to "<<path<<std::endl;
+	return true;
+}
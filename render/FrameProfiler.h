@@ -0,0 +1,92 @@
+#ifndef __MASS_FRAME_PROFILER_H__
+#define __MASS_FRAME_PROFILER_H__
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+namespace MASS
+{
+/**
+ * @brief Wall time of the phases of Window::Step (run on the simulation
+ * thread) and Window::draw (run on the GLUT thread).
+ *
+ * Scope objects time a phase; every duration goes into the current HUD
+ * interval and into the whole run, which Save() summarizes per phase (mean,
+ * percentiles, max). The run keeps a histogram per phase, on a log2
+ * microsecond scale with BINS_PER_OCTAVE bins per doubling, so memory stays
+ * fixed however long it runs and the percentiles are within a bin (~9%).
+ * Recording is a lock and a few adds, a few times per control step.
+ */
+class FrameProfiler
+{
+public:
+	enum Phase
+	{
+		POLICY,			// GetActionFromNN
+		EXO_POLICY,		// GetExoTorquesFromNN
+		MUSCLE_NN,		// GetActivationFromNN (desired torques included)
+		MUSCLES,		// GetMuscleTorques (muscle Update, JtA)
+		DART,			// Environment::Step (muscle forces applied, world stepped)
+		RECORD,			// record_data
+		DRAW,			// Window::draw
+		NUM_PHASES
+	};
+	static const char* GetPhaseName(int phase);
+
+	class Scope
+	{
+	public:
+		Scope(FrameProfiler& profiler,Phase phase)
+			:mProfiler(profiler),mPhase(phase),mBegin(std::chrono::steady_clock::now()){}
+		~Scope(){mProfiler.Record(mPhase,std::chrono::duration<double>(std::chrono::steady_clock::now()-mBegin).count());}
+	private:
+		FrameProfiler& mProfiler;
+		Phase mPhase;
+		std::chrono::steady_clock::time_point mBegin;
+	};
+
+	// What the HUD shows, averaged over the last interval
+	struct Summary
+	{
+		double fps;
+		double real_time_factor;	// simulated seconds per wall second
+		double ms[NUM_PHASES];		// mean per call
+		double ms_per_step[NUM_PHASES];	// total per control step (per frame for DRAW)
+	};
+
+	static const int BINS_PER_OCTAVE = 8;
+	static const int NUM_BINS = 24*BINS_PER_OCTAVE;	// 1 us to ~16 s
+
+	FrameProfiler();
+
+	void Record(Phase phase,double seconds);
+	void AddFrame();
+	void AddStep(double simulated_seconds);
+	const Summary& Update(double interval = 0.5);
+	bool Save(const std::string& path);
+private:
+	struct Interval
+	{
+		double seconds[NUM_PHASES];
+		int calls[NUM_PHASES];
+		int frames;
+		int steps;
+		double simulated;
+	};
+	std::mutex mMutex;
+	Interval mInterval;
+	std::chrono::steady_clock::time_point mIntervalBegin,mBegin;
+	Summary mSummary;
+
+	// The whole run, per phase
+	std::vector<long long> mHistograms[NUM_PHASES];	// NUM_BINS counts, see Record
+	long long mCalls[NUM_PHASES];
+	double mTotal[NUM_PHASES];					// ms
+	double mMax[NUM_PHASES];					// ms
+	long long mFrames,mSteps;
+	double mSimulated;
+};
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include "Headless.h"
+#include "Window.h"
+#include "Environment.h"
+#include <EGL/eglext.h>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+using namespace MASS;
+
+HeadlessContext::
+HeadlessContext()
+	:mDisplay(EGL_NO_DISPLAY),mContext(EGL_NO_CONTEXT),mSurface(EGL_NO_SURFACE)
+{
+}
+HeadlessContext::
+~HeadlessContext()
+{
+	if(mDisplay==EGL_NO_DISPLAY)
+		return;
+	eglMakeCurrent(mDisplay,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+	if(mSurface!=EGL_NO_SURFACE)
+		eglDestroySurface(mDisplay,mSurface);
+	if(mContext!=EGL_NO_CONTEXT)
+		eglDestroyContext(mDisplay,mContext);
+	eglTerminate(mDisplay);
+}
+bool
+HeadlessContext::
+Create(int width,int height)
+{
+	auto query_devices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+	auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	EGLDeviceEXT device;
+	EGLint num_devices = 0;
+	if(query_devices!=nullptr && get_platform_display!=nullptr && query_devices(1,&device,&num_devices) && num_devices>0)
+		mDisplay = get_platform_display(EGL_PLATFORM_DEVICE_EXT,device,nullptr);
+	else
+		mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	EGLint major,minor;
+	if(mDisplay==EGL_NO_DISPLAY || !eglInitialize(mDisplay,&major,&minor))
+	{
+		std::cout<<"Can't initialize EGL"<<std::endl;
+		mDisplay = EGL_NO_DISPLAY;
+		return false;
+	}
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE,EGL_PBUFFER_BIT,
+		EGL_RED_SIZE,8,EGL_GREEN_SIZE,8,EGL_BLUE_SIZE,8,
+		EGL_DEPTH_SIZE,24,
+		EGL_RENDERABLE_TYPE,EGL_OPENGL_BIT,
+		EGL_NONE};
+	const EGLint pbuffer_attribs[] = {EGL_WIDTH,width,EGL_HEIGHT,height,EGL_NONE};
+	EGLConfig config;
+	EGLint num_configs = 0;
+	if(!eglChooseConfig(mDisplay,config_attribs,&config,1,&num_configs) || num_configs==0 || !eglBindAPI(EGL_OPENGL_API))
+	{
+		std::cout<<"No EGL config for offscreen OpenGL"<<std::endl;
+		return false;
+	}
+	mSurface = eglCreatePbufferSurface(mDisplay,config,pbuffer_attribs);
+	mContext = eglCreateContext(mDisplay,config,EGL_NO_CONTEXT,nullptr);
+	if(mSurface==EGL_NO_SURFACE || mContext==EGL_NO_CONTEXT || !eglMakeCurrent(mDisplay,mSurface,mSurface,mContext))
+	{
+		std::cout<<"Can't create offscreen context ("<<width<<"x"<<height<<")"<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+FrameWriter::
+FrameWriter(const std::string& path,int width,int height,bool video)
+	:mPath(path),mWidth(width),mHeight(height),mVideo(video),mNumFrames(0),mFile(nullptr)
+{
+	if(mVideo)
+		mFile = fopen((mPath+".rgb").c_str(),"wb");
+	else
+		mkdir(mPath.c_str(),0755);
+}
+FrameWriter::
+~FrameWriter()
+{
+	if(mFile!=nullptr)
+		fclose(mFile);
+}
+bool
+FrameWriter::
+Write(const std::vector<unsigned char>& rgb)
+{
+	FILE* fp = mFile;
+	if(!mVideo)
+	{
+		std::stringstream ss;
+		ss<<mPath<<"/frame_"<<std::setw(5)<<std::setfill('0')<<mNumFrames<<".ppm";
+		fp = fopen(ss.str().c_str(),"wb");
+		if(fp!=nullptr)
+			fprintf(fp,"P6\n%d %d\n255\n",mWidth,mHeight);
+	}
+	if(fp==nullptr)
+		return false;
+	bool ok = fwrite(rgb.data(),1,rgb.size(),fp)==rgb.size();
+	if(!mVideo)
+		ok = fclose(fp)==0 && ok;
+	mNumFrames++;
+	return ok;
+}
+
+HeadlessOptions::
+HeadlessOptions()
+	:enabled(false),num_episodes(1),num_jobs(1),max_frames(300),width(640),height(480),video(false),draw_obj(false),frame_rate(30)
+{
+}
+
+/**
+ * @brief Takes the headless options out of argv, leaving the positional
+ * arguments in place:
+ * --headless DIR (required to enable), --episodes N, --jobs N (processes),
+ * --frames N (per episode at most), --size WxH, --video (raw rgb24 instead of ppm),
+ * --obj (draw the OBJ meshes)
+ */
+bool
+HeadlessOptions::
+Parse(int& argc,char** argv)
+{
+	int n = 1;
+	for(int i=1;i<argc;i++)
+	{
+		std::string arg = argv[i];
+		bool has_value = i+1<argc;
+		if(arg=="--headless" && has_value)
+		{
+			enabled = true;
+			output_dir = argv[++i];
+		}
+		else if(arg=="--episodes" && has_value)
+			num_episodes = std::stoi(argv[++i]);
+		else if(arg=="--jobs" && has_value)
+			num_jobs = std::stoi(argv[++i]);
+		else if(arg=="--frames" && has_value)
+			max_frames = std::stoi(argv[++i]);
+		else if(arg=="--size" && has_value)
+		{
+			if(sscanf(argv[++i],"%dx%d",&width,&height)!=2)
+				return false;
+		}
+		else if(arg=="--video")
+			video = true;
+		else if(arg=="--obj")
+			draw_obj = true;
+		else if(arg.compare(0,2,"--")==0)
+			return false;
+		else
+			argv[n++] = argv[i];
+	}
+	argc = n;
+	num_jobs = std::max(1,std::min(num_jobs,num_episodes));
+	return width>0 && height>0;
+}
+
+namespace
+{
+/**
+ * @brief Renders episodes job, job+num_jobs, ... as fast as the simulation
+ * and GL allow.
+ * @return the number of frames written
+ */
+long long
+RunJob(const HeadlessOptions& options,int job,const std::function<Window*()>& make_window)
+{
+	HeadlessContext context;
+	if(!context.Create(options.width,options.height))
+		return 0;
+	Window* window = make_window();
+	window->InitHeadless(options.width,options.height);
+	window->mDrawOBJ = options.draw_obj;
+	// every job would write (and plot) the same telemetry file, the
+	// trajectory logs below hold what it records
+	window->DisableTelemetry();
+
+	long long num_frames = 0;
+	double render_time = 0.0;
+	std::vector<unsigned char> rgb;
+	auto begin = std::chrono::steady_clock::now();
+	for(int e=job;e<options.num_episodes;e+=options.num_jobs)
+	{
+		std::stringstream ss;
+		ss<<options.output_dir<<"/episode_"<<std::setw(3)<<std::setfill('0')<<e;
+		FrameWriter writer(ss.str(),options.width,options.height,options.video);
+		window->mEnv->StartRecording(ss.str()+".mtrj");
+		window->Reset();
+		for(int f=0;f<options.max_frames;f++)
+		{
+			auto render_begin = std::chrono::steady_clock::now();
+			window->RenderOffscreen(rgb);
+			render_time += std::chrono::duration<double>(std::chrono::steady_clock::now()-render_begin).count();
+			if(!writer.Write(rgb))
+			{
+				std::cout<<"Can't write frames to "<<ss.str()<<std::endl;
+				return num_frames;
+			}
+			num_frames++;
+			if(window->mEnv->IsEndOfEpisode())
+				break;
+			window->Step();
+		}
+		window->mEnv->StopRecording();
+	}
+	window->SetProfilePath(options.output_dir+"/profile_"+std::to_string(job)+".csv");
+	window->SaveProfile();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+	std::cout<<"Job "<<job<<" : "<<num_frames<<" frames in "<<seconds<<" s ("<<num_frames/seconds<<" fps, drawing "
+		<<render_time/std::max(num_frames,1LL)*1e3<<" ms per frame)"<<std::endl;
+	return num_frames;
+}
+}
+
+/**
+ * @brief Renders options.num_episodes evaluation episodes offscreen into
+ * options.output_dir, split over options.num_jobs forked processes. Each
+ * process makes its own GL context and window (and so its own python
+ * interpreter), the environment built before the fork is shared copy-on-write.
+ */
+int
+MASS::
+RunHeadless(const HeadlessOptions& options,const std::function<Window*()>& make_window)
+{
+	mkdir(options.output_dir.c_str(),0755);
+	auto begin = std::chrono::steady_clock::now();
+	int fds[2];
+	if(pipe(fds)!=0)
+		return 1;
+	std::vector<pid_t> pids;
+	for(int job=0;job<options.num_jobs;job++)
+	{
+		pid_t pid = fork();
+		if(pid==0)
+		{
+			close(fds[0]);
+			long long num_frames = RunJob(options,job,make_window);
+			bool ok = write(fds[1],&num_frames,sizeof(num_frames))==sizeof(num_frames);
+			close(fds[1]);
+			_exit(ok ? 0 : 1);
+		}
+		if(pid>0)
+			pids.push_back(pid);
+	}
+	close(fds[1]);
+	long long total = 0,num_frames;
+	while(read(fds[0],&num_frames,sizeof(num_frames))==sizeof(num_frames))
+		total += num_frames;
+	close(fds[0]);
+	int failed = options.num_jobs-pids.size();
+	for(pid_t pid : pids)
+	{
+		int status = 0;
+		waitpid(pid,&status,0);
+		failed += !WIFEXITED(status) || WEXITSTATUS(status)!=0;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+	std::cout<<"Rendered "<<options.num_episodes<<" episodes ("<<total<<" frames, "<<options.width<<"x"<<options.height<<") in "
+		<<seconds<<" s with "<<options.num_jobs<<" jobs : "<<total/seconds<<" fps"<<std::endl;
+	if(options.video)
+		std::cout<<"Encode with : ffmpeg -f rawvideo -pix_fmt rgb24 -s "<<options.width<<"x"<<options.height
+			<<" -r "<<options.frame_rate<<" -i "<<options.output_dir<<"/episode_000.rgb episode_000.mp4"<<std::endl;
+	return failed==0 ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#ifndef __MASS_HEADLESS_H__
+#define __MASS_HEADLESS_H__
+#include <EGL/egl.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace MASS
+{
+class Window;
+
+/**
+ * @brief Offscreen OpenGL (compatibility profile) context on an EGL pbuffer.
+ * Uses the first EGL device (a GPU, or llvmpipe via Mesa's software device),
+ * so no X display is needed.
+ */
+class HeadlessContext
+{
+public:
+	HeadlessContext();
+	~HeadlessContext();
+	bool Create(int width,int height);
+private:
+	EGLDisplay mDisplay;
+	EGLContext mContext;
+	EGLSurface mSurface;
+};
+
+/**
+ * @brief Writes the frames of one episode, either as an image sequence
+ * (dir/frame_00000.ppm, ...) or as one raw rgb24 video file (path.rgb).
+ */
+class FrameWriter
+{
+public:
+	FrameWriter(const std::string& path,int width,int height,bool video);
+	~FrameWriter();
+	bool Write(const std::vector<unsigned char>& rgb);
+private:
+	std::string mPath;
+	int mWidth,mHeight;
+	bool mVideo;
+	int mNumFrames;
+	FILE* mFile;
+};
+
+struct HeadlessOptions
+{
+	HeadlessOptions();
+	bool Parse(int& argc,char** argv);
+
+	bool enabled;
+	std::string output_dir;
+	int num_episodes;
+	int num_jobs;
+	int max_frames;
+	int width,height;
+	bool video;
+	bool draw_obj;
+	int frame_rate;		// of the written video, the control rate of the env
+};
+
+int RunHeadless(const HeadlessOptions& options,const std::function<Window*()>& make_window);
+};
+
+#endif
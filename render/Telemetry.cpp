@@ -0,0 +1,137 @@
+#include "Telemetry.h"
+#include <iostream>
+using namespace MASS;
+
+/**
+ * @brief Creates the file (overwriting it), writes the header line and
+ * starts the writer thread.
+ *
+ * @param block_rows - samples per block
+ * @param num_blocks - blocks in the ring
+ */
+Telemetry::
+Telemetry(const std::string& path,const std::vector<std::string>& columns,int block_rows,int num_blocks)
+	:mPath(path),mColumns(columns),mFile(nullptr),mBlockRows(std::max(1,block_rows)),mNumRows(0),mCurrent(0),mStop(false)
+{
+	mFile = fopen(mPath.c_str(),"w");
+	if(mFile==nullptr)
+	{
+		std::cout<<"Can't open file : "<<mPath<<std::endl;
+		return;
+	}
+	for(int c=0;c<mColumns.size();c++)
+		fprintf(mFile,c==0 ? "%s" : ",%s",mColumns[c].c_str());
+	fprintf(mFile,"\n");
+
+	mBlocks.resize(std::max(2,num_blocks));
+	for(int i=0;i<mBlocks.size();i++)
+	{
+		mBlocks[i].values.resize((size_t)mBlockRows*mColumns.size());
+		mBlocks[i].num_rows = 0;
+		if(i>0)
+			mFree.push_back(i);
+	}
+	mThread = std::thread(&Telemetry::Run,this);
+}
+Telemetry::
+~Telemetry()
+{
+	Close();
+}
+
+/**
+ * @brief Appends one sample, values in column order.
+ */
+void
+Telemetry::
+Push(const Eigen::VectorXd& values)
+{
+	if(mFile==nullptr)
+		return;
+	if(mCurrent<0)
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mCondition.wait(lock,[this]{return !mFree.empty();});
+		mCurrent = mFree.front();
+		mFree.pop_front();
+	}
+	Block& block = mBlocks[mCurrent];
+	int n = std::min((int)values.rows(),(int)mColumns.size());
+	for(int c=0;c<n;c++)
+		block.values[(size_t)c*mBlockRows+block.num_rows] = values[c];
+	for(int c=n;c<mColumns.size();c++)
+		block.values[(size_t)c*mBlockRows+block.num_rows] = 0.0;
+	mNumRows++;
+	if(++block.num_rows==mBlockRows)
+		SealBlock();
+}
+void
+Telemetry::
+SealBlock()
+{
+	if(mCurrent<0 || mBlocks[mCurrent].num_rows==0)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mFull.push_back(mCurrent);
+	}
+	mCurrent = -1;
+	mCondition.notify_all();
+}
+
+/**
+ * @brief Writes out the partially filled block and every queued one, then
+ * closes the file.
+ */
+void
+Telemetry::
+Close()
+{
+	if(mFile==nullptr)
+		return;
+	SealBlock();
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mCondition.notify_all();
+	mThread.join();
+	fclose(mFile);
+	mFile = nullptr;
+}
+void
+Telemetry::
+Run()
+{
+	while(true)
+	{
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock,[this]{return mStop || !mFull.empty();});
+			if(mFull.empty())
+				return;
+			index = mFull.front();
+			mFull.pop_front();
+		}
+		WriteBlock(mBlocks[index]);
+		mBlocks[index].num_rows = 0;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mFree.push_back(index);
+		}
+		mCondition.notify_all();
+	}
+}
+void
+Telemetry::
+WriteBlock(const Block& block)
+{
+	for(int r=0;r<block.num_rows;r++)
+	{
+		for(int c=0;c<mColumns.size();c++)
+			fprintf(mFile,c==0 ? "%.9g" : ",%.9g",block.values[(size_t)c*mBlockRows+r]);
+		fprintf(mFile,"\n");
+	}
+	fflush(mFile);
+}
@@ -0,0 +1,62 @@
+#ifndef __MASS_TELEMETRY_H__
+#define __MASS_TELEMETRY_H__
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+
+namespace MASS
+{
+/**
+ * @brief Per control step samples of a fixed set of named columns, written
+ * to a CSV file (one header line with the column names) on a background thread.
+ *
+ * Samples go into a ring of preallocated blocks, stored column by column.
+ * Push() only copies the values; a full block is handed to the writer thread
+ * and the next free one is taken, so the stepping thread never touches the
+ * file. Push() only waits if every block is still queued for writing.
+ */
+class Telemetry
+{
+public:
+	Telemetry(const std::string& path,const std::vector<std::string>& columns,int block_rows = 256,int num_blocks = 4);
+	~Telemetry();
+
+	void Push(const Eigen::VectorXd& values);
+	void Close();
+
+	bool IsOpen(){return mFile!=nullptr;}
+	int GetNumColumns(){return mColumns.size();}
+	const std::string& GetPath(){return mPath;}
+	long long GetNumRows(){return mNumRows;}
+private:
+	struct Block
+	{
+		std::vector<double> values;		// column c of row r at c*rows+r
+		int num_rows;
+	};
+	void Run();
+	void WriteBlock(const Block& block);
+	void SealBlock();
+
+	std::string mPath;
+	std::vector<std::string> mColumns;
+	FILE* mFile;
+	int mBlockRows;
+	long long mNumRows;
+
+	std::vector<Block> mBlocks;
+	int mCurrent;						// block being filled, -1 if none is free yet
+	std::deque<int> mFull,mFree;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mStop;
+	std::thread mThread;
+};
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __MASS_TRIPLE_BUFFER_H__
+#define __MASS_TRIPLE_BUFFER_H__
+#include <atomic>
+
+namespace MASS
+{
+/**
+ * @brief Single producer, single consumer triple buffer without locks.
+ *
+ * The writer fills GetBack() and Publish()es it, the reader calls Update()
+ * and reads GetFront(). Neither ever waits for the other: the two swap slots
+ * through one atomic index, whose FRESH bit tells the reader that the middle
+ * slot holds a newer value than its front slot.
+ */
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer():mFront(0),mMiddle(1),mBack(2){}
+
+	T& GetBack(){return mSlots[mBack];}
+	void Publish()
+	{
+		mBack = mMiddle.exchange(mBack|FRESH,std::memory_order_acq_rel)&INDEX;
+	}
+
+	// true if a newer value was published since the last Update
+	bool Update()
+	{
+		if((mMiddle.load(std::memory_order_relaxed)&FRESH)==0)
+			return false;
+		mFront = mMiddle.exchange(mFront,std::memory_order_acq_rel)&INDEX;
+		return true;
+	}
+	const T& GetFront(){return mSlots[mFront];}
+private:
+	static const int INDEX = 3;
+	static const int FRESH = 4;
+
+	T mSlots[3];
+	int mFront;
+	std::atomic<int> mMiddle;
+	int mBack;
+};
+};
+
+#endif
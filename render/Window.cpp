@@ -8,21 +8,47 @@
 #include "Character.h"
 #include "BVH.h"
 #include "Muscle.h"
+#include "MeshCache.h"
+#include "MuscleGroups.h"
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
 using namespace MASS;
 using namespace dart;
 using namespace dart::dynamics;
 using namespace dart::simulation;
 using namespace dart::gui;
 
+namespace
+{
+// Muscle groups of the telemetry, in column order (see TelemetryColumns)
+const char* TELEMETRY_MUSCLE_GROUPS[] = {
+	"LHFlex","LHExt","LHAbd","LHAdd","LHExtRot","LHIntRot","LKFlex","LKExt",
+	"RHFlex","RHExt","RHAbd","RHAdd","RHExtRot","RHIntRot","RKFlex","RKExt"};
+}
+
 Window::
 Window(Environment* env)
-	:mEnv(env),mFocus(true),mSimulating(false),mDrawOBJ(false),mDrawShadow(true),mMuscleNNLoaded(false)
+	:mEnv(env),mFocus(true),mSimulating(false),mDrawOBJ(false),mDrawShadow(true),mMuscleNNLoaded(false),
+	mGroundList(0),mGroundY(0.0),mSphereList(0),mCylinderList(0),
+	mRunning(false),mStepRequests(0),mResetRequested(false),mPlaybackSpeed(1.0),mDisplayTime(0.0),mHasSnapshot(false),
+	mReplaying(false),mScrubbing(false),mReplayFrame(0.0),
+	mTelemetry(nullptr),mTelemetryDone(false),mTelemetryCycles(8.0),mNumWraparounds(0),mLastPhase(0.0),
+	mDrawHUD(false),mReloadDrawn(true)
 {
 	mBackground[0] = 1.0;
 	mBackground[1] = 1.0;
 	mBackground[2] = 1.0;
 	mBackground[3] = 1.0;
+
+	// The ground is static, its height is read once instead of from the stepping world
+	auto ground = mEnv->GetGround();
+	mGroundHeight = ground->getBodyNode(0)->getTransform().translation()[1] + dynamic_cast<const BoxShape*>(ground->getBodyNode(0)->getShapeNodesWith<dart::dynamics::VisualAspect>()[0]->getShape().get())->getSize()[1]*0.5;
+	// Drawn instead of the simulated character, posed from the published snapshots
+	mRenderCharacter = mEnv->GetCharacter()->Clone();
+	// the simulated skeleton is stepped on another thread, meshes still loading go to the drawn one
+	MeshCache::TransferPending(mEnv->GetCharacter()->GetSkeleton(),mRenderCharacter->GetSkeleton());
 	SetFocusing();
 	mZoom = 0.25;	
 	mFocus = false;
@@ -52,9 +78,6 @@ Window(Environment* env)
 	/** instantiate the python plotter object **/
 	plotter = py::eval("Plotter()", mns);
 
-	/** Define muscle groups **/
-	define_muscle_groups();
-
 }
 Window::
 Window(Environment* env,const std::string& nn_path)
@@ -91,209 +114,157 @@ Window(Environment* env,const std::string& nn_path,const std::string& muscle_nn_
 	load(muscle_nn_path);
 }
 
+/**
+ * @brief Records hip/knee joint angles (actual and reference) and the average
+ * activation of every muscle group for the first mTelemetryCycles gait cycles,
+ * then writes the plots (Plot_And_Save).
+ */
 void 
 Window::
 record_data()
 {
-	/** Load applied exo torques to be sent to plotter **/
-	//just call mEnv->GetExoTorques()
-
-	/** Read and save benjaSIM activations, group into:
-	 * Hip flexion/extension groups
-	 * Hip abduction/adduction groups
-	 * Hip external/internal rotation groups
-	 * Knee flexion/extension groups
-	 */
-	// Initialise activation total to 0 for all groups
-	for (MuscleGroup& muscle_group : muscle_groups)
-	{
-		muscle_group.total_activation = 0.0;
-	}
+	double phase;
+	if(!NextTelemetryPhase(phase))
+		return;
+	if(mTelemetry==nullptr)
+		StartTelemetry(std::string(MASS_ROOT_DIR)+"/Exo_agent/Data/All_Data_SIM.csv",false);
 
-	// Loop through all muscles in benjaSIM
-	for(auto muscle : mEnv->GetCharacter()->GetMuscles())
-	{
-		// Loop through all the defined muscles groups of interest
-		for (MuscleGroup& muscle_group : muscle_groups)
-		{
-			// if we are interested in the current muscle
-			// i.e. it is in one of the defined groups,
-			// add the activation to the group's total.
-			if (muscle_group.group.count(muscle->name))
-			{
-				muscle_group.add(muscle->activation);
-			}
-		}
-	}
-	
-	// initialise vector to store avg activations of each group:
-	// {LHFlex,LHExt,LHAbd,LHAdd,LHExtRot,LHIntRot,LKFlex,LKExt,
-    //  RHFlex,RHExt,RHAbd,RHAdd,RHExtRot,RHIntRot,RKFlex,RKExt,} 
-	Eigen::VectorXd avg_activations(16);
-	// Find the average activation for each muscle group,
-	// append to vector for sending to python
-	for (int i=0; i<16; i++)
-	{
-		avg_activations[i] =  muscle_groups[i].get_avg_activation();
-	}
-
-	/** Read and save benjaSIM hip/knee joint angles **/
-	// mEnv->GetCharacter()->GetSkeleton()->getBodyNode("FemurL")->getParentJoint()->get
-	// dummy angle vector so code works
-	Eigen::VectorXd joint_angles_act(4);
-	Eigen::VectorXd joint_angles_ref(4);
-	// Actual positions
-	double l_hip_act = mEnv->GetCharacter()->GetSkeleton()->getBodyNode("FemurL")->getParentJoint()->getPositions()[0];
-	double r_hip_act = mEnv->GetCharacter()->GetSkeleton()->getBodyNode("FemurR")->getParentJoint()->getPositions()[0];
-	double l_knee_act = mEnv->GetCharacter()->GetSkeleton()->getBodyNode("TibiaL")->getParentJoint()->getPositions()[0];
-	double r_knee_act = mEnv->GetCharacter()->GetSkeleton()->getBodyNode("TibiaR")->getParentJoint()->getPositions()[0];
-	//Reference positions
-	auto l_hip_joint_idx = mEnv->GetCharacter()->GetSkeleton()->getBodyNode("FemurL")->getParentJoint()->getIndexInSkeleton(0);
-	auto r_hip_joint_idx = mEnv->GetCharacter()->GetSkeleton()->getBodyNode("FemurR")->getParentJoint()->getIndexInSkeleton(0);
-	auto l_knee_joint_idx = mEnv->GetCharacter()->GetSkeleton()->getBodyNode("TibiaL")->getParentJoint()->getIndexInSkeleton(0);
-	auto r_knee_joint_idx = mEnv->GetCharacter()->GetSkeleton()->getBodyNode("TibiaR")->getParentJoint()->getIndexInSkeleton(0);	
-	double l_hip_ref =  mEnv->GetTargetPositions()[l_hip_joint_idx];
-	double r_hip_ref = mEnv->GetTargetPositions()[r_hip_joint_idx];
-	double l_knee_ref = mEnv->GetTargetPositions()[l_knee_joint_idx];
-	double r_knee_ref = mEnv->GetTargetPositions()[r_knee_joint_idx];
-
-	joint_angles_act << l_hip_act, l_knee_act, r_hip_act, r_knee_act;
-	joint_angles_ref << l_hip_ref, l_knee_ref, r_hip_ref, r_knee_ref;
-
-	/** Send angles, torques, activations to python for plotting **/
-	py::object Update_All_SIM = plotter.attr("Update_All_SIM");
-    Update_All_SIM(joint_angles_act, joint_angles_ref,
-					avg_activations, mEnv->GetState().tail(1));
+	Eigen::VectorXd joint_angles_act,joint_angles_ref;
+	GetLegJointAngles(joint_angles_act,joint_angles_ref);
+	mTelemetryRow<<joint_angles_act,joint_angles_ref,GetMuscleGroupActivations(),phase;
+	mTelemetry->Push(mTelemetryRow);
 }
 void 
 Window::
 Plot_And_Save()
 {	
-	std::cout << "\nin plot_and_save";
-	/** Save data to CSV **/
-	py::object Save_All_To_CSV_SIM = plotter.attr("Save_All_To_CSV_SIM");
-    Save_All_To_CSV_SIM();
+	if(!FinishTelemetry())
+		return;
 	/** Plot the data **/
-	py::object Plot_All_SIM = plotter.attr("Plot_All_SIM");
-    Plot_All_SIM();
+	plotter.attr("Load_CSV")(mTelemetry->GetPath());
+	plotter.attr("Plot_All_SIM")();
 }
-void 
+
+/**
+ * @brief The telemetry columns, named after the Plotter attributes they load into.
+ */
+std::vector<std::string>
+Window::
+TelemetryColumns(bool exo_torques)
+{
+	std::vector<std::string> columns;
+	if(exo_torques)
+		columns = {"t_l_hip","t_l_knee","t_r_hip","t_r_knee"};
+	columns.insert(columns.end(),{
+		"l_hip_angle","l_knee_angle","r_hip_angle","r_knee_angle",
+		"d_l_hip_angle","d_l_knee_angle","d_r_hip_angle","d_r_knee_angle",
+		// same order as TELEMETRY_MUSCLE_GROUPS
+		"l_h_flex","l_h_ext","l_h_abd","l_h_add","l_h_extrot","l_h_introt","l_k_flex","l_k_ext",
+		"r_h_flex","r_h_ext","r_h_abd","r_h_add","r_h_extrot","r_h_introt","r_k_flex","r_k_ext",
+		"gait_phase"});
+	return columns;
+}
+
+/**
+ * @brief Gait phase of this control step, counting completed cycles (the
+ * env phase wraps around to 0). Once mTelemetryCycles are recorded the
+ * telemetry is finished and plotted.
+ *
+ * @return false if nothing is to be recorded anymore
+ */
+bool
+Window::
+NextTelemetryPhase(double& phase)
+{
+	if(mTelemetryDone)
+		return false;
+	double phi = mEnv->GetPhase();
+	if(phi<mLastPhase)
+		mNumWraparounds++;
+	mLastPhase = phi;
+	phase = mNumWraparounds+phi;
+	if(phase>=mTelemetryCycles)
+	{
+		Plot_And_Save();
+		return false;
+	}
+	return true;
+}
+void
+Window::
+StartTelemetry(const std::string& path,bool exo_torques)
+{
+	std::vector<std::string> columns = TelemetryColumns(exo_torques);
+	mTelemetry = new Telemetry(path,columns);
+	mTelemetryRow.resize(columns.size());
+}
+
+/**
+ * @brief Writes out the telemetry file, once.
+ * @return true if there is a file to plot
+ */
+bool
 Window::
-define_muscle_groups()
-{
-	// L Hip Flexion DONE
-	muscle_groups[LHFlex].group = {
-		"L_Rectus_Femoris", "L_Rectus_Femoris1", "L_iliacus", "L_iliacus1",
-		"L_iliacus2", "L_Psoas_Major", "L_Psoas_Major1", "L_Psoas_Major2", 
-		"L_Psoas_Minor", 
-		"L_Sartorius"
-		};
-	// L Hip Extension DONE
-	muscle_groups[LHExt].group = {
-		"L_Gluteus_Maximus", "L_Gluteus_Maximus1", "L_Gluteus_Maximus2", 
-		"L_Gluteus_Maximus3", "L_Gluteus_Maximus4", "L_Adductor_Magnus", 
-		"L_Adductor_Magnus1", "L_Adductor_Magnus2", "L_Adductor_Magnus3",
-		"L_Adductor_Magnus4", "L_Bicep_Femoris_Longus", "L_Semitendinosus",
-		"L_Semimembranosus", "L_Semimembranosus1"
-	};
-	// L Hip Abduction DONE
-	muscle_groups[LHAbd].group = {
-		"L_Gluteus_Medius", "L_Gluteus_Medius1", "L_Gluteus_Medius2", 
-		"L_Gluteus_Medius3", "L_Gluteus_Minimus", "L_Gluteus_Minimus1", 
-		"L_Gluteus_Minimus2", "L_Tensor_Fascia_Lata", "L_Tensor_Fascia_Lata1", 
-		"L_Tensor_Fascia_Lata2"
-	};
-	// L Hip Adduction DONE
-	muscle_groups[LHAdd].group = {
-		"L_Pectineus", "L_Adductor_Longus", "L_Adductor_Longus1",
-		"L_Gracilis", "L_Adductor_Brevis", "L_Adductor_Brevis1",
-		"L_Adductor_Magnus", "L_Adductor_Magnus1", "L_Adductor_Magnus2",
-		"L_Adductor_Magnus3", "L_Adductor_Magnus4"
-	};
-	// L Hip External rotation DONE
-	muscle_groups[LHExtRot].group = {
-		"L_Gluteus_Maximus", "L_Gluteus_Maximus1", "L_Gluteus_Maximus2", 
-		"L_Gluteus_Maximus3", "L_Gluteus_Maximus4", "L_Piriformis", 
-		"L_Piriformis1", "L_Quadratus_Femoris", "L_Obturator_Externus",
-		 "L_Obturator_Internus", "L_Superior_Gemellus", "L_Inferior_Gemellus"
-	};
-	// L hip Internal rotation DONE
-	muscle_groups[LHIntRot].group = { //SUS - exact same muscles as abductor grp
-		"L_Gluteus_Medius", "L_Gluteus_Medius1", "L_Gluteus_Medius2", 
-		"L_Gluteus_Medius3", "L_Gluteus_Minimus", "L_Gluteus_Minimus1", 
-		"L_Gluteus_Minimus2", "L_Tensor_Fascia_Lata", "L_Tensor_Fascia_Lata1", 
-		"L_Tensor_Fascia_Lata2"
-	};
-	// L Knee Flexion 
-	muscle_groups[LKFlex].group = {
-		"L_Semimembranosus", "L_Semimembranosus1", "L_Semitendinosus",
-		"L_Bicep_Femoris_Longus", "L_Bicep_Femoris_Short", "L_Bicep_Femoris_Short1",
-		"L_Gracilis", "L_Sartorius", "L_Gastrocnemius_Lateral_Head", 
-		"L_Gastrocnemius_Medial_Head", "L_Plantaris", "L_Popliteus"
-	};
-	// L Knee Extension
-	muscle_groups[LKExt].group = {
-		"L_Rectus_Femoris", "L_Rectus_Femoris1", "L_Vastus_Lateralis", 
-		"L_Vastus_Lateralis1", "L_Vastus_Medialis", "L_Vastus_Medialis1",
-		"L_Vastus_Medialis2", "L_Vastus_Intermedius", "L_Vastus_Intermedius1"
-	};
-
-	// R Hip Flexion
-	muscle_groups[RHFlex].group = {
-		"R_Rectus_Femoris", "R_Rectus_Femoris1", "R_iliacus", "R_iliacus1",
-		"R_iliacus2", "R_Psoas_Major", "R_Psoas_Major1", "R_Psoas_Major2", 
-		"R_Psoas_Minor",
-		 "R_Sartorius"
-	};
-	// R Hip Extension
-	muscle_groups[RHExt].group = {
-		"R_Gluteus_Maximus", "R_Gluteus_Maximus1", "R_Gluteus_Maximus2", 
-		"R_Gluteus_Maximus3", "R_Gluteus_Maximus4", "R_Adductor_Magnus", 
-		"R_Adductor_Magnus1", "R_Adductor_Magnus2", "R_Adductor_Magnus3",
-		"R_Adductor_Magnus4", "R_Bicep_Femoris_Longus", "R_Semitendinosus",
-		"R_Semimembranosus", "R_Semimembranosus1"
-	};
-	// R Hip Abduction
-	muscle_groups[RHAbd].group = {
-		"R_Gluteus_Medius", "R_Gluteus_Medius1", "R_Gluteus_Medius2", 
-		"R_Gluteus_Medius3", "R_Gluteus_Minimus", "R_Gluteus_Minimus1", 
-		"R_Gluteus_Minimus2", "R_Tensor_Fascia_Lata", "R_Tensor_Fascia_Lata1", 
-		"R_Tensor_Fascia_Lata2"
-	};
-	// R Hip Adduction
-	muscle_groups[RHAdd].group = {
-		"R_Pectineus", "R_Adductor_Longus", "R_Adductor_Longus1",
-		"R_Gracilis", "R_Adductor_Brevis", "R_Adductor_Brevis1",
-		"R_Adductor_Magnus", "R_Adductor_Magnus1", "R_Adductor_Magnus2",
-		"R_Adductor_Magnus3", "R_Adductor_Magnus4"
-	};
-	// R Hip External rotation
-	muscle_groups[RHExtRot].group = {
-		"R_Gluteus_Maximus", "R_Gluteus_Maximus1", "R_Gluteus_Maximus2", 
-		"R_Gluteus_Maximus3", "R_Gluteus_Maximus4", "R_Piriformis", 
-		"R_Piriformis1", "R_Quadratus_Femoris", "R_Obturator_Externus",
-		 "R_Obturator_Internus", "R_Superior_Gemellus", "R_Inferior_Gemellus"
-	};
-	// R hip Internal rotation
-	muscle_groups[RHIntRot].group = {
-		"R_Gluteus_Medius", "R_Gluteus_Medius1", "R_Gluteus_Medius2", 
-		"R_Gluteus_Medius3", "R_Gluteus_Minimus", "R_Gluteus_Minimus1", 
-		"R_Gluteus_Minimus2", "R_Tensor_Fascia_Lata", "R_Tensor_Fascia_Lata1", 
-		"R_Tensor_Fascia_Lata2"
-	};
-	// R Knee Flexion
-	muscle_groups[RKFlex].group = {
-		"R_Semimembranosus", "R_Semimembranosus1", "R_Semitendinosus",
-		"R_Bicep_Femoris_Longus", "R_Bicep_Femoris_Short", "R_Bicep_Femoris_Short1",
-		"R_Gracilis", "R_Sartorius", "R_Gastrocnemius_Lateral_Head", 
-		"R_Gastrocnemius_MediaR_Head", "R_Plantaris", "R_Popliteus"
-	};
-	// R Knee Extension
-	muscle_groups[RKExt].group = {
-		"R_Rectus_Femoris", "R_Rectus_Femoris1", "R_Vastus_Lateralis", 
-		"R_Vastus_Lateralis1", "R_Vastus_Medialis", "R_Vastus_Medialis1",
-		"R_Vastus_Medialis2", "R_Vastus_Intermedius", "R_Vastus_Intermedius1"
-	};
+FinishTelemetry()
+{
+	if(mTelemetryDone)
+		return false;
+	mTelemetryDone = true;
+	if(mTelemetry==nullptr)
+		return false;
+	mTelemetry->Close();
+	std::cout<<mTelemetry->GetNumRows()<<" telemetry rows written to "<<mTelemetry->GetPath()<<std::endl;
+	return true;
+}
+
+/**
+ * @brief Actual and reference angles of [L hip, L knee, R hip, R knee].
+ */
+void
+Window::
+GetLegJointAngles(Eigen::VectorXd& act,Eigen::VectorXd& ref)
+{
+	const SkeletonPtr& skel = mEnv->GetCharacter()->GetSkeleton();
+	const Eigen::VectorXd& target = mEnv->GetTargetPositions();
+	const char* bodies[4] = {"FemurL","TibiaL","FemurR","TibiaR"};
+	act.resize(4);
+	ref.resize(4);
+	for(int i=0;i<4;i++)
+	{
+		Joint* joint = skel->getBodyNode(bodies[i])->getParentJoint();
+		act[i] = joint->getPosition(0);
+		ref[i] = target[joint->getIndexInSkeleton(0)];
+	}
+}
+
+/**
+ * @brief Average activation of every muscle group of TELEMETRY_MUSCLE_GROUPS,
+ * from the character's muscle groups (see MuscleGroups). Groups missing from
+ * the group file read 0.
+ */
+const Eigen::VectorXd&
+Window::
+GetMuscleGroupActivations()
+{
+	const auto& groups = mEnv->GetCharacter()->GetMuscleGroups();
+	int num_groups = sizeof(TELEMETRY_MUSCLE_GROUPS)/sizeof(TELEMETRY_MUSCLE_GROUPS[0]);
+	mMuscleGroupActivations.setZero(num_groups);
+	if(groups==nullptr)
+		return mMuscleGroupActivations;
+	if(mTelemetryGroups.empty())
+	{
+		for(int g=0;g<num_groups;g++)
+		{
+			mTelemetryGroups.push_back(groups->GetIndex(TELEMETRY_MUSCLE_GROUPS[g]));
+			if(mTelemetryGroups.back()<0)
+				std::cout<<"No muscle group "<<TELEMETRY_MUSCLE_GROUPS[g]<<std::endl;
+		}
+	}
+	Eigen::VectorXd activations = groups->Average(mEnv->GetCharacter()->GetMuscleActivations());
+	for(int g=0;g<num_groups;g++)
+		if(mTelemetryGroups[g]>=0)
+			mMuscleGroupActivations[g] = activations[mTelemetryGroups[g]];
+	return mMuscleGroupActivations;
 }
 void
 Window::
@@ -310,12 +281,24 @@ draw()
 	mViewMatrix.linear() = A;
 	mViewMatrix.translation() = b;
 
-	auto ground = mEnv->GetGround();
-	float y = ground->getBodyNode(0)->getTransform().translation()[1] + dynamic_cast<const BoxShape*>(ground->getBodyNode(0)->getShapeNodesWith<dart::dynamics::VisualAspect>()[0]->getShape().get())->getSize()[1]*0.5;
-	
-	DrawGround(y);
-	DrawMuscles(mEnv->GetCharacter()->GetMuscles());
-	DrawSkeleton(mEnv->GetCharacter()->GetSkeleton());
+	{
+		FrameProfiler::Scope scope(mProfiler,FrameProfiler::DRAW);
+		UpdateRenderCharacter();
+		DrawGround(mGroundHeight);
+		DrawMuscles(mRenderCharacter->GetMuscles());
+		DrawSkeleton(mRenderCharacter->GetSkeleton());
+		if(mReplaying)
+			DrawTimeline();
+	}
+	mProfiler.AddFrame();
+	if(mDrawHUD)
+		DrawHUD();
+	if(!mReloadDrawn)
+	{
+		mReloadDrawn = true;
+		std::cout<<"Reloaded model drawn "<<std::chrono::duration<double>(std::chrono::steady_clock::now()-mFirstChange).count()*1e3
+			<<" ms after the file change"<<std::endl;
+	}
 
 	// Eigen::Quaterniond q = mTrackBall.getCurrQuat();
 	// q.x() = 0.0;
@@ -336,14 +319,30 @@ void
 Window::
 keyboard(unsigned char _key, int _x, int _y)
 {
+	if(mReplaying && ReplayKeyboard(_key))
+		return;
 	switch (_key)
 	{
-	case 's': this->Step();break;				// Move forward one simulation step (?)
+	case 's': 									// Move forward one simulation step (?)
+		if(mRunning)
+			mStepRequests++;
+		else
+			this->Step();
+		break;
 	case 'f': mFocus = !mFocus;break;			// Follow simulation with window
-	case 'r': this->Reset();break;				// Reset sim to the start
+	case 'r': 									// Reset sim to the start
+		if(mRunning)
+			mResetRequested = true;
+		else
+			this->Reset();
+		break;
 	case ' ': mSimulating = !mSimulating;break;	// Play the simulation
+	case ']': mPlaybackSpeed = std::min(mPlaybackSpeed*2.0,64.0);std::cout<<"Playback speed x"<<mPlaybackSpeed<<std::endl;break;
+	case '[': mPlaybackSpeed = std::max(mPlaybackSpeed*0.5,1.0/16.0);std::cout<<"Playback speed x"<<mPlaybackSpeed<<std::endl;break;
 	case 'o': mDrawOBJ = !mDrawOBJ;break;		// Switch between simple and complex skeleton model
-	case 27 : exit(0);break;
+	case 'h': mDrawShadow = !mDrawShadow;break;	// Shadows of the skeleton model
+	case 'p': mDrawHUD = !mDrawHUD;break;		// Frame rate and time per phase
+	case 27 : StopSimulationThread();mEnv->StopRecording();SaveProfile();exit(0);break;
 	default:
 		Win3D::keyboard(_key,_x,_y);break;
 	}
@@ -353,12 +352,83 @@ void
 Window::
 displayTimer(int _val)
 {
-	if(mSimulating)
+	MeshCache::AttachLoaded();
+	PollModelFiles();
+	if(mSimulating && !mRunning && !mReplaying)
 		Step();
 	glutPostRedisplay();
 	glutTimerFunc(mDisplayTimeout, refreshTimer, _val);
 }
 
+/**
+ * @brief Prepares drawing into an offscreen GL context (made current by the
+ * caller) instead of a GLUT window: no window, display timer or input.
+ */
+void
+Window::
+InitHeadless(int width,int height)
+{
+	mWinWidth = width;
+	mWinHeight = height;
+	mRI = new dart::gui::OpenGLRenderInterface();
+	mRI->initialize();
+	mFocus = true;
+	SetFocusing();
+}
+
+/**
+ * @brief Draws the current state the way Win3D::render does, without the
+ * GLUT buffer swap, and reads the frame back as top-down RGB rows.
+ */
+void
+Window::
+RenderOffscreen(std::vector<unsigned char>& rgb)
+{
+	MeshCache::AttachLoaded();
+	glViewport(0,0,mWinWidth,mWinHeight);
+	glClearColor(mBackground[0],mBackground[1],mBackground[2],mBackground[3]);
+	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluPerspective(mPersp,(double)mWinWidth/(double)mWinHeight,0.1,10.0);
+	gluLookAt(mEye[0],mEye[1],mEye[2],0.0,0.0,-1.0,mUp[0],mUp[1],mUp[2]);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	static const GLfloat ambient[] = {0.2,0.2,0.2,1.0};
+	static const GLfloat diffuse[] = {0.6,0.6,0.6,1.0};
+	static const GLfloat position0[] = {1.0,0.0,0.0,0.0};
+	static const GLfloat position1[] = {-1.0,0.0,0.0,0.0};
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+	glShadeModel(GL_SMOOTH);
+	glEnable(GL_NORMALIZE);
+	glLightfv(GL_LIGHT0,GL_AMBIENT,ambient);
+	glLightfv(GL_LIGHT0,GL_DIFFUSE,diffuse);
+	glLightfv(GL_LIGHT0,GL_POSITION,position0);
+	glLightfv(GL_LIGHT1,GL_AMBIENT,ambient);
+	glLightfv(GL_LIGHT1,GL_DIFFUSE,diffuse);
+	glLightfv(GL_LIGHT1,GL_POSITION,position1);
+	glEnable(GL_LIGHT0);
+	glEnable(GL_LIGHT1);
+	glEnable(GL_LIGHTING);
+
+	mTrackBall.applyGLRotation();
+	glScalef(mZoom,mZoom,mZoom);
+	glTranslatef(mTrans[0]*0.001,mTrans[1]*0.001,mTrans[2]*0.001);
+	draw();
+	glFinish();
+
+	int row = 3*mWinWidth;
+	std::vector<unsigned char> flipped(row*mWinHeight);
+	glPixelStorei(GL_PACK_ALIGNMENT,1);
+	glReadPixels(0,0,mWinWidth,mWinHeight,GL_RGB,GL_UNSIGNED_BYTE,flipped.data());
+	rgb.resize(flipped.size());
+	for(int i=0;i<mWinHeight;i++)
+		std::memcpy(&rgb[i*row],&flipped[(mWinHeight-1-i)*row],row);
+}
+
 /**
  * @brief Function which handles stepping through the rendering of the simulation,
  * by selecting an action, using this to set activations, then calling the Env step function - XS
@@ -369,30 +439,56 @@ Step()
 {	
 	int num = mEnv->GetSimulationHz()/mEnv->GetControlHz();
 	Eigen::VectorXd action;
-	if(mNNLoaded)
-		action = GetActionFromNN();		// Some vector from which muscle torques can be calculated?
-	else
-		action = Eigen::VectorXd::Zero(mEnv->GetNumAction());
+	{
+		FrameProfiler::Scope scope(mProfiler,FrameProfiler::POLICY);
+		if(mNNLoaded)
+			action = GetActionFromNN();		// Some vector from which muscle torques can be calculated?
+		else
+			action = Eigen::VectorXd::Zero(mEnv->GetNumAction());
+	}
 	mEnv->SetAction(action);			// Action sent to environment
 	
-	record_data();	// Record data to be plotted
+	{
+		FrameProfiler::Scope scope(mProfiler,FrameProfiler::RECORD);
+		record_data();	// Record data to be plotted
+	}
 
+	StepSimulation(num);
+}
+
+/**
+ * @brief Runs the num simulation steps of a control step, timing the muscle
+ * updates, muscle net and DART stepping separately.
+ */
+void
+Window::
+StepSimulation(int num)
+{
 	if(mEnv->GetUseMuscle())
 	{
 		int inference_per_sim = 2;
 		for(int i=0;i<num;i+=inference_per_sim){
-			Eigen::VectorXd mt = mEnv->GetMuscleTorques();		// Muscle torques can be ??
-			mEnv->SetActivationLevels(GetActivationFromNN(mt));
+			Eigen::VectorXd mt;
+			{
+				FrameProfiler::Scope scope(mProfiler,FrameProfiler::MUSCLES);
+				mt = mEnv->GetMuscleTorques();		// Muscle torques can be ??
+			}
+			{
+				FrameProfiler::Scope scope(mProfiler,FrameProfiler::MUSCLE_NN);
+				mEnv->SetActivationLevels(GetActivationFromNN(mt));
+			}
+			FrameProfiler::Scope scope(mProfiler,FrameProfiler::DART);
 			for(int j=0;j<inference_per_sim;j++)
 				mEnv->Step();
 		}	
 	}
 	else
 	{
+		FrameProfiler::Scope scope(mProfiler,FrameProfiler::DART);
 		for(int i=0;i<num;i++)
 			mEnv->Step();	
 	}
-	std::cout << mEnv->GetGaitReward() << '\n';
+	mProfiler.AddStep((double)num/mEnv->GetSimulationHz());
 }
 void
 Window::
@@ -400,13 +496,499 @@ Reset()
 {
 	mEnv->Reset();
 }
+
+/**
+ * @brief Runs the simulation (and the python inference) on its own thread,
+ * paced to mPlaybackSpeed times real time, so drawing never waits for a step.
+ * The GLUT thread gives up the GIL for as long as the thread runs.
+ */
+void
+Window::
+StartSimulationThread()
+{
+	if(mRunning || mReplaying)
+		return;
+	mRunning = true;
+	mGilRelease.reset(new py::gil_scoped_release());
+	mSimulationThread = std::thread(&Window::SimulationLoop,this);
+}
+void
+Window::
+StopSimulationThread()
+{
+	if(!mRunning)
+		return;
+	mRunning = false;
+	mSimulationThread.join();
+	mGilRelease.reset();
+}
+void
+Window::
+SimulationLoop()
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point deadline = Clock::now();
+	Publish();
+	while(mRunning)
+	{
+		bool step = mSimulating;
+		if(!step && mStepRequests>0)
+		{
+			mStepRequests--;
+			step = true;
+		}
+		if(mResetRequested)
+		{
+			mResetRequested = false;
+			Reset();
+			Publish();
+		}
+		if(!step)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			deadline = Clock::now();
+			continue;
+		}
+		{
+			py::gil_scoped_acquire gil;
+			Step();
+		}
+		Publish();
+
+		// Keep simulated time at mPlaybackSpeed x wall time, unless the
+		// simulation can't keep up (then it runs as fast as it can)
+		deadline += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0/(mEnv->GetControlHz()*mPlaybackSpeed)));
+		Clock::time_point now = Clock::now();
+		if(deadline>now)
+			std::this_thread::sleep_until(deadline);
+		else if(now-deadline>std::chrono::milliseconds(100))
+			deadline = now;
+	}
+}
+
+/**
+ * @brief Copies what drawing needs (positions, activations) from the
+ * simulation into the back snapshot and publishes it.
+ */
+void
+Window::
+Publish()
+{
+	Snapshot& snapshot = mSnapshots.GetBack();
+	snapshot.time = mEnv->GetWorld()->getTime();
+	snapshot.positions = mEnv->GetCharacter()->GetSkeleton()->getPositions();
+	const auto& muscles = mEnv->GetCharacter()->GetMuscles();
+	snapshot.activations.resize(muscles.size());
+	for(int i=0;i<muscles.size();i++)
+		snapshot.activations[i] = muscles[i]->activation;
+	mSnapshots.Publish();
+}
+
+/**
+ * @brief Reloads the model (see Environment::Reload) whenever the metadata,
+ * skeleton or muscle files it was built from are saved, keeping the python
+ * interpreter, the networks and the loaded meshes.
+ */
+void
+Window::
+WatchModelFiles()
+{
+	if(mReplaying)
+		return;
+	if(mModelWatcher.Watch(mEnv->GetModelFiles()))
+		std::cout<<"Watching the model files, saving one reloads the model"<<std::endl;
+}
+void
+Window::
+PollModelFiles()
+{
+	std::vector<std::string> changed = mModelWatcher.Poll();
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if(!changed.empty())
+	{
+		if(mChangedFiles.empty())
+			mFirstChange = now;
+		mLastChange = now;
+		for(const auto& path : changed)
+			if(std::find(mChangedFiles.begin(),mChangedFiles.end(),path)==mChangedFiles.end())
+				mChangedFiles.push_back(path);
+	}
+	// Editors may save in several writes, reload once the files are quiet
+	if(!mChangedFiles.empty() && now-mLastChange>std::chrono::milliseconds(100))
+		ReloadModel();
+}
+
+/**
+ * @brief Swaps in the model rebuilt from the changed files. The simulation
+ * thread is paused meanwhile; the drawn character gets new muscles, or is
+ * cloned again if the skeleton changed.
+ */
+void
+Window::
+ReloadModel()
+{
+	auto begin = std::chrono::steady_clock::now();
+	std::cout<<"Changed :";
+	for(const auto& path : mChangedFiles)
+		std::cout<<" "<<path;
+	std::cout<<std::endl;
+	mChangedFiles.clear();
+
+	bool running = mRunning;
+	StopSimulationThread();
+	// the meshes are cached already, the new skeleton gets them right away
+	bool async = MeshCache::GetLoadAsync();
+	MeshCache::SetLoadAsync(false);
+	Environment::ReloadResult result = mEnv->Reload(mNNLoaded);
+	MeshCache::SetLoadAsync(async);
+
+	if(result==Environment::RELOAD_CHARACTER)
+	{
+		delete mRenderCharacter;
+		mRenderCharacter = mEnv->GetCharacter()->Clone();
+	}
+	else if(result==Environment::RELOAD_MUSCLES)
+	{
+		mRenderCharacter->ClearMuscles();
+		for(auto muscle : mEnv->GetCharacter()->GetMuscles())
+			mRenderCharacter->mMuscles.push_back(muscle->Clone(mRenderCharacter->GetSkeleton()));
+	}
+	if(result!=Environment::RELOAD_FAILED)
+	{
+		mTelemetryGroups.clear();
+		mHasSnapshot = false;
+		Publish();
+		mReloadDrawn = false;
+		static const char* parts[] = {"","settings","muscles","character"};
+		std::cout<<"Reloaded "<<parts[result]<<" in "<<std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count()*1e3<<" ms"<<std::endl;
+	}
+	mModelWatcher.Watch(mEnv->GetModelFiles());
+	if(running)
+		StartSimulationThread();
+}
+
+/**
+ * @brief Poses the render character from the latest snapshots, interpolated
+ * between the last two at the display time (which follows the simulation one
+ * snapshot behind). Without the simulation thread, the current state is shown.
+ */
+void
+Window::
+UpdateRenderCharacter()
+{
+	if(mReplaying)
+	{
+		UpdateReplay();
+		return;
+	}
+	if(!mRunning)
+		Publish();
+	if(mSnapshots.Update())
+	{
+		mPrevSnapshot = mHasSnapshot ? mCurrSnapshot : mSnapshots.GetFront();
+		mCurrSnapshot = mSnapshots.GetFront();
+		mHasSnapshot = true;
+	}
+	if(!mHasSnapshot)
+		return;
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double alpha = 1.0;
+	double span = mCurrSnapshot.time-mPrevSnapshot.time;
+	if(mRunning && span>0.0 && mCurrSnapshot.positions.size()==mPrevSnapshot.positions.size())
+	{
+		mDisplayTime += std::chrono::duration<double>(now-mLastDrawTime).count()*mPlaybackSpeed;
+		mDisplayTime = std::max(mPrevSnapshot.time,std::min(mDisplayTime,mCurrSnapshot.time));
+		alpha = (mDisplayTime-mPrevSnapshot.time)/span;
+	}
+	else
+		mDisplayTime = mCurrSnapshot.time;
+	mLastDrawTime = now;
+	PoseRenderCharacter(alpha);
+}
+
+/**
+ * @brief Sets the render character to the pose alpha of the way from
+ * mPrevSnapshot to mCurrSnapshot and updates its muscle activations.
+ */
+void
+Window::
+PoseRenderCharacter(double alpha)
+{
+	const SkeletonPtr& skel = mRenderCharacter->GetSkeleton();
+	if(alpha<1.0)
+	{
+		// Interpolated on the joint configuration spaces (ball and free joints included)
+		Eigen::VectorXd dq = skel->getPositionDifferences(mCurrSnapshot.positions,mPrevSnapshot.positions);
+		skel->setPositions(mPrevSnapshot.positions);
+		skel->setVelocities(dq);
+		skel->integratePositions(alpha);
+	}
+	else
+		skel->setPositions(mCurrSnapshot.positions);
+
+	const auto& muscles = mRenderCharacter->GetMuscles();
+	for(int i=0;i<muscles.size() && i<mCurrSnapshot.activations.size();i++)
+		muscles[i]->activation = (1.0-alpha)*mPrevSnapshot.activations[i]+alpha*mCurrSnapshot.activations[i];
+}
+/**
+ * @brief Plays the trajectory log at path instead of simulating. The log must
+ * come from the same model (number of dofs and muscles).
+ */
+bool
+Window::
+LoadReplay(const std::string& path)
+{
+	if(!mReplay.Load(path))
+		return false;
+	if(mReplay.GetNumDofs()!=mRenderCharacter->GetSkeleton()->getNumDofs() ||
+		mReplay.GetNumMuscles()!=mRenderCharacter->GetMuscles().size())
+	{
+		std::cout<<path<<" was recorded with "<<mReplay.GetNumDofs()<<" dofs and "<<mReplay.GetNumMuscles()
+			<<" muscles, this model has "<<mRenderCharacter->GetSkeleton()->getNumDofs()<<" and "<<mRenderCharacter->GetMuscles().size()<<std::endl;
+		return false;
+	}
+	if(mReplay.GetNumFrames()==0)
+	{
+		std::cout<<path<<" holds no frames"<<std::endl;
+		return false;
+	}
+	mReplayEpisodeStarts.clear();
+	for(int i=0;i<mReplay.GetNumFrames();i++)
+		if(i==0 || mReplay.GetEpisode(i)!=mReplay.GetEpisode(i-1))
+			mReplayEpisodeStarts.push_back(i);
+	std::cout<<"Replaying "<<path<<" : "<<mReplay.GetNumFrames()<<" frames, "<<mReplayEpisodeStarts.size()<<" episodes"<<std::endl;
+
+	mReplaying = true;
+	mSimulating = true;
+	mReplayFrame = 0.0;
+	mLastDrawTime = std::chrono::steady_clock::now();
+	return true;
+}
+
+/**
+ * @brief Advances the replay by the wall time since the last draw (times the
+ * playback speed) and poses the render character, interpolating between the
+ * two frames around the replay position unless they belong to different episodes.
+ */
+void
+Window::
+UpdateReplay()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if(mSimulating && !mScrubbing)
+		SeekReplay(mReplayFrame+std::chrono::duration<double>(now-mLastDrawTime).count()*mPlaybackSpeed*mReplay.GetControlHz());
+	mLastDrawTime = now;
+
+	int frame = (int)mReplayFrame;
+	int next = std::min(frame+1,mReplay.GetNumFrames()-1);
+	TrajectoryLog::Frame f;
+	mReplay.GetFrame(frame,f);
+	mPrevSnapshot.time = f.time;
+	mPrevSnapshot.positions = f.positions;
+	mPrevSnapshot.activations = f.activations;
+	mReplay.GetFrame(next,f);
+	mCurrSnapshot.time = f.time;
+	mCurrSnapshot.positions = f.positions;
+	mCurrSnapshot.activations = f.activations;
+
+	double alpha = mReplayFrame-frame;
+	if(next==frame || mReplay.GetEpisode(next)!=mReplay.GetEpisode(frame))
+		alpha = 0.0;
+	PoseRenderCharacter(alpha);
+}
+void
+Window::
+SeekReplay(double frame)
+{
+	mReplayFrame = std::max(0.0,std::min(frame,(double)(mReplay.GetNumFrames()-1)));
+}
+
+/**
+ * @brief Replay keys: space play/pause, ',' and '.' one frame back/forward,
+ * '<' and '>' previous/next episode, 'r' back to the start.
+ *
+ * @return false for keys the replay does not handle
+ */
+bool
+Window::
+ReplayKeyboard(unsigned char _key)
+{
+	switch(_key)
+	{
+	case ',': mSimulating = false;SeekReplay(std::ceil(mReplayFrame)-1.0);break;
+	case '.':
+	case 's': mSimulating = false;SeekReplay(std::floor(mReplayFrame)+1.0);break;
+	case 'r': SeekReplay(0.0);break;
+	case '<':
+	case '>':
+	{
+		int frame = (int)mReplayFrame;
+		auto it = std::upper_bound(mReplayEpisodeStarts.begin(),mReplayEpisodeStarts.end(),frame);	// start of the next episode
+		if(_key=='>')
+		{
+			if(it!=mReplayEpisodeStarts.end())
+				SeekReplay(*it);
+		}
+		else
+		{
+			--it;	// start of this episode
+			if(it!=mReplayEpisodeStarts.begin() && frame-*it<mReplay.GetControlHz())
+				--it;
+			SeekReplay(*it);
+		}
+		break;
+	}
+	default: return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Timeline at the bottom of the window, with episode starts marked.
+ * Click or drag on it to scrub.
+ */
+void
+Window::
+DrawTimeline()
+{
+	int n = mReplay.GetNumFrames();
+	double x0 = 20.0, x1 = mWinWidth-20.0;
+	double px = x0+(x1-x0)*(n>1 ? mReplayFrame/(n-1) : 0.0);
+
+	glPushAttrib(GL_ENABLE_BIT|GL_CURRENT_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	gluOrtho2D(0,mWinWidth,0,mWinHeight);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glColor3f(0.7,0.7,0.7);
+	glRectd(x0,10,x1,24);
+	glColor3f(0.3,0.5,0.8);
+	glRectd(x0,10,px,24);
+	glColor3f(0.1,0.1,0.1);
+	glBegin(GL_LINES);
+	for(int start : mReplayEpisodeStarts)
+	{
+		double x = x0+(x1-x0)*(n>1 ? (double)start/(n-1) : 0.0);
+		glVertex2d(x,8);
+		glVertex2d(x,26);
+	}
+	glEnd();
+
+	TrajectoryLog::Frame f;
+	mReplay.GetFrame((int)mReplayFrame,f);
+	char text[128];
+	snprintf(text,sizeof(text),"frame %d/%d  episode %d  t %.2f s  reward %.3f  x%g%s",
+		(int)mReplayFrame,n-1,f.episode,f.time,f.reward,(double)mPlaybackSpeed,mSimulating ? "" : "  (paused)");
+	glRasterPos2d(x0,32);
+	for(const char* c = text;*c;c++)
+		glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12,*c);
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+}
+
+/**
+ * @brief Frame rate, simulation speed and time per phase, averaged over the
+ * last half second, in the top left corner.
+ */
+void
+Window::
+DrawHUD()
+{
+	const FrameProfiler::Summary& summary = mProfiler.Update();
+	std::vector<std::string> lines;
+	char text[128];
+	snprintf(text,sizeof(text),"%.1f fps  real time x%.2f%s",summary.fps,summary.real_time_factor,mSimulating ? "" : "  (paused)");
+	lines.push_back(text);
+	for(int p=0;p<FrameProfiler::NUM_PHASES;p++)
+	{
+		if(summary.ms[p]==0.0)
+			continue;
+		snprintf(text,sizeof(text),"%-12s %7.3f ms/%s  %7.3f ms/call",FrameProfiler::GetPhaseName(p),
+			summary.ms_per_step[p],p==FrameProfiler::DRAW ? "frame" : "step ",summary.ms[p]);
+		lines.push_back(text);
+	}
+
+	glPushAttrib(GL_ENABLE_BIT|GL_CURRENT_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_DEPTH_TEST);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	gluOrtho2D(0,mWinWidth,0,mWinHeight);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glColor3f(0.1,0.1,0.1);
+	for(int i=0;i<lines.size();i++)
+	{
+		glRasterPos2d(20,mWinHeight-24-16*i);
+		for(const char* c = lines[i].c_str();*c;c++)
+			glutBitmapCharacter(GLUT_BITMAP_9_BY_15,*c);
+	}
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+}
+
+/**
+ * @brief Writes the timings of the whole run to the --profile file, if one
+ * was given (see FrameProfiler::Save).
+ */
+bool
+Window::
+SaveProfile()
+{
+	if(mProfilePath.empty())
+		return false;
+	return mProfiler.Save(mProfilePath);
+}
+void
+Window::
+click(int _button, int _state, int _x, int _y)
+{
+	if(mReplaying && _button==GLUT_LEFT_BUTTON && (_state==GLUT_UP ? mScrubbing : _y>mWinHeight-40))
+	{
+		mScrubbing = _state==GLUT_DOWN;
+		if(mScrubbing)
+			drag(_x,_y);
+		return;
+	}
+	Win3D::click(_button,_state,_x,_y);
+}
+void
+Window::
+drag(int _x, int _y)
+{
+	if(!mScrubbing)
+	{
+		Win3D::drag(_x,_y);
+		return;
+	}
+	double u = (_x-20.0)/std::max(1.0,mWinWidth-40.0);
+	SeekReplay(u*(mReplay.GetNumFrames()-1));
+}
 void
 Window::
 SetFocusing()
 {
 	if(mFocus)
 	{
-		mTrans = -mEnv->GetWorld()->getSkeleton("Human")->getRootBodyNode()->getCOM();
+		mTrans = -mRenderCharacter->GetSkeleton()->getRootBodyNode()->getCOM();
 		mTrans[1] -= 0.3;
 
 		mTrans *=1000.0;
@@ -552,82 +1134,137 @@ DrawShape(const Shape* shape,const Eigen::Vector4d& color)
 		if (shape->is<MeshShape>())
 		{
 			const auto& mesh = static_cast<const MeshShape*>(shape);
+			const Eigen::Vector3d& scale = mesh->getScale();
 			glDisable(GL_COLOR_MATERIAL);
-			mRI->drawMesh(mesh->getScale(), mesh->getMesh());
-			float y = mEnv->GetGround()->getBodyNode(0)->getTransform().translation()[1] + dynamic_cast<const BoxShape*>(mEnv->GetGround()->getBodyNode(0)->getShapeNodesWith<dart::dynamics::VisualAspect>()[0]->getShape().get())->getSize()[1]*0.5;
-			this->DrawShadow(mesh->getScale(), mesh->getMesh(),y);
+			glPushMatrix();
+			glScaled(scale[0],scale[1],scale[2]);
+			glCallList(GetMeshLists(mesh->getMesh()).mesh);
+			glPopMatrix();
+			if(mDrawShadow)
+			{
+				this->DrawShadow(scale, mesh->getMesh(),mGroundHeight);
+			}
 		}
 
 	}
 	
 	glDisable(GL_COLOR_MATERIAL);
 }
+/**
+ * @brief Unit sphere and unit cylinder (radius 1, height 1 along z, centered)
+ * compiled into display lists, drawn scaled for every muscle segment.
+ */
+void
+Window::
+BuildMuscleLists()
+{
+	GLUquadric* quadric = gluNewQuadric();
+	gluQuadricNormals(quadric,GLU_SMOOTH);
+	mSphereList = glGenLists(2);
+	mCylinderList = mSphereList+1;
+
+	glNewList(mSphereList,GL_COMPILE);
+	gluSphere(quadric,1.0,16,16);
+	glEndList();
+
+	glNewList(mCylinderList,GL_COMPILE);
+	glPushMatrix();
+	glTranslated(0.0,0.0,-0.5);
+	gluCylinder(quadric,1.0,1.0,1.0,16,1);
+	glRotated(180.0,1.0,0.0,0.0);
+	gluDisk(quadric,0.0,1.0,16,1);
+	glRotated(180.0,1.0,0.0,0.0);
+	glTranslated(0.0,0.0,1.0);
+	gluDisk(quadric,0.0,1.0,16,1);
+	glPopMatrix();
+	glEndList();
+	gluDeleteQuadric(quadric);
+}
 void
 Window::
 DrawMuscles(const std::vector<Muscle*>& muscles)
 {
-	int count =0;
+	if(mSphereList==0)
+		BuildMuscleLists();
+
+	// Anchor points of all muscles, filled in one pass
+	mAnchorPoints.clear();
+	for(auto muscle : muscles)
+		for(int i=0;i<muscle->GetNumAnchors();i++)
+			mAnchorPoints.push_back(muscle->GetAnchorPoint(i));
+
 	glEnable(GL_LIGHTING);
 	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_NORMALIZE);
 	glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
 	glEnable(GL_COLOR_MATERIAL);
 	
+	const Eigen::Vector3d* aps = mAnchorPoints.data();
 	for(auto muscle : muscles)
 	{
-		auto aps = muscle->GetAnchors();
-		bool lower_body = true;
+		int num_anchors = muscle->GetNumAnchors();
 		double a = muscle->activation;
 		// Eigen::Vector3d color(0.7*(3.0*a),0.2,0.7*(1.0-3.0*a));
 		Eigen::Vector4d color(0.4+(2.0*a),0.4,0.4,1.0);//0.7*(1.0-3.0*a));
-		// glColor3f(1.0,0.0,0.362);
-		// glColor3f(0.0,0.0,0.0);
 		mRI->setPenColor(color);
-		for(int i=0;i<aps.size();i++)
+		double radius = 0.005*sqrt(muscle->GetF0()/1000.0);
+		for(int i=0;i<num_anchors;i++)
 		{
-			Eigen::Vector3d p = aps[i]->GetPoint();
-			mRI->pushMatrix();
-			mRI->translate(p);
-			mRI->drawSphere(0.005*sqrt(muscle->f0/1000.0));
-			mRI->popMatrix();
+			glPushMatrix();
+			glTranslated(aps[i][0],aps[i][1],aps[i][2]);
+			glScaled(radius,radius,radius);
+			glCallList(mSphereList);
+			glPopMatrix();
 		}
 			
-		for(int i=0;i<aps.size()-1;i++)
+		for(int i=0;i<num_anchors-1;i++)
 		{
-			Eigen::Vector3d p = aps[i]->GetPoint();
-			Eigen::Vector3d p1 = aps[i+1]->GetPoint();
-
-			Eigen::Vector3d u(0,0,1);
-			Eigen::Vector3d v = p-p1;
-			Eigen::Vector3d mid = 0.5*(p+p1);
+			Eigen::Vector3d v = aps[i]-aps[i+1];
 			double len = v.norm();
-			v /= len;
 			Eigen::Isometry3d T;
 			T.setIdentity();
-			Eigen::Vector3d axis = u.cross(v);
-			axis.normalize();
-			double angle = acos(u.dot(v));
-			Eigen::Matrix3d w_bracket = Eigen::Matrix3d::Zero();
-			w_bracket(0, 1) = -axis(2);
-			w_bracket(1, 0) =  axis(2);
-			w_bracket(0, 2) =  axis(1);
-			w_bracket(2, 0) = -axis(1);
-			w_bracket(1, 2) = -axis(0);
-			w_bracket(2, 1) =  axis(0);
-
-			
-			Eigen::Matrix3d R = Eigen::Matrix3d::Identity()+(sin(angle))*w_bracket+(1.0-cos(angle))*w_bracket*w_bracket;
-			T.linear() = R;
-			T.translation() = mid;
-			mRI->pushMatrix();
-			mRI->transform(T);
-			mRI->drawCylinder(0.005*sqrt(muscle->f0/1000.0),len);
-			mRI->popMatrix();
+			T.linear() = Eigen::Quaterniond::FromTwoVectors(Eigen::Vector3d::UnitZ(),v).toRotationMatrix();
+			T.translation() = 0.5*(aps[i]+aps[i+1]);
+			glPushMatrix();
+			glMultMatrixd(T.data());
+			glScaled(radius,radius,len);
+			glCallList(mCylinderList);
+			glPopMatrix();
 		}
-		
+		aps += num_anchors;
 	}
 	glEnable(GL_LIGHTING);
 	glDisable(GL_DEPTH_TEST);
 }
+/**
+ * @brief Display lists of a mesh as the render interface draws it, and of its
+ * bare faces for the shadow, compiled the first time the mesh is drawn.
+ * Meshes are kept alive by the MeshCache, so a scene pointer is never reused.
+ */
+const Window::MeshLists&
+Window::
+GetMeshLists(const aiScene* mesh)
+{
+	auto it = mMeshLists.find(mesh);
+	if(it!=mMeshLists.end())
+		return it->second;
+
+	MeshLists lists;
+	lists.mesh = glGenLists(2);
+	lists.shadow = lists.mesh+1;
+	glNewList(lists.mesh,GL_COMPILE);
+	mRI->drawMesh(Eigen::Vector3d::Ones(),mesh);
+	glEndList();
+	glNewList(lists.shadow,GL_COMPILE);
+	DrawAiMesh(mesh,mesh->mRootNode);
+	glEndList();
+	return mMeshLists[mesh] = lists;
+}
+
+/**
+ * @brief Draws the mesh flattened onto the ground (y), cast along dir. The
+ * projection is a matrix applied by GL to the cached faces of the mesh.
+ */
 void
 Window::
 DrawShadow(const Eigen::Vector3d& scale, const aiScene* mesh,double y) 
@@ -649,25 +1286,32 @@ DrawShadow(const Eigen::Vector3d& scale, const aiScene* mesh,double y)
 	M.translation() = b;
 	M = (mViewMatrix.inverse()) * M;
 
+	// v += (v[1]-y)*dir, v[1] = y+0.001
+	Eigen::Vector3d dir(0.4,0,-0.4);
+	Eigen::Matrix4d P = Eigen::Matrix4d::Identity();
+	P(0,1) = dir[0];
+	P(0,3) = -dir[0]*y;
+	P(2,1) = dir[2];
+	P(2,3) = -dir[2]*y;
+	P.row(1) << 0.0,0.0,0.0,y+0.001;
+
 	glPushMatrix();
 	glLoadIdentity();
 	glMultMatrixd(mViewMatrix.data());
-	DrawAiMesh(mesh,mesh->mRootNode,M,y);
+	glMultMatrixd(P.data());
+	glMultMatrixd(M.data());
+	glColor3f(0.3,0.3,0.3);
+	glCallList(GetMeshLists(mesh).shadow);
 	glPopMatrix();
 	glPopMatrix();
 	glEnable(GL_LIGHTING);
 }
 void
 Window::
-DrawAiMesh(const struct aiScene *sc, const struct aiNode* nd,const Eigen::Affine3d& M,double y)
+DrawAiMesh(const struct aiScene *sc, const struct aiNode* nd)
 {
 	unsigned int i;
     unsigned int n = 0, t;
-    Eigen::Vector3d v;
-    Eigen::Vector3d dir(0.4,0,-0.4);
-    glColor3f(0.3,0.3,0.3);
-    
-    // update transform
 
     // draw all meshes assigned to this node
     for (; n < nd->mNumMeshes; ++n) {
@@ -685,20 +1329,7 @@ DrawAiMesh(const struct aiScene *sc, const struct aiNode* nd,const Eigen::Affine
             }
             glBegin(face_mode);
         	for (i = 0; i < face->mNumIndices; i++)
-        	{
-        		int index = face->mIndices[i];
-
-        		v[0] = (&mesh->mVertices[index].x)[0];
-        		v[1] = (&mesh->mVertices[index].x)[1];
-        		v[2] = (&mesh->mVertices[index].x)[2];
-        		v = M*v;
-        		double h = v[1]-y;
-        		
-        		v += h*dir;
-        		
-        		v[1] = y+0.001;
-        		glVertex3f(v[0],v[1],v[2]);
-        	}
+        		glVertex3fv(&mesh->mVertices[face->mIndices[i]].x);
             glEnd();
         }
 
@@ -706,14 +1337,27 @@ DrawAiMesh(const struct aiScene *sc, const struct aiNode* nd,const Eigen::Affine
 
     // draw all children
     for (n = 0; n < nd->mNumChildren; ++n) {
-        DrawAiMesh(sc, nd->mChildren[n],M,y);
+        DrawAiMesh(sc, nd->mChildren[n]);
     }
 
 }
+/**
+ * @brief The 200x200 checkerboard, compiled into a display list the first
+ * time (and whenever the ground height changes) and replayed after that.
+ */
 void
 Window::
 DrawGround(double y)
 {
+	if(mGroundList!=0 && y==mGroundY)
+	{
+		glCallList(mGroundList);
+		return;
+	}
+	if(mGroundList==0)
+		mGroundList = glGenLists(1);
+	mGroundY = y;
+	glNewList(mGroundList,GL_COMPILE_AND_EXECUTE);
 	glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
 	glDisable(GL_LIGHTING);
 	double width = 0.005;
@@ -736,4 +1380,5 @@ DrawGround(double y)
 	}
 	glEnd();
 	glEnable(GL_LIGHTING);
+	glEndList();
 }
\ No newline at end of file
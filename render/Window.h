@@ -7,11 +7,21 @@
 #include <pybind11/numpy.h>
 #include <pybind11/embed.h>
 #include <pybind11/stl.h>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include "TripleBuffer.h"
+#include "TrajectoryLog.h"
+#include "Telemetry.h"
+#include "FrameProfiler.h"
+#include "FileWatcher.h"
 namespace py = pybind11;
 
 namespace MASS
 {
 class Environment;
+class Character;
 class Muscle;
 class Window : public dart::gui::glut::Win3D
 {
@@ -21,12 +31,28 @@ public:
 	Window(Environment* env,const std::string& nn_path,const std::string& muscle_nn_path);
 
     virtual void record_data();
-    virtual void define_muscle_groups();
     virtual void Plot_And_Save();
 
+	// Telemetry of the first mTelemetryCycles gait cycles, see record_data
+	static std::vector<std::string> TelemetryColumns(bool exo_torques);
+	bool NextTelemetryPhase(double& phase);
+	void StartTelemetry(const std::string& path,bool exo_torques);
+	bool FinishTelemetry();
+	void DisableTelemetry(){mTelemetryDone = true;}
+	void GetLegJointAngles(Eigen::VectorXd& act,Eigen::VectorXd& ref);
+	const Eigen::VectorXd& GetMuscleGroupActivations();
+
 	void draw() override;
 	void keyboard(unsigned char _key, int _x, int _y) override;
 	void displayTimer(int _val) override;
+	void click(int _button, int _state, int _x, int _y) override;
+	void drag(int _x, int _y) override;
+
+	void InitHeadless(int width,int height);
+	void SetProfilePath(const std::string& path){mProfilePath = path;}
+	void WatchModelFiles();
+	bool SaveProfile();
+	void RenderOffscreen(std::vector<unsigned char>& rgb);
 
 	py::object plotter;
 public:
@@ -38,13 +64,36 @@ public:
 	void DrawShapeFrame(const dart::dynamics::ShapeFrame* shapeFrame);
 	void DrawShape(const dart::dynamics::Shape* shape,const Eigen::Vector4d& color);
 
+	void BuildMuscleLists();
 	void DrawMuscles(const std::vector<Muscle*>& muscles);
+	struct MeshLists
+	{
+		GLuint mesh,shadow;
+	};
+	const MeshLists& GetMeshLists(const aiScene* mesh);
 	void DrawShadow(const Eigen::Vector3d& scale, const aiScene* mesh,double y);
-	void DrawAiMesh(const struct aiScene *sc, const struct aiNode* nd,const Eigen::Affine3d& M,double y);
+	void DrawAiMesh(const struct aiScene *sc, const struct aiNode* nd);
 	void DrawGround(double y);
 	virtual void Step();
+	void StepSimulation(int num);
 	void Reset();
 
+	void StartSimulationThread();
+	void StopSimulationThread();
+	void SimulationLoop();
+	void Publish();
+	void UpdateRenderCharacter();
+	void PoseRenderCharacter(double alpha);
+	void PollModelFiles();
+	void ReloadModel();
+
+	bool LoadReplay(const std::string& path);
+	void UpdateReplay();
+	void SeekReplay(double frame);
+	bool ReplayKeyboard(unsigned char _key);
+	void DrawTimeline();
+	void DrawHUD();
+
 	Eigen::VectorXd GetActionFromNN();
 	Eigen::VectorXd GetActivationFromNN(const Eigen::VectorXd& mt);
 
@@ -54,49 +103,70 @@ public:
 
 	Environment* mEnv;
 	bool mFocus;
-	bool mSimulating;
+	std::atomic<bool> mSimulating;
 	bool mDrawOBJ;
 	bool mDrawShadow;
 	bool mNNLoaded;
 	bool mMuscleNNLoaded;
 	Eigen::Affine3d mViewMatrix;
 
+	// display lists, built on first use in the current GL context
+	GLuint mGroundList;
+	double mGroundY;
+	GLuint mSphereList,mCylinderList;
+	std::vector<Eigen::Vector3d> mAnchorPoints;
+	std::map<const aiScene*,MeshLists> mMeshLists;
+
+	// What the simulation thread hands to drawing after every control step
+	struct Snapshot
+	{
+		double time;
+		Eigen::VectorXd positions;
+		Eigen::VectorXd activations;
+	};
+	std::thread mSimulationThread;
+	std::unique_ptr<py::gil_scoped_release> mGilRelease;
+	std::atomic<bool> mRunning;
+	std::atomic<int> mStepRequests;
+	std::atomic<bool> mResetRequested;
+	std::atomic<double> mPlaybackSpeed;		// simulated seconds per wall second
+	TripleBuffer<Snapshot> mSnapshots;
+	Snapshot mPrevSnapshot,mCurrSnapshot;	// drawn poses are interpolated between these
+	double mDisplayTime;
+	bool mHasSnapshot;
+	std::chrono::steady_clock::time_point mLastDrawTime;
+	Character* mRenderCharacter;			// posed from the snapshots, never stepped
+	double mGroundHeight;
+
+	// Replay of a trajectory log instead of simulating: positions are set and
+	// only forward kinematics runs
+	TrajectoryLog mReplay;
+	bool mReplaying;
+	bool mScrubbing;
+	double mReplayFrame;					// fractional frame shown
+	std::vector<int> mReplayEpisodeStarts;
+
 	/** muscle groups for plotting activation **/
-    enum MuscleGroupIndex {
-        LHFlex,
-        LHExt,
-        LHAbd,
-        LHAdd,
-        LHExtRot,
-        LHIntRot,
-        LKFlex,
-        LKExt,
-        RHFlex,
-        RHExt,
-        RHAbd,
-        RHAdd,
-        RHExtRot,
-        RHIntRot,
-        RKFlex,
-        RKExt,
-        TOTAL
-    };
-
-    struct MuscleGroup {
-        double total_activation;
-        std::unordered_set<std::string> group;
-
-        inline double add(double activation) {
-            total_activation += activation;
-            return total_activation;
-        }
-
-        inline double get_avg_activation() {
-            return total_activation / group.size();
-        }
-    };
-
-    std::array<MuscleGroup, MuscleGroupIndex::TOTAL> muscle_groups;
+    std::vector<int> mTelemetryGroups;		// index in the character's MuscleGroups, resolved on first use
+    Eigen::VectorXd mMuscleGroupActivations;
+
+    Telemetry* mTelemetry;
+    bool mTelemetryDone;
+    double mTelemetryCycles;	// gait cycles recorded before plotting
+    int mNumWraparounds;
+    double mLastPhase;
+    Eigen::VectorXd mTelemetryRow;
+
+	// Time per phase of Step and draw, shown with 'p' and saved on exit (--profile)
+	FrameProfiler mProfiler;
+	bool mDrawHUD;
+	std::string mProfilePath;
+
+	// Hot reload of the metadata, skeleton and muscle files, see WatchModelFiles
+	FileWatcher mModelWatcher;
+	std::vector<std::string> mChangedFiles;
+	std::chrono::steady_clock::time_point mFirstChange,mLastChange;
+	bool mReloadDrawn;			// the first frame after a reload was drawn
 };
 };
 
@@ -4,6 +4,9 @@
 #include "Character.h"
 #include "BVH.h"
 #include "Muscle.h"
+#include "MeshCache.h"
+#include "Headless.h"
+#include <chrono>
 #include <signal.h>
 
 MASS::Window* window;
@@ -17,15 +20,49 @@ MASS::Window* window;
 int main(int argc,char** argv)
 {
 	// signal (SIGINT,SIGINT_handler); //catches cntrl-C and graphs data -> depreciated
+	auto begin = std::chrono::steady_clock::now();
 
 	MASS::Environment* env = new MASS::Environment();
 
+	// removes "name VALUE" from the arguments and returns VALUE
+	auto take_option = [&](const std::string& name) -> std::string
+	{
+		for(int i=1;i+1<argc;i++)
+		{
+			if(name!=argv[i])
+				continue;
+			std::string value = argv[i+1];
+			for(int j=i;j+2<=argc;j++)
+				argv[j] = argv[j+2];
+			argc -= 2;
+			return value;
+		}
+		return std::string();
+	};
+	// --replay LOG plays a trajectory log (python/main.py --record) instead of simulating,
+	// --record LOG writes one of the simulation shown
+	std::string replay = take_option("--replay");
+	std::string record = take_option("--record");
+	// --profile FILE writes the time per phase of the viewer on exit (ESC)
+	std::string profile = take_option("--profile");
+
+	MASS::HeadlessOptions headless;
+	if(!headless.Parse(argc,argv))
+	{
+		std::cout<<"Options : --headless DIR [--episodes N] [--jobs N] [--frames N] [--size WxH] [--video] [--obj]"<<std::endl;
+		std::cout<<"          --replay LOG | --record LOG, --profile FILE"<<std::endl;
+		return 0;
+	}
 	if(argc==1)
 	{
 		std::cout<<"Provide Metadata.txt"<<std::endl;
 		return 0;
 	}
-	env->Initialize(std::string(argv[1]),true);
+	// The OBJ meshes load in the background and show up once the window is running.
+	// Headless jobs are forked after this, so they load everything up front.
+	if(!headless.enabled)
+		MASS::MeshCache::SetLoadAsync(true);
+	env->Initialize(std::string(argv[1]),!headless.enabled || headless.draw_obj);
 	// if(argc==3)
 	// 	env->SetUseMuscle(true);
 	// else
@@ -46,15 +83,9 @@ int main(int argc,char** argv)
 
 	// env->Initialize();
 
-	glutInit(&argc, argv);
-
 	// MASS::Window* window;
 	// check if commandline args are correct:
-	if(argc == 2)
-	{
-		window = new MASS::Window(env);
-	}
-	else
+	if(argc != 2 && replay.empty())
 	{
 		if(env->GetUseMuscle())
 		{
@@ -62,7 +93,6 @@ int main(int argc,char** argv)
 				std::cout<<"Please provide two networks"<<std::endl;
 				return 0;
 			}
-			window = new MASS::Window(env,argv[2],argv[3]);
 		}
 		else
 		{
@@ -71,9 +101,30 @@ int main(int argc,char** argv)
 				std::cout<<"Please provide the network"<<std::endl;
 				return 0;
 			}
-			window = new MASS::Window(env,argv[2]);
 		}
 	}
+	auto make_window = [&]() -> MASS::Window*
+	{
+		if(argc == 2 || !replay.empty())
+			return new MASS::Window(env);
+		else if(env->GetUseMuscle())
+			return new MASS::Window(env,argv[2],argv[3]);
+		else
+			return new MASS::Window(env,argv[2]);
+	};
+	if(headless.enabled)
+	{
+		headless.frame_rate = env->GetControlHz();
+		return MASS::RunHeadless(headless,make_window);
+	}
+
+	glutInit(&argc, argv);
+	window = make_window();
+	if(!replay.empty() && !window->LoadReplay(replay))
+		return 0;
+	if(replay.empty() && !record.empty())
+		env->StartRecording(record);
+	window->SetProfilePath(profile);
 	// if(argc==1)
 	// 	window = new MASS::Window(env);
 	// else if (argc==2)
@@ -83,5 +134,8 @@ int main(int argc,char** argv)
 	
 	// begin simulation
 	window->initWindow(1920,1080,"gui");
+	window->StartSimulationThread();
+	window->WatchModelFiles();
+	std::cout<<"Window ready "<<std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count()*1e3<<" ms after start"<<std::endl;
 	glutMainLoop();
 }
@@ -0,0 +1,197 @@
+#include "EnvManager.h"
+#include "RolloutProtocol.h"
+#include <iostream>
+#include <cstring>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+typedef Eigen::Matrix<float,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> RowMatrixXf;
+
+/**
+ * Serves the environments of one EnvManager to a RemoteEnvManager client
+ * (pymss.pymss_remote) using the protocol in python/RolloutProtocol.h.
+ * Clients are served one at a time; the environments keep their state between
+ * connections.
+ */
+
+Eigen::MatrixXd
+UnpackRows(const std::vector<float>& payload,int rows,int cols)
+{
+	if(payload.size()!=(size_t)rows*cols)
+		throw std::runtime_error("Malformed matrix payload : "+std::to_string(payload.size())+" values for "+
+			std::to_string(rows)+"x"+std::to_string(cols));
+	return Eigen::Map<const RowMatrixXf>(payload.data(),rows,cols).cast<double>();
+}
+
+/**
+ * @brief Rejects env ids the client can't mean, -1 (every env) only if allow_all.
+ */
+void
+CheckEnvId(int id,int num_envs,bool allow_all)
+{
+	if(id>=num_envs || id<(allow_all ? -1 : 0))
+		throw std::runtime_error("Env id "+std::to_string(id)+" out of range for "+std::to_string(num_envs)+" envs");
+}
+
+/**
+ * @brief Executes one request and fills in the reply payload.
+ *
+ * @return the num field of the reply
+ */
+int
+Execute(EnvManager& env,const RolloutHeader& request,const std::vector<float>& payload,std::vector<float>& reply)
+{
+	int num_envs = env.GetNumEnvs();
+	switch(request.type)
+	{
+	case ROLLOUT_HELLO:
+	{
+		RolloutHello hello;
+		std::memset(&hello,0,sizeof(hello));
+		hello.num_envs = env.GetNumEnvs();
+		hello.num_state = env.GetNumState();
+		hello.num_action = env.GetNumAction();
+		hello.use_muscle = env.UseMuscle();
+		hello.num_muscles = env.UseMuscle() ? env.GetNumMuscles() : 0;
+		hello.num_related_dofs = env.UseMuscle() ? env.GetNumTotalMuscleRelatedDofs() : 0;
+		hello.sim_hz = env.GetSimulationHz();
+		hello.con_hz = env.GetControlHz();
+		hello.num_steps = env.GetNumSteps();
+		reply.resize(sizeof(hello)/sizeof(float));
+		std::memcpy(reply.data(),&hello,sizeof(hello));
+		break;
+	}
+	case ROLLOUT_CLOSE: break;
+	case ROLLOUT_RESET:
+		CheckEnvId(request.id,num_envs,false);
+		env.Reset(request.num!=0,request.id);
+		break;
+	case ROLLOUT_RESETS: env.Resets(request.num!=0);break;
+	case ROLLOUT_STEPS:
+		CheckEnvId(request.id,num_envs,true);
+		if(request.num<0)
+			throw std::runtime_error("Negative step count "+std::to_string(request.num));
+		if(request.id<0)
+			env.Steps(request.num);
+		else
+			for(int i=0;i<request.num;i++)
+				env.Step(request.id);
+		break;
+	case ROLLOUT_STEP_CONTROL:
+		if(!payload.empty())
+			env.SetActions(UnpackRows(payload,num_envs,env.GetNumAction()));
+		env.StepsAtOnce();
+		break;
+	case ROLLOUT_SET_ACTIONS: env.SetActions(UnpackRows(payload,num_envs,env.GetNumAction()));break;
+	case ROLLOUT_GET_STATES: PackRows(env.GetStates(),reply);break;
+	case ROLLOUT_GET_REWARDS: PackRows(env.GetRewards(),reply);break;
+	case ROLLOUT_GET_GAIT_REWARDS: PackRows(env.GetGaitRewards(),reply);break;
+	case ROLLOUT_IS_END_OF_EPISODES: PackRows(env.IsEndOfEpisodes(),reply);break;
+	case ROLLOUT_GET_EPISODE_STATUS:
+		PackRows(env.IsEndOfEpisodes(),reply);
+		PackRows(env.GetRewards(),reply);
+		break;
+	case ROLLOUT_GET_MUSCLE_TORQUES: PackRows(env.GetMuscleTorques(),reply);break;
+	case ROLLOUT_GET_DESIRED_TORQUES: PackRows(env.GetDesiredTorques(),reply);break;
+	case ROLLOUT_SET_ACTIVATION_LEVELS:
+		if(!env.UseMuscle())
+			throw std::runtime_error("Activation levels sent to envs without muscles");
+		env.SetActivationLevels(UnpackRows(payload,num_envs,env.GetNumMuscles()));
+		break;
+	case ROLLOUT_COMPUTE_MUSCLE_TUPLES:
+		env.ComputeMuscleTuples();
+		PackRows(env.GetMuscleTuplesJtA(),reply);
+		PackRows(env.GetMuscleTuplesTauDes(),reply);
+		PackRows(env.GetMuscleTuplesL(),reply);
+		PackRows(env.GetMuscleTuplesb(),reply);
+		return env.GetMuscleTuplesJtA().rows();
+	case ROLLOUT_SET_EXO_TORQUE:
+		if(request.id==0) env.SetLHipTs(request.value);
+		else if(request.id==1) env.SetRHipTs(request.value);
+		else if(request.id==2) env.SetLKneeTs(request.value);
+		else env.SetRKneeTs(request.value);
+		break;
+	default:
+		throw std::runtime_error("Unknown request type "+std::to_string(request.type));
+	}
+	return 0;
+}
+
+/**
+ * @brief Answers requests in order until the client sends ROLLOUT_CLOSE or disconnects.
+ */
+void
+Serve(EnvManager& env,int fd)
+{
+	int one = 1;
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+	RolloutHeader request;
+	std::vector<float> payload,reply;
+	while(RolloutRecv(fd,request,payload))
+	{
+		RolloutHeader response;
+		std::memset(&response,0,sizeof(response));
+		response.type = request.type;
+		response.seq = request.seq;
+		reply.clear();
+		try
+		{
+			response.num = Execute(env,request,payload,reply);
+		}
+		catch(const std::exception& e)
+		{
+			std::cout<<"Request "<<request.seq<<" failed : "<<e.what()<<std::endl;
+			response.status = 1;
+			reply.clear();
+		}
+		RolloutSend(fd,response,reply.data(),reply.size());
+		if(request.type==ROLLOUT_CLOSE)
+			return;
+	}
+}
+
+int main(int argc,char** argv)
+{
+	if(argc<4)
+	{
+		std::cout<<"Usage : mass_rollout_server metadata.txt num_envs host:port|unix:/path [--pin] [--cpu-offset N]"<<std::endl;
+		return 0;
+	}
+	signal(SIGPIPE,SIG_IGN);
+
+	// --pin pins the stepping threads; servers sharing a machine need different --cpu-offset
+	bool pin_threads = false;
+	int cpu_offset = 0;
+	for(int i=4;i<argc;i++)
+	{
+		if(std::string(argv[i])=="--pin")
+			pin_threads = true;
+		else if(std::string(argv[i])=="--cpu-offset" && i+1<argc)
+			cpu_offset = atoi(argv[++i]);
+	}
+
+	EnvManager env(std::string(argv[1]),atoi(argv[2]),0,true,pin_threads,cpu_offset);
+	env.Resets(true);
+	int listen_fd = RolloutListen(argv[3]);
+	std::cout<<"Serving "<<atoi(argv[2])<<" envs on "<<argv[3]<<std::endl;
+	while(true)
+	{
+		int fd = accept(listen_fd,nullptr,nullptr);
+		if(fd<0)
+			continue;
+		try
+		{
+			Serve(env,fd);
+		}
+		catch(const std::exception& e)
+		{
+			std::cout<<"Connection dropped : "<<e.what()<<std::endl;
+		}
+		close(fd);
+	}
+	return 0;
+}
@@ -0,0 +1,31 @@
+#include "MotionData.h"
+#include <iostream>
+#include <chrono>
+
+// Converts BVH captures to the binary .mbin motion format, e.g.
+// ./bvh2mbin ../data/motion/walk.bvh ../data/motion/walk.mbin
+int main(int argc,char** argv)
+{
+	if(argc!=3)
+	{
+		std::cout<<"Usage : "<<argv[0]<<" input.bvh output.mbin"<<std::endl;
+		return 1;
+	}
+	MASS::MotionData data;
+	auto begin = std::chrono::steady_clock::now();
+	if(!data.LoadBVH(argv[1]))
+		return 1;
+	double parse_ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-begin).count();
+	if(!data.SaveMBin(argv[2]))
+		return 1;
+
+	MASS::MotionData check;
+	begin = std::chrono::steady_clock::now();
+	if(!check.LoadMBin(argv[2]))
+		return 1;
+	double load_ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-begin).count();
+
+	std::cout<<data.GetJoints().size()<<" joints, "<<data.GetNumChannels()<<" channels, "<<data.GetNumFrames()<<" frames"<<std::endl;
+	std::cout<<"bvh parse "<<parse_ms<<" ms, mbin load "<<load_ms<<" ms"<<std::endl;
+	return 0;
+}
@@ -0,0 +1,57 @@
+#include "Character.h"
+#include "BVH.h"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Times BVH::GetMotion (motion table lookup with interpolation) against
+ * computing the frame from the raw channels, which is what GetMotion did
+ * before the table existed, and checks that both agree on the frames.
+ *
+ * usage : bvh_benchmark [skeleton.xml] [motion.bvh] [num_queries]
+ */
+int main(int argc,char** argv)
+{
+	std::string skel_file = std::string(MASS_ROOT_DIR)+"/data/human.xml";
+	std::string bvh_file = std::string(MASS_ROOT_DIR)+"/data/motion/walk.bvh";
+	int num_queries = 100000;
+	if(argc>1)
+		skel_file = argv[1];
+	if(argc>2)
+		bvh_file = argv[2];
+	if(argc>3)
+		num_queries = atoi(argv[3]);
+
+	MASS::Character* character = new MASS::Character();
+	character->LoadSkeleton(skel_file,false);
+	character->LoadBVH(bvh_file,true);
+	MASS::BVH* bvh = character->GetBVH();
+
+	double max_time = bvh->GetMaxTime();
+	int num_frames = (int)std::round(max_time/bvh->GetTimeStep());
+	double max_error = 0.0;
+	for(int k=0;k<num_frames;k++)
+		max_error = std::max(max_error,(bvh->GetMotion((k+1e-9)*bvh->GetTimeStep())-bvh->ComputeFrame(k)).cwiseAbs().maxCoeff());
+	std::cout<<num_frames<<" frames, max difference to the raw frames : "<<max_error<<std::endl;
+
+	double sum = 0.0;
+	auto begin = std::chrono::steady_clock::now();
+	for(int i=0;i<num_queries;i++)
+	{
+		int k = (int)((double)i/num_queries*max_time/bvh->GetTimeStep())%num_frames;
+		sum += bvh->ComputeFrame(k)[0];
+	}
+	double raw = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+
+	begin = std::chrono::steady_clock::now();
+	for(int i=0;i<num_queries;i++)
+		sum += bvh->GetMotion((double)i/num_queries*max_time)[0];
+	double table = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+
+	std::cout<<"raw frames   : "<<raw/num_queries*1e6<<" us/query"<<std::endl;
+	std::cout<<"motion table : "<<table/num_queries*1e6<<" us/query (interpolated)"<<std::endl;
+	std::cout<<"speedup      : "<<raw/table<<"x"<<std::endl;
+	volatile double sink = sum;
+	(void)sink;
+	return 0;
+}
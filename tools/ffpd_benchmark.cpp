@@ -0,0 +1,81 @@
+#include "Environment.h"
+#include "Character.h"
+#include "DARTHelper.h"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Compares the two desired torque modes of Environment on a torque driven
+ * (muscle free) character following the reference motion with zero actions:
+ * stable PD versus the inverse dynamics feedforward table plus PD. Reports
+ * tracking error, difference to the stable PD torque at the same states,
+ * time per torque computation and how long the character stays up.
+ *
+ * usage : ffpd_benchmark [skeleton.xml] [motion.bvh] [num_control_steps]
+ */
+int main(int argc,char** argv)
+{
+	std::string skel_file = std::string(MASS_ROOT_DIR)+"/data/human.xml";
+	std::string bvh_file = std::string(MASS_ROOT_DIR)+"/data/motion/walk.bvh";
+	int num_control_steps = 300;
+	if(argc>1)
+		skel_file = argv[1];
+	if(argc>2)
+		bvh_file = argv[2];
+	if(argc>3)
+		num_control_steps = atoi(argv[3]);
+
+	MASS::Environment* env = new MASS::Environment();
+	MASS::Character* character = new MASS::Character();
+	character->LoadSkeleton(skel_file,false);
+	character->LoadBVH(bvh_file,true);
+	double kp = 300.0;
+	character->SetPDParameters(kp,sqrt(2*kp));
+	env->SetUseMuscle(false);
+	env->SetControlHz(30);
+	env->SetSimulationHz(600);
+	env->SetCharacter(character);
+	env->SetGround(MASS::BuildFromFile(std::string(MASS_ROOT_DIR)+std::string("/data/ground.xml")));
+	env->Initialize();
+
+	auto skel = character->GetSkeleton();
+	Eigen::VectorXd action = Eigen::VectorXd::Zero(env->GetNumAction());
+	for(int mode=0;mode<2;mode++)
+	{
+		env->SetUseFeedforwardPD(mode==1);
+		env->Reset(false);
+
+		double tracking = 0.0,torque_error = 0.0,torque_time = 0.0;
+		int num_samples = 0,num_torques = 0,steps = 0;
+		for(;steps<num_control_steps && !env->IsEndOfEpisode();steps++)
+		{
+			env->SetAction(action);
+			for(int j=0;j<env->GetNumSteps();j++)
+			{
+				auto begin = std::chrono::steady_clock::now();
+				Eigen::VectorXd tau = env->GetDesiredTorques();
+				torque_time += std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+				num_torques++;
+				if(mode==1)
+				{
+					env->SetUseFeedforwardPD(false);
+					torque_error += (tau-env->GetDesiredTorques()).norm()/std::max(1e-6,tau.norm());
+					env->SetUseFeedforwardPD(true);
+				}
+				env->Step();
+			}
+			Eigen::VectorXd diff = skel->getPositionDifferences(skel->getPositions(),env->GetTargetPositions());
+			tracking += diff.tail(diff.rows()-6).norm();
+			num_samples++;
+		}
+
+		std::cout<<(mode==0 ? "stable PD          " : "feedforward + PD   ")
+			<<" tracking error "<<tracking/std::max(1,num_samples)
+			<<", "<<torque_time/std::max(1,num_torques)*1e6<<" us/torque"
+			<<", up for "<<steps<<"/"<<num_control_steps<<" control steps";
+		if(mode==1)
+			std::cout<<", relative difference to stable PD "<<torque_error/std::max(1,num_torques);
+		std::cout<<std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include "Character.h"
+#include "BVH.h"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Checks Character::GetSPDForces (Cholesky solve) against the previous
+ * implementation with the dense inverse of M + dt*Kv on random states along
+ * the reference motion, and times both.
+ *
+ * usage : spd_benchmark [skeleton.xml] [motion.bvh] [num_queries]
+ */
+static Eigen::VectorXd
+DenseSPDForces(MASS::Character* character,const Eigen::VectorXd& p_desired,const Eigen::VectorXd& kp,const Eigen::VectorXd& kv)
+{
+	auto skel = character->GetSkeleton();
+	Eigen::VectorXd q = skel->getPositions();
+	Eigen::VectorXd dq = skel->getVelocities();
+	double dt = skel->getTimeStep();
+	Eigen::MatrixXd M_inv = (skel->getMassMatrix() + Eigen::MatrixXd(dt*kv.asDiagonal())).inverse();
+
+	Eigen::VectorXd qdqdt = q + dq*dt;
+	Eigen::VectorXd p_diff = -kp.cwiseProduct(skel->getPositionDifferences(qdqdt,p_desired));
+	Eigen::VectorXd v_diff = -kv.cwiseProduct(dq);
+	Eigen::VectorXd ddq = M_inv*(-skel->getCoriolisAndGravityForces()+p_diff+v_diff+skel->getConstraintForces());
+
+	Eigen::VectorXd tau = p_diff + v_diff - dt*kv.cwiseProduct(ddq);
+	tau.head<6>().setZero();
+	return tau;
+}
+
+int main(int argc,char** argv)
+{
+	std::string skel_file = std::string(MASS_ROOT_DIR)+"/data/human.xml";
+	std::string bvh_file = std::string(MASS_ROOT_DIR)+"/data/motion/walk.bvh";
+	int num_queries = 10000;
+	if(argc>1)
+		skel_file = argv[1];
+	if(argc>2)
+		bvh_file = argv[2];
+	if(argc>3)
+		num_queries = atoi(argv[3]);
+
+	MASS::Character* character = new MASS::Character();
+	character->LoadSkeleton(skel_file,false);
+	character->LoadBVH(bvh_file,true);
+	double kp = 300.0;
+	character->SetPDParameters(kp,sqrt(2*kp));
+	auto skel = character->GetSkeleton();
+	MASS::BVH* bvh = character->GetBVH();
+	int dof = skel->getNumDofs();
+	Eigen::VectorXd kps = Eigen::VectorXd::Constant(dof,kp);
+	Eigen::VectorXd kvs = Eigen::VectorXd::Constant(dof,sqrt(2*kp));
+
+	// States and targets: the motion itself, perturbed
+	int num_states = 64;
+	std::vector<Eigen::VectorXd> qs,dqs,targets;
+	for(int i=0;i<num_states;i++)
+	{
+		double t = (double)i/num_states*bvh->GetMaxTime();
+		qs.push_back(bvh->GetMotion(t)+0.05*Eigen::VectorXd::Random(dof));
+		dqs.push_back(bvh->GetVelocity(t)+0.5*Eigen::VectorXd::Random(dof));
+		targets.push_back(bvh->GetMotion(t+0.01));
+	}
+
+	double max_error = 0.0,max_tau = 0.0;
+	for(int i=0;i<num_states;i++)
+	{
+		skel->setPositions(qs[i]);
+		skel->setVelocities(dqs[i]);
+		Eigen::VectorXd tau = character->GetSPDForces(targets[i]);
+		Eigen::VectorXd ref = DenseSPDForces(character,targets[i],kps,kvs);
+		max_error = std::max(max_error,(tau-ref).cwiseAbs().maxCoeff());
+		max_tau = std::max(max_tau,ref.cwiseAbs().maxCoeff());
+	}
+	std::cout<<dof<<" dofs, max difference to the dense inverse : "<<max_error<<" (max |tau| "<<max_tau<<")"<<std::endl;
+
+	double sum = 0.0;
+	auto begin = std::chrono::steady_clock::now();
+	for(int i=0;i<num_queries;i++)
+	{
+		skel->setPositions(qs[i%num_states]);
+		skel->setVelocities(dqs[i%num_states]);
+		sum += DenseSPDForces(character,targets[i%num_states],kps,kvs)[6];
+	}
+	double dense = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+
+	begin = std::chrono::steady_clock::now();
+	for(int i=0;i<num_queries;i++)
+	{
+		skel->setPositions(qs[i%num_states]);
+		skel->setVelocities(dqs[i%num_states]);
+		sum += character->GetSPDForces(targets[i%num_states])[6];
+	}
+	double llt = std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+
+	std::cout<<"dense inverse : "<<dense/num_queries*1e6<<" us/call"<<std::endl;
+	std::cout<<"cholesky      : "<<llt/num_queries*1e6<<" us/call"<<std::endl;
+	std::cout<<"speedup       : "<<dense/llt<<"x"<<std::endl;
+	volatile double sink = sum;
+	(void)sink;
+	return max_error<1e-6*std::max(1.0,max_tau) ? 0 : 1;
+}